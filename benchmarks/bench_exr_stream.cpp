@@ -0,0 +1,174 @@
+/**
+ * Input Stream Benchmark
+ * 
+ * Compares the mmap-backed MappedIStream against OpenEXR's stock file
+ * stream for the three reader entry points:
+ * 1. isDeepEXR       - header probe
+ * 2. getDeepEXRInfo  - header probe + data window
+ * 3. loadDeepEXR     - full decode
+ * 
+ * With no file arguments a synthetic deep image is generated first.
+ * Run twice to compare cold and warm page cache behaviour.
+ */
+
+#include "deep_image.h"
+#include "deep_reader.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace deep_compositor;
+
+namespace {
+
+struct BenchResult {
+    double probeMs = 0.0;
+    double infoMs = 0.0;
+    double loadMs = 0.0;
+};
+
+/**
+ * Deep image with a few samples per pixel, enough to make decode dominate
+ */
+DeepImage generateBenchImage(int width, int height, int samplesPerPixel) {
+    DeepImage img(width, height);
+    
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            DeepPixel& pixel = img.pixel(x, y);
+            for (int s = 0; s < samplesPerPixel; ++s) {
+                float z = 1.0f + static_cast<float>(s) * 2.0f + static_cast<float>(x % 7) * 0.01f;
+                pixel.addSample(DeepSample(z, z + 1.0f, 0.1f, 0.2f, 0.3f, 0.25f));
+            }
+        }
+    }
+    
+    return img;
+}
+
+BenchResult runBench(const std::vector<std::string>& files, int probeIterations, int loadIterations) {
+    BenchResult result;
+    
+    Timer probeTimer;
+    for (int i = 0; i < probeIterations; ++i) {
+        for (const auto& file : files) {
+            if (!isDeepEXR(file)) {
+                throw std::runtime_error("Not a deep EXR: " + file);
+            }
+        }
+    }
+    result.probeMs = probeTimer.elapsedMs() / (probeIterations * files.size());
+    
+    Timer infoTimer;
+    for (int i = 0; i < probeIterations; ++i) {
+        for (const auto& file : files) {
+            int width = 0, height = 0;
+            bool isDeep = false;
+            getDeepEXRInfo(file, width, height, isDeep);
+        }
+    }
+    result.infoMs = infoTimer.elapsedMs() / (probeIterations * files.size());
+    
+    Timer loadTimer;
+    for (int i = 0; i < loadIterations; ++i) {
+        for (const auto& file : files) {
+            DeepImage img = loadDeepEXR(file);
+            if (img.width() <= 0) {
+                throw std::runtime_error("Empty image: " + file);
+            }
+        }
+    }
+    result.loadMs = loadTimer.elapsedMs() / (loadIterations * files.size());
+    
+    return result;
+}
+
+void printRow(const std::string& label, double stockMs, double mappedMs) {
+    std::cout << "  " << std::left << std::setw(16) << label
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << stockMs << " ms"
+              << std::setw(12) << mappedMs << " ms"
+              << std::setw(10) << std::setprecision(2) << (mappedMs > 0.0 ? stockMs / mappedMs : 0.0) << "x\n";
+}
+
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " [options] [input1.exr ...]\n\n"
+              << "Options:\n"
+              << "  --probe-iterations N  Header probes per file (default: 200)\n"
+              << "  --load-iterations N   Full loads per file (default: 5)\n"
+              << "  --help, -h            Show this help message\n\n"
+              << "Without inputs, a 1024x1024 deep image with 8 samples/pixel is generated.\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    int probeIterations = 200;
+    int loadIterations = 5;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--probe-iterations" && i + 1 < argc) {
+            probeIterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--load-iterations" && i + 1 < argc) {
+            loadIterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg[0] == '-') {
+            std::cerr << "Error: Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    
+    std::string generated;
+    if (files.empty()) {
+        generated = "bench_exr_stream_input.exr";
+        log("Generating " + generated + "...");
+        writeDeepEXR(generateBenchImage(1024, 1024, 8), generated);
+        files.push_back(generated);
+    }
+    
+    try {
+        // Warm the page cache so both streams see the same starting state
+        for (const auto& file : files) {
+            loadDeepEXR(file);
+        }
+        
+        setMemoryMappedInput(false);
+        BenchResult stock = runBench(files, probeIterations, loadIterations);
+        
+        setMemoryMappedInput(true);
+        BenchResult mapped = runBench(files, probeIterations, loadIterations);
+        
+        std::cout << "\nPer-file averages over " << files.size() << " file(s):\n\n"
+                  << "  " << std::left << std::setw(16) << "operation"
+                  << std::right << std::setw(15) << "stock stream"
+                  << std::setw(15) << "mmap stream"
+                  << std::setw(11) << "speedup" << "\n";
+        printRow("isDeepEXR", stock.probeMs, mapped.probeMs);
+        printRow("getDeepEXRInfo", stock.infoMs, mapped.infoMs);
+        printRow("loadDeepEXR", stock.loadMs, mapped.loadMs);
+    } catch (const std::exception& e) {
+        logError(e.what());
+        return 1;
+    }
+    
+    if (!generated.empty()) {
+        std::remove(generated.c_str());
+    }
+    
+    return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * Kernel Benchmark
+ *
+ * Times each hot kernel (see src/kernels/kernels.h) in every instruction
+ * set variant this CPU supports, on synthetic data:
+ * 1. flatten          - front-to-back over, 8 samples per pixel
+ * 2. blendCoincident  - runs of 3 coincident fragments
+ * 3. splitVolume      - one volume cut into 15 pieces
+ * 4. quantizeRGBA8    - float RGBA to 8-bit display values
+ *
+ * Speedups are relative to the scalar variant.
+ */
+
+#include "deep_image.h"
+#include "kernels/kernels.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace deep_compositor;
+
+namespace {
+
+constexpr size_t kPixels = 1 << 16;
+constexpr size_t kSamplesPerPixel = 8;
+constexpr size_t kCuts = 14;
+
+volatile float g_sink;  // Keeps kernel results from being optimised away
+
+struct BenchData {
+    std::vector<DeepSample> samples;    // kSamplesPerPixel per pixel, sorted
+    std::vector<DeepSample> coincident; // Runs of 3 sharing an interval
+    std::vector<float> cuts;
+    std::vector<float> rgba;
+};
+
+BenchData generateBenchData() {
+    BenchData data;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for (size_t p = 0; p < kPixels; ++p) {
+        for (size_t s = 0; s < kSamplesPerPixel; ++s) {
+            float z = 1.0f + static_cast<float>(s);
+            float a = 0.05f + unit(rng) * 0.2f;
+            data.samples.emplace_back(z, z + 0.5f, unit(rng) * a, unit(rng) * a, unit(rng) * a, a);
+        }
+    }
+    for (size_t i = 0; i < kPixels * kSamplesPerPixel; ++i) {
+        float z = 1.0f + static_cast<float>(i / 3);
+        data.coincident.emplace_back(z, z + 1.0f, 0.1f, 0.2f, 0.3f, 0.1f + unit(rng) * 0.5f);
+    }
+    for (size_t c = 0; c < kCuts; ++c) {
+        data.cuts.push_back(1.0f + static_cast<float>(c + 1) * 0.5f);
+    }
+    for (size_t p = 0; p < kPixels; ++p) {
+        float a = unit(rng);
+        data.rgba.insert(data.rgba.end(), {unit(rng) * 2.0f * a, unit(rng) * a, unit(rng) * a, a});
+    }
+    return data;
+}
+
+struct BenchResult {
+    double flattenMs = 0.0;
+    double blendMs = 0.0;
+    double splitMs = 0.0;
+    double quantizeMs = 0.0;
+};
+
+BenchResult runBench(const KernelTable& kernel, const BenchData& data, int iterations) {
+    BenchResult result;
+    float sink = 0.0f;
+
+    Timer flattenTimer;
+    for (int i = 0; i < iterations; ++i) {
+        const float* samples = reinterpret_cast<const float*>(data.samples.data());
+        for (size_t p = 0; p < kPixels; ++p) {
+            float rgba[4];
+            kernel.flatten(samples + p * kSamplesPerPixel * kSampleFloats, kSamplesPerPixel, rgba);
+            sink += rgba[0];
+        }
+    }
+    result.flattenMs = flattenTimer.elapsedMs() / iterations;
+
+    std::vector<DeepSample> scratch;
+    double blendMs = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        scratch = data.coincident;
+        Timer blendTimer;
+        sink += static_cast<float>(kernel.blendCoincident(reinterpret_cast<float*>(scratch.data()),
+                                                           scratch.size(), 0.001f));
+        blendMs += blendTimer.elapsedMs();
+    }
+    result.blendMs = blendMs / iterations;
+
+    std::vector<DeepSample> pieces(kCuts + 1);
+    DeepSample volume(1.0f, 9.0f, 0.3f, 0.2f, 0.1f, 0.8f);
+    Timer splitTimer;
+    for (int i = 0; i < iterations; ++i) {
+        for (size_t p = 0; p < kPixels; ++p) {
+            kernel.splitVolume(reinterpret_cast<const float*>(&volume), data.cuts.data(), kCuts,
+                               reinterpret_cast<float*>(pieces.data()));
+            sink += pieces[p % pieces.size()].alpha;
+        }
+    }
+    result.splitMs = splitTimer.elapsedMs() / iterations;
+
+    std::vector<uint8_t> bytes(kPixels * 4);
+    Timer quantizeTimer;
+    for (int i = 0; i < iterations; ++i) {
+        kernel.quantizeRGBA8(data.rgba.data(), kPixels, bytes.data());
+        sink += bytes[static_cast<size_t>(i) % bytes.size()];
+    }
+    result.quantizeMs = quantizeTimer.elapsedMs() / iterations;
+
+    g_sink = sink;
+    return result;
+}
+
+void printRow(const std::string& label, double scalarMs, double ms) {
+    std::cout << "  " << std::left << std::setw(16) << label
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(12) << ms << " ms"
+              << std::setw(10) << std::setprecision(2) << (ms > 0.0 ? scalarMs / ms : 0.0) << "x\n";
+}
+
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " [options]\n\n"
+              << "Options:\n"
+              << "  --iterations N  Runs of each kernel over the data (default: 20)\n"
+              << "  --isa NAME      Only this instruction set (and scalar, for reference)\n"
+              << "  --help, -h      Show this help message\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = 20;
+    std::vector<KernelIsa> isas = supportedKernelIsas();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--isa" && i + 1 < argc) {
+            KernelIsa isa;
+            if (!parseKernelIsa(argv[++i], isa) || !kernelIsaSupported(isa)) {
+                std::cerr << "Error: Unsupported instruction set: " << argv[i] << "\n";
+                return 1;
+            }
+            isas = {KernelIsa::Scalar};
+            if (isa != KernelIsa::Scalar) {
+                isas.push_back(isa);
+            }
+        } else {
+            std::cerr << "Error: Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    BenchData data = generateBenchData();
+    log("Default kernels on this CPU: " + std::string(kernelIsaName(kernels().isa)));
+
+    BenchResult scalar;
+    for (KernelIsa isa : isas) {
+        BenchResult result = runBench(kernelTable(isa), data, iterations);
+        if (isa == KernelIsa::Scalar) {
+            scalar = result;
+        }
+
+        std::cout << "\n" << kernelIsaName(isa) << " (" << formatNumber(kPixels) << " pixels, "
+                  << iterations << " iterations):\n";
+        printRow("flatten", scalar.flattenMs, result.flattenMs);
+        printRow("blendCoincident", scalar.blendMs, result.blendMs);
+        printRow("splitVolume", scalar.splitMs, result.splitMs);
+        printRow("quantizeRGBA8", scalar.quantizeMs, result.quantizeMs);
+    }
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+#include "deep_cache.h"
+#include "deep_pager.h"
+#include "deep_reader.h"
+#include "utils.h"
+
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+namespace deep_compositor {
+
+namespace {
+
+// The sample array is DeepSample records copied straight to disk
+static_assert(std::is_trivially_copyable<DeepSample>::value,
+              "DeepSample must be trivially copyable for the cache format");
+static_assert(sizeof(DeepSample) == 6 * sizeof(float),
+              "DeepSample must be six packed floats for the cache format");
+
+const char kMagic[8] = {'D', 'E', 'E', 'P', 'C', 'A', 'C', 'H'};
+const uint32_t kByteOrderMark = 0x01020304;
+
+/**
+ * On-disk header, padded out to the first page
+ */
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;       // kByteOrderMark as written by the producer
+    uint32_t sampleSize;      // sizeof(DeepSample)
+    uint32_t reserved;
+    int32_t dataWindow[4];    // minX, minY, maxX, maxY
+    int32_t displayWindow[4];
+    uint64_t pixelCount;
+    uint64_t sampleCount;
+    uint64_t offsetsStart;    // Byte offset of the offset table
+    uint64_t samplesStart;    // Byte offset of the sample array
+};
+
+static_assert(sizeof(CacheHeader) <= kDeepCachePageSize, "Cache header must fit in one page");
+
+uint64_t alignToPage(uint64_t offset) {
+    return (offset + kDeepCachePageSize - 1) / kDeepCachePageSize * kDeepCachePageSize;
+}
+
+PixelBox boxFromHeader(const int32_t box[4]) {
+    return PixelBox(box[0], box[1], box[2], box[3]);
+}
+
+void boxToHeader(const PixelBox& box, int32_t out[4]) {
+    out[0] = box.minX;
+    out[1] = box.minY;
+    out[2] = box.maxX;
+    out[3] = box.maxY;
+}
+
+void writePadding(std::ofstream& out, uint64_t& pos, uint64_t target) {
+    static const char zeros[kDeepCachePageSize] = {};
+    while (pos < target) {
+        uint64_t n = std::min<uint64_t>(target - pos, sizeof(zeros));
+        out.write(zeros, static_cast<std::streamsize>(n));
+        pos += n;
+    }
+}
+
+} // anonymous namespace
+
+// ============================================================================
+// DeepCache
+// ============================================================================
+
+DeepCache::DeepCache(const std::string& filename)
+    : filename_(filename), sampleCount_(0), offsets_(nullptr), samples_(nullptr) {
+    if (!fileExists(filename)) {
+        throw DeepReaderException("File not found: " + filename);
+    }
+
+    try {
+        // No prefetch: pages are faulted in as rows are materialised
+        map_.reset(new MappedIStream(filename, MapAccess::Normal));
+    } catch (const std::exception& e) {
+        throw DeepReaderException("Failed to map deep cache " + filename + ": " + e.what());
+    }
+
+    const char* data = map_->data();
+    uint64_t size = map_->size();
+
+    CacheHeader header;
+    if (size < sizeof(header)) {
+        throw DeepReaderException("Not a deep cache (file too small): " + filename);
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw DeepReaderException("Not a deep cache: " + filename);
+    }
+    if (header.version != kDeepCacheVersion) {
+        throw DeepReaderException("Unsupported deep cache version " +
+                                  std::to_string(header.version) + ": " + filename);
+    }
+    if (header.byteOrder != kByteOrderMark || header.sampleSize != sizeof(DeepSample)) {
+        throw DeepReaderException("Deep cache was written on an incompatible platform: " + filename);
+    }
+
+    dataWindow_ = boxFromHeader(header.dataWindow);
+    displayWindow_ = boxFromHeader(header.displayWindow);
+    sampleCount_ = header.sampleCount;
+
+    uint64_t pixelCount = static_cast<uint64_t>(dataWindow_.width()) *
+                          static_cast<uint64_t>(dataWindow_.height());
+    if (header.pixelCount != pixelCount || pixelCount >= size / sizeof(uint64_t)) {
+        throw DeepReaderException("Corrupt or truncated deep cache: " + filename);
+    }
+    uint64_t offsetsBytes = (pixelCount + 1) * sizeof(uint64_t);
+
+    // The header is untrusted: compare by subtraction so nothing wraps
+    bool layoutOk = header.offsetsStart % kDeepCachePageSize == 0
+        && header.samplesStart % kDeepCachePageSize == 0
+        && header.offsetsStart >= sizeof(header)
+        && header.offsetsStart <= size
+        && offsetsBytes <= size - header.offsetsStart
+        && header.samplesStart <= size
+        && header.samplesStart >= header.offsetsStart
+        && header.samplesStart - header.offsetsStart >= offsetsBytes
+        && header.sampleCount <= (size - header.samplesStart) / sizeof(DeepSample);
+    if (!layoutOk) {
+        throw DeepReaderException("Corrupt or truncated deep cache: " + filename);
+    }
+
+    offsets_ = reinterpret_cast<const uint64_t*>(data + header.offsetsStart);
+    samples_ = reinterpret_cast<const DeepSample*>(data + header.samplesStart);
+
+    if (offsets_[0] != 0 || offsets_[pixelCount] != sampleCount_) {
+        throw DeepReaderException("Corrupt deep cache offset table: " + filename);
+    }
+}
+
+size_t DeepCache::sampleCount(int x, int y) const {
+    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+        throw std::out_of_range("Pixel coordinates out of range");
+    }
+    size_t i = static_cast<size_t>(y) * static_cast<size_t>(width()) + static_cast<size_t>(x);
+    uint64_t begin = offsets_[i];
+    uint64_t end = offsets_[i + 1];
+    if (end < begin || end > sampleCount_) {
+        throw DeepReaderException("Corrupt deep cache offset table: " + filename_);
+    }
+    return static_cast<size_t>(end - begin);
+}
+
+const DeepSample* DeepCache::samples(int x, int y) const {
+    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+        throw std::out_of_range("Pixel coordinates out of range");
+    }
+    size_t i = static_cast<size_t>(y) * static_cast<size_t>(width()) + static_cast<size_t>(x);
+    return samples_ + offsets_[i];
+}
+
+// ============================================================================
+// Reading and writing
+// ============================================================================
+
+void writeDeepCache(const DeepImage& img, const std::string& filename) {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw DeepWriterException("Cannot open deep cache for writing: " + filename);
+    }
+    if (img.hasExtraChannels()) {
+        log("  Warning: deep caches hold RGBA, Z and ZBack only; dropping " +
+            std::to_string(img.channels().extras.size()) + " extra channels from " + filename);
+    }
+
+    int width = img.width();
+    int height = img.height();
+    uint64_t pixelCount = static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kDeepCacheVersion;
+    header.byteOrder = kByteOrderMark;
+    header.sampleSize = sizeof(DeepSample);
+    boxToHeader(img.dataWindow(), header.dataWindow);
+    boxToHeader(img.displayWindow(), header.displayWindow);
+    header.pixelCount = pixelCount;
+    header.sampleCount = img.totalSampleCount();
+    header.offsetsStart = kDeepCachePageSize;
+    header.samplesStart = alignToPage(header.offsetsStart + (pixelCount + 1) * sizeof(uint64_t));
+
+    uint64_t pos = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pos += sizeof(header);
+    writePadding(out, pos, header.offsetsStart);
+
+    // Offset table, one row at a time
+    std::vector<uint64_t> rowOffsets(static_cast<size_t>(width));
+    uint64_t running = 0;
+    out.write(reinterpret_cast<const char*>(&running), sizeof(running));
+    pos += sizeof(running);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            running += img.pixel(x, y).sampleCount();
+            rowOffsets[static_cast<size_t>(x)] = running;
+        }
+        out.write(reinterpret_cast<const char*>(rowOffsets.data()),
+                  static_cast<std::streamsize>(rowOffsets.size() * sizeof(uint64_t)));
+        pos += rowOffsets.size() * sizeof(uint64_t);
+    }
+    writePadding(out, pos, header.samplesStart);
+
+    // Sample array in the same order
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const auto& samples = img.pixel(x, y).samples();
+            out.write(reinterpret_cast<const char*>(samples.data()),
+                      static_cast<std::streamsize>(samples.size() * sizeof(DeepSample)));
+        }
+    }
+
+    if (!out) {
+        throw DeepWriterException("Failed to write deep cache: " + filename);
+    }
+
+    logVerbose("Wrote deep cache " + filename + " (" + std::to_string(header.sampleCount) +
+               " samples)");
+}
+
+bool isDeepCache(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(kMagic)];
+    if (!in.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+DeepImage loadDeepCache(const std::string& filename) {
+    auto cache = std::make_shared<const DeepCache>(filename);
+    PixelBox window = cache->dataWindow();
+
+    DeepImage img;
+    img.attachCache(std::move(cache), window);
+    if (std::shared_ptr<TilePager> pager = outOfCorePager()) {
+        img.enableOutOfCore(std::move(pager));
+    }
+    return img;
+}
+
+DeepImage loadDeepCache(const std::string& filename, const PixelBox& region) {
+    auto cache = std::make_shared<const DeepCache>(filename);
+    PixelBox clipped = region.intersect(cache->dataWindow());
+    if (clipped.isEmpty()) {
+        DeepImage empty(clipped);
+        empty.setDisplayWindow(cache->displayWindow());
+        return empty;
+    }
+
+    DeepImage img;
+    img.attachCache(std::move(cache), clipped);
+    if (std::shared_ptr<TilePager> pager = outOfCorePager()) {
+        img.enableOutOfCore(std::move(pager));
+    }
+    return img;
+}
+
+void convertEXRToCache(const std::string& exrFilename, const std::string& cacheFilename) {
+    writeDeepCache(loadDeepEXR(exrFilename), cacheFilename);
+}
+
+void convertCacheToEXR(const std::string& cacheFilename, const std::string& exrFilename,
+                       const DeepWriteOptions& options) {
+    writeDeepEXR(loadDeepCache(cacheFilename), exrFilename, options);
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "deep_image.h"
+#include "deep_stream.h"
+#include "deep_writer.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace deep_compositor {
+
+/**
+ * Native deep cache format (.dcache)
+ *
+ * A deep EXR has to be decompressed on every load. The cache stores the same
+ * samples uncompressed in the layout DeepImage uses in memory, so it can be
+ * mmapped and read in place:
+ *
+ *   header page   magic, version, byte order, windows, counts, section offsets
+ *   offset table  uint64[pixelCount + 1], row-major prefix sums of sample counts
+ *   sample array  DeepSample[sampleCount], each pixel sorted front to back
+ *
+ * Each section starts on a kDeepCachePageSize boundary. Files are written in
+ * native byte order and rejected on a mismatch.
+ */
+constexpr uint32_t kDeepCacheVersion = 1;
+constexpr uint64_t kDeepCachePageSize = 4096;
+
+/**
+ * Read-only view of a mapped deep cache file
+ *
+ * Opening only maps the file and validates the header; sample data is paged
+ * in by the kernel as it is touched.
+ */
+class DeepCache {
+public:
+    /**
+     * @param filename Path to a .dcache file
+     * @throws DeepReaderException if the file is missing, truncated or not a
+     *         cache this build can read
+     */
+    explicit DeepCache(const std::string& filename);
+
+    DeepCache(const DeepCache&) = delete;
+    DeepCache& operator=(const DeepCache&) = delete;
+
+    const std::string& filename() const { return filename_; }
+    PixelBox dataWindow() const { return dataWindow_; }
+    PixelBox displayWindow() const { return displayWindow_; }
+    int width() const { return dataWindow_.width(); }
+    int height() const { return dataWindow_.height(); }
+    uint64_t totalSampleCount() const { return sampleCount_; }
+
+    /**
+     * Samples of pixel (x, y), addressed relative to the data window like
+     * DeepImage::pixel()
+     *
+     * @throws DeepReaderException if the offset table entry is corrupt
+     */
+    size_t sampleCount(int x, int y) const;
+    const DeepSample* samples(int x, int y) const;
+
+private:
+    std::string filename_;
+    std::unique_ptr<MappedIStream> map_;
+    PixelBox dataWindow_;
+    PixelBox displayWindow_;
+    uint64_t sampleCount_;
+    const uint64_t* offsets_;
+    const DeepSample* samples_;
+};
+
+/**
+ * Write a deep image as a cache file. Caches hold R, G, B, A, Z and ZBack;
+ * extra channels are dropped with a warning.
+ *
+ * @throws DeepWriterException on file errors
+ */
+void writeDeepCache(const DeepImage& img, const std::string& filename);
+
+/**
+ * Check whether a file starts with the deep cache magic
+ */
+bool isDeepCache(const std::string& filename);
+
+/**
+ * Load a cache file as a lazily materialised, cache-backed DeepImage
+ *
+ * Only the header is read; see DeepImage::attachCache().
+ *
+ * @throws DeepReaderException on file errors
+ */
+DeepImage loadDeepCache(const std::string& filename);
+
+/**
+ * Load part of a cache file
+ *
+ * @param region Pixel region in absolute coordinates; clipped to the data window
+ * @throws DeepReaderException on file errors (a region missing the data window gives
+ *         an empty image)
+ */
+DeepImage loadDeepCache(const std::string& filename, const PixelBox& region);
+
+/**
+ * Convert a deep EXR to a cache file
+ */
+void convertEXRToCache(const std::string& exrFilename, const std::string& cacheFilename);
+
+/**
+ * Convert a cache file back to a deep EXR
+ */
+void convertCacheToEXR(const std::string& cacheFilename, const std::string& exrFilename,
+                       const DeepWriteOptions& options = DeepWriteOptions());
+
+} // namespace deep_compositor
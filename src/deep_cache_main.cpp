@@ -0,0 +1,74 @@
+#include "deep_cache.h"
+#include "deep_reader.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <iostream>
+#include <string>
+
+namespace {
+
+void printUsage(const char* programName) {
+    std::cout << "Deep cache converter\n\n"
+              << "Usage:\n"
+              << "  " << programName << " to-cache <input.exr> <output.dcache>\n"
+              << "  " << programName << " to-exr [--tiled] <input.dcache> <output.exr>\n"
+              << "  " << programName << " info <file.dcache>\n\n"
+              << "A deep cache stores deep samples uncompressed in the compositor's\n"
+              << "in-memory layout, so it can be memory-mapped instead of decoded.\n"
+              << "deep_compositor accepts cache files anywhere it accepts deep EXRs.\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    using namespace deep_compositor;
+
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string command = argv[1];
+
+    try {
+        if (command == "to-cache" && argc == 4) {
+            Timer timer;
+            convertEXRToCache(argv[2], argv[3]);
+            log("Wrote " + std::string(argv[3]) + " in " + timer.elapsedString());
+        } else if (command == "to-exr" && (argc == 4 || argc == 5)) {
+            DeepWriteOptions options;
+            int arg = 2;
+            if (std::string(argv[arg]) == "--tiled") {
+                options.tiled = true;
+                ++arg;
+            }
+            if (arg + 2 != argc) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            Timer timer;
+            convertCacheToEXR(argv[arg], argv[arg + 1], options);
+            log("Wrote " + std::string(argv[arg + 1]) + " in " + timer.elapsedString());
+        } else if (command == "info" && argc == 3) {
+            Timer timer;
+            DeepCache cache(argv[2]);
+            PixelBox data = cache.dataWindow();
+            PixelBox display = cache.displayWindow();
+            log("Opened in " + timer.elapsedString());
+            log("  Data window:    " + std::to_string(data.minX) + "," + std::to_string(data.minY) +
+                " - " + std::to_string(data.maxX) + "," + std::to_string(data.maxY));
+            log("  Display window: " + std::to_string(display.minX) + "," + std::to_string(display.minY) +
+                " - " + std::to_string(display.maxX) + "," + std::to_string(display.maxY));
+            log("  Samples:        " + std::to_string(cache.totalSampleCount()));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        logError(e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include "deep_image.h"
+#include "deep_volume.h"
+#include "kernels/kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * A deep sample channel layout, fixed at compile time
+ *
+ * A sample is Z, then ZBack if the layout has it, then kChannels
+ * channels: premultiplied R, G, B, A and `Aovs` extra AOVs. Without ZBack
+ * every sample is a point, so merges skip volume splitting. Kernels
+ * instantiated for a layout loop over a constant channel count, which the
+ * compiler unrolls and vectorises.
+ */
+template<bool ZBack, size_t Aovs>
+struct ChannelLayout {
+    static constexpr bool kHasZBack = ZBack;
+    static constexpr size_t kAovs = Aovs;
+    static constexpr size_t kDepths = ZBack ? 2 : 1;
+    static constexpr size_t kChannels = 4 + Aovs;
+    static constexpr size_t kAlpha = kDepths + 3;  // Float index of A
+    static constexpr size_t kFloats = kDepths + kChannels;
+};
+
+using RGBALayout = ChannelLayout<false, 0>;      // Points only
+using RGBAZBackLayout = ChannelLayout<true, 0>;  // DeepSample
+
+/**
+ * One sample of a layout, as plain floats
+ */
+template<class Layout>
+struct LayoutSample {
+    float values[Layout::kFloats];
+
+    float depth() const { return values[0]; }
+    float depthBack() const { return values[Layout::kDepths - 1]; }
+    float alpha() const { return values[Layout::kAlpha]; }
+
+    bool operator<(const LayoutSample& other) const {
+        if (depth() != other.depth()) return depth() < other.depth();
+        return depthBack() < other.depthBack();
+    }
+};
+
+/**
+ * Sample type of a layout. RGBA+ZBack is DeepSample itself, so merging
+ * images without extra channels works on their samples directly.
+ */
+template<class Layout>
+struct LayoutSampleType {
+    using type = LayoutSample<Layout>;
+};
+
+template<>
+struct LayoutSampleType<RGBAZBackLayout> {
+    using type = DeepSample;
+};
+
+template<class Layout>
+using SampleFor = typename LayoutSampleType<Layout>::type;
+
+static_assert(sizeof(SampleFor<RGBALayout>) == RGBALayout::kFloats * sizeof(float),
+              "layout samples must be tightly packed floats");
+static_assert(sizeof(SampleFor<RGBAZBackLayout>) == kSampleFloats * sizeof(float),
+              "DeepSample must match the RGBA+ZBack layout");
+
+template<class Sample>
+float* sampleFloats(Sample* samples) {
+    return reinterpret_cast<float*>(samples);
+}
+
+template<class Sample>
+const float* sampleFloats(const Sample* samples) {
+    return reinterpret_cast<const float*>(samples);
+}
+
+// ============================================================================
+// Kernels
+// ============================================================================
+//
+// Sample arrays are Layout::kFloats floats per sample. The RGBA+ZBack
+// instantiations run the CPU-dispatched kernels (kernels/kernels.h); the
+// others perform the same float operations in the same order, so the
+// colour channels come out the same whichever layout an image uses.
+//
+// `idAovs` marks ID AOVs (bit a for AOV a, see ExtraChannel): splits copy
+// them and blends keep the one of the more opaque sample.
+
+// Widest AOV count one layout instantiation carries
+constexpr size_t kMaxLayoutAovs = 16;
+
+using AovMask = uint32_t;
+static_assert(sizeof(AovMask) * 8 >= kMaxLayoutAovs, "AovMask needs a bit per layout AOV");
+
+/**
+ * Smallest layout with ZBack as given carrying `aovs` AOVs (at most
+ * kMaxLayoutAovs), passed to fn as a value
+ */
+template<bool ZBack, class F>
+void withAovLayout(size_t aovs, F&& fn) {
+    if (aovs <= 1) {
+        fn(ChannelLayout<ZBack, 1>());
+    } else if (aovs <= 2) {
+        fn(ChannelLayout<ZBack, 2>());
+    } else if (aovs <= 4) {
+        fn(ChannelLayout<ZBack, 4>());
+    } else if (aovs <= 8) {
+        fn(ChannelLayout<ZBack, 8>());
+    } else {
+        static_assert(kMaxLayoutAovs == 16, "dispatch the widths up to kMaxLayoutAovs");
+        fn(ChannelLayout<ZBack, 16>());
+    }
+}
+
+/**
+ * Depths and RGBA of a DeepSample into the front of a layout sample's
+ * floats; the AOVs are left to the caller
+ */
+template<class Layout>
+void loadLayoutSample(const DeepSample& sample, float* values) {
+    values[0] = sample.depth;
+    values[Layout::kDepths - 1] = Layout::kHasZBack ? sample.depth_back : sample.depth;
+    values[Layout::kDepths + 0] = sample.red;
+    values[Layout::kDepths + 1] = sample.green;
+    values[Layout::kDepths + 2] = sample.blue;
+    values[Layout::kDepths + 3] = sample.alpha;
+}
+
+/**
+ * Front-to-back over of `count` samples into out[Layout::kChannels],
+ * stopping once alpha reaches 0.9999 (alpha is then set to 1). ID AOVs
+ * take the value of the sample contributing the most alpha (0 if there
+ * are no samples).
+ *
+ * @return Samples composited
+ */
+template<class Layout>
+size_t flattenLayout(const float* samples, size_t count, float* out, AovMask idAovs = 0) {
+    if constexpr (std::is_same_v<Layout, RGBAZBackLayout>) {
+        return kernels().flatten(samples, count, out);
+    } else {
+        constexpr size_t kChannels = Layout::kChannels;
+        constexpr size_t kIds = Layout::kAovs > 0 ? Layout::kAovs : 1;
+        float accum[kChannels] = {};
+        float ids[kIds] = {};
+        float idWeights[kIds];
+        std::fill(idWeights, idWeights + kIds, -1.0f);
+
+        // IDs are accumulated with the rest and replaced when storing
+        auto store = [&](size_t used) {
+            std::memcpy(out, accum, sizeof(accum));
+            for (size_t a = 0; a < Layout::kAovs; ++a) {
+                if (idAovs & (AovMask(1) << a)) {
+                    out[4 + a] = ids[a];
+                }
+            }
+            return used;
+        };
+
+        for (size_t i = 0; i < count; ++i) {
+            const float* channels = samples + i * Layout::kFloats + Layout::kDepths;
+            float transmit = 1.0f - accum[3];
+            if (Layout::kAovs > 0 && idAovs) {
+                float weight = channels[3] * transmit;
+                for (size_t a = 0; a < Layout::kAovs; ++a) {
+                    if ((idAovs & (AovMask(1) << a)) && weight > idWeights[a]) {
+                        idWeights[a] = weight;
+                        ids[a] = channels[4 + a];
+                    }
+                }
+            }
+            for (size_t c = 0; c < kChannels; ++c) {
+                accum[c] = accum[c] + channels[c] * transmit;
+            }
+            if (accum[3] >= 0.9999f) {
+                accum[3] = 1.0f;
+                return store(i + 1);
+            }
+        }
+        return store(count);
+    }
+}
+
+/**
+ * Blend runs of consecutive samples whose depths all lie within `epsilon`
+ * of the run's first sample (uniform interspersion), in place
+ *
+ * @return Samples left
+ */
+template<class Layout>
+size_t blendCoincidentLayout(float* samples, size_t count, float epsilon, AovMask idAovs = 0) {
+    if constexpr (std::is_same_v<Layout, RGBAZBackLayout>) {
+        return kernels().blendCoincident(samples, count, epsilon);
+    } else {
+        constexpr size_t kFloats = Layout::kFloats;
+        constexpr size_t kDepths = Layout::kDepths;
+        constexpr size_t kAlpha = Layout::kAlpha;
+        constexpr size_t kAovStart = kAlpha + 1;
+        size_t kept = 0;
+        size_t i = 0;
+        while (i < count) {
+            float run[kFloats];
+            std::memcpy(run, samples + i * kFloats, sizeof(run));
+            i++;
+
+            while (i < count) {
+                const float* next = samples + i * kFloats;
+                if (!(std::abs(run[0] - next[0]) < epsilon &&
+                      std::abs(run[kDepths - 1] - next[kDepths - 1]) < epsilon)) {
+                    break;
+                }
+                // alpha_combined = 1 - (1 - a)(1 - b); channels share it by alpha
+                float combined = run[kAlpha] + next[kAlpha] - run[kAlpha] * next[kAlpha];
+                float alphaSum = run[kAlpha] + next[kAlpha];
+                float scale = alphaSum > 0.0f ? combined / alphaSum : 0.0f;
+                bool nextWins = next[kAlpha] > run[kAlpha];
+                for (size_t c = kDepths; c < kAovStart; ++c) {
+                    run[c] = (run[c] + next[c]) * scale;
+                }
+                for (size_t c = kAovStart; c < kFloats; ++c) {
+                    if (idAovs & (AovMask(1) << (c - kAovStart))) {
+                        run[c] = nextWins ? next[c] : run[c];
+                    } else {
+                        run[c] = (run[c] + next[c]) * scale;
+                    }
+                }
+                run[kAlpha] = combined;
+                i++;
+            }
+
+            // Never ahead of the read position, so in place is safe
+            std::memcpy(samples + kept * kFloats, run, sizeof(run));
+            kept++;
+        }
+        return kept;
+    }
+}
+
+/**
+ * Split one volumetric sample at `cutCount` increasing depths strictly
+ * inside it (Beer-Lambert), writing cutCount + 1 samples to `out`
+ */
+template<class Layout>
+void splitVolumeLayout(const float* sample, const float* cuts, size_t cutCount, float* out,
+                       AovMask idAovs = 0) {
+    static_assert(Layout::kHasZBack, "point layouts have no volumes to split");
+    constexpr size_t kFloats = Layout::kFloats;
+    const KernelTable& kernel = kernels();
+
+    // Depths and RGBA from the dispatched kernel into the front of `out`,
+    // then spread to the layout's stride from the back (never overlapping
+    // a piece not yet moved)
+    size_t pieces = cutCount + 1;
+    kernel.splitVolume(sample, cuts, cutCount, out);
+    if constexpr (kFloats != kSampleFloats) {
+        for (size_t p = pieces; p-- > 1;) {
+            std::memmove(out + p * kFloats, out + p * kSampleFloats, kSampleFloats * sizeof(float));
+        }
+
+        // AOVs scale with each piece's share of the alpha, like colour;
+        // IDs are copied
+        float alpha = sample[5] >= 1.0f ? 1.0f - 1e-7f : sample[5];
+        for (size_t p = 0; p < pieces; ++p) {
+            float* piece = out + p * kFloats;
+            float ratio = alpha > 0.0f ? piece[5] / alpha : 0.0f;
+            for (size_t c = kSampleFloats; c < kFloats; ++c) {
+                bool id = idAovs & (AovMask(1) << (c - kSampleFloats));
+                piece[c] = id ? sample[c] : sample[c] * ratio;
+            }
+        }
+    }
+}
+
+/**
+ * Volumetric merge of the samples gathered from every input pixel (see
+ * mergePixelsVolumetric), in place: `samples` ends up sorted, split and
+ * blended. Point layouts only sort and blend.
+ *
+ * @param fragments Scratch space, reused across calls
+ * @param counts If set, split and blend counts are added to it
+ * @param idAovs ID AOVs, copied rather than scaled or summed
+ */
+template<class Layout>
+void mergeLayoutSamples(std::vector<SampleFor<Layout>>& samples,
+                        std::vector<SampleFor<Layout>>& fragments, float epsilon,
+                        VolumeMergeCounts* counts, AovMask idAovs = 0) {
+    using Sample = SampleFor<Layout>;
+    constexpr size_t kBack = Layout::kDepths - 1;
+    size_t inputCount = samples.size();
+
+    if constexpr (Layout::kHasZBack) {
+        // Split points: every unique depth and depth_back
+        std::set<float> splitPointSet;
+        for (const Sample& s : samples) {
+            const float* v = sampleFloats(&s);
+            splitPointSet.insert(v[0]);
+            splitPointSet.insert(v[kBack]);
+        }
+        std::vector<float> splitPoints(splitPointSet.begin(), splitPointSet.end());
+
+        // Split each volumetric sample at every split point inside its range
+        fragments.clear();
+        fragments.reserve(samples.size() * 2); // rough estimate
+        std::vector<float> cuts;
+        for (const Sample& sample : samples) {
+            const float* v = sampleFloats(&sample);
+            float depth = v[0];
+            float depthBack = v[kBack];
+            if (!(depthBack > depth)) {
+                // Point / hard-surface sample -- never split
+                fragments.push_back(sample);
+                continue;
+            }
+
+            // Collect split points strictly inside (depth, depth_back),
+            // skipping any too close to the previous cut to leave a piece
+            // between them
+            auto it = std::upper_bound(splitPoints.begin(), splitPoints.end(), depth);
+            cuts.clear();
+            float previous = depth;
+            while (it != splitPoints.end() && *it < depthBack - 1e-7f) {
+                if (*it > previous + 1e-7f) {
+                    cuts.push_back(*it);
+                    previous = *it;
+                }
+                ++it;
+            }
+
+            if (cuts.empty()) {
+                fragments.push_back(sample);
+                continue;
+            }
+
+            size_t first = fragments.size();
+            fragments.resize(first + cuts.size() + 1);
+            splitVolumeLayout<Layout>(v, cuts.data(), cuts.size(),
+                                      sampleFloats(&fragments[first]), idAovs);
+        }
+        samples.swap(fragments);
+    }
+
+    // Sort by (depth, depth_back), then blend matching intervals in place
+    std::sort(samples.begin(), samples.end());
+    size_t fragmentCount = samples.size();
+    samples.resize(blendCoincidentLayout<Layout>(sampleFloats(samples.data()), fragmentCount,
+                                                 epsilon, idAovs));
+
+    if (counts) {
+        counts->fragments += fragmentCount - inputCount;
+        counts->blends += fragmentCount - samples.size();
+    }
+}
+
+} // namespace deep_compositor
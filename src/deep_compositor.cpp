@@ -1,12 +1,375 @@
 #include "deep_compositor.h"
+#include "deep_pager.h"
+#include "deep_schedule.h"
+#include "deep_tasks.h"
+#include "deep_trace.h"
 #include "deep_volume.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
+#include <utility>
 
 namespace deep_compositor {
 
+namespace {
+
+/**
+ * Running input statistics for a merge pass
+ */
+struct MergeTally {
+    size_t inputSamples = 0;
+    size_t outputSamples = 0;
+    size_t pixels = 0;
+    float minDepth = std::numeric_limits<float>::infinity();
+    float maxDepth = -std::numeric_limits<float>::infinity();
+    VolumeMergeCounts volume;
+    
+    void addInput(const DeepPixel& pixel) {
+        inputSamples += pixel.sampleCount();
+        minDepth = std::min(minDepth, pixel.minDepth());
+        maxDepth = std::max(maxDepth, pixel.maxDepth());
+    }
+    
+    void add(const MergeTally& other) {
+        inputSamples += other.inputSamples;
+        outputSamples += other.outputSamples;
+        pixels += other.pixels;
+        minDepth = std::min(minDepth, other.minDepth);
+        maxDepth = std::max(maxDepth, other.maxDepth);
+        volume.fragments += other.volume.fragments;
+        volume.blends += other.volume.blends;
+    }
+};
+
+/**
+ * Where each input keeps the extra channels of a merge result
+ */
+struct ExtraChannelPlan {
+    ChannelSet channels;  // The result's
+    std::vector<const DeepImage*> images;
+    std::vector<std::vector<int>> maps;  // Per image: its column of each result channel, -1 if absent
+    std::vector<size_t> all;             // 0 .. images.size() - 1
+    
+    ExtraChannelPlan(const ChannelSet& result, const std::vector<const DeepImage*>& inputs)
+        : channels(result), images(inputs) {
+        for (const auto* img : inputs) {
+            std::vector<int> map(result.extras.size());
+            for (size_t c = 0; c < map.size(); ++c) {
+                map[c] = img->channels().findExtra(result.extras[c].name);
+            }
+            maps.push_back(std::move(map));
+            all.push_back(all.size());
+        }
+    }
+};
+
+/**
+ * Per-thread scratch buffers and statistics of deepMerge
+ */
+struct MergeWorker {
+    MergeTally tally;
+    std::vector<const DeepImage*> rowInputs;   // Inputs overlapping the current span
+    std::vector<size_t> rowIndices;            // Their indices in the input list
+    std::vector<const DeepPixel*> pixelPtrs;   // Non-empty pixels at (x, y)
+    std::vector<ExtraMergeInput> extraInputs;  // The same, with their extra channels
+};
+
+// Width of the row pieces deepMerge estimates cost for and schedules
+constexpr int kCostBinWidth = 64;
+
+// Work units per merge thread: enough slack for stealing to even out
+// estimation errors
+constexpr size_t kUnitsPerThread = 8;
+
+/**
+ * Pixel of `img` at absolute (x, y), or nullptr if it's outside the data
+ * window or has no samples
+ */
+const DeepPixel* samplesAt(const DeepImage& img, int x, int y) {
+    int localX = x - img.originX();
+    int localY = y - img.originY();
+    if (localX < 0 || localX >= img.width() || localY < 0 || localY >= img.height()) {
+        return nullptr;
+    }
+    const DeepPixel& pixel = img.pixel(localX, localY);
+    return pixel.isEmpty() ? nullptr : &pixel;
+}
+
+/**
+ * Collect the non-empty pixels of `inputs` at absolute (x, y)
+ */
+void gatherPixels(const std::vector<const DeepImage*>& inputs, int x, int y,
+                  std::vector<const DeepPixel*>& pixelPtrs, MergeTally& tally) {
+    pixelPtrs.clear();
+    for (const auto* img : inputs) {
+        const DeepPixel* pixel = samplesAt(*img, x, y);
+        if (pixel) {
+            pixelPtrs.push_back(pixel);
+            tally.addInput(*pixel);
+        }
+    }
+}
+
+/**
+ * Collect the non-empty pixels at absolute (x, y) of the plan's inputs
+ * `indices` with their extra channel columns
+ */
+void gatherExtraInputs(const ExtraChannelPlan& plan, const std::vector<size_t>& indices,
+                       int x, int y, std::vector<ExtraMergeInput>& extraInputs, MergeTally& tally) {
+    static const std::vector<float> kNoColumns;
+    extraInputs.clear();
+    for (size_t i : indices) {
+        const DeepImage* img = plan.images[i];
+        const DeepPixel* pixel = samplesAt(*img, x, y);
+        if (pixel) {
+            const std::vector<float>* columns = img->hasExtraChannels()
+                ? &img->extraColumns(x - img->originX(), y - img->originY()) : &kNoColumns;
+            extraInputs.push_back({pixel, columns, &plan.maps[i]});
+            tally.addInput(*pixel);
+        }
+    }
+}
+
+/**
+ * Merge the pixels of `inputs` at absolute (x, y) into `merged`, extra
+ * channels included when `extras` (planned for `inputs`) is set. The pixel
+ * is cleared if no input has samples there.
+ */
+void remergePixel(DeepImage& merged, const std::vector<const DeepImage*>& inputs, int x, int y,
+                  float threshold, PixelMergeFn merge, const ExtraChannelPlan* extras,
+                  MergeWorker& worker) {
+    int localX = x - merged.originX();
+    int localY = y - merged.originY();
+    DeepPixel& out = merged.pixel(localX, localY);
+    MergeTally& tally = worker.tally;
+    if (extras) {
+        gatherExtraInputs(*extras, extras->all, x, y, worker.extraInputs, tally);
+        if (worker.extraInputs.empty()) {
+            out.clear();
+            merged.extraColumns(localX, localY).clear();
+            return;
+        }
+        out = mergePixelsWithExtras(worker.extraInputs, extras->channels, threshold,
+                                    merged.extraColumns(localX, localY), &tally.volume);
+    } else {
+        gatherPixels(inputs, x, y, worker.pixelPtrs, tally);
+        if (worker.pixelPtrs.empty()) {
+            out.clear();
+            return;
+        }
+        out = merge(worker.pixelPtrs, threshold, &tally.volume);
+    }
+    tally.outputSamples += out.sampleCount();
+    tally.pixels++;
+}
+
+/**
+ * Merge pixels x0..x1 of row y (absolute coordinates) into `result`, extra
+ * channels included when `extras` is set
+ */
+void mergeSpan(const std::vector<const DeepImage*>& inputs, DeepImage& result,
+               int y, int x0, int x1, float threshold, PixelMergeFn merge,
+               const ExtraChannelPlan* extras, MergeWorker& worker, MergeCostMap* costMap) {
+    worker.rowInputs.clear();
+    worker.rowIndices.clear();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        PixelBox w = inputs[i]->dataWindow();
+        if (y >= w.minY && y <= w.maxY && w.minX <= x1 && w.maxX >= x0) {
+            worker.rowInputs.push_back(inputs[i]);
+            worker.rowIndices.push_back(i);
+        }
+    }
+    if (worker.rowInputs.empty()) {
+        return;
+    }
+    
+    PixelBox window = result.dataWindow();
+    MergeTally& tally = worker.tally;
+    for (int x = x0; x <= x1; ++x) {
+        uint64_t start = costMap ? cycleCount() : 0;
+        size_t inputsBefore = tally.inputSamples;
+        size_t splitsBefore = tally.volume.fragments;
+        
+        // Gather non-empty pixels from the inputs covering (x, y)
+        if (extras) {
+            gatherExtraInputs(*extras, worker.rowIndices, x, y, worker.extraInputs, tally);
+            if (worker.extraInputs.empty()) {
+                continue;
+            }
+        } else {
+            gatherPixels(worker.rowInputs, x, y, worker.pixelPtrs, tally);
+            if (worker.pixelPtrs.empty()) {
+                continue;
+            }
+        }
+        
+        // Merge pixels (a fresh in-core result needs no checks or paging)
+        int localX = x - window.minX;
+        int localY = y - window.minY;
+        DeepPixel& out = result.isOutOfCore() ? result.pixel(localX, localY)
+                                              : result.pixelUnchecked(localX, localY);
+        if (extras) {
+            out = mergePixelsWithExtras(worker.extraInputs, extras->channels, threshold,
+                                        result.extraColumns(localX, localY), &tally.volume);
+        } else {
+            out = merge(worker.pixelPtrs, threshold, &tally.volume);
+        }
+        tally.outputSamples += out.sampleCount();
+        tally.pixels++;
+        
+        if (costMap) {
+            size_t inputs = tally.inputSamples - inputsBefore;
+            size_t index = static_cast<size_t>(y - window.minY) * window.width() + (x - window.minX);
+            float* cost = &costMap->values[index * MergeCostMap::kChannels];
+            cost[0] = static_cast<float>(inputs);
+            cost[1] = static_cast<float>(inputs + tally.volume.fragments - splitsBefore);
+            cost[2] = static_cast<float>(out.sampleCount());
+            cost[3] = static_cast<float>(cycleCount() - start);
+        }
+    }
+}
+
+/**
+ * Estimated merge cost of every kCostBinWidth-pixel piece of every row of
+ * `window`, row-major: one per pixel plus the input samples there
+ */
+std::vector<uint64_t> mergeCostBins(const std::vector<const DeepImage*>& inputs,
+                                    const PixelBox& window, int binsPerRow, int threads) {
+    std::vector<uint64_t> bins(static_cast<size_t>(binsPerRow) * window.height());
+    
+    // Rows cost about the same to count, so split them evenly
+    std::vector<uint64_t> rowCosts(window.height(), static_cast<uint64_t>(window.width()));
+    std::vector<WorkUnit> rowBlocks = partitionByCost(rowCosts, static_cast<size_t>(threads));
+    
+    runWorkUnits(rowBlocks, threads, [&](const WorkUnit& block, int) {
+        for (size_t r = block.begin; r < block.end; ++r) {
+            int y = window.minY + static_cast<int>(r);
+            uint64_t* row = &bins[r * binsPerRow];
+            for (int b = 0; b < binsPerRow; ++b) {
+                row[b] = static_cast<uint64_t>(
+                    std::min(kCostBinWidth, window.maxX - (window.minX + b * kCostBinWidth) + 1));
+            }
+            for (const auto* img : inputs) {
+                PixelBox w = img->dataWindow();
+                if (y < w.minY || y > w.maxY) {
+                    continue;
+                }
+                int x0 = std::max(w.minX, window.minX);
+                int x1 = std::min(w.maxX, window.maxX);
+                for (int x = x0; x <= x1; ++x) {
+                    row[(x - window.minX) / kCostBinWidth] +=
+                        img->pixel(x - w.minX, y - w.minY).sampleCount();
+                }
+            }
+        }
+    });
+    return bins;
+}
+
+void fillStats(CompositorStats* stats, size_t inputCount, const MergeTally& tally,
+               double mergeTimeMs) {
+    if (!stats) {
+        return;
+    }
+    stats->inputImageCount = inputCount;
+    stats->totalInputSamples = tally.inputSamples;
+    stats->totalOutputSamples = tally.outputSamples;
+    stats->remergedPixels = tally.pixels;
+    stats->minDepth = tally.minDepth;
+    stats->maxDepth = tally.maxDepth;
+    stats->splitFragments = tally.volume.fragments;
+    stats->blends = tally.volume.blends;
+    stats->mergeTimeMs = mergeTimeMs;
+}
+
+/**
+ * Grow an image's data window to cover `box`, keeping existing pixels
+ */
+void growDataWindow(DeepImage& img, const PixelBox& box) {
+    PixelBox current = img.dataWindow();
+    PixelBox grown = current.unite(box);
+    if (grown == current) {
+        return;
+    }
+    
+    DeepImage result(grown);
+    result.setDisplayWindow(img.displayWindow());
+    result.setChannels(img.channels());
+    int dx = current.minX - grown.minX;
+    int dy = current.minY - grown.minY;
+    bool extras = img.hasExtraChannels();
+    img.forEachPixel([&](int x, int y, DeepPixel& pixel) {
+        result.pixelUnchecked(x + dx, y + dy) = std::move(pixel);
+        if (extras) {
+            result.extraColumns(x + dx, y + dy) = std::move(img.extraColumns(x, y));
+        }
+    });
+    img = std::move(result);
+}
+
+/**
+ * Make room in `merged` for the changed layers and return the part of
+ * their footprints an update has to visit (empty if there's nothing to do)
+ */
+PixelBox prepareUpdate(DeepImage& merged, const std::vector<const DeepImage*>& changed,
+                       const CompositorOptions& options) {
+    ChannelSet channels = merged.channels();
+    PixelBox region;
+    PixelBox display = merged.displayWindow();
+    for (const auto* layer : changed) {
+        channels = channels.unite(layer->channels());
+        PixelBox footprint = layerFootprint(*layer);
+        if (!options.roi.isEmpty()) {
+            footprint = footprint.intersect(options.roi);
+        }
+        if (!footprint.isEmpty()) {
+            region = region.unite(footprint);
+            display = display.unite(layer->displayWindow());
+        }
+    }
+    merged.setChannels(channels);
+    if (!region.isEmpty()) {
+        growDataWindow(merged, region);
+        merged.setDisplayWindow(display);
+    }
+    return region;
+}
+
+/**
+ * Re-merge the pixels of `merged` inside `region` where any of `changed`
+ * has samples, from `layers`
+ */
+void remergeChanged(DeepImage& merged, const std::vector<const DeepImage*>& layers,
+                    const std::vector<const DeepImage*>& changed, const PixelBox& region,
+                    float threshold, MergeTally& tally) {
+    PixelMergeFn merge = pixelMergeFunction(merged.channels());
+    ExtraChannelPlan plan(merged.channels(), layers);
+    MergeWorker worker;
+    worker.pixelPtrs.reserve(layers.size());
+    
+    for (int y = region.minY; y <= region.maxY; ++y) {
+        for (int x = region.minX; x <= region.maxX; ++x) {
+            bool dirty = false;
+            for (const auto* img : changed) {
+                if (samplesAt(*img, x, y)) {
+                    dirty = true;
+                    break;
+                }
+            }
+            if (dirty) {
+                remergePixel(merged, layers, x, y, threshold, merge,
+                             merged.hasExtraChannels() ? &plan : nullptr, worker);
+            }
+        }
+    }
+    tally.add(worker.tally);
+}
+
+} // anonymous namespace
+
 bool validateDimensions(const std::vector<DeepImage>& inputs) {
     if (inputs.empty()) {
         return true;
@@ -42,13 +405,18 @@ bool validateDimensions(const std::vector<const DeepImage*>& inputs) {
 }
 
 DeepPixel mergePixels(const std::vector<const DeepPixel*>& pixels,
-                      float mergeThreshold) {
-    return mergePixelsVolumetric(pixels, mergeThreshold);
+                      float mergeThreshold, VolumeMergeCounts* counts) {
+    return mergePixelsVolumetric(pixels, mergeThreshold, counts);
+}
+
+std::vector<std::string> MergeCostMap::channelNames() {
+    return {"cost.inputSamples", "cost.fragments", "cost.outputSamples", "cost.cycles"};
 }
 
 DeepImage deepMerge(const std::vector<DeepImage>& inputs,
                     const CompositorOptions& options,
-                    CompositorStats* stats) {
+                    CompositorStats* stats,
+                    MergeCostMap* costMap) {
     // Convert to pointer version
     std::vector<const DeepImage*> ptrs;
     ptrs.reserve(inputs.size());
@@ -56,87 +424,339 @@ DeepImage deepMerge(const std::vector<DeepImage>& inputs,
         ptrs.push_back(&img);
     }
     
-    return deepMerge(ptrs, options, stats);
+    return deepMerge(ptrs, options, stats, costMap);
 }
 
 DeepImage deepMerge(const std::vector<const DeepImage*>& inputs,
                     const CompositorOptions& options,
-                    CompositorStats* stats) {
+                    CompositorStats* stats,
+                    MergeCostMap* costMap) {
     Timer timer;
+    TraceZone zone("deepMerge");
     
     // Handle empty input
     if (inputs.empty()) {
         if (stats) {
             stats->inputImageCount = 0;
         }
+        if (costMap) {
+            *costMap = MergeCostMap();
+        }
         return DeepImage();
     }
     
-    // Validate dimensions
-    if (!validateDimensions(inputs)) {
-        throw std::runtime_error("Input images have mismatched dimensions");
+    // The result covers the union of the input data windows (and display
+    // windows); the ROI narrows it
+    PixelBox window;
+    PixelBox display;
+    for (const auto* img : inputs) {
+        window = window.unite(img->dataWindow());
+        display = display.unite(img->displayWindow());
+    }
+    if (!options.roi.isEmpty()) {
+        window = window.intersect(options.roi);
     }
     
-    int width = inputs[0]->width();
-    int height = inputs[0]->height();
-    
-    // Calculate input statistics
-    size_t totalInputSamples = 0;
-    float minDepth = std::numeric_limits<float>::infinity();
-    float maxDepth = -std::numeric_limits<float>::infinity();
+    logVerbose("  Merging " + std::to_string(inputs.size()) + " images...");
     
+    // Create output image, merged with the code for its channel layout
+    ChannelSet channels = inputs.front()->channels();
     for (const auto* img : inputs) {
-        totalInputSamples += img->totalSampleCount();
-        
-        float imgMin, imgMax;
-        img->depthRange(imgMin, imgMax);
-        minDepth = std::min(minDepth, imgMin);
-        maxDepth = std::max(maxDepth, imgMax);
+        channels = channels.unite(img->channels());
     }
+    PixelMergeFn merge = pixelMergeFunction(channels);
+    DeepImage result(window);
+    result.setDisplayWindow(display);
+    result.setChannels(channels);
+    ExtraChannelPlan plan(channels, inputs);
+    const ExtraChannelPlan* extras = result.hasExtraChannels() ? &plan : nullptr;
+    logVerbose(std::string("    Layout: ") + (channels.zBack ? "RGBA+ZBack" : "RGBA (points only)") +
+               (extras ? " + " + std::to_string(channels.extras.size()) + " extra channels" : ""));
     
-    logVerbose("  Merging " + std::to_string(inputs.size()) + " images...");
-    logVerbose("    Input samples: " + formatNumber(totalInputSamples));
+    if (costMap) {
+        costMap->window = window;
+        costMap->values.assign(static_cast<size_t>(window.width()) * window.height() *
+                                   MergeCostMap::kChannels, 0.0f);
+    }
     
-    // Create output image
-    DeepImage result(width, height);
+    // Out-of-core results are filled a page at a time, on this thread (a
+    // paged image is single-threaded)
+    std::vector<PixelBox> blocks;
+    bool paged = false;
+    if (std::shared_ptr<TilePager> pager = outOfCorePager()) {
+        result.enableOutOfCore(std::move(pager));
+        for (const PixelBox& tile : result.tileOrder()) {
+            blocks.emplace_back(tile.minX + window.minX, tile.minY + window.minY,
+                                tile.maxX + window.minX, tile.maxY + window.minY);
+        }
+        paged = true;
+    }
+    for (const auto* img : inputs) {
+        paged = paged || img->isOutOfCore();
+    }
     
-    // Prepare pixel pointer arrays for each input
-    std::vector<const DeepPixel*> pixelPtrs(inputs.size());
+    // Input statistics are gathered while merging so only visited pixels
+    // are touched
+    MergeTally tally;
+    float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+    int threads = options.threads > 0 ? options.threads : TaskScheduler::shared().threadCount();
+    ScheduleStats schedule;
     
-    // Merge each pixel
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            // Gather pixel pointers from all inputs
-            for (size_t i = 0; i < inputs.size(); ++i) {
-                pixelPtrs[i] = &(inputs[i]->pixel(x, y));
+    if (paged || threads == 1) {
+        if (blocks.empty()) {
+            blocks.push_back(window);
+        }
+        MergeWorker worker;
+        worker.rowInputs.reserve(inputs.size());
+        worker.rowIndices.reserve(inputs.size());
+        worker.pixelPtrs.reserve(inputs.size());
+        for (const PixelBox& block : blocks) {
+            for (int y = block.minY; y <= block.maxY; ++y) {
+                mergeSpan(inputs, result, y, block.minX, block.maxX, threshold, merge, extras, worker,
+                          costMap);
             }
-            
-            // Merge pixels
-            float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
-            result.pixel(x, y) = mergePixels(pixelPtrs, threshold);
+        }
+        tally = worker.tally;
+        schedule.threads = 1;
+        schedule.units = blocks.size();
+    } else if (!window.isEmpty()) {
+        // Cut the window into pieces of equal estimated cost, so rows of
+        // empty sky and rows of dense volumes even out across threads
+        int binsPerRow = (window.width() + kCostBinWidth - 1) / kCostBinWidth;
+        std::vector<uint64_t> costs = mergeCostBins(inputs, window, binsPerRow, threads);
+        std::vector<WorkUnit> units = partitionByCost(costs, static_cast<size_t>(threads) * kUnitsPerThread);
+        
+        std::vector<MergeWorker> workers(threads);
+        schedule = runWorkUnits(units, threads, [&](const WorkUnit& unit, int w) {
+            MergeWorker& worker = workers[w];
+            for (size_t bin = unit.begin; bin < unit.end; ++bin) {
+                int y = window.minY + static_cast<int>(bin / binsPerRow);
+                int x0 = window.minX + static_cast<int>(bin % binsPerRow) * kCostBinWidth;
+                int x1 = std::min(x0 + kCostBinWidth - 1, window.maxX);
+                mergeSpan(inputs, result, y, x0, x1, threshold, merge, extras, worker, costMap);
+            }
+        });
+        for (const MergeWorker& worker : workers) {
+            tally.add(worker.tally);
         }
     }
     
-    double mergeTime = timer.elapsedMs();
+    logVerbose("    Input samples: " + formatNumber(tally.inputSamples));
     
-    // Calculate output statistics
-    size_t totalOutputSamples = result.totalSampleCount();
+    double mergeTime = timer.elapsedMs();
     
-    logVerbose("    Output samples: " + formatNumber(totalOutputSamples));
-    logVerbose("    Depth range: " + std::to_string(minDepth) + " to " + std::to_string(maxDepth));
+    logVerbose("    Output samples: " + formatNumber(tally.outputSamples));
+    logVerbose("    Depth range: " + std::to_string(tally.minDepth) + " to " + std::to_string(tally.maxDepth));
     logVerbose("    Merge time: " + std::to_string(static_cast<int>(mergeTime)) + " ms");
     
-    // Fill stats if requested
+    logVerbose("    Threads: " + std::to_string(schedule.threads) + ", " +
+               std::to_string(schedule.units) + " work units, " +
+               std::to_string(schedule.steals) + " stolen, balance " +
+               std::to_string(static_cast<int>(schedule.balance * 100.0 + 0.5)) + "%");
+    
+    fillStats(stats, inputs.size(), tally, mergeTime);
     if (stats) {
-        stats->inputImageCount = inputs.size();
-        stats->totalInputSamples = totalInputSamples;
-        stats->totalOutputSamples = totalOutputSamples;
-        stats->minDepth = minDepth;
-        stats->maxDepth = maxDepth;
-        stats->mergeTimeMs = mergeTime;
+        stats->mergeThreads = schedule.threads;
+        stats->workUnits = schedule.units;
+        stats->steals = schedule.steals;
+        stats->loadBalance = schedule.balance;
     }
+    zone.arg("inputs", static_cast<int64_t>(inputs.size()));
+    zone.arg("units", static_cast<int64_t>(schedule.units));
+    zone.arg("pixels", static_cast<int64_t>(tally.pixels));
+    zone.arg("samples", static_cast<int64_t>(tally.outputSamples));
     
     return result;
 }
 
+// ============================================================================
+// Incremental updates
+// ============================================================================
+
+PixelBox layerFootprint(const DeepImage& layer) {
+    // Bound each tile's non-empty pixels, then unite the tile bounds
+    std::mutex mutex;
+    PixelBox footprint;
+    layer.forEachTile(PixelBox(0, 0, layer.width() - 1, layer.height() - 1), 64,
+                      [&](const PixelBox& tile) {
+        int minX = std::numeric_limits<int>::max();
+        int minY = std::numeric_limits<int>::max();
+        int maxX = std::numeric_limits<int>::min();
+        int maxY = std::numeric_limits<int>::min();
+        for (int y = tile.minY; y <= tile.maxY; ++y) {
+            for (int x = tile.minX; x <= tile.maxX; ++x) {
+                if (!layer.pixelUnchecked(x, y).isEmpty()) {
+                    minX = std::min(minX, x);
+                    maxX = std::max(maxX, x);
+                    minY = std::min(minY, y);
+                    maxY = std::max(maxY, y);
+                }
+            }
+        }
+        if (minX <= maxX) {
+            std::lock_guard<std::mutex> lock(mutex);
+            footprint = footprint.unite(PixelBox(minX, minY, maxX, maxY));
+        }
+    });
+    
+    if (footprint.isEmpty()) {
+        return PixelBox();
+    }
+    return PixelBox(footprint.minX + layer.originX(), footprint.minY + layer.originY(),
+                    footprint.maxX + layer.originX(), footprint.maxY + layer.originY());
+}
+
+void remergeRegion(DeepImage& merged, const std::vector<const DeepImage*>& layers,
+                   const PixelBox& region, const CompositorOptions& options,
+                   CompositorStats* stats) {
+    Timer timer;
+    MergeTally tally;
+    
+    PixelBox coverage;
+    ChannelSet channels = merged.channels();
+    for (const auto* img : layers) {
+        coverage = coverage.unite(img->dataWindow());
+        channels = channels.unite(img->channels());
+    }
+    merged.setChannels(channels);
+    PixelBox window = region.intersect(coverage.unite(merged.dataWindow()));
+    if (!options.roi.isEmpty()) {
+        window = window.intersect(options.roi);
+    }
+    
+    if (!window.isEmpty()) {
+        growDataWindow(merged, window.intersect(coverage));
+        float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+        PixelMergeFn merge = pixelMergeFunction(channels);
+        ExtraChannelPlan plan(channels, layers);
+        MergeWorker worker;
+        worker.pixelPtrs.reserve(layers.size());
+        
+        PixelBox target = window.intersect(merged.dataWindow());
+        for (int y = target.minY; y <= target.maxY; ++y) {
+            for (int x = target.minX; x <= target.maxX; ++x) {
+                remergePixel(merged, layers, x, y, threshold, merge,
+                             merged.hasExtraChannels() ? &plan : nullptr, worker);
+            }
+        }
+        tally.add(worker.tally);
+    }
+    
+    fillStats(stats, layers.size(), tally, timer.elapsedMs());
+}
+
+void insertLayer(DeepImage& merged, const DeepImage& layer,
+                 const CompositorOptions& options, CompositorStats* stats,
+                 size_t baseLayerCount) {
+    Timer timer;
+    MergeTally tally;
+    
+    PixelBox region = prepareUpdate(merged, {&layer}, options);
+    float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+    PixelMergeFn merge = pixelMergeFunction(merged.channels());
+    std::vector<const DeepPixel*> pixelPtrs;
+    
+    // The merged pixel's own columns are in result order
+    const ChannelSet& channels = merged.channels();
+    bool extras = merged.hasExtraChannels();
+    std::vector<int> identity(channels.extras.size());
+    for (size_t c = 0; c < identity.size(); ++c) {
+        identity[c] = static_cast<int>(c);
+    }
+    ExtraChannelPlan plan(channels, {&layer});
+    static const std::vector<float> kNoColumns;
+    std::vector<ExtraMergeInput> extraInputs;
+    std::vector<float> columns;
+    
+    for (int y = region.minY; y <= region.maxY; ++y) {
+        for (int x = region.minX; x <= region.maxX; ++x) {
+            const DeepPixel* added = samplesAt(layer, x, y);
+            if (!added) {
+                continue;
+            }
+            
+            int localX = x - merged.originX();
+            int localY = y - merged.originY();
+            DeepPixel& out = merged.pixel(localX, localY);
+            pixelPtrs.clear();
+            extraInputs.clear();
+            if (!out.isEmpty()) {
+                pixelPtrs.push_back(&out);
+                if (extras) {
+                    extraInputs.push_back({&out, &merged.extraColumns(localX, localY), &identity});
+                }
+                tally.addInput(out);
+            }
+            pixelPtrs.push_back(added);
+            if (extras) {
+                const std::vector<float>* addedColumns = layer.hasExtraChannels()
+                    ? &layer.extraColumns(x - layer.originX(), y - layer.originY()) : &kNoColumns;
+                extraInputs.push_back({added, addedColumns, &plan.maps[0]});
+            }
+            tally.addInput(*added);
+            
+            if (extras) {
+                // The merged pixel is an input, so merge into scratch columns
+                out = mergePixelsWithExtras(extraInputs, channels, threshold, columns, &tally.volume);
+                merged.extraColumns(localX, localY).swap(columns);
+            } else {
+                out = merge(pixelPtrs, threshold, &tally.volume);
+            }
+            tally.outputSamples += out.sampleCount();
+            tally.pixels++;
+        }
+    }
+    
+    logVerbose("    Inserted layer: " + formatNumber(tally.pixels) + " pixels re-merged");
+    fillStats(stats, baseLayerCount + 1, tally, timer.elapsedMs());
+}
+
+void insertLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                 const DeepImage& layer, const CompositorOptions& options,
+                 CompositorStats* stats) {
+    Timer timer;
+    MergeTally tally;
+    
+    PixelBox region = prepareUpdate(merged, {&layer}, options);
+    float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+    
+    std::vector<const DeepImage*> layers = otherLayers;
+    layers.push_back(&layer);
+    remergeChanged(merged, layers, {&layer}, region, threshold, tally);
+    
+    logVerbose("    Inserted layer: " + formatNumber(tally.pixels) + " pixels re-merged");
+    fillStats(stats, layers.size(), tally, timer.elapsedMs());
+}
+
+void removeLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                 const DeepImage& removed, const CompositorOptions& options,
+                 CompositorStats* stats) {
+    Timer timer;
+    MergeTally tally;
+    
+    PixelBox region = prepareUpdate(merged, {&removed}, options);
+    float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+    remergeChanged(merged, otherLayers, {&removed}, region, threshold, tally);
+    
+    logVerbose("    Removed layer: " + formatNumber(tally.pixels) + " pixels re-merged");
+    fillStats(stats, otherLayers.size(), tally, timer.elapsedMs());
+}
+
+void replaceLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                  const DeepImage& oldLayer, const DeepImage& newLayer,
+                  const CompositorOptions& options, CompositorStats* stats) {
+    Timer timer;
+    MergeTally tally;
+    
+    PixelBox region = prepareUpdate(merged, {&oldLayer, &newLayer}, options);
+    float threshold = options.enableMerging ? options.mergeThreshold : 0.0f;
+    
+    std::vector<const DeepImage*> layers = otherLayers;
+    layers.push_back(&newLayer);
+    remergeChanged(merged, layers, {&oldLayer, &newLayer}, region, threshold, tally);
+    
+    logVerbose("    Replaced layer: " + formatNumber(tally.pixels) + " pixels re-merged");
+    fillStats(stats, layers.size(), tally, timer.elapsedMs());
+}
+
 } // namespace deep_compositor
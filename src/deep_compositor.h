@@ -1,16 +1,21 @@
 #pragma once
 
 #include "deep_image.h"
+#include <string>
 #include <vector>
 
 namespace deep_compositor {
 
+struct VolumeMergeCounts;
+
 /**
  * Options for the compositing operation
  */
 struct CompositorOptions {
     float mergeThreshold = 0.001f;  // Epsilon for merging nearby samples
     bool enableMerging = true;       // Whether to merge nearby samples
+    PixelBox roi;                    // Only merge this region (empty = whole data window)
+    int threads = 0;                 // deepMerge worker threads (0 = the whole shared pool)
 };
 
 /**
@@ -22,45 +27,171 @@ struct CompositorStats {
     size_t totalOutputSamples = 0;
     float minDepth = 0.0f;
     float maxDepth = 0.0f;
+    size_t remergedPixels = 0;       // Non-empty output pixels (re)computed
+    size_t splitFragments = 0;       // Extra fragments from splitting volumes
+    size_t blends = 0;               // Coincident fragments blended together
+    size_t culledSamples = 0;        // Samples behind full opacity, skipped by flattening
+    size_t mergeThreads = 1;         // Threads deepMerge ran on
+    size_t workUnits = 0;            // Equal-cost pieces the merge was cut into
+    size_t steals = 0;               // Work units run by a thread that didn't own them
+    double loadBalance = 1.0;        // Mean / max busy time per merge thread
     double mergeTimeMs = 0.0;
     double flattenTimeMs = 0.0;
 };
 
+/**
+ * Per-pixel cost of a merge, for finding the regions that make it slow
+ *
+ * kChannels floats per pixel of `window` (row-major): input samples,
+ * fragments after volumetric splitting, output samples and merge time in
+ * cycleCount() ticks. Pixels with no input samples stay zero.
+ */
+struct MergeCostMap {
+    static constexpr int kChannels = 4;
+    
+    PixelBox window;            // Absolute coordinates (the merge result's data window)
+    std::vector<float> values;
+    
+    /**
+     * EXR channel names of the four values, in order
+     */
+    static std::vector<std::string> channelNames();
+};
+
 /**
  * Deep merge multiple deep images into a single deep image
  *
  * Combines all samples from all input images, sorting by depth.
- * All input images must have the same dimensions.
+ * Inputs may have different data windows (e.g. bbox-cropped elements);
+ * the result covers the union of them, and each input is only visited
+ * inside its own data window. If options.roi is set, only pixels inside
+ * it are visited and the result's data window is clipped to it.
+ *
+ * With more than one thread the window is cut into work units of about
+ * equal cost, estimated from the inputs' per-pixel sample counts, and idle
+ * threads steal units from busy ones. Out-of-core merges (inputs or
+ * result paged) run on the calling thread.
  *
  * @param inputs Vector of deep images to merge
  * @param options Compositing options
  * @param stats Optional output statistics
+ * @param costMap Optional per-pixel cost output; costs a few cycles per
+ *        merged pixel, so it can stay on in production runs
  * @return Merged deep image
- * @throws std::runtime_error if inputs have mismatched dimensions
  */
 DeepImage deepMerge(const std::vector<DeepImage>& inputs,
                     const CompositorOptions& options = CompositorOptions(),
-                    CompositorStats* stats = nullptr);
+                    CompositorStats* stats = nullptr,
+                    MergeCostMap* costMap = nullptr);
 
 /**
  * Deep merge (pointer version for large images)
  */
 DeepImage deepMerge(const std::vector<const DeepImage*>& inputs,
                     const CompositorOptions& options = CompositorOptions(),
-                    CompositorStats* stats = nullptr);
+                    CompositorStats* stats = nullptr,
+                    MergeCostMap* costMap = nullptr);
+
+// ============================================================================
+// Incremental updates
+// ============================================================================
+//
+// These update an existing merge result in place instead of re-running
+// deepMerge over every layer. Only the changed layer's footprint is
+// visited, and within it only pixels where that layer has samples. The
+// merged image's data window grows if the changed layer reaches outside it
+// (it never shrinks). Stats, when requested, cover just the visited pixels.
+
+/**
+ * Bounding box of a layer's non-empty pixels, in absolute coordinates
+ * (empty if the layer has no samples)
+ */
+PixelBox layerFootprint(const DeepImage& layer);
+
+/**
+ * Recompute every pixel of `merged` inside `region` from `layers`
+ *
+ * `layers` must be the complete layer set the merge is made of.
+ */
+void remergeRegion(DeepImage& merged, const std::vector<const DeepImage*>& layers,
+                   const PixelBox& region,
+                   const CompositorOptions& options = CompositorOptions(),
+                   CompositorStats* stats = nullptr);
+
+/**
+ * Add a layer to an existing merge, approximately
+ *
+ * Needs only the previous result: each pixel the layer covers is merged
+ * with the existing merged pixel. That is not the full merge where the
+ * layer's samples come within mergeThreshold of merged ones: a group
+ * blended earlier is joined as a whole, so colour moves between samples
+ * that deepMerge would have kept apart (flattened alpha is unchanged).
+ * Cutting merged volumes again also compounds rounding. Use the overload
+ * taking the other layers when they are available.
+ *
+ * @param baseLayerCount Layers `merged` was made of, for the stats'
+ *        inputImageCount (the layers after the insert)
+ */
+void insertLayer(DeepImage& merged, const DeepImage& layer,
+                 const CompositorOptions& options = CompositorOptions(),
+                 CompositorStats* stats = nullptr, size_t baseLayerCount = 1);
+
+/**
+ * Add a layer to an existing merge, exactly
+ *
+ * Pixels the layer covers are re-merged from `otherLayers` plus `layer`,
+ * matching deepMerge over them.
+ *
+ * @param otherLayers Every layer `merged` was made of
+ */
+void insertLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                 const DeepImage& layer,
+                 const CompositorOptions& options = CompositorOptions(),
+                 CompositorStats* stats = nullptr);
+
+/**
+ * Take a layer out of an existing merge
+ *
+ * Merging can't be undone, so the pixels the removed layer covered are
+ * re-merged from the remaining layers.
+ *
+ * @param otherLayers Every layer of the merge except `removed`
+ */
+void removeLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                 const DeepImage& removed,
+                 const CompositorOptions& options = CompositorOptions(),
+                 CompositorStats* stats = nullptr);
+
+/**
+ * Swap one layer of an existing merge for a new version
+ *
+ * Pixels covered by either version are re-merged from the other layers
+ * plus `newLayer`.
+ *
+ * @param otherLayers Every layer of the merge except `oldLayer`
+ */
+void replaceLayer(DeepImage& merged, const std::vector<const DeepImage*>& otherLayers,
+                  const DeepImage& oldLayer, const DeepImage& newLayer,
+                  const CompositorOptions& options = CompositorOptions(),
+                  CompositorStats* stats = nullptr);
 
 /**
  * Merge samples from multiple deep pixels into one
  *
  * @param pixels Vector of deep pixels to merge
  * @param mergeThreshold Epsilon for merging nearby samples
+ * @param counts Optional split/blend counters to add to
  * @return Merged deep pixel with sorted samples
  */
 DeepPixel mergePixels(const std::vector<const DeepPixel*>& pixels,
-                      float mergeThreshold = 0.001f);
+                      float mergeThreshold = 0.001f,
+                      VolumeMergeCounts* counts = nullptr);
 
 /**
- * Validate that all images have compatible dimensions
+ * Check whether all images have the same dimensions
+ *
+ * deepMerge no longer requires this; it is kept for callers that need
+ * full-frame inputs.
  *
  * @param inputs Vector of images to validate
  * @return true if all dimensions match
@@ -1,4 +1,13 @@
 #include "deep_image.h"
+#include "deep_cache.h"
+#include "deep_pager.h"
+#include "deep_tasks.h"
+
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <numeric>
 #include <sstream>
 
 namespace deep_compositor {
@@ -107,29 +116,598 @@ bool DeepPixel::isValidSortOrder() const {
     return true;
 }
 
+// ============================================================================
+// ChannelSet Implementation
+// ============================================================================
+
+ExtraChannel ExtraChannel::fromFile(const std::string& name, bool isUint) {
+    ExtraChannel channel;
+    channel.name = name;
+    channel.isUint = isUint;
+    
+    // Only the last component counts ("crypto.ID", not "id.weight")
+    size_t dot = name.rfind('.');
+    std::string leaf = dot == std::string::npos ? name : name.substr(dot + 1);
+    std::string lower = leaf;
+    for (char& c : lower) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    size_t n = leaf.size();
+    bool camelId = n > 2 && (leaf.compare(n - 2, 2, "Id") == 0 || leaf.compare(n - 2, 2, "ID") == 0) &&
+                   !std::isupper(static_cast<unsigned char>(leaf[n - 3]));
+    bool snakeId = n > 3 && lower.compare(n - 3, 3, "_id") == 0;
+    channel.isId = isUint || lower == "id" || camelId || snakeId;
+    return channel;
+}
+
+ChannelSet ChannelSet::unite(const ChannelSet& other) const {
+    ChannelSet result = *this;
+    result.zBack = zBack || other.zBack;
+    for (const ExtraChannel& channel : other.extras) {
+        if (findExtra(channel.name) < 0) {
+            result.extras.push_back(channel);
+        }
+    }
+    return result;
+}
+
+int ChannelSet::findExtra(const std::string& name) const {
+    for (size_t i = 0; i < extras.size(); ++i) {
+        if (extras[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+std::vector<std::string> ChannelSet::names() const {
+    std::vector<std::string> result = {"R", "G", "B", "A", "Z"};
+    if (zBack) {
+        result.push_back("ZBack");
+    }
+    for (const ExtraChannel& channel : extras) {
+        result.push_back(channel.name);
+    }
+    return result;
+}
+
 // ============================================================================
 // DeepImage Implementation
 // ============================================================================
 
-DeepImage::DeepImage() : width_(0), height_(0) {}
+/**
+ * Lazy view of a mapped cache. Rows are copied into pixels_ in bands of
+ * kBandRows; a band's ready flag is set (release) only after its pixels are
+ * filled, so readers that see it set (acquire) can use them without locking.
+ */
+struct DeepImage::CacheBacking {
+    static constexpr int kBandRows = 64;
+    
+    std::shared_ptr<const DeepCache> cache;
+    int offsetX = 0;  // Image column 0 in cache data window coordinates
+    int offsetY = 0;
+    std::unique_ptr<std::atomic<bool>[]> bandReady;
+    std::atomic<bool> modified{false};  // Set once a pixel is handed out mutably
+    std::mutex mutex;
+};
+
+/**
+ * Tiles of an out-of-core image. Pixel headers stay in pixels_; a paged-out
+ * tile has its sample vectors freed and its data in the pager's scratch
+ * file as per-pixel uint32 counts followed by the samples. Everything but
+ * `current` is only touched with the pager's lock held, or by the owning
+ * thread on its current tile (which the pager never evicts).
+ */
+struct DeepImage::PagedStorage final : TilePager::Client {
+    static constexpr size_t kNoTile = std::numeric_limits<size_t>::max();
+    
+    struct Tile {
+        bool resident = true;
+        bool dirty = true;   // Differs from the scratch copy (or has none)
+        size_t bytes = 0;    // Resident sample bytes, as last measured
+        size_t samples = 0;  // Sample count while paged out
+        ScratchSlot slot;
+    };
+    
+    std::shared_ptr<TilePager> pager;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    int width;
+    int height;
+    DeepPixel* pixels;  // The owner's pixels_ (stable across moves)
+    std::vector<Tile> tiles;
+    std::atomic<size_t> current{kNoTile};
+    std::vector<char> buffer;
+    
+    PagedStorage(std::shared_ptr<TilePager> tilePager, int size, int w, int h, DeepPixel* data)
+        : pager(std::move(tilePager)), tileSize(size),
+          tilesX((w + size - 1) / size), tilesY((h + size - 1) / size),
+          width(w), height(h), pixels(data),
+          tiles(static_cast<size_t>(tilesX) * static_cast<size_t>(tilesY)) {}
+    
+    ~PagedStorage() {
+        auto lock = pager->lock();
+        for (size_t t = 0; t < tiles.size(); ++t) {
+            pager->forget(this, t);
+            pager->release(tiles[t].slot);
+        }
+    }
+    
+    PixelBox box(size_t t) const {
+        int x0 = static_cast<int>(t % static_cast<size_t>(tilesX)) * tileSize;
+        int y0 = static_cast<int>(t / static_cast<size_t>(tilesX)) * tileSize;
+        return PixelBox(x0, y0, std::min(width, x0 + tileSize) - 1,
+                        std::min(height, y0 + tileSize) - 1);
+    }
+    
+    DeepPixel& at(int x, int y) const {
+        return pixels[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)];
+    }
+    
+    size_t measure(size_t t) const {
+        PixelBox b = box(t);
+        size_t bytes = 0;
+        for (int y = b.minY; y <= b.maxY; ++y) {
+            for (int x = b.minX; x <= b.maxX; ++x) {
+                bytes += at(x, y).samples().capacity() * sizeof(DeepSample);
+            }
+        }
+        return bytes;
+    }
+    
+    size_t currentTile() const override { return current.load(std::memory_order_relaxed); }
+    
+    void pageOut(size_t t) override {
+        Tile& tile = tiles[t];
+        PixelBox b = box(t);
+        size_t samples = 0;
+        for (int y = b.minY; y <= b.maxY; ++y) {
+            for (int x = b.minX; x <= b.maxX; ++x) {
+                samples += at(x, y).sampleCount();
+            }
+        }
+        
+        if (samples == 0) {
+            pager->release(tile.slot);
+        } else if (tile.dirty || tile.slot.capacity == 0) {
+            size_t pixelCount = static_cast<size_t>(b.width()) * static_cast<size_t>(b.height());
+            buffer.resize(pixelCount * sizeof(uint32_t) + samples * sizeof(DeepSample));
+            char* counts = buffer.data();
+            char* data = counts + pixelCount * sizeof(uint32_t);
+            for (int y = b.minY; y <= b.maxY; ++y) {
+                for (int x = b.minX; x <= b.maxX; ++x) {
+                    const std::vector<DeepSample>& s = at(x, y).samples();
+                    uint32_t count = static_cast<uint32_t>(s.size());
+                    std::memcpy(counts, &count, sizeof(count));
+                    counts += sizeof(count);
+                    if (!s.empty()) {
+                        std::memcpy(data, s.data(), s.size() * sizeof(DeepSample));
+                        data += s.size() * sizeof(DeepSample);
+                    }
+                }
+            }
+            pager->write(buffer.data(), buffer.size(), tile.slot);
+        }
+        
+        for (int y = b.minY; y <= b.maxY; ++y) {
+            for (int x = b.minX; x <= b.maxX; ++x) {
+                std::vector<DeepSample>().swap(at(x, y).samples());
+            }
+        }
+        tile.resident = false;
+        tile.dirty = false;
+        tile.bytes = 0;
+        tile.samples = samples;
+    }
+    
+    void pageIn(size_t t) {
+        Tile& tile = tiles[t];
+        if (tile.slot.size > 0) {
+            buffer.resize(tile.slot.size);
+            pager->read(tile.slot, buffer.data());
+            pager->countPageIn();
+            
+            PixelBox b = box(t);
+            size_t pixelCount = static_cast<size_t>(b.width()) * static_cast<size_t>(b.height());
+            const char* counts = buffer.data();
+            const char* data = counts + pixelCount * sizeof(uint32_t);
+            for (int y = b.minY; y <= b.maxY; ++y) {
+                for (int x = b.minX; x <= b.maxX; ++x) {
+                    uint32_t count;
+                    std::memcpy(&count, counts, sizeof(count));
+                    counts += sizeof(count);
+                    std::vector<DeepSample>& s = at(x, y).samples();
+                    s.resize(count);
+                    if (count > 0) {
+                        std::memcpy(s.data(), data, count * sizeof(DeepSample));
+                        data += count * sizeof(DeepSample);
+                    }
+                }
+            }
+        }
+        tile.resident = true;
+        tile.dirty = false;
+        tile.bytes = tile.samples * sizeof(DeepSample);
+    }
+};
+
+DeepImage::DeepImage() : width_(0), height_(0), originX_(0), originY_(0) {}
 
-DeepImage::DeepImage(int width, int height) : width_(0), height_(0) {
+DeepImage::DeepImage(int width, int height)
+    : width_(0), height_(0), originX_(0), originY_(0) {
     resize(width, height);
 }
 
+DeepImage::DeepImage(const PixelBox& dataWindow)
+    : width_(0), height_(0), originX_(dataWindow.minX), originY_(dataWindow.minY) {
+    resize(dataWindow.width(), dataWindow.height());
+}
+
+DeepImage::~DeepImage() = default;
+DeepImage::DeepImage(DeepImage&& other) noexcept = default;
+
+DeepImage& DeepImage::operator=(DeepImage&& other) noexcept {
+    if (this != &other) {
+        paged_.reset();  // Unregister from the pager before its pixels go away
+        width_ = other.width_;
+        height_ = other.height_;
+        originX_ = other.originX_;
+        originY_ = other.originY_;
+        displayWindow_ = other.displayWindow_;
+        channels_ = other.channels_;
+        pixels_ = std::move(other.pixels_);
+        extras_ = std::move(other.extras_);
+        backing_ = std::move(other.backing_);
+        paged_ = std::move(other.paged_);
+        statsCache_ = other.statsCache_;
+        other.statsCache_.invalidate();
+    }
+    return *this;
+}
+
+DeepImage::DeepImage(const DeepImage& other)
+    : width_(other.width_), height_(other.height_),
+      originX_(other.originX_), originY_(other.originY_),
+      displayWindow_(other.displayWindow_), channels_(other.channels_),
+      extras_(other.extras_), statsCache_(other.statsCache_) {
+    if (other.paged_) {
+        copyPaged(other);
+        return;
+    }
+    other.materializeAll();
+    pixels_ = other.pixels_;
+}
+
+DeepImage& DeepImage::operator=(const DeepImage& other) {
+    if (this != &other) {
+        paged_.reset();
+        backing_.reset();
+        statsCache_.invalidate();
+        width_ = other.width_;
+        height_ = other.height_;
+        originX_ = other.originX_;
+        originY_ = other.originY_;
+        displayWindow_ = other.displayWindow_;
+        channels_ = other.channels_;
+        extras_ = other.extras_;
+        if (other.paged_) {
+            copyPaged(other);
+        } else {
+            other.materializeAll();
+            pixels_ = other.pixels_;
+        }
+        statsCache_ = other.statsCache_;
+    }
+    return *this;
+}
+
+void DeepImage::copyPaged(const DeepImage& other) {
+    pixels_.clear();
+    pixels_.resize(static_cast<size_t>(width_) * static_cast<size_t>(height_));
+    enableOutOfCore(other.paged_->pager, other.paged_->tileSize);
+    
+    for (size_t t = 0; t < paged_->tiles.size(); ++t) {
+        other.pageInTile(t);
+        pageInTile(t);
+        paged_->tiles[t].dirty = true;
+        PixelBox b = paged_->box(t);
+        for (int y = b.minY; y <= b.maxY; ++y) {
+            for (int x = b.minX; x <= b.maxX; ++x) {
+                pixels_[index(x, y)] = other.pixels_[index(x, y)];
+            }
+        }
+    }
+}
+
+void DeepImage::enableOutOfCore(std::shared_ptr<TilePager> pager, int tileSize) {
+    if (!pager || tileSize <= 0) {
+        throw std::invalid_argument("Out-of-core paging needs a pager and a positive tile size");
+    }
+    if (paged_) {
+        return;
+    }
+    
+    size_t pixelCount = static_cast<size_t>(width_) * static_cast<size_t>(height_);
+    if (pixels_.size() != pixelCount) {
+        pixels_.resize(pixelCount);  // Cache-backed, no band materialised yet
+    }
+    paged_.reset(new PagedStorage(pager, tileSize, width_, height_, pixels_.data()));
+    PagedStorage& paged = *paged_;
+    
+    // Register a row of tiles at a time so a cache-backed image never has
+    // much more than the budget materialised
+    for (int ty = 0; ty < paged.tilesY; ++ty) {
+        if (backing_) {
+            int firstBand = ty * tileSize / CacheBacking::kBandRows;
+            int lastBand = (std::min(height_, (ty + 1) * tileSize) - 1) / CacheBacking::kBandRows;
+            for (int band = firstBand; band <= lastBand; ++band) {
+                materializeBand(band * CacheBacking::kBandRows);
+            }
+        }
+        
+        auto lock = pager->lock();
+        for (int tx = 0; tx < paged.tilesX; ++tx) {
+            size_t t = static_cast<size_t>(ty) * static_cast<size_t>(paged.tilesX) +
+                       static_cast<size_t>(tx);
+            paged.tiles[t].bytes = paged.measure(t);
+            pager->setResident(&paged, t, paged.tiles[t].bytes);
+        }
+        pager->enforceBudget();
+    }
+    backing_.reset();
+}
+
+std::vector<PixelBox> DeepImage::tileOrder(int tileSize) const {
+    if (paged_) {
+        tileSize = paged_->tileSize;
+    }
+    if (tileSize <= 0) {
+        throw std::invalid_argument("Tile size must be positive");
+    }
+    
+    std::vector<PixelBox> tiles;
+    for (int y = 0; y < height_; y += tileSize) {
+        for (int x = 0; x < width_; x += tileSize) {
+            tiles.emplace_back(x, y, std::min(width_, x + tileSize) - 1,
+                               std::min(height_, y + tileSize) - 1);
+        }
+    }
+    return tiles;
+}
+
+void DeepImage::pageIn(int x, int y) const {
+    size_t tx = static_cast<size_t>(x / paged_->tileSize);
+    size_t ty = static_cast<size_t>(y / paged_->tileSize);
+    pageInTile(ty * static_cast<size_t>(paged_->tilesX) + tx);
+}
+
+void DeepImage::pageInTile(size_t t) const {
+    PagedStorage& paged = *paged_;
+    if (paged.current.load(std::memory_order_relaxed) == t) {
+        return;
+    }
+    
+    auto lock = paged.pager->lock();
+    size_t previous = paged.current.load(std::memory_order_relaxed);
+    if (previous != PagedStorage::kNoTile) {
+        PagedStorage::Tile& tile = paged.tiles[previous];
+        if (tile.dirty) {
+            tile.bytes = paged.measure(previous);  // May have grown while current
+        }
+        paged.pager->setResident(&paged, previous, tile.bytes);
+    }
+    
+    PagedStorage::Tile& tile = paged.tiles[t];
+    if (!tile.resident) {
+        paged.pageIn(t);
+    }
+    paged.current.store(t, std::memory_order_relaxed);
+    paged.pager->setResident(&paged, t, tile.bytes);
+    paged.pager->enforceBudget();
+}
+
+template<typename F>
+void DeepImage::visitPagedPixels(F&& fn) const {
+    for (size_t t = 0; t < paged_->tiles.size(); ++t) {
+        pageInTile(t);
+        PixelBox b = paged_->box(t);
+        for (int y = b.minY; y <= b.maxY; ++y) {
+            for (int x = b.minX; x <= b.maxX; ++x) {
+                fn(pixels_[index(x, y)]);
+            }
+        }
+    }
+}
+
+void DeepImage::visitBoxes(const PixelBox& region, int tileWidth, int tileHeight, bool parallel,
+                           bool modify, const std::function<void(const PixelBox&)>& fn) const {
+    PixelBox area = region.intersect(PixelBox(0, 0, width_ - 1, height_ - 1));
+    if (area.isEmpty()) {
+        return;
+    }
+    if (modify) {
+        statsCache_.invalidate();
+        if (backing_) {
+            backing_->modified.store(true, std::memory_order_relaxed);
+        }
+    }
+    
+    if (paged_) {
+        // One thread and one resident tile at a time
+        for (size_t t = 0; t < paged_->tiles.size(); ++t) {
+            PixelBox box = paged_->box(t).intersect(area);
+            if (box.isEmpty()) {
+                continue;
+            }
+            pageInTile(t);
+            if (modify) {
+                paged_->tiles[t].dirty = true;
+            }
+            fn(box);
+        }
+        return;
+    }
+    
+    tileWidth = std::max(tileWidth, 1);
+    tileHeight = std::max(tileHeight, 1);
+    std::vector<PixelBox> boxes;
+    for (int y = area.minY; y <= area.maxY; y += tileHeight) {
+        for (int x = area.minX; x <= area.maxX; x += tileWidth) {
+            boxes.emplace_back(x, y, std::min(area.maxX, x + tileWidth - 1),
+                               std::min(area.maxY, y + tileHeight - 1));
+        }
+    }
+    
+    auto visit = [&](const PixelBox& box) {
+        if (backing_) {
+            for (int y = box.minY; y <= box.maxY; ++y) {
+                materializeBand(y);
+            }
+        }
+        fn(box);
+    };
+    if (!parallel || boxes.size() == 1) {
+        for (const PixelBox& box : boxes) {
+            visit(box);
+        }
+        return;
+    }
+    parallelFor(0, boxes.size(), 0, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            visit(boxes[i]);
+        }
+    });
+}
+
+void DeepImage::attachCache(std::shared_ptr<const DeepCache> cache, const PixelBox& region) {
+    PixelBox window = cache->dataWindow();
+    if (region.isEmpty() || region.intersect(window) != region) {
+        throw std::invalid_argument("Cache region must lie inside the cache's data window");
+    }
+    
+    paged_.reset();
+    statsCache_.invalidate();
+    width_ = region.width();
+    height_ = region.height();
+    originX_ = region.minX;
+    originY_ = region.minY;
+    displayWindow_ = cache->displayWindow();
+    channels_.extras.clear();  // Caches hold RGBA, Z and ZBack only
+    extras_.clear();
+    pixels_.clear();  // Allocated when the first band is materialised
+    
+    int bands = (height_ + CacheBacking::kBandRows - 1) / CacheBacking::kBandRows;
+    backing_.reset(new CacheBacking());
+    backing_->cache = std::move(cache);
+    backing_->offsetX = region.minX - window.minX;
+    backing_->offsetY = region.minY - window.minY;
+    backing_->bandReady.reset(new std::atomic<bool>[static_cast<size_t>(bands)]);
+    for (int i = 0; i < bands; ++i) {
+        backing_->bandReady[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+void DeepImage::materializeBand(int y) const {
+    CacheBacking& backing = *backing_;
+    int band = y / CacheBacking::kBandRows;
+    if (backing.bandReady[band].load(std::memory_order_acquire)) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(backing.mutex);
+    if (backing.bandReady[band].load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    // Filling in rows is logically const: the image already holds this data,
+    // it just hasn't been copied out of the mapping yet
+    auto& pixels = const_cast<std::vector<DeepPixel>&>(pixels_);
+    size_t pixelCount = static_cast<size_t>(width_) * static_cast<size_t>(height_);
+    if (pixels.size() != pixelCount) {
+        pixels.resize(pixelCount);  // First band: no other band is ready yet
+    }
+    
+    const DeepCache& cache = *backing.cache;
+    int y0 = band * CacheBacking::kBandRows;
+    int y1 = std::min(height_, y0 + CacheBacking::kBandRows);
+    for (int row = y0; row < y1; ++row) {
+        for (int x = 0; x < width_; ++x) {
+            int cx = x + backing.offsetX;
+            int cy = row + backing.offsetY;
+            const DeepSample* samples = cache.samples(cx, cy);
+            pixels[index(x, row)].samples().assign(samples, samples + cache.sampleCount(cx, cy));
+        }
+    }
+    
+    backing.bandReady[band].store(true, std::memory_order_release);
+}
+
+void DeepImage::materializeAll() const {
+    if (!backing_) {
+        return;
+    }
+    for (int y = 0; y < height_; y += CacheBacking::kBandRows) {
+        materializeBand(y);
+    }
+}
+
 void DeepImage::resize(int width, int height) {
     if (width < 0 || height < 0) {
         throw std::invalid_argument("Image dimensions must be non-negative");
     }
     
+    paged_.reset();
+    statsCache_.invalidate();
     width_ = width;
     height_ = height;
+    backing_.reset();
     pixels_.clear();
     pixels_.resize(static_cast<size_t>(width) * static_cast<size_t>(height));
+    extras_.clear();
+    if (hasExtraChannels()) {
+        extras_.resize(pixels_.size());
+    }
 }
 
-size_t DeepImage::index(int x, int y) const {
-    return static_cast<size_t>(y) * static_cast<size_t>(width_) + static_cast<size_t>(x);
+void DeepImage::setChannels(const ChannelSet& channels) {
+    if (channels.extras == channels_.extras) {
+        channels_ = channels;
+        return;
+    }
+    if (channels.extras.empty()) {
+        channels_ = channels;
+        extras_.clear();
+        extras_.shrink_to_fit();
+        return;
+    }
+    
+    // Where each new channel's column comes from (-1: zero-filled)
+    std::vector<int> source(channels.extras.size());
+    for (size_t c = 0; c < source.size(); ++c) {
+        source[c] = channels_.findExtra(channels.extras[c].name);
+    }
+    size_t pixelCount = static_cast<size_t>(width_) * static_cast<size_t>(height_);
+    std::vector<std::vector<float>> remapped(pixelCount);
+    if (!extras_.empty()) {
+        size_t oldCount = channels_.extras.size();
+        for (size_t i = 0; i < pixelCount; ++i) {
+            const std::vector<float>& columns = extras_[i];
+            size_t samples = columns.size() / oldCount;
+            if (samples == 0) {
+                continue;
+            }
+            std::vector<float>& out = remapped[i];
+            out.assign(source.size() * samples, 0.0f);
+            for (size_t c = 0; c < source.size(); ++c) {
+                if (source[c] >= 0) {
+                    std::copy_n(columns.begin() + source[c] * samples, samples, out.begin() + c * samples);
+                }
+            }
+        }
+    }
+    channels_ = channels;
+    extras_ = std::move(remapped);
 }
 
 bool DeepImage::isValidCoord(int x, int y) const {
@@ -140,6 +718,16 @@ DeepPixel& DeepImage::pixel(int x, int y) {
     if (!isValidCoord(x, y)) {
         throw std::out_of_range("Pixel coordinates out of range");
     }
+    if (statsCache_.claimed()) {
+        statsCache_.invalidate();
+    }
+    if (backing_) {
+        materializeBand(y);
+        backing_->modified.store(true, std::memory_order_relaxed);
+    } else if (paged_) {
+        pageIn(x, y);
+        paged_->tiles[paged_->currentTile()].dirty = true;
+    }
     return pixels_[index(x, y)];
 }
 
@@ -147,77 +735,206 @@ const DeepPixel& DeepImage::pixel(int x, int y) const {
     if (!isValidCoord(x, y)) {
         throw std::out_of_range("Pixel coordinates out of range");
     }
+    if (backing_) {
+        materializeBand(y);
+    } else if (paged_) {
+        pageIn(x, y);
+    }
     return pixels_[index(x, y)];
 }
 
+ImageStats DeepImage::statistics() const {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(statsCache_.mutex);
+        generation = statsCache_.generation.load();
+        if (statsCache_.statsGeneration == generation) {
+            return statsCache_.stats;
+        }
+        // Mutators now invalidate even if nothing was cached
+        statsCache_.claimedGeneration.store(generation);
+    }
+    
+    auto addPixel = [](ImageStats& stats, const DeepPixel& pixel) {
+        if (pixel.isEmpty()) {
+            return;
+        }
+        stats.totalSamples += pixel.sampleCount();
+        stats.nonEmptyPixels++;
+        stats.minDepth = std::min(stats.minDepth, pixel.minDepth());
+        stats.maxDepth = std::max(stats.maxDepth, pixel.maxDepth());
+        stats.depthOrdered = stats.depthOrdered && pixel.isValidSortOrder();
+    };
+    
+    // Computed outside the lock: a thread waiting on the parallel pass may
+    // run another task that asks for these statistics too
+    ImageStats stats;
+    if (paged_) {
+        // Paging is serial, one resident tile at a time
+        visitPagedPixels([&](const DeepPixel& pixel) { addPixel(stats, pixel); });
+    } else {
+        materializeAll();
+        std::mutex partialMutex;
+        parallelFor(0, pixels_.size(), 0, [&](size_t begin, size_t end) {
+            ImageStats partial;
+            for (size_t i = begin; i < end; ++i) {
+                addPixel(partial, pixels_[i]);
+            }
+            std::lock_guard<std::mutex> lock(partialMutex);
+            stats.totalSamples += partial.totalSamples;
+            stats.nonEmptyPixels += partial.nonEmptyPixels;
+            stats.minDepth = std::min(stats.minDepth, partial.minDepth);
+            stats.maxDepth = std::max(stats.maxDepth, partial.maxDepth);
+            stats.depthOrdered = stats.depthOrdered && partial.depthOrdered;
+        });
+    }
+    
+    // Dropped if a mutator invalidated the image during the pass
+    std::lock_guard<std::mutex> lock(statsCache_.mutex);
+    if (statsCache_.generation.load() == generation) {
+        statsCache_.stats = stats;
+        statsCache_.statsGeneration = generation;
+    }
+    return stats;
+}
+
 size_t DeepImage::totalSampleCount() const {
-    size_t total = 0;
-    for (const auto& pixel : pixels_) {
-        total += pixel.sampleCount();
+    ImageStats cached;
+    if (statsCache_.lookup(cached)) {
+        return cached.totalSamples;
+    }
+    if (backing_ && !backing_->modified.load(std::memory_order_relaxed)) {
+        // Untouched cache-backed image: count from the offset table
+        const DeepCache& cache = *backing_->cache;
+        if (width_ == cache.width() && height_ == cache.height()) {
+            return static_cast<size_t>(cache.totalSampleCount());
+        }
+    }
+    if (paged_) {
+        // Paged-out tiles remember their count; don't read them back
+        auto lock = paged_->pager->lock();
+        size_t total = 0;
+        for (size_t t = 0; t < paged_->tiles.size(); ++t) {
+            if (!paged_->tiles[t].resident) {
+                total += paged_->tiles[t].samples;
+                continue;
+            }
+            PixelBox b = paged_->box(t);
+            for (int y = b.minY; y <= b.maxY; ++y) {
+                for (int x = b.minX; x <= b.maxX; ++x) {
+                    total += pixels_[index(x, y)].sampleCount();
+                }
+            }
+        }
+        return total;
     }
-    return total;
+    return statistics().totalSamples;
 }
 
 float DeepImage::averageSamplesPerPixel() const {
-    if (pixels_.empty()) {
+    size_t pixelCount = static_cast<size_t>(width_) * static_cast<size_t>(height_);
+    if (pixelCount == 0) {
         return 0.0f;
     }
-    return static_cast<float>(totalSampleCount()) / static_cast<float>(pixels_.size());
+    return static_cast<float>(totalSampleCount()) / static_cast<float>(pixelCount);
 }
 
 void DeepImage::depthRange(float& minDepth, float& maxDepth) const {
-    minDepth = std::numeric_limits<float>::infinity();
-    maxDepth = -std::numeric_limits<float>::infinity();
-    
-    for (const auto& pixel : pixels_) {
-        if (!pixel.isEmpty()) {
-            minDepth = std::min(minDepth, pixel.minDepth());
-            maxDepth = std::max(maxDepth, pixel.maxDepth());
-        }
-    }
+    ImageStats stats = statistics();
+    minDepth = stats.minDepth;
+    maxDepth = stats.maxDepth;
 }
 
 size_t DeepImage::nonEmptyPixelCount() const {
-    size_t count = 0;
-    for (const auto& pixel : pixels_) {
-        if (!pixel.isEmpty()) {
-            count++;
-        }
-    }
-    return count;
+    return statistics().nonEmptyPixels;
 }
 
 void DeepImage::sortAllPixels() {
-    for (auto& pixel : pixels_) {
-        pixel.sortByDepth();
+    if (!hasExtraChannels()) {
+        forEachPixel([](int, int, DeepPixel& pixel) {
+            pixel.sortByDepth();
+        });
+        return;
     }
+    
+    // Sort an index and apply it to the samples and their columns alike
+    size_t channelCount = channels_.extras.size();
+    forEachPixel([&](int x, int y, DeepPixel& pixel) {
+        std::vector<DeepSample>& samples = pixel.samples();
+        std::vector<float>& columns = extras_[index(x, y)];
+        if (columns.empty()) {
+            pixel.sortByDepth();
+            return;
+        }
+        std::vector<uint32_t> order(samples.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return samples[a] < samples[b];
+        });
+        
+        std::vector<DeepSample> sorted(samples.size());
+        std::vector<float> sortedColumns(columns.size());
+        size_t n = samples.size();
+        for (size_t s = 0; s < n; ++s) {
+            sorted[s] = samples[order[s]];
+            for (size_t c = 0; c < channelCount; ++c) {
+                sortedColumns[c * n + s] = columns[c * n + order[s]];
+            }
+        }
+        samples.swap(sorted);
+        columns.swap(sortedColumns);
+    });
 }
 
 bool DeepImage::isValid() const {
-    for (const auto& pixel : pixels_) {
-        if (!pixel.isValidSortOrder()) {
-            return false;
-        }
-    }
-    return true;
+    return statistics().depthOrdered;
 }
 
 size_t DeepImage::estimatedMemoryUsage() const {
+    // Paged-out tiles hold no samples, but eviction may run concurrently
+    std::unique_lock<std::mutex> lock;
+    if (paged_) {
+        lock = paged_->pager->lock();
+    }
+    
     // Base structure size
     size_t usage = sizeof(DeepImage);
     
     // Vector overhead
     usage += pixels_.capacity() * sizeof(DeepPixel);
     
-    // Sample data
+    // Sample data (only rows materialised so far for cache-backed images)
     for (const auto& pixel : pixels_) {
         usage += pixel.samples().capacity() * sizeof(DeepSample);
     }
     
+    // Extra channel columns
+    usage += extras_.capacity() * sizeof(std::vector<float>);
+    for (const auto& columns : extras_) {
+        usage += columns.capacity() * sizeof(float);
+    }
+    
     return usage;
 }
 
 void DeepImage::clear() {
+    statsCache_.invalidate();
+    for (auto& columns : extras_) {
+        columns.clear();
+    }
+    if (paged_) {
+        std::shared_ptr<TilePager> pager = paged_->pager;
+        int tileSize = paged_->tileSize;
+        paged_.reset();
+        pixels_.assign(static_cast<size_t>(width_) * static_cast<size_t>(height_), DeepPixel());
+        enableOutOfCore(std::move(pager), tileSize);
+        return;
+    }
+    if (backing_) {
+        backing_.reset();
+        pixels_.assign(static_cast<size_t>(width_) * static_cast<size_t>(height_), DeepPixel());
+        return;
+    }
     for (auto& pixel : pixels_) {
         pixel.clear();
     }
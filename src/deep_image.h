@@ -2,12 +2,21 @@
 
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <functional>
 #include <stdexcept>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
 
 namespace deep_compositor {
 
+class DeepCache;
+class TilePager;
+
 /**
  * A single deep sample containing depth and premultiplied RGBA values
  */
@@ -129,15 +138,201 @@ private:
 };
 
 /**
- * A 2D deep image containing a grid of deep pixels
+ * An inclusive integer pixel rectangle, following the OpenEXR window
+ * convention: max is the last pixel inside the box, so a default box
+ * (max < min) is empty.
+ */
+struct PixelBox {
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+
+    PixelBox() : minX(0), minY(0), maxX(-1), maxY(-1) {}
+
+    PixelBox(int x0, int y0, int x1, int y1)
+        : minX(x0), minY(y0), maxX(x1), maxY(y1) {}
+
+    int width() const { return isEmpty() ? 0 : maxX - minX + 1; }
+    int height() const { return isEmpty() ? 0 : maxY - minY + 1; }
+    bool isEmpty() const { return maxX < minX || maxY < minY; }
+
+    bool contains(int x, int y) const {
+        return x >= minX && x <= maxX && y >= minY && y <= maxY;
+    }
+
+    /**
+     * Overlap of two boxes (empty if they don't intersect)
+     */
+    PixelBox intersect(const PixelBox& other) const {
+        return PixelBox(std::max(minX, other.minX), std::max(minY, other.minY),
+                        std::min(maxX, other.maxX), std::min(maxY, other.maxY));
+    }
+
+    /**
+     * Smallest box containing both (empty boxes are ignored)
+     */
+    PixelBox unite(const PixelBox& other) const {
+        if (isEmpty()) return other;
+        if (other.isEmpty()) return *this;
+        return PixelBox(std::min(minX, other.minX), std::min(minY, other.minY),
+                        std::max(maxX, other.maxX), std::max(maxY, other.maxY));
+    }
+
+    bool operator==(const PixelBox& other) const {
+        return minX == other.minX && minY == other.minY
+            && maxX == other.maxX && maxY == other.maxY;
+    }
+    bool operator!=(const PixelBox& other) const { return !(*this == other); }
+};
+
+/**
+ * Whole-image statistics, gathered in one pass (see DeepImage::statistics)
+ */
+struct ImageStats {
+    size_t totalSamples = 0;
+    size_t nonEmptyPixels = 0;
+    float minDepth = std::numeric_limits<float>::infinity();   // Over non-empty pixels
+    float maxDepth = -std::numeric_limits<float>::infinity();
+    bool depthOrdered = true;  // Every pixel's samples are sorted front to back
+};
+
+/**
+ * A deep channel beyond R, G, B, A, Z and ZBack (an AOV)
+ *
+ * Values are premultiplied like colour: splitting a volume scales them by
+ * each piece's share of the alpha, blending sums them and flattening
+ * composites them over. ID channels are labels rather than quantities, so
+ * they are copied into split pieces, and blends and flattening keep the ID
+ * of the sample contributing the most. UINT channels (object IDs, usually)
+ * keep their 32-bit patterns in the float slots.
+ */
+struct ExtraChannel {
+    std::string name;
+    bool isId = false;    // Copied and picked, never scaled or summed
+    bool isUint = false;  // Stored in the file as UINT
+
+    /**
+     * A channel as a file declares it: UINT channels and channels named
+     * like IDs ("id", "objectId", "crypto.ID", "mat_id") are IDs
+     */
+    static ExtraChannel fromFile(const std::string& name, bool isUint);
+
+    bool operator==(const ExtraChannel& other) const {
+        return name == other.name && isId == other.isId && isUint == other.isUint;
+    }
+    bool operator!=(const ExtraChannel& other) const { return !(*this == other); }
+};
+
+/**
+ * The channels an image's samples carry beyond R, G, B, A and Z, as in a
+ * deep EXR's channel list. Merging and writing pick the code specialised
+ * for them (see deep_channels.h).
+ */
+struct ChannelSet {
+    bool zBack = true;  // Without ZBack every sample is a point (depth_back is ignored)
+    std::vector<ExtraChannel> extras;  // AOVs, in file order
+
+    /**
+     * Channels of a merge of both: extras of `other` missing here are
+     * appended in its order
+     */
+    ChannelSet unite(const ChannelSet& other) const;
+
+    /**
+     * Index of the extra channel called `name`, or -1
+     */
+    int findExtra(const std::string& name) const;
+
+    /**
+     * EXR channel names, in the order files list them
+     */
+    std::vector<std::string> names() const;
+
+    bool operator==(const ChannelSet& other) const {
+        return zBack == other.zBack && extras == other.extras;
+    }
+    bool operator!=(const ChannelSet& other) const { return !(*this == other); }
+};
+
+/**
+ * How DeepImage::forEach* visit rows and tiles: in parallel on the shared
+ * task pool, or one after another on the calling thread
+ */
+enum class IterPolicy {
+    Serial,
+    Parallel
+};
+
+/**
+ * A 2D deep image containing a grid of deep pixels.
+ *
+ * The grid covers a data window in absolute pixel coordinates (origin 0,0 by
+ * default). pixel(x, y) is addressed relative to the data window's min corner.
  */
 class DeepImage {
 public:
     DeepImage();
     DeepImage(int width, int height);
+    explicit DeepImage(const PixelBox& dataWindow);
+    ~DeepImage();
     
     /**
-     * Resize the image (clears all existing data)
+     * Copies are fully materialised (out-of-core images copy into a new
+     * out-of-core image on the same pager); moves keep any cache backing
+     * or paging
+     */
+    DeepImage(const DeepImage& other);
+    DeepImage(DeepImage&& other) noexcept;
+    DeepImage& operator=(const DeepImage& other);
+    DeepImage& operator=(DeepImage&& other) noexcept;
+    
+    /**
+     * Back this image with a mapped deep cache (see deep_cache.h).
+     *
+     * The image takes the window of `region` (absolute coordinates, must lie
+     * inside the cache's data window) and the cache's display window. Nothing
+     * is copied up front: pixel rows are copied out of the mapping in bands
+     * the first time they are accessed. Safe for concurrent readers.
+     */
+    void attachCache(std::shared_ptr<const DeepCache> cache, const PixelBox& region);
+    
+    /**
+     * True while pixel data may still be served from a mapped cache
+     */
+    bool isCacheBacked() const { return backing_ != nullptr; }
+    
+    /**
+     * Keep this image's sample data under `pager`'s memory budget.
+     *
+     * The image is split into tileSize x tileSize tiles; tiles not touched
+     * recently are written to the pager's scratch file and read back on
+     * access, transparently to pixel(). The tile touched last always stays
+     * resident, so a reference returned by pixel() is valid until the image
+     * is accessed in another tile. Access in tile order (see tileOrder())
+     * to avoid thrashing; a budget holding one row of tiles keeps row-major
+     * access cheap as well.
+     *
+     * A paged image must only be used by one thread at a time (different
+     * images sharing a pager may be used concurrently). Cache-backed images
+     * are copied into pages band by band. No-op if already paged.
+     */
+    void enableOutOfCore(std::shared_ptr<TilePager> pager, int tileSize = 64);
+    
+    /**
+     * True if sample data is paged through a TilePager
+     */
+    bool isOutOfCore() const { return paged_ != nullptr; }
+    
+    /**
+     * Tiles covering the image in the order that pages them efficiently
+     * (image-relative coordinates). Uses the paging tile size for paged
+     * images and tileSize otherwise.
+     */
+    std::vector<PixelBox> tileOrder(int tileSize = 64) const;
+    
+    /**
+     * Resize the image (clears all existing data and disables paging)
      */
     void resize(int width, int height);
     
@@ -147,6 +342,55 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
     
+    /**
+     * Data window in absolute pixel coordinates
+     */
+    PixelBox dataWindow() const {
+        return PixelBox(originX_, originY_, originX_ + width_ - 1, originY_ + height_ - 1);
+    }
+    
+    /**
+     * Move the data window without touching pixel data
+     */
+    void setOrigin(int x, int y) { originX_ = x; originY_ = y; }
+    int originX() const { return originX_; }
+    int originY() const { return originY_; }
+    
+    /**
+     * Display window (the full frame the data window sits in).
+     * Defaults to the data window until set explicitly.
+     */
+    PixelBox displayWindow() const {
+        return displayWindow_.isEmpty() ? dataWindow() : displayWindow_;
+    }
+    void setDisplayWindow(const PixelBox& window) { displayWindow_ = window; }
+
+    /**
+     * Channels the samples carry (RGBA, Z and ZBack until set explicitly).
+     * Changing the extra channels keeps the values of those still present,
+     * matched by name, and zero-fills the new ones.
+     */
+    const ChannelSet& channels() const { return channels_; }
+    void setChannels(const ChannelSet& channels);
+    
+    /**
+     * Extra channel values are stored apart from the samples, one buffer
+     * per pixel holding a column per extra channel: value s of channel c
+     * is at [c * sampleCount + s], in the pixel's sample order. An empty
+     * buffer means every extra channel is zero. Images without extra
+     * channels allocate nothing for them. The buffers are kept in memory
+     * for out-of-core images too, and are not written to deep caches.
+     */
+    bool hasExtraChannels() const { return !channels_.extras.empty(); }
+    
+    /**
+     * Extra channel columns of pixel (x, y), empty or channels x samples
+     * long; only valid while hasExtraChannels(). Whoever changes a pixel's
+     * samples keeps its columns in step (or clears them).
+     */
+    std::vector<float>& extraColumns(int x, int y) { return extras_[index(x, y)]; }
+    const std::vector<float>& extraColumns(int x, int y) const { return extras_[index(x, y)]; }
+
     /**
      * Access a pixel at (x, y)
      */
@@ -159,6 +403,68 @@ public:
     DeepPixel& operator()(int x, int y) { return pixel(x, y); }
     const DeepPixel& operator()(int x, int y) const { return pixel(x, y); }
     
+    /**
+     * Pixel at (x, y) without bounds checks, paging or cache copies. Only
+     * for pixels known to be resident: inside forEach* callbacks, or in
+     * images that are neither cache-backed nor out-of-core. The non-const
+     * overload invalidates statistics() like pixel() does.
+     */
+    DeepPixel& pixelUnchecked(int x, int y) {
+        // Checked first so parallel writers don't all store to one line
+        if (statsCache_.claimed()) {
+            statsCache_.invalidate();
+        }
+        return pixels_[index(x, y)];
+    }
+    const DeepPixel& pixelUnchecked(int x, int y) const { return pixels_[index(x, y)]; }
+    
+    /**
+     * Pixel iteration in image-relative coordinates. Each row or tile is
+     * made resident before its callback runs, so the callback may use
+     * pixelUnchecked() inside it. With IterPolicy::Parallel rows and tiles
+     * run concurrently on the shared task pool, so callbacks must only
+     * write the pixels they were handed; out-of-core images always run
+     * serially, tile by tile.
+     */
+    
+    /**
+     * Call fn(x, y, pixel) for every pixel
+     */
+    template<typename F>
+    void forEachPixel(F&& fn, IterPolicy policy = IterPolicy::Parallel);
+    template<typename F>
+    void forEachPixel(F&& fn, IterPolicy policy = IterPolicy::Parallel) const;
+    
+    /**
+     * Call fn(y, row) with `row` pointing at the width() pixels of row y.
+     * Throws std::logic_error for out-of-core images, whose rows aren't
+     * contiguous.
+     */
+    template<typename F>
+    void forEachRow(F&& fn, IterPolicy policy = IterPolicy::Parallel);
+    template<typename F>
+    void forEachRow(F&& fn, IterPolicy policy = IterPolicy::Parallel) const;
+    
+    /**
+     * Call fn(tile) for every tileSize x tileSize tile of `region` (clipped
+     * to it and to the image). Out-of-core images use their paging tiles.
+     */
+    template<typename F>
+    void forEachTile(const PixelBox& region, int tileSize, F&& fn,
+                     IterPolicy policy = IterPolicy::Parallel);
+    template<typename F>
+    void forEachTile(const PixelBox& region, int tileSize, F&& fn,
+                     IterPolicy policy = IterPolicy::Parallel) const;
+    
+    /**
+     * Sample count, non-empty pixels, depth range and sort order, in one
+     * pass over the pixels. The result is kept until the image is next
+     * handed out mutably (non-const pixel(), sortAllPixels(), clear(), ...),
+     * so repeated queries, including the accessors below, are O(1). Don't
+     * modify a pixel through a reference obtained before the query.
+     */
+    ImageStats statistics() const;
+    
     /**
      * Get total number of samples across all pixels
      */
@@ -200,14 +506,111 @@ public:
     void clear();
 
 private:
+    struct CacheBacking;
+    struct PagedStorage;
+    
+    /**
+     * statistics() result, carried along by copies and moves
+     *
+     * Mutators bump `generation`; stats hold only while statsGeneration
+     * matches it. statistics() stores a result only if the generation it
+     * started from is still current, so an invalidation during the pass
+     * isn't lost.
+     */
+    struct StatsCache {
+        mutable std::mutex mutex;
+        std::atomic<uint64_t> generation{1};
+        std::atomic<uint64_t> claimedGeneration{0};  // Last computed or being computed
+        uint64_t statsGeneration = 0;                // Under mutex, like stats
+        ImageStats stats;
+        
+        StatsCache() = default;
+        StatsCache(const StatsCache& other) noexcept { *this = other; }
+        StatsCache& operator=(const StatsCache& other) noexcept {
+            if (this != &other) {
+                ImageStats copied;
+                bool current = other.lookup(copied);
+                std::lock_guard<std::mutex> lock(mutex);
+                uint64_t next = generation.fetch_add(1) + 1;
+                stats = copied;
+                statsGeneration = current ? next : 0;
+                claimedGeneration.store(statsGeneration);
+            }
+            return *this;
+        }
+        
+        void invalidate() { generation.fetch_add(1); }
+        
+        // True if statistics() holds or is computing stats for the current
+        // generation, so a mutation must invalidate
+        bool claimed() const { return claimedGeneration.load() == generation.load(); }
+        
+        // The stats if they are current
+        bool lookup(ImageStats& out) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (statsGeneration != generation.load()) {
+                return false;
+            }
+            out = stats;
+            return true;
+        }
+    };
+    
     int width_;
     int height_;
+    int originX_;
+    int originY_;
+    PixelBox displayWindow_;         // Empty = same as data window
+    ChannelSet channels_;
     std::vector<DeepPixel> pixels_;  // Stored row-major: index = y * width + x
+    std::vector<std::vector<float>> extras_;  // Extra channel columns, as pixels_ (empty without extras)
+    std::unique_ptr<CacheBacking> backing_;  // Non-null for cache-backed images
+    std::unique_ptr<PagedStorage> paged_;    // Non-null for out-of-core images
+    mutable StatsCache statsCache_;
+    
+    /**
+     * Copy the band holding row y out of the cache if it isn't there yet
+     */
+    void materializeBand(int y) const;
+    
+    /**
+     * Materialise every row (no-op for images that aren't cache backed)
+     */
+    void materializeAll() const;
+    
+    /**
+     * Make the paged tile holding (x, y) resident and current
+     */
+    void pageIn(int x, int y) const;
+    void pageInTile(size_t tile) const;
+    
+    /**
+     * Copy other's pixels tile by tile into a new paged image on its pager
+     */
+    void copyPaged(const DeepImage& other);
+    
+    /**
+     * Call fn(const DeepPixel&) for every pixel of an out-of-core image,
+     * paging tiles in as needed
+     */
+    template<typename F>
+    void visitPagedPixels(F&& fn) const;
+    
+    /**
+     * Call fn(box) for `region` cut into tileWidth x tileHeight boxes
+     * (paging tiles for out-of-core images), with each box's pixels
+     * resident. `modify` invalidates statistics and marks the pixels
+     * written. Backs the forEach* calls.
+     */
+    void visitBoxes(const PixelBox& region, int tileWidth, int tileHeight, bool parallel,
+                    bool modify, const std::function<void(const PixelBox&)>& fn) const;
     
     /**
      * Convert (x, y) to linear index
      */
-    size_t index(int x, int y) const;
+    size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * static_cast<size_t>(width_) + static_cast<size_t>(x);
+    }
     
     /**
      * Check if coordinates are valid
@@ -215,4 +618,69 @@ private:
     bool isValidCoord(int x, int y) const;
 };
 
+// ============================================================================
+// Pixel iteration
+// ============================================================================
+
+template<typename F>
+void DeepImage::forEachPixel(F&& fn, IterPolicy policy) {
+    visitBoxes(PixelBox(0, 0, width_ - 1, height_ - 1), width_, 1,
+               policy == IterPolicy::Parallel, true, [&](const PixelBox& box) {
+        for (int y = box.minY; y <= box.maxY; ++y) {
+            DeepPixel* row = &pixels_[index(0, y)];
+            for (int x = box.minX; x <= box.maxX; ++x) {
+                fn(x, y, row[x]);
+            }
+        }
+    });
+}
+
+template<typename F>
+void DeepImage::forEachPixel(F&& fn, IterPolicy policy) const {
+    visitBoxes(PixelBox(0, 0, width_ - 1, height_ - 1), width_, 1,
+               policy == IterPolicy::Parallel, false, [&](const PixelBox& box) {
+        for (int y = box.minY; y <= box.maxY; ++y) {
+            const DeepPixel* row = &pixels_[index(0, y)];
+            for (int x = box.minX; x <= box.maxX; ++x) {
+                fn(x, y, row[x]);
+            }
+        }
+    });
+}
+
+template<typename F>
+void DeepImage::forEachRow(F&& fn, IterPolicy policy) {
+    if (isOutOfCore()) {
+        throw std::logic_error("forEachRow: rows of an out-of-core image aren't contiguous");
+    }
+    visitBoxes(PixelBox(0, 0, width_ - 1, height_ - 1), width_, 1,
+               policy == IterPolicy::Parallel, true, [&](const PixelBox& box) {
+        fn(box.minY, &pixels_[index(0, box.minY)]);
+    });
+}
+
+template<typename F>
+void DeepImage::forEachRow(F&& fn, IterPolicy policy) const {
+    if (isOutOfCore()) {
+        throw std::logic_error("forEachRow: rows of an out-of-core image aren't contiguous");
+    }
+    visitBoxes(PixelBox(0, 0, width_ - 1, height_ - 1), width_, 1,
+               policy == IterPolicy::Parallel, false, [&](const PixelBox& box) {
+        const DeepPixel* row = &pixels_[index(0, box.minY)];
+        fn(box.minY, row);
+    });
+}
+
+template<typename F>
+void DeepImage::forEachTile(const PixelBox& region, int tileSize, F&& fn, IterPolicy policy) {
+    visitBoxes(region, tileSize, tileSize, policy == IterPolicy::Parallel, true,
+               [&](const PixelBox& tile) { fn(tile); });
+}
+
+template<typename F>
+void DeepImage::forEachTile(const PixelBox& region, int tileSize, F&& fn, IterPolicy policy) const {
+    visitBoxes(region, tileSize, tileSize, policy == IterPolicy::Parallel, false,
+               [&](const PixelBox& tile) { fn(tile); });
+}
+
 } // namespace deep_compositor
@@ -0,0 +1,241 @@
+#include "deep_input_cache.h"
+#include "deep_stream.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <sys/stat.h>
+
+namespace deep_compositor {
+
+namespace {
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Bytes a cached image holds, or will hold once read: a cache-backed
+ * image copies its rows out of the mapping on first access, so it is
+ * charged as if fully materialised
+ */
+size_t chargedBytes(const DeepImage& image) {
+    size_t bytes = image.estimatedMemoryUsage();
+    if (image.isCacheBacked()) {
+        size_t pixels = static_cast<size_t>(image.width()) * static_cast<size_t>(image.height());
+        size_t materialised = sizeof(DeepImage) + pixels * sizeof(DeepPixel) +
+                              image.totalSampleCount() * sizeof(DeepSample);
+        bytes = std::max(bytes, materialised);
+    }
+    return bytes;
+}
+
+} // anonymous namespace
+
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+    const uint64_t k1 = 0x9E3779B185EBCA87ull;
+    const uint64_t k2 = 0xC2B2AE3D27D4EB4Full;
+
+    // Eight bytes per step
+    uint64_t h = (size + seed) * k1;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        h = rotl(h ^ (word * k2), 31) * k1;
+    }
+    uint64_t tail = 0;
+    if (i < size) {
+        std::memcpy(&tail, data + i, size - i);
+    }
+    h = rotl(h ^ (tail * k2), 31) * k1;
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= k2;
+    h ^= h >> 29;
+    return h;
+}
+
+bool hashFileContents(const std::string& filename, uint64_t& hash) {
+    try {
+        // The mapping is read sequentially
+        MappedIStream map(filename);
+        hash = hashBytes(map.data(), static_cast<size_t>(map.size()));
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+bool makeInputKey(const std::string& filename, const PixelBox& region, InputKey& key) {
+    key = InputKey();
+    key.region = region;
+
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) {
+        return false;
+    }
+    key.identityValid = true;
+    key.device = static_cast<uint64_t>(st.st_dev);
+    key.inode = static_cast<uint64_t>(st.st_ino);
+    key.size = static_cast<uint64_t>(st.st_size);
+    key.mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// ============================================================================
+// DeepInputCache
+// ============================================================================
+
+DeepInputCache::DeepInputCache(bool hashContent)
+    : hashContent_(hashContent), frame_(0), hits_(0), misses_(0) {}
+
+DeepInputCache::IdentityKey DeepInputCache::identityKey(const InputKey& key) {
+    return IdentityKey(key.device, key.inode, key.size, key.mtimeNs,
+                       key.region.minX, key.region.minY, key.region.maxX, key.region.maxY);
+}
+
+DeepInputCache::ContentKey DeepInputCache::contentKey(const InputKey& key) {
+    return ContentKey(key.contentHash, key.size,
+                      key.region.minX, key.region.minY, key.region.maxX, key.region.maxY);
+}
+
+void DeepInputCache::touch(Entry& entry) {
+    entry.lastUsed = frame_;
+    hits_++;
+}
+
+std::shared_ptr<const DeepImage> DeepInputCache::find(const std::string& filename,
+                                                      const PixelBox& region, InputKey& key) {
+    if (!makeInputKey(filename, region, key)) {
+        misses_++;
+        return nullptr;  // Let the loader report the error
+    }
+
+    auto it = entries_.find(identityKey(key));
+    if (it != entries_.end()) {
+        touch(*it->second);
+        return it->second->image;
+    }
+
+    if (hashContent_ && hashFileContents(filename, key.contentHash)) {
+        key.contentValid = true;
+        auto byHash = byContent_.find(contentKey(key));
+        if (byHash != byContent_.end()) {
+            // Same bytes under another name: remember this identity too
+            std::shared_ptr<Entry> entry = byHash->second;
+            entries_[identityKey(key)] = entry;
+            touch(*entry);
+            logVerbose("  Reusing " + filename + " (same content as an earlier input)");
+            return entry->image;
+        }
+    }
+
+    misses_++;
+    return nullptr;
+}
+
+void DeepInputCache::insert(const InputKey& key, std::shared_ptr<const DeepImage> image) {
+    if (!key.identityValid) {
+        return;
+    }
+
+    auto entry = std::make_shared<Entry>();
+    entry->image = std::move(image);
+    entry->lastUsed = frame_;
+
+    entries_[identityKey(key)] = entry;
+    if (key.contentValid) {
+        byContent_[contentKey(key)] = entry;
+    }
+}
+
+void DeepInputCache::endFrame() {
+    // Keep what this frame used; anything older is no longer in the sequence
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        it = it->second->lastUsed < frame_ ? entries_.erase(it) : std::next(it);
+    }
+    for (auto it = byContent_.begin(); it != byContent_.end();) {
+        it = it->second->lastUsed < frame_ ? byContent_.erase(it) : std::next(it);
+    }
+    frame_++;
+}
+
+// ============================================================================
+// DeepImageLRU
+// ============================================================================
+
+DeepImageLRU::DeepImageLRU(size_t budgetBytes)
+    : budget_(budgetBytes), usage_(0), hits_(0), misses_(0) {}
+
+std::shared_ptr<const DeepImage> DeepImageLRU::find(const std::string& filename,
+                                                    const PixelBox& region, InputKey& key) {
+    bool valid = makeInputKey(filename, region, key);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (valid) {
+        auto it = index_.find(DeepInputCache::identityKey(key));
+        if (it != index_.end()) {
+            order_.splice(order_.begin(), order_, it->second);
+            hits_++;
+            return it->second->image;
+        }
+    }
+    misses_++;
+    return nullptr;
+}
+
+void DeepImageLRU::insert(const InputKey& key, std::shared_ptr<const DeepImage> image) {
+    if (!key.identityValid) {
+        return;
+    }
+    size_t bytes = chargedBytes(*image);
+    if (bytes > budget_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    DeepInputCache::IdentityKey id = DeepInputCache::identityKey(key);
+    auto existing = index_.find(id);
+    if (existing != index_.end()) {
+        usage_ -= existing->second->bytes;
+        order_.erase(existing->second);
+        index_.erase(existing);
+    }
+
+    order_.push_front(Entry{id, std::move(image), bytes});
+    index_[id] = order_.begin();
+    usage_ += bytes;
+
+    while (usage_ > budget_ && !order_.empty()) {
+        const Entry& victim = order_.back();
+        usage_ -= victim.bytes;
+        index_.erase(victim.key);
+        order_.pop_back();
+    }
+}
+
+size_t DeepImageLRU::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t DeepImageLRU::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+size_t DeepImageLRU::entryCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return order_.size();
+}
+
+size_t DeepImageLRU::memoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return usage_;
+}
+
+} // namespace deep_compositor
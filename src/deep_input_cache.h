@@ -0,0 +1,170 @@
+#pragma once
+
+#include "deep_image.h"
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+namespace deep_compositor {
+
+/**
+ * Identity of an input file as seen by DeepInputCache
+ */
+struct InputKey {
+    bool identityValid = false;    // stat() succeeded
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+    bool contentValid = false;     // contentHash was computed
+    uint64_t contentHash = 0;
+    PixelBox region;               // Requested region (empty = whole file)
+};
+
+/**
+ * Fill the identity part of an input key from stat()
+ *
+ * @return false if the file can't be stat'ed (the key is then unusable)
+ */
+bool makeInputKey(const std::string& filename, const PixelBox& region, InputKey& key);
+
+/**
+ * Decoded inputs shared across frames of a sequence
+ *
+ * Held frames and static set pieces are often the very same file on every
+ * frame (or a byte-identical copy). The cache hands back the already
+ * decoded, depth-sorted DeepImage for such inputs instead of reading and
+ * decoding them again. Inputs are matched by file identity (device, inode,
+ * size, modification time) and, optionally, by a hash of the file's bytes,
+ * which also catches copies under different names.
+ *
+ * Entries not used during a frame are dropped when that frame ends (see
+ * endFrame()), so memory stays bounded by roughly one frame's inputs.
+ * Not thread-safe: the sequence loader stage is its only user.
+ */
+class DeepInputCache {
+public:
+    /**
+     * @param hashContent Also match inputs by content hash (reads every
+     *        file whose identity is new)
+     */
+    explicit DeepInputCache(bool hashContent = false);
+
+    /**
+     * Look up an input
+     *
+     * @param filename Input path
+     * @param region Region the caller will load (empty = whole file)
+     * @param key Output: key to pass to insert() on a miss
+     * @return The cached image, or nullptr on a miss
+     */
+    std::shared_ptr<const DeepImage> find(const std::string& filename, const PixelBox& region,
+                                          InputKey& key);
+
+    /**
+     * Remember a freshly loaded input under the key from find()
+     */
+    void insert(const InputKey& key, std::shared_ptr<const DeepImage> image);
+
+    /**
+     * Finish a frame: drop entries that were neither used nor inserted
+     * since the previous endFrame()
+     */
+    void endFrame();
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+    size_t identityCount() const { return entries_.size(); }
+
+    using IdentityKey = std::tuple<uint64_t, uint64_t, uint64_t, int64_t, int, int, int, int>;
+    static IdentityKey identityKey(const InputKey& key);
+
+private:
+    struct Entry {
+        std::shared_ptr<const DeepImage> image;
+        uint64_t lastUsed = 0;  // Frame counter at last use
+    };
+
+    using ContentKey = std::tuple<uint64_t, uint64_t, int, int, int, int>;
+
+    static ContentKey contentKey(const InputKey& key);
+    void touch(Entry& entry);
+
+    bool hashContent_;
+    uint64_t frame_;
+    size_t hits_;
+    size_t misses_;
+    std::map<IdentityKey, std::shared_ptr<Entry>> entries_;
+    std::map<ContentKey, std::shared_ptr<Entry>> byContent_;
+};
+
+/**
+ * Decoded inputs kept by a long-running process, evicted least recently
+ * used first once their estimated size exceeds a memory budget. Images
+ * backed by a deep cache are charged their fully materialised size, since
+ * their rows are copied out of the mapping as they are read.
+ *
+ * Inputs are matched by file identity like DeepInputCache, so an input
+ * that was rewritten on disk misses and is decoded again. Thread-safe.
+ */
+class DeepImageLRU {
+public:
+    /**
+     * @param budgetBytes Upper bound on the estimated size of the cached
+     *        images. A single image larger than the
+     *        budget is returned to the caller but not kept.
+     */
+    explicit DeepImageLRU(size_t budgetBytes);
+
+    /**
+     * @see DeepInputCache::find
+     */
+    std::shared_ptr<const DeepImage> find(const std::string& filename, const PixelBox& region,
+                                          InputKey& key);
+
+    void insert(const InputKey& key, std::shared_ptr<const DeepImage> image);
+
+    size_t hits() const;
+    size_t misses() const;
+    size_t entryCount() const;
+    size_t memoryUsage() const;
+    size_t budget() const { return budget_; }
+
+private:
+    struct Entry {
+        DeepInputCache::IdentityKey key;
+        std::shared_ptr<const DeepImage> image;
+        size_t bytes;
+    };
+
+    size_t budget_;
+    size_t usage_;
+    size_t hits_;
+    size_t misses_;
+    std::list<Entry> order_;  // Most recently used first
+    std::map<DeepInputCache::IdentityKey, std::list<Entry>::iterator> index_;
+    mutable std::mutex mutex_;
+};
+
+/**
+ * Hash a byte range (64-bit, not cryptographic)
+ *
+ * @param seed Different seeds give independent hashes of the same bytes
+ */
+uint64_t hashBytes(const char* data, size_t size, uint64_t seed = 0);
+
+/**
+ * Hash the contents of a file (64-bit, not cryptographic)
+ *
+ * @param filename File to hash
+ * @param hash Output hash
+ * @return false if the file can't be read
+ */
+bool hashFileContents(const std::string& filename, uint64_t& hash);
+
+} // namespace deep_compositor
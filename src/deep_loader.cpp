@@ -0,0 +1,101 @@
+#include "deep_loader.h"
+#include "deep_cache.h"
+#include "deep_reader.h"
+#include "deep_stream.h"
+#include "deep_trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+namespace deep_compositor {
+
+namespace {
+
+void loadOne(const std::string& filename, const LoaderOptions& options, LoadResult& result) {
+    Timer timer;
+    double cpuStart = threadCpuMs();
+    TraceZone zone("load");
+    zone.detail(filename);
+    result.filename = filename;
+    
+    try {
+        if (filename == "-") {
+            // Buffer all of stdin, then decode from memory
+            std::vector<char> data((std::istreambuf_iterator<char>(std::cin)),
+                                   std::istreambuf_iterator<char>());
+            result.io.bytes = data.size();
+            MemoryIStream stream(std::move(data), "<stdin>");
+            result.image = options.roi.isEmpty() ? loadDeepEXR(stream)
+                                                 : loadDeepEXR(stream, options.roi);
+        } else if (isDeepCache(filename)) {
+            result.image = options.roi.isEmpty() ? loadDeepCache(filename)
+                                                 : loadDeepCache(filename, options.roi);
+            // Mapped, not read: count the samples the image covers
+            result.io.bytes = result.image.totalSampleCount() * sizeof(DeepSample);
+        } else {
+            result.image = options.roi.isEmpty() ? loadDeepEXR(filename, &result.io.bytes)
+                                                 : loadDeepEXR(filename, options.roi, &result.io.bytes);
+        }
+        result.success = true;
+        result.io.samples = result.image.totalSampleCount();
+        zone.arg("samples", static_cast<int64_t>(result.io.samples));
+        zone.arg("bytes", static_cast<int64_t>(result.io.bytes));
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    
+    result.loadTimeMs = timer.elapsedMs();
+    result.io.wallMs = result.loadTimeMs;
+    result.io.cpuMs = threadCpuMs() - cpuStart;
+}
+
+} // anonymous namespace
+
+size_t loadConcurrency(size_t fileCount, const LoaderOptions& options) {
+    return std::min(fileCount, static_cast<size_t>(std::max(1, options.maxConcurrent)));
+}
+
+std::vector<LoadResult> loadDeepEXRFiles(const std::vector<std::string>& filenames,
+                                         const LoaderOptions& options) {
+    std::vector<LoadResult> results(filenames.size());
+    
+    size_t workerCount = loadConcurrency(filenames.size(), options);
+    
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < filenames.size(); ++i) {
+            loadOne(filenames[i], options, results[i]);
+        }
+        return results;
+    }
+    
+    // Dedicated threads, not pool tasks: they mostly block on storage, so
+    // their number is set by maxConcurrent rather than the CPU count, and
+    // a decoder waiting on its own pool tasks never picks up another file.
+    // Workers pull the next file index until the list is exhausted, so a
+    // slow file only holds up its own worker.
+    std::atomic<size_t> next{0};
+    std::atomic<int> workerIds{0};
+    auto worker = [&]() {
+        setTraceThreadName("load " + std::to_string(++workerIds));
+        for (size_t i = next++; i < filenames.size(); i = next++) {
+            loadOne(filenames[i], options, results[i]);
+        }
+    };
+    
+    std::vector<std::thread> threads;
+    threads.reserve(workerCount);
+    for (size_t t = 0; t < workerCount; ++t) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    return results;
+}
+
+} // namespace deep_compositor
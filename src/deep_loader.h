@@ -0,0 +1,56 @@
+#pragma once
+
+#include "deep_image.h"
+#include "utils.h"
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * Options for loading several deep EXR files at once
+ */
+struct LoaderOptions {
+    int maxConcurrent = 4;  // Upper bound on files open/decoding at the same time
+    PixelBox roi;           // Only load this region (empty = full data window)
+};
+
+/**
+ * Outcome of loading one file
+ */
+struct LoadResult {
+    std::string filename;
+    DeepImage image;
+    bool success = false;
+    std::string error;        // Set when success is false
+    double loadTimeMs = 0.0;  // Open + probe + decode wall time for this file
+    IOStats io;               // Bytes read, samples decoded, wall and CPU time
+};
+
+/**
+ * Files loadDeepEXRFiles loads at once for `fileCount` inputs
+ */
+size_t loadConcurrency(size_t fileCount, const LoaderOptions& options);
+
+/**
+ * Load deep EXR files concurrently
+ *
+ * Files are loaded on loadConcurrency() dedicated threads, so slow storage
+ * overlaps however few CPUs there are; decoding inside each load still
+ * runs on the shared task pool.
+ *
+ * Each file's magic is read first to tell deep cache files (see
+ * deep_cache.h), which are mapped instead of decoded, from EXRs. An EXR is
+ * then opened once: the same open checks that it is deep and decodes it.
+ * At most options.maxConcurrent files are in flight at any time. Failures
+ * are reported per file rather than thrown, so one bad input doesn't
+ * cancel the others. A filename of "-" reads the EXR from standard input.
+ *
+ * @param filenames Files to load
+ * @param options Parallelism limit and optional ROI
+ * @return One result per input, in the same order as filenames
+ */
+std::vector<LoadResult> loadDeepEXRFiles(const std::vector<std::string>& filenames,
+                                         const LoaderOptions& options = LoaderOptions());
+
+} // namespace deep_compositor
@@ -0,0 +1,187 @@
+#include "deep_pager.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+namespace deep_compositor {
+
+namespace {
+
+std::mutex g_pagerMutex;
+std::shared_ptr<TilePager> g_pager;
+
+} // anonymous namespace
+
+void setOutOfCorePager(std::shared_ptr<TilePager> pager) {
+    std::lock_guard<std::mutex> lock(g_pagerMutex);
+    g_pager = std::move(pager);
+}
+
+std::shared_ptr<TilePager> outOfCorePager() {
+    std::lock_guard<std::mutex> lock(g_pagerMutex);
+    return g_pager;
+}
+
+TilePager::TilePager(size_t budgetBytes, const std::string& scratchDirectory)
+    : budget_(budgetBytes),
+      scratchDirectory_(scratchDirectory),
+      fd_(-1),
+      scratchEnd_(0),
+      resident_(0),
+      peak_(0),
+      pageOuts_(0),
+      pageIns_(0) {}
+
+TilePager::~TilePager() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+size_t TilePager::residentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_;
+}
+
+size_t TilePager::peakResidentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+size_t TilePager::pageOuts() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pageOuts_;
+}
+
+size_t TilePager::pageIns() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pageIns_;
+}
+
+uint64_t TilePager::scratchBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return scratchEnd_;
+}
+
+void TilePager::setResident(Client* client, size_t tile, size_t bytes) {
+    TileKey key(client, tile);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        resident_ -= it->second->bytes;
+        it->second->bytes = bytes;
+        order_.splice(order_.begin(), order_, it->second);
+    } else {
+        order_.push_front(Entry{key, bytes});
+        index_[key] = order_.begin();
+    }
+    resident_ += bytes;
+    peak_ = std::max(peak_, resident_);
+}
+
+void TilePager::forget(Client* client, size_t tile) {
+    auto it = index_.find(TileKey(client, tile));
+    if (it == index_.end()) {
+        return;
+    }
+    resident_ -= it->second->bytes;
+    order_.erase(it->second);
+    index_.erase(it);
+}
+
+void TilePager::enforceBudget() {
+    auto victim = order_.end();
+    while (resident_ > budget_ && victim != order_.begin()) {
+        --victim;
+        Client* client = victim->key.first;
+        size_t tile = victim->key.second;
+        if (victim->bytes == 0 || client->currentTile() == tile) {
+            continue;  // Nothing to free, or pinned
+        }
+
+        client->pageOut(tile);
+        pageOuts_++;
+        resident_ -= victim->bytes;
+        index_.erase(victim->key);
+        victim = order_.erase(victim);
+    }
+}
+
+void TilePager::openScratch() {
+    std::string dir = scratchDirectory_;
+    if (dir.empty()) {
+        const char* tmp = std::getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+    }
+    std::string path = dir + "/deep_pager.XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+
+    fd_ = ::mkstemp(name.data());
+    if (fd_ < 0) {
+        throw std::runtime_error("Can't create scratch file in " + dir + ": " + std::strerror(errno));
+    }
+    // Nothing else needs the name; the space is freed when the pager closes it
+    ::unlink(name.data());
+}
+
+void TilePager::write(const char* data, size_t size, ScratchSlot& slot) {
+    if (fd_ < 0) {
+        openScratch();
+    }
+
+    if (size > slot.capacity) {
+        release(slot);
+        auto fit = freeSlots_.lower_bound(size);
+        if (fit != freeSlots_.end()) {
+            slot.offset = fit->second;
+            slot.capacity = fit->first;
+            freeSlots_.erase(fit);
+        } else {
+            slot.offset = scratchEnd_;
+            slot.capacity = size;
+            scratchEnd_ += size;
+        }
+    }
+    slot.size = size;
+
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pwrite(fd_, data + done, size - done, static_cast<off_t>(slot.offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Scratch file write failed: ") + std::strerror(errno));
+        }
+        done += static_cast<uint64_t>(n);
+    }
+}
+
+void TilePager::read(const ScratchSlot& slot, char* out) {
+    uint64_t done = 0;
+    while (done < slot.size) {
+        ssize_t n = ::pread(fd_, out + done, slot.size - done, static_cast<off_t>(slot.offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(std::string("Scratch file read failed: ") + std::strerror(errno));
+        }
+        done += static_cast<uint64_t>(n);
+    }
+}
+
+void TilePager::release(ScratchSlot& slot) {
+    if (slot.capacity > 0) {
+        freeSlots_.emplace(slot.capacity, slot.offset);
+    }
+    slot = ScratchSlot();
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace deep_compositor {
+
+/**
+ * Location of one paged-out tile in a TilePager's scratch file
+ */
+struct ScratchSlot {
+    uint64_t offset = 0;
+    uint64_t capacity = 0;  // Bytes reserved (0 = no slot)
+    uint64_t size = 0;      // Bytes in use
+};
+
+/**
+ * Memory budget and scratch file shared by out-of-core DeepImages
+ *
+ * Paged images (see DeepImage::enableOutOfCore) register every tile that
+ * holds sample data in memory. When the total passes the budget, the least
+ * recently used tiles across all images are written to an unlinked scratch
+ * file and their samples freed; touching such a tile again reads it back.
+ * The tile each image touched last is never evicted, so resident memory is
+ * bounded by the budget plus one tile per image.
+ *
+ * Thread-safe: images on different threads may share a pager.
+ */
+class TilePager {
+public:
+    /**
+     * Side of a paged image the pager calls back into (always with the
+     * pager's lock held)
+     */
+    class Client {
+    public:
+        /**
+         * Write a tile to scratch (if needed) and free its samples
+         */
+        virtual void pageOut(size_t tile) = 0;
+
+        /**
+         * The tile the image touched last; it is never evicted
+         */
+        virtual size_t currentTile() const = 0;
+
+    protected:
+        ~Client() = default;
+    };
+
+    /**
+     * @param budgetBytes Resident sample bytes before tiles are paged out
+     * @param scratchDirectory Where the scratch file goes (default: $TMPDIR
+     *        or /tmp). The file is unlinked as soon as it is created.
+     */
+    explicit TilePager(size_t budgetBytes, const std::string& scratchDirectory = "");
+    ~TilePager();
+
+    TilePager(const TilePager&) = delete;
+    TilePager& operator=(const TilePager&) = delete;
+
+    size_t budget() const { return budget_; }
+    size_t residentBytes() const;
+    size_t peakResidentBytes() const;
+    size_t pageOuts() const;
+    size_t pageIns() const;
+    uint64_t scratchBytes() const;
+
+    // ------------------------------------------------------------------
+    // Client interface: call with lock() held
+    // ------------------------------------------------------------------
+
+    std::unique_lock<std::mutex> lock() const { return std::unique_lock<std::mutex>(mutex_); }
+
+    /**
+     * Record a resident tile's size and make it the most recently used
+     */
+    void setResident(Client* client, size_t tile, size_t bytes);
+
+    /**
+     * Drop a tile from the resident set (without paging it out)
+     */
+    void forget(Client* client, size_t tile);
+
+    /**
+     * Page out least recently used tiles until within budget
+     */
+    void enforceBudget();
+
+    /**
+     * Store tile bytes, reusing `slot` if they fit
+     *
+     * @throws std::runtime_error on I/O errors
+     */
+    void write(const char* data, size_t size, ScratchSlot& slot);
+
+    /**
+     * Read a tile's bytes back (slot.size bytes into out)
+     *
+     * @throws std::runtime_error on I/O errors
+     */
+    void read(const ScratchSlot& slot, char* out);
+
+    /**
+     * Return a slot's space for reuse
+     */
+    void release(ScratchSlot& slot);
+
+    /**
+     * Page-in counter for clients
+     */
+    void countPageIn() { pageIns_++; }
+
+private:
+    using TileKey = std::pair<Client*, size_t>;
+
+    struct Entry {
+        TileKey key;
+        size_t bytes;
+    };
+
+    void openScratch();
+
+    size_t budget_;
+    std::string scratchDirectory_;
+    int fd_;
+    uint64_t scratchEnd_;
+    std::multimap<uint64_t, uint64_t> freeSlots_;  // capacity -> offset
+
+    size_t resident_;
+    size_t peak_;
+    size_t pageOuts_;
+    size_t pageIns_;
+    std::list<Entry> order_;  // Most recently used first
+    std::map<TileKey, std::list<Entry>::iterator> index_;
+    mutable std::mutex mutex_;
+};
+
+/**
+ * Page images produced by the loaders and deepMerge through `pager`
+ * (nullptr, the default, keeps them in memory)
+ */
+void setOutOfCorePager(std::shared_ptr<TilePager> pager);
+
+/**
+ * @see setOutOfCorePager
+ */
+std::shared_ptr<TilePager> outOfCorePager();
+
+} // namespace deep_compositor
@@ -1,85 +1,403 @@
 #include "deep_reader.h"
+#include "deep_pager.h"
+#include "deep_stream.h"
+#include "deep_trace.h"
 #include "utils.h"
 
-#include <OpenEXR/ImfDeepScanLineInputFile.h>
+#include <OpenEXR/ImfDeepScanLineInputPart.h>
+#include <OpenEXR/ImfDeepTiledInputPart.h>
 #include <OpenEXR/ImfDeepFrameBuffer.h>
 #include <OpenEXR/ImfPartType.h>
 #include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfHeader.h>
-#include <OpenEXR/ImfInputFile.h>
 #include <OpenEXR/ImfMultiPartInputFile.h>
+#include <OpenEXR/ImfStdIO.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <memory>
 
 namespace deep_compositor {
 
-bool isDeepEXR(const std::string& filename) {
-    try {
-        Imf::MultiPartInputFile file(filename.c_str());
-        if (file.parts() < 1) {
-            return false;
-        }
-        
-        const Imf::Header& header = file.header(0);
-        return header.hasType() && Imf::isDeepData(header.type());
-    } catch (...) {
-        return false;
+namespace {
+
+// Read by loader threads; setters may run while loads are in flight
+std::atomic<bool> g_memoryMappedInput{true};
+std::atomic<bool> g_loadExtraChannels{true};
+
+// Scanlines decoded at a time into out-of-core images (one row of pages)
+const int kPagedChunkRows = 64;
+
+/**
+ * Open a file for OpenEXR: mmap-backed by default, stock stream otherwise.
+ * `access` tells the mapping how it will be read (see MapAccess).
+ */
+std::unique_ptr<Imf::IStream> openInputStream(const std::string& filename, MapAccess access) {
+    if (g_memoryMappedInput.load(std::memory_order_relaxed)) {
+        return std::make_unique<MappedIStream>(filename, access);
     }
+    return std::make_unique<Imf::StdIFStream>(filename.c_str());
 }
 
-bool getDeepEXRInfo(const std::string& filename, 
-                    int& width, int& height, bool& isDeep) {
-    try {
-        Imf::MultiPartInputFile file(filename.c_str());
-        if (file.parts() < 1) {
-            return false;
+/**
+ * Decode buffers for a block of pixels.
+ *
+ * OpenEXR stores a copy of the frame buffer descriptor, so the sample count
+ * and pointer arrays must remain stable in memory until the read completes.
+ * Slices are addressed in absolute pixel coordinates over `window`.
+ */
+struct DeepReadBuffers {
+    PixelBox window;
+    bool hasZBack = false;
+    std::vector<ExtraChannel> extras;
+
+    std::vector<unsigned int> sampleCounts;
+
+    std::vector<float*> rPtrs;
+    std::vector<float*> gPtrs;
+    std::vector<float*> bPtrs;
+    std::vector<float*> aPtrs;
+    std::vector<float*> zPtrs;
+    std::vector<float*> zBackPtrs;
+
+    std::vector<float> rData;
+    std::vector<float> gData;
+    std::vector<float> bData;
+    std::vector<float> aData;
+    std::vector<float> zData;
+    std::vector<float> zBackData;
+
+    // Per extra channel (UINT channels decode their bits into the floats)
+    std::vector<std::vector<float*>> extraPtrs;
+    std::vector<std::vector<float>> extraData;
+
+    DeepReadBuffers(const PixelBox& w, const ChannelSet& channels)
+        : window(w), hasZBack(channels.zBack), extras(channels.extras) {
+        size_t count = static_cast<size_t>(w.width()) * w.height();
+        sampleCounts.assign(count, 0);
+        rPtrs.assign(count, nullptr);
+        gPtrs.assign(count, nullptr);
+        bPtrs.assign(count, nullptr);
+        aPtrs.assign(count, nullptr);
+        zPtrs.assign(count, nullptr);
+        zBackPtrs.assign(count, nullptr);
+        extraPtrs.assign(extras.size(), std::vector<float*>(count, nullptr));
+        extraData.resize(extras.size());
+    }
+
+    // Base pointer such that base + x * xStride + y * yStride hits (x, y)
+    template<typename T>
+    char* base(std::vector<T>& v) {
+        return reinterpret_cast<char*>(
+            v.data() - window.minX - static_cast<long>(window.minY) * window.width());
+    }
+
+    Imf::DeepSlice pointerSlice(std::vector<float*>& ptrs, Imf::PixelType type = Imf::FLOAT) {
+        return Imf::DeepSlice(
+            type,
+            base(ptrs),
+            sizeof(float*),                   // xStride for pointer array
+            sizeof(float*) * window.width(),  // yStride for pointer array
+            sizeof(float)                     // sample stride
+        );
+    }
+
+    Imf::DeepFrameBuffer frameBuffer() {
+        Imf::DeepFrameBuffer frameBuffer;
+
+        frameBuffer.insertSampleCountSlice(
+            Imf::Slice(
+                Imf::UINT,
+                base(sampleCounts),
+                sizeof(unsigned int),                  // xStride
+                sizeof(unsigned int) * window.width()  // yStride
+            )
+        );
+
+        frameBuffer.insert("R", pointerSlice(rPtrs));
+        frameBuffer.insert("G", pointerSlice(gPtrs));
+        frameBuffer.insert("B", pointerSlice(bPtrs));
+        frameBuffer.insert("A", pointerSlice(aPtrs));
+        frameBuffer.insert("Z", pointerSlice(zPtrs));
+        if (hasZBack) {
+            frameBuffer.insert("ZBack", pointerSlice(zBackPtrs));
         }
-        
-        const Imf::Header& header = file.header(0);
-        isDeep = header.hasType() && Imf::isDeepData(header.type());
-        
-        Imath::Box2i dataWindow = header.dataWindow();
-        width = dataWindow.max.x - dataWindow.min.x + 1;
-        height = dataWindow.max.y - dataWindow.min.y + 1;
-        
-        return true;
-    } catch (...) {
-        return false;
+        for (size_t c = 0; c < extras.size(); ++c) {
+            frameBuffer.insert(extras[c].name,
+                               pointerSlice(extraPtrs[c], extras[c].isUint ? Imf::UINT : Imf::FLOAT));
+        }
+
+        return frameBuffer;
     }
+
+    /**
+     * Allocate contiguous sample storage once sample counts are known and
+     * point every pixel into it. Returns the total number of samples.
+     */
+    size_t allocateSamples() {
+        size_t totalSamples = 0;
+        for (const auto& count : sampleCounts) {
+            totalSamples += count;
+        }
+
+        rData.resize(totalSamples);
+        gData.resize(totalSamples);
+        bData.resize(totalSamples);
+        aData.resize(totalSamples);
+        zData.resize(totalSamples);
+        zBackData.resize(hasZBack ? totalSamples : 0);
+        for (auto& data : extraData) {
+            data.resize(totalSamples);
+        }
+
+        size_t offset = 0;
+        for (size_t i = 0; i < sampleCounts.size(); ++i) {
+            if (sampleCounts[i] > 0) {
+                rPtrs[i] = rData.data() + offset;
+                gPtrs[i] = gData.data() + offset;
+                bPtrs[i] = bData.data() + offset;
+                aPtrs[i] = aData.data() + offset;
+                zPtrs[i] = zData.data() + offset;
+                if (hasZBack) zBackPtrs[i] = zBackData.data() + offset;
+                for (size_t c = 0; c < extras.size(); ++c) {
+                    extraPtrs[c][i] = extraData[c].data() + offset;
+                }
+                offset += sampleCounts[i];
+            }
+        }
+
+        return totalSamples;
+    }
+
+    /**
+     * Convert the decoded samples inside `region` (absolute coordinates,
+     * inside result's data window) into `result`. Columns are visited in
+     * 64-wide strips so out-of-core results are filled a page at a time.
+     */
+    void copyTo(DeepImage& result, const PixelBox& region) const {
+        if (!extras.empty()) {
+            copyWithExtrasTo(result, region);
+            return;
+        }
+        const int strip = 64;
+        for (int x0 = region.minX; x0 <= region.maxX; x0 += strip) {
+            int x1 = std::min(region.maxX, x0 + strip - 1);
+            for (int y = region.minY; y <= region.maxY; ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    size_t pixelIndex = static_cast<size_t>(y - window.minY) * window.width()
+                                      + static_cast<size_t>(x - window.minX);
+                    unsigned int numSamples = sampleCounts[pixelIndex];
+                    if (numSamples == 0) {
+                        continue;
+                    }
+
+                    DeepPixel& pixel = result.pixel(x - result.originX(), y - result.originY());
+
+                    for (unsigned int s = 0; s < numSamples; ++s) {
+                        DeepSample sample;
+                        sample.depth = zPtrs[pixelIndex][s];
+                        sample.depth_back = hasZBack ? zBackPtrs[pixelIndex][s] : sample.depth;
+                        sample.red = rPtrs[pixelIndex][s];
+                        sample.green = gPtrs[pixelIndex][s];
+                        sample.blue = bPtrs[pixelIndex][s];
+                        sample.alpha = aPtrs[pixelIndex][s];
+
+                        pixel.addSample(sample);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * copyTo for files with extra channels: samples are placed as
+     * DeepPixel::addSample places them, and the extra channel columns
+     * follow them
+     */
+    void copyWithExtrasTo(DeepImage& result, const PixelBox& region) const {
+        const int strip = 64;
+        size_t channelCount = extras.size();
+        std::vector<uint32_t> order;
+        for (int x0 = region.minX; x0 <= region.maxX; x0 += strip) {
+            int x1 = std::min(region.maxX, x0 + strip - 1);
+            for (int y = region.minY; y <= region.maxY; ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    size_t pixelIndex = static_cast<size_t>(y - window.minY) * window.width()
+                                      + static_cast<size_t>(x - window.minX);
+                    unsigned int numSamples = sampleCounts[pixelIndex];
+                    if (numSamples == 0) {
+                        continue;
+                    }
+
+                    int localX = x - result.originX();
+                    int localY = y - result.originY();
+                    std::vector<DeepSample>& samples = result.pixel(localX, localY).samples();
+                    std::vector<float>& columns = result.extraColumns(localX, localY);
+                    size_t existing = samples.size();
+                    if (columns.empty() && existing > 0) {
+                        columns.assign(channelCount * existing, 0.0f);
+                    }
+
+                    // File index of each sample, in pixel order
+                    order.resize(existing);
+                    for (size_t s = 0; s < existing; ++s) {
+                        order[s] = static_cast<uint32_t>(s);
+                    }
+                    for (unsigned int s = 0; s < numSamples; ++s) {
+                        DeepSample sample;
+                        sample.depth = zPtrs[pixelIndex][s];
+                        sample.depth_back = hasZBack ? zBackPtrs[pixelIndex][s] : sample.depth;
+                        sample.red = rPtrs[pixelIndex][s];
+                        sample.green = gPtrs[pixelIndex][s];
+                        sample.blue = bPtrs[pixelIndex][s];
+                        sample.alpha = aPtrs[pixelIndex][s];
+
+                        auto it = std::lower_bound(samples.begin(), samples.end(), sample);
+                        order.insert(order.begin() + (it - samples.begin()),
+                                     static_cast<uint32_t>(existing + s));
+                        samples.insert(it, sample);
+                    }
+
+                    size_t n = samples.size();
+                    std::vector<float> sorted(channelCount * n);
+                    for (size_t c = 0; c < channelCount; ++c) {
+                        for (size_t s = 0; s < n; ++s) {
+                            uint32_t from = order[s];
+                            sorted[c * n + s] = from < existing
+                                ? columns[c * existing + from]
+                                : extraPtrs[c][pixelIndex][from - existing];
+                        }
+                    }
+                    columns.swap(sorted);
+                }
+            }
+        }
+    }
+};
+
+PixelBox toPixelBox(const Imath::Box2i& box) {
+    return PixelBox(box.min.x, box.min.y, box.max.x, box.max.y);
 }
 
-DeepImage loadDeepEXR(const std::string& filename) {
-    logVerbose("  Opening: " + filename);
-    
-    // Check if file exists
-    if (!fileExists(filename)) {
-        throw DeepReaderException("File not found: " + filename);
+/**
+ * Scanline parts: decode only the scanlines spanned by the region. Whole
+ * lines are decoded, so the buffers span the full data window width.
+ * Out-of-core results are decoded kPagedChunkRows lines at a time so the
+ * decode buffers stay small too.
+ */
+void readScanLineRegion(Imf::DeepScanLineInputPart& part, const PixelBox& dataWindow,
+                        const PixelBox& region, DeepImage& result) {
+    TraceZone zone("readScanLines");
+    int chunkRows = result.isOutOfCore() ? kPagedChunkRows : region.height();
+    size_t totalSamples = 0;
+
+    for (int y0 = region.minY; y0 <= region.maxY; y0 += chunkRows) {
+        int y1 = std::min(region.maxY, y0 + chunkRows - 1);
+        PixelBox lines(dataWindow.minX, y0, dataWindow.maxX, y1);
+        DeepReadBuffers buffers(lines, result.channels());
+
+        // Use one persistent frame buffer lifecycle: set once, then read sample
+        // counts and deep samples. This avoids version-specific state resets.
+        part.setFrameBuffer(buffers.frameBuffer());
+        part.readPixelSampleCounts(y0, y1);
+
+        totalSamples += buffers.allocateSamples();
+
+        part.readPixels(y0, y1);
+        buffers.copyTo(result, PixelBox(region.minX, y0, region.maxX, y1));
     }
-    
-    // Open the deep EXR file
-    std::unique_ptr<Imf::DeepScanLineInputFile> file;
+    logVerbose("    Total samples: " + formatNumber(totalSamples));
+    zone.arg("lines", region.height());
+    zone.arg("samples", static_cast<int64_t>(totalSamples));
+}
+
+/**
+ * Tiled parts: decode only the level-0 tiles that intersect the region.
+ */
+void readTiledRegion(Imf::DeepTiledInputPart& part, const PixelBox& dataWindow,
+                     const PixelBox& region, DeepImage& result) {
+    TraceZone zone("readTiles");
+    int tileW = static_cast<int>(part.tileXSize());
+    int tileH = static_cast<int>(part.tileYSize());
+
+    int tx0 = (region.minX - dataWindow.minX) / tileW;
+    int tx1 = (region.maxX - dataWindow.minX) / tileW;
+    int ty0 = (region.minY - dataWindow.minY) / tileH;
+    int ty1 = (region.maxY - dataWindow.minY) / tileH;
+
+    // Tiles are decoded whole, so the buffers cover the tile-aligned span
+    PixelBox tiles(dataWindow.minX + tx0 * tileW,
+                   dataWindow.minY + ty0 * tileH,
+                   dataWindow.minX + (tx1 + 1) * tileW - 1,
+                   dataWindow.minY + (ty1 + 1) * tileH - 1);
+    tiles = tiles.intersect(dataWindow);
+
+    logVerbose("    Tiles: " + std::to_string((tx1 - tx0 + 1) * (ty1 - ty0 + 1)) + " of " +
+               std::to_string(part.numXTiles(0) * part.numYTiles(0)) +
+               " (" + std::to_string(tileW) + "x" + std::to_string(tileH) + ")");
+
+    // Out-of-core results are decoded one row of tiles at a time
+    int chunkRows = result.isOutOfCore() ? 1 : ty1 - ty0 + 1;
+    size_t totalSamples = 0;
+
+    for (int cy0 = ty0; cy0 <= ty1; cy0 += chunkRows) {
+        int cy1 = std::min(ty1, cy0 + chunkRows - 1);
+        PixelBox chunk = PixelBox(tiles.minX, dataWindow.minY + cy0 * tileH,
+                                  tiles.maxX, dataWindow.minY + (cy1 + 1) * tileH - 1)
+                             .intersect(dataWindow);
+        DeepReadBuffers buffers(chunk, result.channels());
+
+        part.setFrameBuffer(buffers.frameBuffer());
+        part.readPixelSampleCounts(tx0, tx1, cy0, cy1);
+
+        totalSamples += buffers.allocateSamples();
+
+        part.readTiles(tx0, tx1, cy0, cy1);
+        buffers.copyTo(result, region.intersect(chunk));
+    }
+    logVerbose("    Total samples: " + formatNumber(totalSamples));
+    zone.arg("tiles", (tx1 - tx0 + 1) * (ty1 - ty0 + 1));
+    zone.arg("samples", static_cast<int64_t>(totalSamples));
+}
+
+/**
+ * Decode a deep EXR from an open stream. `filename` is only used in messages.
+ */
+DeepImage loadDeepEXRImpl(Imf::IStream& stream, const std::string& filename,
+                          const PixelBox* requested) {
+    // Open the file once; the part header tells us scanline vs tiled
+    std::unique_ptr<Imf::MultiPartInputFile> file;
     try {
-        file = std::make_unique<Imf::DeepScanLineInputFile>(filename.c_str());
+        file = std::make_unique<Imf::MultiPartInputFile>(stream);
     } catch (const std::exception& e) {
         throw DeepReaderException("Failed to open EXR file: " + std::string(e.what()));
     }
     
-    const Imf::Header& header = file->header();
+    if (file->parts() < 1) {
+        throw DeepReaderException("File has no parts: " + filename);
+    }
+    
+    const Imf::Header& header = file->header(0);
     
     // Verify it's a deep image
     if (!header.hasType() || !Imf::isDeepData(header.type())) {
         throw DeepReaderException("File is not a deep EXR: " + filename);
     }
     
+    bool tiled = header.type() == Imf::DEEPTILE;
+    
     // Get dimensions
-    Imath::Box2i dataWindow = header.dataWindow();
-    int width = dataWindow.max.x - dataWindow.min.x + 1;
-    int height = dataWindow.max.y - dataWindow.min.y + 1;
-    int minX = dataWindow.min.x;
-    int minY = dataWindow.min.y;
+    PixelBox dataWindow = toPixelBox(header.dataWindow());
+    PixelBox region = requested ? requested->intersect(dataWindow) : dataWindow;
     
-    logVerbose("    Resolution: " + std::to_string(width) + "x" + std::to_string(height));
+    logVerbose("    Resolution: " + std::to_string(dataWindow.width()) + "x" +
+               std::to_string(dataWindow.height()) + (tiled ? " (tiled)" : ""));
+    if (requested) {
+        logVerbose("    Region: " + std::to_string(region.width()) + "x" +
+                   std::to_string(region.height()) + " at " +
+                   std::to_string(region.minX) + "," + std::to_string(region.minY));
+    }
     
     // Check for required channels
     const Imf::ChannelList& channels = header.channels();
@@ -100,169 +418,46 @@ DeepImage loadDeepEXR(const std::string& filename) {
         throw DeepReaderException("Missing required channels: " + missing);
     }
     
-    // Create the result image
-    DeepImage result(width, height);
-    
-    // Allocate sample count array
-    std::vector<unsigned int> sampleCounts(static_cast<size_t>(width) * height);
-    
-    // Prepare pointer arrays before setFrameBuffer(). OpenEXR stores a copy of
-    // the frame buffer descriptor, so these arrays must remain stable in memory.
-    std::vector<float*> rPtrs(sampleCounts.size(), nullptr);
-    std::vector<float*> gPtrs(sampleCounts.size(), nullptr);
-    std::vector<float*> bPtrs(sampleCounts.size(), nullptr);
-    std::vector<float*> aPtrs(sampleCounts.size(), nullptr);
-    std::vector<float*> zPtrs(sampleCounts.size(), nullptr);
-    std::vector<float*> zBackPtrs(sampleCounts.size(), nullptr);
-
-    // Use one persistent frame buffer lifecycle: set once, then read sample
-    // counts and deep samples. This avoids version-specific state resets.
-    Imf::DeepFrameBuffer frameBuffer;
-
-    frameBuffer.insertSampleCountSlice(
-        Imf::Slice(
-            Imf::UINT,
-            reinterpret_cast<char*>(sampleCounts.data() - minX - static_cast<long>(minY) * width),
-            sizeof(unsigned int),      // xStride
-            sizeof(unsigned int) * width  // yStride
-        )
-    );
-
-    frameBuffer.insert(
-        "R",
-        Imf::DeepSlice(
-            Imf::FLOAT,
-            reinterpret_cast<char*>(rPtrs.data() - minX - static_cast<long>(minY) * width),
-            sizeof(float*),           // xStride for pointer array
-            sizeof(float*) * width,   // yStride for pointer array
-            sizeof(float)             // sample stride
-        )
-    );
-
-    frameBuffer.insert(
-        "G",
-        Imf::DeepSlice(
-            Imf::FLOAT,
-            reinterpret_cast<char*>(gPtrs.data() - minX - static_cast<long>(minY) * width),
-            sizeof(float*),
-            sizeof(float*) * width,
-            sizeof(float)
-        )
-    );
-
-    frameBuffer.insert(
-        "B",
-        Imf::DeepSlice(
-            Imf::FLOAT,
-            reinterpret_cast<char*>(bPtrs.data() - minX - static_cast<long>(minY) * width),
-            sizeof(float*),
-            sizeof(float*) * width,
-            sizeof(float)
-        )
-    );
-
-    frameBuffer.insert(
-        "A",
-        Imf::DeepSlice(
-            Imf::FLOAT,
-            reinterpret_cast<char*>(aPtrs.data() - minX - static_cast<long>(minY) * width),
-            sizeof(float*),
-            sizeof(float*) * width,
-            sizeof(float)
-        )
-    );
-
-    frameBuffer.insert(
-        "Z",
-        Imf::DeepSlice(
-            Imf::FLOAT,
-            reinterpret_cast<char*>(zPtrs.data() - minX - static_cast<long>(minY) * width),
-            sizeof(float*),
-            sizeof(float*) * width,
-            sizeof(float)
-        )
-    );
-
-    if (hasZBack) {
-        frameBuffer.insert(
-            "ZBack",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(zBackPtrs.data() - minX - static_cast<long>(minY) * width),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
+    // Create the result image, with the file's other channels as extras
+    ChannelSet fileChannels;
+    fileChannels.zBack = hasZBack;
+    if (g_loadExtraChannels.load(std::memory_order_relaxed)) {
+        for (auto it = channels.begin(); it != channels.end(); ++it) {
+            std::string name = it.name();
+            if (name == "R" || name == "G" || name == "B" || name == "A" ||
+                name == "Z" || name == "ZBack") {
+                continue;
+            }
+            fileChannels.extras.push_back(ExtraChannel::fromFile(name, it.channel().type == Imf::UINT));
+        }
+        if (!fileChannels.extras.empty()) {
+            logVerbose("    Extra channels: " + std::to_string(fileChannels.extras.size()));
+        }
     }
     
-    file->setFrameBuffer(frameBuffer);
-    
-    // Read sample counts
-    file->readPixelSampleCounts(minY, minY + height - 1);
-    
-    // Calculate total samples and allocate data arrays
-    size_t totalSamples = 0;
-    for (const auto& count : sampleCounts) {
-        totalSamples += count;
+    DeepImage result(region);
+    result.setDisplayWindow(toPixelBox(header.displayWindow()));
+    result.setChannels(fileChannels);
+    if (region.isEmpty()) {
+        // A layer outside the region contributes nothing (and merges as such)
+        logVerbose("    Region misses the data window, nothing to read");
+        return result;
     }
-    
-    logVerbose("    Total samples: " + formatNumber(totalSamples));
-    
-    // Allocate contiguous storage for all samples
-    std::vector<float> rData(totalSamples);
-    std::vector<float> gData(totalSamples);
-    std::vector<float> bData(totalSamples);
-    std::vector<float> aData(totalSamples);
-    std::vector<float> zData(totalSamples);
-    std::vector<float> zBackData(hasZBack ? totalSamples : 0);
-    
-    // Set up pointers into the contiguous arrays
-    size_t offset = 0;
-    for (size_t i = 0; i < sampleCounts.size(); ++i) {
-        if (sampleCounts[i] > 0) {
-            rPtrs[i] = rData.data() + offset;
-            gPtrs[i] = gData.data() + offset;
-            bPtrs[i] = bData.data() + offset;
-            aPtrs[i] = aData.data() + offset;
-            zPtrs[i] = zData.data() + offset;
-            if (hasZBack) zBackPtrs[i] = zBackData.data() + offset;
-            offset += sampleCounts[i];
-        } else {
-            rPtrs[i] = nullptr;
-            gPtrs[i] = nullptr;
-            bPtrs[i] = nullptr;
-            aPtrs[i] = nullptr;
-            zPtrs[i] = nullptr;
-            if (hasZBack) zBackPtrs[i] = nullptr;
-        }
+    if (std::shared_ptr<TilePager> pager = outOfCorePager()) {
+        result.enableOutOfCore(std::move(pager));
     }
     
-    // Read the deep pixel data
-    file->readPixels(minY, minY + height - 1);
-    
-    // Convert to our DeepImage format
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            size_t pixelIndex = static_cast<size_t>(y) * width + x;
-            unsigned int numSamples = sampleCounts[pixelIndex];
-            
-            if (numSamples > 0) {
-                DeepPixel& pixel = result.pixel(x, y);
-                
-                for (unsigned int s = 0; s < numSamples; ++s) {
-                    DeepSample sample;
-                    sample.depth = zPtrs[pixelIndex][s];
-                    sample.depth_back = hasZBack ? zBackPtrs[pixelIndex][s] : sample.depth;
-                    sample.red = rPtrs[pixelIndex][s];
-                    sample.green = gPtrs[pixelIndex][s];
-                    sample.blue = bPtrs[pixelIndex][s];
-                    sample.alpha = aPtrs[pixelIndex][s];
-
-                    pixel.addSample(sample);
-                }
-            }
+    try {
+        if (tiled) {
+            Imf::DeepTiledInputPart part(*file, 0);
+            readTiledRegion(part, dataWindow, region, result);
+        } else {
+            Imf::DeepScanLineInputPart part(*file, 0);
+            readScanLineRegion(part, dataWindow, region, result);
         }
+    } catch (const std::exception& e) {
+        throw DeepReaderException("Failed to read deep pixels from " + filename +
+                                  ": " + std::string(e.what()));
     }
     
     // Verify depth ordering
@@ -274,4 +469,104 @@ DeepImage loadDeepEXR(const std::string& filename) {
     return result;
 }
 
+DeepImage loadDeepEXRImpl(const std::string& filename, const PixelBox* requested,
+                          uint64_t* bytesRead) {
+    logVerbose("  Opening: " + filename);
+    
+    // Check if file exists
+    if (!fileExists(filename)) {
+        throw DeepReaderException("File not found: " + filename);
+    }
+    
+    // The stream must outlive the decode
+    std::unique_ptr<Imf::IStream> stream;
+    try {
+        // Whole files are read front to back; a region only touches its blocks
+        stream = openInputStream(filename, requested ? MapAccess::Random : MapAccess::Sequential);
+    } catch (const std::exception& e) {
+        throw DeepReaderException("Failed to open EXR file: " + std::string(e.what()));
+    }
+    
+    CountingIStream counted(*stream);
+    DeepImage image = loadDeepEXRImpl(counted, filename, requested);
+    if (bytesRead) {
+        *bytesRead = counted.bytesRead();
+    }
+    return image;
+}
+
+} // anonymous namespace
+
+void setMemoryMappedInput(bool enabled) {
+    g_memoryMappedInput.store(enabled, std::memory_order_relaxed);
+}
+
+bool isMemoryMappedInput() {
+    return g_memoryMappedInput.load(std::memory_order_relaxed);
+}
+
+void setLoadExtraChannels(bool enabled) {
+    g_loadExtraChannels.store(enabled, std::memory_order_relaxed);
+}
+
+bool isLoadingExtraChannels() {
+    return g_loadExtraChannels.load(std::memory_order_relaxed);
+}
+
+bool isDeepEXR(const std::string& filename) {
+    try {
+        auto stream = openInputStream(filename, MapAccess::Normal);
+        Imf::MultiPartInputFile file(*stream);
+        if (file.parts() < 1) {
+            return false;
+        }
+        
+        const Imf::Header& header = file.header(0);
+        return header.hasType() && Imf::isDeepData(header.type());
+    } catch (...) {
+        return false;
+    }
+}
+
+bool getDeepEXRInfo(const std::string& filename, 
+                    int& width, int& height, bool& isDeep) {
+    try {
+        auto stream = openInputStream(filename, MapAccess::Normal);
+        Imf::MultiPartInputFile file(*stream);
+        if (file.parts() < 1) {
+            return false;
+        }
+        
+        const Imf::Header& header = file.header(0);
+        isDeep = header.hasType() && Imf::isDeepData(header.type());
+        
+        Imath::Box2i dataWindow = header.dataWindow();
+        width = dataWindow.max.x - dataWindow.min.x + 1;
+        height = dataWindow.max.y - dataWindow.min.y + 1;
+        
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+DeepImage loadDeepEXR(const std::string& filename, uint64_t* bytesRead) {
+    return loadDeepEXRImpl(filename, nullptr, bytesRead);
+}
+
+DeepImage loadDeepEXR(const std::string& filename, const PixelBox& region,
+                      uint64_t* bytesRead) {
+    return loadDeepEXRImpl(filename, &region, bytesRead);
+}
+
+DeepImage loadDeepEXR(Imf::IStream& stream) {
+    logVerbose("  Reading stream: " + std::string(stream.fileName()));
+    return loadDeepEXRImpl(stream, stream.fileName(), nullptr);
+}
+
+DeepImage loadDeepEXR(Imf::IStream& stream, const PixelBox& region) {
+    logVerbose("  Reading stream: " + std::string(stream.fileName()));
+    return loadDeepEXRImpl(stream, stream.fileName(), &region);
+}
+
 } // namespace deep_compositor
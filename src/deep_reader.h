@@ -1,6 +1,8 @@
 #pragma once
 
 #include "deep_image.h"
+#include <OpenEXR/ImfIO.h>
+#include <cstdint>
 #include <string>
 
 namespace deep_compositor {
@@ -14,14 +16,74 @@ public:
         : std::runtime_error(message) {}
 };
 
+/**
+ * Choose how input files are read. When enabled (the default), files are
+ * mmapped (see MappedIStream); otherwise OpenEXR's stock file stream is used.
+ * Applies to loadDeepEXR, isDeepEXR and getDeepEXRInfo.
+ */
+void setMemoryMappedInput(bool enabled);
+
+/**
+ * Check whether inputs are read through mmap
+ */
+bool isMemoryMappedInput();
+
+/**
+ * Choose whether loadDeepEXR keeps channels other than R, G, B, A, Z and
+ * ZBack (AOVs, IDs) as the image's extra channels (see ExtraChannel). On by
+ * default; pipelines that only need the beauty turn it off so those
+ * channels are never decoded or stored.
+ */
+void setLoadExtraChannels(bool enabled);
+
+/**
+ * Check whether extra channels are loaded
+ */
+bool isLoadingExtraChannels();
+
 /**
  * Load a deep OpenEXR file into a DeepImage
  * 
  * @param filename Path to the deep EXR file
+ * @param bytesRead If set, receives the bytes read from the file
  * @return Loaded DeepImage with all samples
  * @throws DeepReaderException on file errors
  */
-DeepImage loadDeepEXR(const std::string& filename);
+DeepImage loadDeepEXR(const std::string& filename, uint64_t* bytesRead = nullptr);
+
+/**
+ * Load only part of a deep OpenEXR file
+ *
+ * Scanline files decode just the scanlines spanned by the region; tiled
+ * (DEEPTILE) files decode just the tiles that intersect it. The returned
+ * image's data window is the region clipped to the file's data window,
+ * which is empty (nothing decoded) if the region misses it.
+ *
+ * @param filename Path to the deep EXR file
+ * @param region Pixel region to load, in absolute (data window) coordinates
+ * @param bytesRead If set, receives the bytes read from the file: the
+ *        header, offset tables and the decoded chunks only
+ * @return Loaded DeepImage covering the clipped region
+ * @throws DeepReaderException on file errors
+ */
+DeepImage loadDeepEXR(const std::string& filename, const PixelBox& region,
+                      uint64_t* bytesRead = nullptr);
+
+/**
+ * Load a deep EXR from an already open stream (e.g. a MemoryIStream)
+ * 
+ * @param stream Stream positioned at the start of the EXR data
+ * @return Loaded DeepImage with all samples
+ * @throws DeepReaderException on decode errors
+ */
+DeepImage loadDeepEXR(Imf::IStream& stream);
+
+/**
+ * Load part of a deep EXR from an already open stream
+ * 
+ * @see loadDeepEXR(const std::string&, const PixelBox&)
+ */
+DeepImage loadDeepEXR(Imf::IStream& stream, const PixelBox& region);
 
 /**
  * Check if a file is a valid deep EXR file
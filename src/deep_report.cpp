@@ -0,0 +1,86 @@
+#include "deep_report.h"
+#include "deep_tasks.h"
+#include "kernels/kernels.h"
+
+#include <fstream>
+#include <thread>
+
+namespace deep_compositor {
+
+namespace {
+
+void writeFileStatsJson(std::ostream& out, const std::vector<FileStats>& files) {
+    out << "[";
+    for (size_t i = 0; i < files.size(); ++i) {
+        const IOStats& io = files[i].io;
+        out << (i ? "," : "") << "\n    {\"file\": " << jsonString(files[i].path)
+            << ", \"bytes\": " << io.bytes
+            << ", \"samples\": " << io.samples
+            << ", \"wall_ms\": " << jsonNumber(io.wallMs)
+            << ", \"cpu_ms\": " << jsonNumber(io.cpuMs)
+            << ", \"throughput_mb_s\": " << jsonNumber(io.throughputMBps()) << "}";
+    }
+    out << (files.empty() ? "]" : "\n  ]");
+}
+
+} // anonymous namespace
+
+void writeStatsJson(std::ostream& out, const RunReport& report, const TilePager* pager) {
+    const CompositorStats& merge = report.merge;
+    out << "{\n  \"version\": " << jsonString(report.version) << ",\n"
+        << "  \"inputs\": ";
+    writeFileStatsJson(out, report.inputs);
+    out << ",\n  \"merge\": {"
+        << "\"input_samples\": " << merge.totalInputSamples
+        << ", \"output_samples\": " << merge.totalOutputSamples
+        << ", \"pixels\": " << merge.remergedPixels
+        << ", \"split_fragments\": " << merge.splitFragments
+        << ", \"blends\": " << merge.blends
+        << ", \"culled_samples\": " << merge.culledSamples
+        << ", \"threads\": " << merge.mergeThreads
+        << ", \"work_units\": " << merge.workUnits
+        << ", \"steals\": " << merge.steals
+        << ", \"load_balance\": " << jsonNumber(merge.loadBalance)
+        << ", \"min_depth\": " << jsonNumber(merge.minDepth)
+        << ", \"max_depth\": " << jsonNumber(merge.maxDepth) << "},\n"
+        << "  \"outputs\": ";
+    writeFileStatsJson(out, report.outputs);
+    
+    // Utilisation: average busy threads over the threads the phase can use
+    out << ",\n  \"phases\": [";
+    for (size_t i = 0; i < report.phases.size(); ++i) {
+        const PhaseTime& phase = report.phases[i];
+        double busy = phase.wallMs > 0.0 ? phase.cpuMs / phase.wallMs : 0.0;
+        out << (i ? "," : "") << "\n    {\"name\": " << jsonString(phase.name)
+            << ", \"wall_ms\": " << jsonNumber(phase.wallMs)
+            << ", \"cpu_ms\": " << jsonNumber(phase.cpuMs)
+            << ", \"threads\": " << phase.threads
+            << ", \"utilisation\": " << jsonNumber(busy / phase.threads) << "}";
+    }
+    out << (report.phases.empty() ? "]" : "\n  ]") << ",\n"
+        << "  \"threads\": {\"pool\": " << TaskScheduler::shared().threadCount()
+        << ", \"load\": " << report.loadThreads
+        << ", \"available\": " << availableCpuCount()
+        << ", \"hardware\": " << std::thread::hardware_concurrency() << "},\n"
+        << "  \"kernels\": " << jsonString(kernelIsaName(kernels().isa)) << ",\n"
+        << "  \"peak_rss_bytes\": " << peakRssBytes() << ",\n";
+    if (pager) {
+        out << "  \"paging\": {\"budget_bytes\": " << pager->budget()
+            << ", \"peak_resident_bytes\": " << pager->peakResidentBytes()
+            << ", \"page_outs\": " << pager->pageOuts()
+            << ", \"page_ins\": " << pager->pageIns()
+            << ", \"scratch_bytes\": " << pager->scratchBytes() << "},\n";
+    }
+    out << "  \"result_cache\": " << jsonString(report.resultCache) << "\n}\n";
+}
+
+bool writeStatsJson(const std::string& path, const RunReport& report, const TilePager* pager) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    writeStatsJson(out, report, pager);
+    return static_cast<bool>(out);
+}
+
+} // namespace deep_compositor
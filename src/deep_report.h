@@ -0,0 +1,80 @@
+#pragma once
+
+#include "deep_compositor.h"
+#include "deep_pager.h"
+#include "utils.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+// ============================================================================
+// Run statistics (--stats-json)
+// ============================================================================
+
+/**
+ * Wall and CPU time of one pipeline phase
+ */
+struct PhaseTime {
+    const char* name;
+    double wallMs;
+    double cpuMs;   // Whole process, all threads
+    int threads;    // Threads the phase can keep busy
+};
+
+/**
+ * Measures a phase from construction to finish()
+ */
+class PhaseClock {
+public:
+    PhaseClock() : cpuStart_(processCpuMs()) {}
+
+    PhaseTime finish(const char* name, int threads = 1) const {
+        return {name, timer_.elapsedMs(), processCpuMs() - cpuStart_, threads};
+    }
+
+private:
+    Timer timer_;
+    double cpuStart_;
+};
+
+/**
+ * I/O statistics of one file read or written
+ */
+struct FileStats {
+    std::string path;
+    IOStats io;
+};
+
+/**
+ * Everything the run statistics report about a run
+ */
+struct RunReport {
+    std::string version;
+    std::vector<FileStats> inputs;
+    std::vector<FileStats> outputs;
+    CompositorStats merge;
+    std::vector<PhaseTime> phases;
+    int loadThreads = 0;               // Files loaded at once (0 = none loaded)
+    std::string resultCache = "off";   // "off", "hit" or "miss"
+};
+
+/**
+ * Write a run report as JSON: per-file I/O, merge counters, phase times
+ * and thread utilisation, thread counts, kernel set, peak RSS and, with a
+ * pager, its paging counters
+ */
+void writeStatsJson(std::ostream& out, const RunReport& report,
+                    const TilePager* pager = nullptr);
+
+/**
+ * writeStatsJson to a file
+ *
+ * @return false if the file couldn't be written
+ */
+bool writeStatsJson(const std::string& path, const RunReport& report,
+                    const TilePager* pager = nullptr);
+
+} // namespace deep_compositor
@@ -0,0 +1,163 @@
+#include "deep_result_cache.h"
+#include "deep_input_cache.h"
+#include "deep_reader.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace deep_compositor {
+
+namespace {
+
+// Bump when the key text or entry layout changes
+const int kResultCacheVersion = 2;
+
+std::string hex64(uint64_t value) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+
+} // anonymous namespace
+
+ResultCache::ResultCache(const std::string& directory, bool hashContent)
+    : directory_(directory), hashContent_(hashContent) {}
+
+bool ResultCache::computeKey(const std::vector<std::string>& inputs, const std::string& settings,
+                             std::string& key) const {
+    // How inputs decode decides the output channels too
+    std::string text = "result-cache " + std::to_string(kResultCacheVersion) + "\n" +
+                       "extra-channels " + (isLoadingExtraChannels() ? "on" : "off") + "\n" +
+                       settings + "\n";
+
+    for (const std::string& input : inputs) {
+        if (hashContent_) {
+            uint64_t hash;
+            if (!hashFileContents(input, hash)) {
+                return false;
+            }
+            text += "content " + hex64(hash) + "\n";
+        } else {
+            InputKey id;
+            if (!makeInputKey(input, PixelBox(), id)) {
+                return false;
+            }
+            text += "file " + std::to_string(id.device) + " " + std::to_string(id.inode) + " " +
+                    std::to_string(id.size) + " " + std::to_string(id.mtimeNs) + "\n";
+        }
+    }
+
+    // 128 bits from two independently seeded hashes
+    key = hex64(hashBytes(text.data(), text.size(), 0)) +
+          hex64(hashBytes(text.data(), text.size(), 1));
+    return true;
+}
+
+bool ResultCache::fetch(const std::string& key, const std::vector<CachedOutput>& outputs,
+                        bool link) {
+    fs::path entry = fs::path(directory_) / key;
+    std::error_code ec;
+
+    bool complete = fs::is_directory(entry, ec);
+    for (const CachedOutput& output : outputs) {
+        complete = complete && fs::is_regular_file(entry / output.name, ec);
+    }
+    if (!complete) {
+        record("miss");
+        return false;
+    }
+
+    for (const CachedOutput& output : outputs) {
+        fs::path source = entry / output.name;
+        fs::remove(output.path, ec);
+        if (link) {
+            fs::create_hard_link(source, output.path, ec);
+            if (!ec) {
+                continue;
+            }
+            // Across filesystems, fall back to a copy
+        }
+        ec.clear();
+        fs::copy_file(source, output.path, fs::copy_options::overwrite_existing, ec);
+        if (ec) {
+            logError("Result cache: failed to restore " + output.path + ": " + ec.message());
+            record("miss");
+            return false;
+        }
+    }
+
+    record("hit");
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const std::vector<CachedOutput>& outputs) const {
+    fs::path entry = fs::path(directory_) / key;
+    fs::path staging = fs::path(directory_) / (key + ".tmp." + std::to_string(::getpid()));
+    std::error_code ec;
+
+    if (fs::is_directory(entry, ec)) {
+        return;  // Another run stored it first
+    }
+
+    try {
+        fs::remove_all(staging);
+        fs::create_directories(staging);
+        for (const CachedOutput& output : outputs) {
+            fs::copy_file(output.path, staging / output.name);
+        }
+    } catch (const fs::filesystem_error& e) {
+        fs::remove_all(staging, ec);
+        throw DeepWriterException("Failed to store result cache entry: " + std::string(e.what()));
+    }
+
+    // Publish atomically; if another run won the race, keep its entry
+    fs::rename(staging, entry, ec);
+    if (ec) {
+        fs::remove_all(staging, ec);
+    }
+}
+
+void detachOutput(const std::string& path) {
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+void ResultCache::record(const char* event) const {
+    std::error_code ec;
+    fs::create_directories(directory_, ec);
+
+    // O_APPEND keeps concurrent runs' lines whole
+    std::string path = (fs::path(directory_) / "stats.log").string();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return;
+    }
+    std::string line = std::string(event) + "\n";
+    ssize_t written = ::write(fd, line.data(), line.size());
+    (void)written;
+    ::close(fd);
+}
+
+void ResultCache::statistics(size_t& hits, size_t& misses) const {
+    hits = 0;
+    misses = 0;
+    std::ifstream in(fs::path(directory_) / "stats.log");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line == "hit") {
+            hits++;
+        } else if (line == "miss") {
+            misses++;
+        }
+    }
+}
+
+} // namespace deep_compositor
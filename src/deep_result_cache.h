@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * One output of a composite, as stored in a ResultCache entry
+ */
+struct CachedOutput {
+    std::string name;  // File name inside the entry (e.g. "flat.exr")
+    std::string path;  // Where the composite writes / wants it
+};
+
+/**
+ * Content-addressed on-disk cache of composite outputs
+ *
+ * A retried or re-submitted composite with the same inputs and settings
+ * produces byte-identical files, so they are looked up by a key instead of
+ * recomputed. The key hashes a settings string (tool version, merge
+ * options, ROI, output selection and layout), whether inputs are loaded
+ * with their extra channels (see setLoadExtraChannels), and every input in
+ * order, each by file identity (device, inode, size, mtime) or, with
+ * hashContent, by the hash of its bytes, which also matches re-rendered
+ * but identical inputs.
+ *
+ * Directory layout:
+ *   <key>/<output name>  one directory per cached composite
+ *   stats.log            one "hit"/"miss" line per lookup (appended)
+ *
+ * Entries are published with a directory rename, so concurrent runs on a
+ * shared cache see either a complete entry or none.
+ */
+class ResultCache {
+public:
+    /**
+     * @param directory Cache directory (created on first store)
+     * @param hashContent Key inputs by content instead of file identity
+     */
+    explicit ResultCache(const std::string& directory, bool hashContent = false);
+
+    /**
+     * Compute the key for a composite
+     *
+     * @param inputs Input files in composite order
+     * @param settings Everything else that affects the output bytes,
+     *        including the tool version
+     * @param key Output: hex key
+     * @return false if an input can't be stat'ed or read (no caching)
+     */
+    bool computeKey(const std::vector<std::string>& inputs, const std::string& settings,
+                    std::string& key) const;
+
+    /**
+     * Restore the outputs of a cached composite
+     *
+     * Copies each output from the entry, or hard-links it with link (the
+     * linked file then shares storage with the cache: detachOutput it
+     * before rewriting it). Records a hit or miss in the statistics.
+     *
+     * @return false on a miss (no entry, or an output is missing from it)
+     */
+    bool fetch(const std::string& key, const std::vector<CachedOutput>& outputs, bool link);
+
+    /**
+     * Add the freshly written outputs of a composite under key
+     *
+     * The outputs are copied, so the entry never shares storage with them.
+     *
+     * @throws DeepWriterException on file errors
+     */
+    void store(const std::string& key, const std::vector<CachedOutput>& outputs) const;
+
+    /**
+     * Lookups recorded in the cache directory so far, by all processes
+     */
+    void statistics(size_t& hits, size_t& misses) const;
+
+    const std::string& directory() const { return directory_; }
+
+private:
+    void record(const char* event) const;
+
+    std::string directory_;
+    bool hashContent_;
+};
+
+/**
+ * Remove an output file that is about to be rewritten
+ *
+ * An output restored by ResultCache::fetch with link shares its inode with
+ * the cache entry, and the writers truncate and rewrite files in place, so
+ * writing through it would change the entry. A missing file is fine.
+ */
+void detachOutput(const std::string& path);
+
+} // namespace deep_compositor
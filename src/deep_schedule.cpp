@@ -0,0 +1,179 @@
+#include "deep_schedule.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+namespace deep_compositor {
+
+namespace {
+
+/**
+ * One thread's share of the units: the owner takes from the front,
+ * thieves from the back
+ */
+struct WorkerQueue {
+    std::mutex mutex;
+    size_t next = 0;
+    size_t end = 0;
+    
+    bool takeFront(size_t& unit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next == end) {
+            return false;
+        }
+        unit = next++;
+        return true;
+    }
+    
+    bool takeBack(size_t& unit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (next == end) {
+            return false;
+        }
+        unit = --end;
+        return true;
+    }
+};
+
+} // anonymous namespace
+
+std::vector<WorkUnit> partitionByCost(const std::vector<uint64_t>& costs, size_t count) {
+    std::vector<WorkUnit> units;
+    if (costs.empty() || count == 0) {
+        return units;
+    }
+    
+    // prefix[i] = cost of bins [0, i]
+    std::vector<uint64_t> prefix(costs.size());
+    uint64_t total = 0;
+    for (size_t i = 0; i < costs.size(); ++i) {
+        total += costs[i];
+        prefix[i] = total;
+    }
+    
+    size_t begin = 0;
+    for (size_t k = 1; k <= count && begin < costs.size(); ++k) {
+        // Unit k ends after the first bin that reaches k/count of the total
+        size_t end = costs.size();
+        if (k < count) {
+            uint64_t target = total / count * k + total % count * k / count;
+            end = static_cast<size_t>(std::lower_bound(prefix.begin() + begin, prefix.end(), target) -
+                                      prefix.begin()) + 1;
+            end = std::min(end, costs.size());
+        }
+        if (end <= begin) {
+            continue;
+        }
+        
+        WorkUnit unit;
+        unit.begin = begin;
+        unit.end = end;
+        unit.cost = prefix[end - 1] - (begin > 0 ? prefix[begin - 1] : 0);
+        units.push_back(unit);
+        begin = end;
+    }
+    return units;
+}
+
+ScheduleStats runWorkUnits(const std::vector<WorkUnit>& units, int threads,
+                           const std::function<void(const WorkUnit& unit, int worker)>& fn,
+                           TaskScheduler& scheduler) {
+    ScheduleStats stats;
+    stats.units = units.size();
+    size_t threadCount = std::min({units.size(), static_cast<size_t>(std::max(threads, 1)),
+                                   static_cast<size_t>(scheduler.threadCount())});
+    threadCount = std::max<size_t>(threadCount, 1);
+    stats.threads = units.empty() ? 0 : threadCount;
+    if (units.empty()) {
+        return stats;
+    }
+    
+    if (threadCount == 1) {
+        for (const WorkUnit& unit : units) {
+            fn(unit, 0);
+        }
+        return stats;
+    }
+    
+    // Equal-cost contiguous shares, one per thread
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    uint64_t total = 0;
+    for (const WorkUnit& unit : units) {
+        total += unit.cost;
+    }
+    uint64_t done = 0;
+    size_t next = 0;
+    for (size_t w = 0; w < threadCount; ++w) {
+        queues.emplace_back(new WorkerQueue());
+        queues[w]->next = next;
+        uint64_t target = total / threadCount * (w + 1) + total % threadCount * (w + 1) / threadCount;
+        while (next < units.size() && (done < target || w + 1 == threadCount)) {
+            done += units[next++].cost;
+        }
+        queues[w]->end = next;
+    }
+    
+    std::atomic<size_t> steals{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    std::vector<double> busyMs(threadCount, 0.0);
+    
+    auto work = [&](size_t w) {
+        Timer timer;
+        size_t unit;
+        try {
+            while (!failed.load(std::memory_order_relaxed)) {
+                if (queues[w]->takeFront(unit)) {
+                    fn(units[unit], static_cast<int>(w));
+                    continue;
+                }
+                
+                // Own share done: steal from the back of someone else's
+                bool stole = false;
+                for (size_t i = 1; i < threadCount && !stole; ++i) {
+                    stole = queues[(w + i) % threadCount]->takeBack(unit);
+                }
+                if (!stole) {
+                    break;
+                }
+                steals.fetch_add(1, std::memory_order_relaxed);
+                fn(units[unit], static_cast<int>(w));
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            failed.store(true, std::memory_order_relaxed);
+        }
+        busyMs[w] = timer.elapsedMs();
+    };
+    
+    TaskGroup group(scheduler);
+    for (size_t w = 1; w < threadCount; ++w) {
+        group.run([&work, w]() { work(w); });
+    }
+    work(0);
+    group.wait();
+    
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    
+    double sum = 0.0;
+    double peak = 0.0;
+    for (double ms : busyMs) {
+        sum += ms;
+        peak = std::max(peak, ms);
+    }
+    stats.steals = steals.load();
+    stats.balance = peak > 0.0 ? sum / threadCount / peak : 1.0;
+    return stats;
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "deep_tasks.h"
+
+namespace deep_compositor {
+
+/**
+ * A contiguous run of cost bins [begin, end) processed as one piece of work
+ */
+struct WorkUnit {
+    size_t begin = 0;
+    size_t end = 0;
+    uint64_t cost = 0;  // Sum of the bins' costs
+};
+
+/**
+ * How a runWorkUnits() call went
+ */
+struct ScheduleStats {
+    size_t threads = 0;
+    size_t units = 0;
+    size_t steals = 0;     // Units run by a thread other than their owner
+    double balance = 1.0;  // Mean / max busy time per thread (1 = perfectly even)
+};
+
+/**
+ * Cut a sequence of per-bin costs into at most `count` contiguous units of
+ * about equal total cost
+ *
+ * Unit boundaries are found by binary search in the prefix sum of `costs`,
+ * so a single expensive bin can't be split but everything around it is
+ * spread evenly. Empty units are dropped.
+ */
+std::vector<WorkUnit> partitionByCost(const std::vector<uint64_t>& costs, size_t count);
+
+/**
+ * Run `fn(unit, worker)` for every unit on `threads` threads of `scheduler`
+ *
+ * Each thread starts with an equal-cost contiguous share of the units and
+ * works through it front to back; a thread that runs out steals from the
+ * back of another thread's share, so cost estimates only need to be
+ * roughly right. Blocks until every unit has run. If `fn` throws, the
+ * remaining units are skipped and the first exception is rethrown.
+ *
+ * @param threads Worker count (clamped to [1, units.size()] and to the
+ *        pool's size); 1 runs everything on the calling thread
+ */
+ScheduleStats runWorkUnits(const std::vector<WorkUnit>& units, int threads,
+                           const std::function<void(const WorkUnit& unit, int worker)>& fn,
+                           TaskScheduler& scheduler = TaskScheduler::shared());
+
+} // namespace deep_compositor
@@ -0,0 +1,428 @@
+#include "deep_select.h"
+#include "deep_pager.h"
+#include "deep_tasks.h"
+#include "deep_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+namespace deep_compositor {
+
+// ============================================================================
+// ID sets
+// ============================================================================
+
+void IdSet::add(uint32_t first, uint32_t last) {
+    ranges.emplace_back(first, last);
+    std::sort(ranges.begin(), ranges.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> merged;
+    for (const auto& range : ranges) {
+        if (!merged.empty() && uint64_t(range.first) <= uint64_t(merged.back().second) + 1) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    ranges.swap(merged);
+}
+
+bool IdSet::contains(uint32_t id) const {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), id,
+                               [](uint32_t value, const std::pair<uint32_t, uint32_t>& range) {
+        return value < range.first;
+    });
+    return it != ranges.begin() && id <= std::prev(it)->second;
+}
+
+namespace {
+
+/**
+ * Parse the unsigned 32-bit number at text[pos], advancing pos past it
+ */
+bool parseId(const std::string& text, size_t& pos, uint32_t& id) {
+    uint64_t value = 0;
+    size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+        value = value * 10 + static_cast<uint64_t>(text[pos] - '0');
+        if (value > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+        pos++;
+    }
+    id = static_cast<uint32_t>(value);
+    return pos > start;
+}
+
+} // anonymous namespace
+
+bool parseIdSet(const std::string& text, IdSet& ids) {
+    ids.ranges.clear();
+    size_t pos = 0;
+
+    while (true) {
+        uint32_t first, last;
+        if (!parseId(text, pos, first)) {
+            return false;
+        }
+        last = first;
+        if (pos < text.size() && text[pos] == '-') {
+            pos++;
+            if (!parseId(text, pos, last) || last < first) {
+                return false;
+            }
+        }
+        ids.add(first, last);
+
+        if (pos == text.size()) {
+            break;
+        }
+        if (text[pos] != ',') {
+            return false;
+        }
+        pos++;
+    }
+
+    return !ids.empty();
+}
+
+int findIdChannel(const ChannelSet& channels, const std::string& channel) {
+    if (!channel.empty()) {
+        return channels.findExtra(channel);
+    }
+    for (size_t c = 0; c < channels.extras.size(); ++c) {
+        if (channels.extras[c].isId) {
+            return static_cast<int>(c);
+        }
+    }
+    return -1;
+}
+
+uint32_t idValue(float value, const ExtraChannel& channel) {
+    if (channel.isUint) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    return std::isfinite(value) ? static_cast<uint32_t>(std::llround(value)) : 0u;
+}
+
+// ============================================================================
+// Presence index
+// ============================================================================
+
+void IdBits::add(uint32_t id) {
+    // Fibonacci hashing spreads consecutive IDs over the buckets
+    uint32_t bucket = (id * 0x9E3779B1u) >> 24;
+    words[bucket >> 6] |= uint64_t(1) << (bucket & 63);
+}
+
+void IdBits::addAll(const IdSet& ids) {
+    for (const auto& range : ids.ranges) {
+        if (range.second - range.first >= 4096) {
+            std::fill(std::begin(words), std::end(words), ~uint64_t(0));
+            return;
+        }
+        for (uint64_t id = range.first; id <= range.second; ++id) {
+            add(static_cast<uint32_t>(id));
+        }
+    }
+}
+
+IdPresenceIndex::IdPresenceIndex(const DeepImage& img, int channel, int tileSize)
+    : channel_(channel), tileSize_(tileSize) {
+    const std::vector<ExtraChannel>& extras = img.channels().extras;
+    if (channel < 0 || static_cast<size_t>(channel) >= extras.size()) {
+        throw std::invalid_argument("ID index: the image has no extra channel " +
+                                    std::to_string(channel));
+    }
+    if (tileSize <= 0) {
+        throw std::invalid_argument("ID index: tile size must be positive");
+    }
+
+    tilesX_ = (img.width() + tileSize - 1) / tileSize;
+    tilesY_ = (img.height() + tileSize - 1) / tileSize;
+    tiles_.resize(static_cast<size_t>(tilesX_) * static_cast<size_t>(tilesY_));
+    if (tiles_.empty()) {
+        return;
+    }
+
+    // Column buffers stay in memory for out-of-core images, so no tile is
+    // paged in; each task writes only its own tile
+    TraceZone zone("IdPresenceIndex");
+    const ExtraChannel& id = extras[channel];
+    size_t extraCount = extras.size();
+    parallelForTiles(PixelBox(0, 0, img.width() - 1, img.height() - 1), tileSize,
+                     [&](const PixelBox& box) {
+        Tile& tile = tiles_[static_cast<size_t>(box.minY / tileSize) * tilesX_ + box.minX / tileSize];
+        for (int y = box.minY; y <= box.maxY; ++y) {
+            for (int x = box.minX; x <= box.maxX; ++x) {
+                const std::vector<float>& columns = img.extraColumns(x, y);
+                if (columns.empty()) {
+                    tile.zeroFilled = true;
+                    continue;
+                }
+                size_t count = columns.size() / extraCount;
+                const float* values = columns.data() + static_cast<size_t>(channel) * count;
+                for (size_t s = 0; s < count; ++s) {
+                    tile.bits.add(idValue(values[s], id));
+                }
+            }
+        }
+    });
+}
+
+bool IdPresenceIndex::mayContain(int tx, int ty, const IdSet& ids, const IdBits& bits) const {
+    const Tile& tile = tiles_[static_cast<size_t>(ty) * tilesX_ + tx];
+    return tile.bits.intersects(bits) || (tile.zeroFilled && ids.contains(0));
+}
+
+// ============================================================================
+// Selection
+// ============================================================================
+
+namespace {
+
+/**
+ * Keeps or drops the samples of single pixels
+ */
+struct PixelFilter {
+    const IdSelection& selection;
+    const ExtraChannel& id;
+    size_t channel;
+    size_t extraCount;
+
+    bool keeps(uint32_t value) const { return selection.ids.contains(value) == selection.keep; }
+
+    /**
+     * Samples of pixel (x, y) the selection keeps; only reads the pixel's
+     * samples when its IDs are all 0 and 0 is kept
+     */
+    size_t keptCount(const DeepImage& img, int x, int y) const {
+        const std::vector<float>& columns = img.extraColumns(x, y);
+        if (columns.empty()) {
+            return keeps(0) ? img.pixel(x, y).sampleCount() : 0;
+        }
+        size_t count = columns.size() / extraCount;
+        const float* ids = columns.data() + channel * count;
+        size_t kept = 0;
+        for (size_t s = 0; s < count; ++s) {
+            kept += keeps(idValue(ids[s], id));
+        }
+        return kept;
+    }
+
+    /**
+     * Kept samples of `in` and their columns, in order
+     *
+     * @param keptIndices Scratch space, reused across calls
+     */
+    void apply(const DeepPixel& in, const std::vector<float>& inColumns, DeepPixel& out,
+               std::vector<float>& outColumns, std::vector<size_t>& keptIndices) const {
+        out.clear();
+        outColumns.clear();
+        if (inColumns.empty()) {
+            if (keeps(0)) {
+                out = in;
+            }
+            return;
+        }
+
+        const std::vector<DeepSample>& samples = in.samples();
+        size_t count = samples.size();
+        const float* ids = inColumns.data() + channel * count;
+        keptIndices.clear();
+        for (size_t s = 0; s < count; ++s) {
+            if (keeps(idValue(ids[s], id))) {
+                keptIndices.push_back(s);
+            }
+        }
+        if (keptIndices.size() == count) {
+            out = in;
+            outColumns = inColumns;
+            return;
+        }
+        if (keptIndices.empty()) {
+            return;
+        }
+
+        // A subsequence of sorted samples is still sorted
+        size_t kept = keptIndices.size();
+        std::vector<DeepSample>& outSamples = out.samples();
+        outSamples.reserve(kept);
+        for (size_t s : keptIndices) {
+            outSamples.push_back(samples[s]);
+        }
+        outColumns.resize(extraCount * kept);
+        for (size_t c = 0; c < extraCount; ++c) {
+            const float* from = inColumns.data() + c * count;
+            float* to = outColumns.data() + c * kept;
+            for (size_t j = 0; j < kept; ++j) {
+                to[j] = from[keptIndices[j]];
+            }
+        }
+    }
+};
+
+/**
+ * What selectById does with one tile of the index
+ */
+struct TileWork {
+    bool filter = false;  // May hold a selected ID
+    int minX = std::numeric_limits<int>::max();  // Bounds of the pixels kept
+    int minY = std::numeric_limits<int>::max();
+    int maxX = std::numeric_limits<int>::min();
+    int maxY = std::numeric_limits<int>::min();
+    size_t keptSamples = 0;
+
+    bool empty() const { return keptSamples == 0; }
+    PixelBox kept() const { return empty() ? PixelBox() : PixelBox(minX, minY, maxX, maxY); }
+};
+
+} // anonymous namespace
+
+DeepImage selectById(const DeepImage& img, const IdSelection& selection,
+                     const IdPresenceIndex& index, SelectStats* stats) {
+    TraceZone zone("selectById");
+    const ChannelSet& channels = img.channels();
+    int channel = findIdChannel(channels, selection.channel);
+    if (channel < 0) {
+        throw std::invalid_argument(selection.channel.empty()
+                                        ? "selectById: the image has no ID channel"
+                                        : "selectById: the image has no channel " + selection.channel);
+    }
+    int tileSize = index.tileSize();
+    if (index.channel() != channel || index.tilesX() != (img.width() + tileSize - 1) / tileSize ||
+        index.tilesY() != (img.height() + tileSize - 1) / tileSize) {
+        throw std::invalid_argument("selectById: the ID index is of another channel or image");
+    }
+
+    PixelFilter filter{selection, channels.extras[channel], static_cast<size_t>(channel),
+                       channels.extras.size()};
+    IdBits bits;
+    bits.addAll(selection.ids);
+
+    // Paged images are single-threaded
+    std::shared_ptr<TilePager> pager = outOfCorePager();
+    bool serial = img.isOutOfCore() || pager;
+    size_t tileCount = static_cast<size_t>(index.tilesX()) * static_cast<size_t>(index.tilesY());
+    auto forTiles = [&](const std::function<void(size_t)>& fn) {
+        if (serial) {
+            for (size_t t = 0; t < tileCount; ++t) {
+                fn(t);
+            }
+        } else {
+            parallelFor(0, tileCount, 1, [&](size_t begin, size_t end) {
+                for (size_t t = begin; t < end; ++t) {
+                    fn(t);
+                }
+            });
+        }
+    };
+    auto tileBox = [&](size_t t) {
+        int x = static_cast<int>(t % index.tilesX()) * tileSize;
+        int y = static_cast<int>(t / index.tilesX()) * tileSize;
+        return PixelBox(x, y, std::min(img.width(), x + tileSize) - 1,
+                        std::min(img.height(), y + tileSize) - 1);
+    };
+
+    // Pass 1: which tiles may hold selected IDs, and the pixels each keeps.
+    // Tiles that can't are skipped when keeping and kept whole when dropping.
+    std::vector<TileWork> work(tileCount);
+    forTiles([&](size_t t) {
+        TileWork& tile = work[t];
+        tile.filter = index.mayContain(static_cast<int>(t % index.tilesX()),
+                                       static_cast<int>(t / index.tilesX()), selection.ids, bits);
+        if (!tile.filter && selection.keep) {
+            return;
+        }
+        PixelBox box = tileBox(t);
+        for (int y = box.minY; y <= box.maxY; ++y) {
+            for (int x = box.minX; x <= box.maxX; ++x) {
+                size_t kept = tile.filter ? filter.keptCount(img, x, y)
+                                          : img.pixel(x, y).sampleCount();
+                if (kept) {
+                    tile.minX = std::min(tile.minX, x);
+                    tile.minY = std::min(tile.minY, y);
+                    tile.maxX = std::max(tile.maxX, x);
+                    tile.maxY = std::max(tile.maxY, y);
+                    tile.keptSamples += kept;
+                }
+            }
+        }
+    });
+
+    PixelBox window;
+    for (const TileWork& tile : work) {
+        window = window.unite(tile.kept());
+    }
+    PixelBox absolute;
+    if (!window.isEmpty()) {
+        absolute = PixelBox(window.minX + img.originX(), window.minY + img.originY(),
+                            window.maxX + img.originX(), window.maxY + img.originY());
+    }
+    DeepImage result(absolute);
+    result.setDisplayWindow(img.displayWindow());
+    result.setChannels(channels);
+    bool paged = pager && !absolute.isEmpty();
+    if (paged) {
+        result.enableOutOfCore(pager);
+    }
+
+    // Pass 2: copy what each tile keeps. Pixels are built before they are
+    // stored, so paging the result can't evict a source pixel in use.
+    forTiles([&](size_t t) {
+        const TileWork& tile = work[t];
+        PixelBox box = tile.kept();
+        DeepPixel pixel;
+        std::vector<float> columns;
+        std::vector<size_t> keptIndices;
+        for (int y = box.minY; y <= box.maxY; ++y) {
+            for (int x = box.minX; x <= box.maxX; ++x) {
+                if (tile.filter) {
+                    filter.apply(img.pixel(x, y), img.extraColumns(x, y), pixel, columns,
+                                 keptIndices);
+                } else {
+                    pixel = img.pixel(x, y);
+                    columns = img.extraColumns(x, y);
+                }
+                if (pixel.isEmpty()) {
+                    continue;
+                }
+                int rx = x - window.minX;
+                int ry = y - window.minY;
+                (paged ? result.pixel(rx, ry) : result.pixelUnchecked(rx, ry)) = std::move(pixel);
+                result.extraColumns(rx, ry) = std::move(columns);
+            }
+        }
+    });
+
+    if (stats) {
+        *stats = SelectStats();
+        stats->tiles = tileCount;
+        for (const TileWork& tile : work) {
+            if (!tile.filter) {
+                (selection.keep ? stats->skippedTiles : stats->copiedTiles)++;
+            }
+            stats->keptSamples += tile.keptSamples;
+        }
+    }
+    return result;
+}
+
+DeepImage selectById(const DeepImage& img, const IdSelection& selection, SelectStats* stats) {
+    int channel = findIdChannel(img.channels(), selection.channel);
+    if (channel < 0) {
+        throw std::invalid_argument(selection.channel.empty()
+                                        ? "selectById: the image has no ID channel"
+                                        : "selectById: the image has no channel " + selection.channel);
+    }
+    return selectById(img, selection, IdPresenceIndex(img, channel), stats);
+}
+
+} // namespace deep_compositor
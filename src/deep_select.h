@@ -0,0 +1,160 @@
+#pragma once
+
+#include "deep_image.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace deep_compositor {
+
+// ============================================================================
+// ID selection
+// ============================================================================
+//
+// Isolates or removes objects by the values of an ID channel (see
+// ExtraChannel): every sample whose ID is in the set is kept (or dropped),
+// with its extra channel values. UINT channels are matched by their 32-bit
+// value, float ID channels by their value rounded to an integer. Pixels
+// whose extra channels are all zero (an empty column buffer) have ID 0.
+
+/**
+ * A set of IDs, as inclusive ranges
+ */
+struct IdSet {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;  // Sorted, disjoint
+
+    /**
+     * Add the IDs first..last, merging with overlapping or adjacent ranges
+     */
+    void add(uint32_t first, uint32_t last);
+
+    bool contains(uint32_t id) const;
+    bool empty() const { return ranges.empty(); }
+};
+
+/**
+ * Parse an ID list such as "7", "3,7,12-15" or "1000-1999"
+ *
+ * @return false if the list is malformed or empty
+ */
+bool parseIdSet(const std::string& text, IdSet& ids);
+
+/**
+ * What selectById keeps
+ */
+struct IdSelection {
+    IdSet ids;
+    bool keep = true;      // Keep the samples with these IDs (isolate) or drop them (remove)
+    std::string channel;   // ID channel to match (empty = the image's first ID channel)
+};
+
+/**
+ * Extra channel a selection matches in `channels`: the one named
+ * `channel`, or the first ID channel if it's empty (-1 if there is none)
+ */
+int findIdChannel(const ChannelSet& channels, const std::string& channel);
+
+/**
+ * ID of a sample from its value in extra channel `channel`
+ */
+uint32_t idValue(float value, const ExtraChannel& channel);
+
+/**
+ * 256 bits, one per hash bucket of IDs: a bucket's bit is set if any ID
+ * hashing to it may be present
+ */
+struct IdBits {
+    uint64_t words[4] = {};
+
+    void add(uint32_t id);
+    void addAll(const IdSet& ids);
+
+    bool intersects(const IdBits& other) const {
+        return ((words[0] & other.words[0]) | (words[1] & other.words[1]) |
+                (words[2] & other.words[2]) | (words[3] & other.words[3])) != 0;
+    }
+};
+
+/**
+ * Which IDs may be present in each tile of an image
+ *
+ * Built from the ID channel's columns alone, so an out-of-core image's
+ * samples aren't paged in. A tile's bits may claim IDs it doesn't have
+ * (hash collisions) but never miss one, so a selection can skip every
+ * tile whose bits don't meet its own. One index serves any number of
+ * selections on the same channel.
+ */
+class IdPresenceIndex {
+public:
+    static constexpr int kDefaultTileSize = 64;
+
+    IdPresenceIndex() = default;
+
+    /**
+     * Index extra channel `channel` of `img` in tileSize x tileSize tiles
+     * (image-relative, from 0,0)
+     *
+     * @throws std::invalid_argument if `channel` isn't one of img's extra channels
+     */
+    IdPresenceIndex(const DeepImage& img, int channel, int tileSize = kDefaultTileSize);
+
+    int channel() const { return channel_; }
+    int tileSize() const { return tileSize_; }
+    int tilesX() const { return tilesX_; }
+    int tilesY() const { return tilesY_; }
+
+    /**
+     * True if tile (tx, ty) may hold a sample with an ID in `ids`, whose
+     * bits are `bits`
+     */
+    bool mayContain(int tx, int ty, const IdSet& ids, const IdBits& bits) const;
+
+private:
+    struct Tile {
+        IdBits bits;
+        bool zeroFilled = false;  // Has pixels with an empty column buffer (ID 0)
+    };
+
+    int channel_ = -1;
+    int tileSize_ = kDefaultTileSize;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+    std::vector<Tile> tiles_;
+};
+
+/**
+ * Work done by selectById
+ */
+struct SelectStats {
+    size_t tiles = 0;          // Tiles of the index
+    size_t skippedTiles = 0;   // Tiles without a selected ID, not visited (keep mode)
+    size_t copiedTiles = 0;    // Tiles without a selected ID, copied whole (drop mode)
+    size_t keptSamples = 0;    // Samples in the result
+};
+
+/**
+ * The samples of `img` that `selection` keeps
+ *
+ * Only tiles that may hold a selected ID (see IdPresenceIndex) are
+ * filtered sample by sample; the others are skipped when keeping and
+ * copied when dropping. The result has img's channels and display window,
+ * and its data window is cropped to the pixels with samples left, so
+ * writing it writes only the selection (an empty window if nothing is
+ * left). It is paged like loaded images (see setOutOfCorePager).
+ *
+ * @param index Index of img's selected ID channel
+ * @throws std::invalid_argument if img has no such channel or `index`
+ *         covers another one
+ */
+DeepImage selectById(const DeepImage& img, const IdSelection& selection,
+                     const IdPresenceIndex& index, SelectStats* stats = nullptr);
+
+/**
+ * selectById, indexing img first
+ */
+DeepImage selectById(const DeepImage& img, const IdSelection& selection,
+                     SelectStats* stats = nullptr);
+
+} // namespace deep_compositor
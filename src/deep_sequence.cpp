@@ -0,0 +1,349 @@
+#include "deep_sequence.h"
+#include "deep_input_cache.h"
+#include "deep_trace.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace deep_compositor {
+
+// ============================================================================
+// Frame patterns
+// ============================================================================
+
+namespace {
+
+/**
+ * Locate the frame token in a pattern
+ *
+ * @param start Output: offset of the token
+ * @param length Output: token length in characters
+ * @param padding Output: zero-padded width (0 = none)
+ */
+bool findFrameToken(const std::string& pattern, size_t& start, size_t& length, int& padding) {
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] == '#') {
+            size_t end = pattern.find_first_not_of('#', i);
+            if (end == std::string::npos) {
+                end = pattern.size();
+            }
+            start = i;
+            length = end - i;
+            padding = static_cast<int>(length);
+            return true;
+        }
+
+        if (pattern[i] == '%') {
+            // %d or %0Nd
+            size_t j = i + 1;
+            int width = 0;
+            if (j < pattern.size() && pattern[j] == '0') {
+                ++j;
+                while (j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9') {
+                    width = width * 10 + (pattern[j] - '0');
+                    ++j;
+                }
+            }
+            if (j < pattern.size() && pattern[j] == 'd') {
+                start = i;
+                length = j + 1 - i;
+                padding = width;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+bool hasFramePattern(const std::string& pattern) {
+    size_t start, length;
+    int padding;
+    return findFrameToken(pattern, start, length, padding);
+}
+
+std::string expandFramePattern(const std::string& pattern, int frame) {
+    size_t start, length;
+    int padding;
+    if (!findFrameToken(pattern, start, length, padding)) {
+        return pattern;
+    }
+
+    char digits[32];
+    std::snprintf(digits, sizeof(digits), "%0*d", padding, frame);
+    return pattern.substr(0, start) + digits + pattern.substr(start + length);
+}
+
+bool parseFrameList(const std::string& text, std::vector<int>& frames) {
+    frames.clear();
+    size_t pos = 0;
+
+    while (pos <= text.size()) {
+        size_t comma = text.find(',', pos);
+        std::string part = text.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+
+        int first, last, step = 1;
+        char tail;
+        if (std::sscanf(part.c_str(), "%d-%dx%d%c", &first, &last, &step, &tail) == 3 ||
+            std::sscanf(part.c_str(), "%d-%d%c", &first, &last, &tail) == 2) {
+            // range, optionally stepped
+        } else if (std::sscanf(part.c_str(), "%d%c", &first, &tail) == 1) {
+            last = first;
+        } else {
+            return false;
+        }
+        if (step <= 0 || last < first) {
+            return false;
+        }
+
+        // Counted, so a range ending near INT_MAX can't overflow the frame
+        long long count = (static_cast<long long>(last) - first) / step + 1;
+        for (long long i = 0; i < count; ++i) {
+            frames.push_back(static_cast<int>(first + i * step));
+        }
+
+        if (comma == std::string::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+
+    return !frames.empty();
+}
+
+// ============================================================================
+// Pipeline
+// ============================================================================
+
+namespace {
+
+/**
+ * Blocking single-producer/single-consumer rendezvous: push() returns only
+ * once the consumer has taken the item, so nothing waits in between stages
+ */
+template<typename T>
+class Handoff {
+public:
+    Handoff() : closed_(false), pushed_(0), popped_(0) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        items_.push_back(std::move(item));
+        uint64_t ticket = ++pushed_;
+        notEmpty_.notify_one();
+        taken_.wait(lock, [&] { return popped_ >= ticket; });
+    }
+
+    /**
+     * @return false once the queue is closed and drained
+     */
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [&] { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        popped_++;
+        taken_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    bool closed_;
+    uint64_t pushed_;
+    uint64_t popped_;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable taken_;
+};
+
+/**
+ * A frame travelling through the pipeline. Inputs ride along to the writer
+ * stage so they are freed there, not on the merge thread.
+ */
+struct FrameJob {
+    FrameResult result;
+    std::vector<std::shared_ptr<const DeepImage>> inputs;
+};
+
+} // anonymous namespace
+
+SequenceSummary compositeSequence(const std::vector<std::string>& patterns,
+                                  const std::vector<int>& frames,
+                                  const SequenceOptions& options,
+                                  const FrameWriter& writer) {
+    Timer timer;
+    SequenceSummary summary;
+
+    Handoff<FrameJob> loaded;
+    Handoff<FrameJob> merged;
+
+    // Frames from the start of their load until the writer releases them
+    std::atomic<size_t> inFlight(0);
+    std::atomic<size_t> peakInFlight(0);
+
+    // Flat buffers go back from the writer to the merge stage
+    std::mutex spareMutex;
+    std::vector<std::vector<float>> spareFlat;
+
+    std::thread loadStage([&]() {
+        setTraceThreadName("sequence load");
+        DeepInputCache cache(options.hashInputs);
+        std::vector<std::string> files(patterns.size());
+        std::vector<InputKey> keys(patterns.size());
+        std::vector<std::string> missingFiles;
+        std::vector<size_t> missing;
+
+        for (int frame : frames) {
+            size_t live = ++inFlight;
+            size_t peak = peakInFlight.load();
+            while (live > peak && !peakInFlight.compare_exchange_weak(peak, live)) {
+            }
+
+            FrameJob job;
+            job.result.frame = frame;
+            job.inputs.assign(patterns.size(), nullptr);
+            Timer loadTimer;
+            TraceZone zone("loadFrame");
+            zone.arg("frame", frame);
+
+            // Inputs unchanged since the last frame come from the cache
+            missing.clear();
+            missingFiles.clear();
+            for (size_t i = 0; i < patterns.size(); ++i) {
+                files[i] = expandFramePattern(patterns[i], frame);
+                if (options.reuseInputs) {
+                    job.inputs[i] = cache.find(files[i], options.loader.roi, keys[i]);
+                }
+                if (job.inputs[i]) {
+                    job.result.reusedInputs++;
+                } else {
+                    missing.push_back(i);
+                    missingFiles.push_back(files[i]);
+                }
+            }
+
+            std::vector<LoadResult> results = loadDeepEXRFiles(missingFiles, options.loader);
+            for (size_t m = 0; m < results.size(); ++m) {
+                LoadResult& entry = results[m];
+                if (!entry.success) {
+                    job.result.error = "Failed to load " + entry.filename + ": " + entry.error;
+                    job.inputs.clear();
+                    break;
+                }
+                size_t i = missing[m];
+                job.inputs[i] = std::make_shared<const DeepImage>(std::move(entry.image));
+                if (options.reuseInputs) {
+                    cache.insert(keys[i], job.inputs[i]);
+                }
+            }
+            cache.endFrame();
+            job.result.loadTimeMs = loadTimer.elapsedMs();
+            zone.arg("loaded", static_cast<int64_t>(missing.size()));
+
+            loaded.push(std::move(job));
+        }
+
+        if (options.reuseInputs) {
+            logVerbose("  Input reuse: " + std::to_string(cache.hits()) + " reused, " +
+                       std::to_string(cache.misses()) + " loaded");
+        }
+        loaded.close();
+    });
+
+    std::thread mergeStage([&]() {
+        setTraceThreadName("sequence merge");
+        FrameJob job;
+        while (loaded.pop(job)) {
+            FrameResult& result = job.result;
+            TraceZone zone("mergeFrame");
+            zone.arg("frame", result.frame);
+
+            if (result.error.empty()) {
+                try {
+                    std::vector<const DeepImage*> ptrs;
+                    ptrs.reserve(job.inputs.size());
+                    for (const auto& img : job.inputs) {
+                        ptrs.push_back(img.get());
+                    }
+                    result.merged = deepMerge(ptrs, options.compositor, &result.stats);
+
+                    if (options.flatten) {
+                        {
+                            std::lock_guard<std::mutex> lock(spareMutex);
+                            if (!spareFlat.empty()) {
+                                result.flat = std::move(spareFlat.back());
+                                spareFlat.pop_back();
+                            }
+                        }
+                        Timer flattenTimer;
+                        flattenImage(result.merged, result.merged.dataWindow(), result.flat);
+                        result.stats.flattenTimeMs = flattenTimer.elapsedMs();
+                    }
+                    result.success = true;
+                } catch (const std::exception& e) {
+                    result.error = std::string("Merge failed: ") + e.what();
+                }
+            }
+
+            merged.push(std::move(job));
+        }
+        merged.close();
+    });
+
+    // The calling thread is the writer stage
+    FrameJob job;
+    while (merged.pop(job)) {
+        FrameResult& result = job.result;
+        if (result.success) {
+            TraceZone zone("writeFrame");
+            zone.arg("frame", result.frame);
+            try {
+                writer(result);
+            } catch (const std::exception& e) {
+                result.success = false;
+                result.error = std::string("Write failed: ") + e.what();
+            }
+        }
+
+        if (result.success) {
+            summary.framesWritten++;
+        } else {
+            summary.framesFailed++;
+            logError("Frame " + std::to_string(result.frame) + ": " + result.error);
+        }
+
+        job.inputs.clear();
+        if (!result.flat.empty()) {
+            std::lock_guard<std::mutex> lock(spareMutex);
+            spareFlat.push_back(std::move(result.flat));
+        }
+        result.merged = DeepImage();
+        inFlight--;
+    }
+
+    loadStage.join();
+    mergeStage.join();
+
+    summary.peakFramesInFlight = peakInFlight.load();
+    summary.totalTimeMs = timer.elapsedMs();
+    return summary;
+}
+
+} // namespace deep_compositor
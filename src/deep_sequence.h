@@ -0,0 +1,105 @@
+#pragma once
+
+#include "deep_compositor.h"
+#include "deep_image.h"
+#include "deep_loader.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * Substitute a frame number into a file pattern
+ *
+ * Understands printf-style "%d" / "%04d" and runs of '#' ("####" pads to
+ * four digits). A pattern without a frame token is returned unchanged, so
+ * a static layer can be listed by its plain filename.
+ */
+std::string expandFramePattern(const std::string& pattern, int frame);
+
+/**
+ * Check whether a pattern contains a frame token
+ */
+bool hasFramePattern(const std::string& pattern);
+
+/**
+ * Parse a frame list such as "1-100", "1-100x2", "7" or "1-10,20-30"
+ *
+ * @param text Frame list
+ * @param frames Output: frames in the order given
+ * @return false if the list is malformed or empty
+ */
+bool parseFrameList(const std::string& text, std::vector<int>& frames);
+
+/**
+ * Options for a frame-sequence run
+ */
+struct SequenceOptions {
+    LoaderOptions loader;           // Per-frame file loading (concurrency, ROI)
+    CompositorOptions compositor;
+    bool flatten = true;            // Produce FrameResult::flat
+    bool reuseInputs = true;        // Share decoded inputs across frames (see DeepInputCache)
+    bool hashInputs = false;        // Also match reused inputs by content hash
+};
+
+/**
+ * One composited frame, handed to the writer stage
+ */
+struct FrameResult {
+    int frame = 0;
+    bool success = false;
+    std::string error;              // Set when success is false
+    DeepImage merged;
+    std::vector<float> flat;        // Flattened data window (if options.flatten)
+    CompositorStats stats;
+    double loadTimeMs = 0.0;
+    size_t reusedInputs = 0;        // Inputs shared with an earlier frame
+};
+
+/**
+ * Totals for a sequence run
+ */
+struct SequenceSummary {
+    size_t framesWritten = 0;
+    size_t framesFailed = 0;
+    size_t peakFramesInFlight = 0;  // Most frames held by the pipeline at once
+    double totalTimeMs = 0.0;
+};
+
+/**
+ * Writer stage callback, called once per frame in frame order. Throwing
+ * marks the frame as failed.
+ */
+using FrameWriter = std::function<void(FrameResult& result)>;
+
+/**
+ * Composite a range of frames through a pipelined worker pool
+ *
+ * Three stages run on their own threads: loading frame N+1 overlaps
+ * merging frame N and writing frame N-1. A stage hands a frame on only
+ * when the next stage takes it, and starts its next frame after that, so
+ * at most three frames are in memory. Flat buffers are
+ * recycled from the writer back to the merge stage, and decoded inputs are
+ * released on the writer thread, off the merge path.
+ *
+ * With options.reuseInputs, inputs whose file is unchanged since the
+ * previous frame (a held frame, a static set piece listed without a frame
+ * token) are not read again: the decoded image is shared between frames.
+ *
+ * A frame that fails to load or merge is passed to the writer with
+ * success = false; the rest of the range continues.
+ *
+ * @param patterns Input file patterns (see expandFramePattern)
+ * @param frames Frames to composite, in order
+ * @param options Loader, compositor and flatten options
+ * @param writer Called on the writer thread for every frame
+ */
+SequenceSummary compositeSequence(const std::vector<std::string>& patterns,
+                                  const std::vector<int>& frames,
+                                  const SequenceOptions& options,
+                                  const FrameWriter& writer);
+
+} // namespace deep_compositor
@@ -0,0 +1,607 @@
+#include "deep_server.h"
+#include "deep_loader.h"
+#include "deep_stream.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace deep_compositor {
+
+// ============================================================================
+// Request text
+// ============================================================================
+
+namespace {
+
+// A path would end its line early and inject the rest as request lines
+bool hasLineBreak(const std::string& value) {
+    return value.find_first_of("\r\n") != std::string::npos;
+}
+
+} // anonymous namespace
+
+std::string formatRequest(const CompositeRequest& request) {
+    std::string text = "COMPOSITE\n";
+    for (const std::string& input : request.inputs) {
+        if (hasLineBreak(input)) {
+            throw CompositeServerException("Input path contains a line break: " + input);
+        }
+        text += "input " + input + "\n";
+    }
+    if (!request.roi.isEmpty()) {
+        text += "roi " + std::to_string(request.roi.minX) + " " + std::to_string(request.roi.minY) +
+                " " + std::to_string(request.roi.maxX) + " " + std::to_string(request.roi.maxY) + "\n";
+    }
+    char threshold[32];
+    std::snprintf(threshold, sizeof(threshold), "%.9g", request.mergeThreshold);
+    text += std::string("merge-threshold ") + threshold + "\n";
+    if (request.deepOutput) {
+        text += "deep\n";
+    }
+    if (request.flatOutput) {
+        text += "flat\n";
+    }
+    if (request.tiled) {
+        text += "tiled " + std::to_string(request.tileSize) + "\n";
+    }
+    text += "end\n";
+    return text;
+}
+
+bool parseRequest(const std::vector<std::string>& lines, CompositeRequest& request,
+                  std::string& error) {
+    request = CompositeRequest();
+    request.flatOutput = false;  // Outputs are listed explicitly
+
+    for (const std::string& line : lines) {
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? std::string() : line.substr(space + 1);
+        char tail;
+        bool ok = true;
+
+        if (key == "input") {
+            ok = !value.empty() && !hasLineBreak(value);
+            request.inputs.push_back(value);
+        } else if (key == "roi") {
+            int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+            ok = std::sscanf(value.c_str(), "%d %d %d %d%c", &x0, &y0, &x1, &y1, &tail) == 4;
+            request.roi = PixelBox(x0, y0, x1, y1);
+            ok = ok && !request.roi.isEmpty();
+        } else if (key == "merge-threshold") {
+            ok = std::sscanf(value.c_str(), "%f%c", &request.mergeThreshold, &tail) == 1;
+        } else if (key == "deep" && value.empty()) {
+            request.deepOutput = true;
+        } else if (key == "flat" && value.empty()) {
+            request.flatOutput = true;
+        } else if (key == "tiled") {
+            ok = std::sscanf(value.c_str(), "%d%c", &request.tileSize, &tail) == 1 &&
+                 request.tileSize > 0;
+            request.tiled = true;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            error = "Malformed request line: " + line;
+            return false;
+        }
+    }
+
+    if (request.inputs.empty()) {
+        error = "Request has no inputs";
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Socket helpers
+// ============================================================================
+
+namespace {
+
+const size_t kMaxLineLength = 1 << 16;
+
+/**
+ * Closes a descriptor when it goes out of scope
+ */
+struct SocketFd {
+    explicit SocketFd(int descriptor) : fd(descriptor) {}
+    ~SocketFd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    SocketFd(const SocketFd&) = delete;
+    SocketFd& operator=(const SocketFd&) = delete;
+    int fd;
+};
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        throw CompositeServerException("Invalid socket path (empty or longer than " +
+                                       std::to_string(sizeof(addr.sun_path) - 1) +
+                                       " bytes): " + path);
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return addr;
+}
+
+void sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw CompositeServerException(std::string("Socket write failed: ") + std::strerror(errno));
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+}
+
+void sendAll(int fd, const std::string& text) {
+    sendAll(fd, text.data(), text.size());
+}
+
+/**
+ * Buffered reads of lines and fixed-size blobs from a socket
+ */
+class SocketReader {
+public:
+    explicit SocketReader(int fd) : fd_(fd), pos_(0), end_(0) {}
+
+    /**
+     * @return false on a clean end of stream before any byte of the line
+     */
+    bool readLine(std::string& line) {
+        line.clear();
+        while (true) {
+            if (pos_ == end_ && !fill()) {
+                if (!line.empty()) {
+                    throw CompositeServerException("Connection closed mid-line");
+                }
+                return false;
+            }
+            char* start = buffer_ + pos_;
+            char* newline = static_cast<char*>(std::memchr(start, '\n', end_ - pos_));
+            size_t count = newline ? static_cast<size_t>(newline - start) : end_ - pos_;
+            line.append(start, count);
+            pos_ += count;
+            if (line.size() > kMaxLineLength) {
+                throw CompositeServerException("Protocol line too long");
+            }
+            if (newline) {
+                pos_++;
+                return true;
+            }
+        }
+    }
+
+    void readExact(char* out, size_t size) {
+        while (size > 0) {
+            if (pos_ == end_ && !fill()) {
+                throw CompositeServerException("Connection closed mid-message");
+            }
+            size_t count = std::min(size, end_ - pos_);
+            std::memcpy(out, buffer_ + pos_, count);
+            pos_ += count;
+            out += count;
+            size -= count;
+        }
+    }
+
+private:
+    bool fill() {
+        while (true) {
+            ssize_t got = ::recv(fd_, buffer_, sizeof(buffer_), 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                throw CompositeServerException(std::string("Socket read failed: ") + std::strerror(errno));
+            }
+            pos_ = 0;
+            end_ = static_cast<size_t>(got);
+            return got > 0;
+        }
+    }
+
+    int fd_;
+    size_t pos_;
+    size_t end_;
+    char buffer_[1 << 16];
+};
+
+void sendBlob(int fd, const char* name, const std::vector<char>& data) {
+    sendAll(fd, std::string(name) + " " + std::to_string(data.size()) + "\n");
+    sendAll(fd, data.data(), data.size());
+}
+
+void sendError(int fd, std::string message) {
+    for (char& c : message) {
+        if (c == '\n') {
+            c = ' ';
+        }
+    }
+    sendAll(fd, "ERROR " + message + "\n");
+}
+
+/**
+ * Read an "OK" reply's sections up to "end"
+ *
+ * Replies are "ERROR message" or "OK" followed by "key value" lines, where
+ * the blob keys (deep, flat, text) are followed by that many raw bytes.
+ */
+void readReply(SocketReader& reader, CompositeReply& reply, std::string* text) {
+    std::string line;
+    if (!reader.readLine(line)) {
+        throw CompositeServerException("Server closed the connection without a reply");
+    }
+    if (line.compare(0, 6, "ERROR ") == 0) {
+        reply.success = false;
+        reply.error = line.substr(6);
+        return;
+    }
+    if (line != "OK") {
+        throw CompositeServerException("Unexpected reply: " + line);
+    }
+
+    while (reader.readLine(line) && line != "end") {
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? std::string() : line.substr(space + 1);
+
+        try {
+            if (key == "deep" || key == "flat" || key == "text") {
+                std::vector<char> blob(std::stoull(value));
+                reader.readExact(blob.data(), blob.size());
+                if (key == "deep") {
+                    reply.deepExr = std::move(blob);
+                } else if (key == "flat") {
+                    reply.flatExr = std::move(blob);
+                } else if (text) {
+                    text->assign(blob.begin(), blob.end());
+                }
+            } else if (key == "samples") {
+                reply.outputSamples = std::stoull(value);
+            } else if (key == "cached") {
+                reply.cachedInputs = std::stoull(value);
+            } else if (key == "time") {
+                reply.timeMs = std::stod(value);
+            }
+        } catch (const std::logic_error&) {
+            throw CompositeServerException("Malformed reply line: " + line);
+        }
+    }
+    if (line != "end") {
+        throw CompositeServerException("Connection closed mid-reply");
+    }
+    reply.success = true;
+}
+
+} // anonymous namespace
+
+// ============================================================================
+// CompositeServer
+// ============================================================================
+
+CompositeServer::CompositeServer(const ServerOptions& options)
+    : options_(options),
+      cache_(options.cacheBudgetBytes),
+      listenFd_(-1),
+      stopping_(false),
+      requests_(0),
+      active_(0) {}
+
+CompositeServer::~CompositeServer() {
+    if (listenFd_ >= 0) {
+        ::close(listenFd_);
+    }
+}
+
+void CompositeServer::listen() {
+    sockaddr_un addr = socketAddress(options_.socketPath);
+
+    // A socket file nobody answers on is left over from a crashed server
+    struct stat st;
+    if (::lstat(options_.socketPath.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            throw CompositeServerException("Not a socket, refusing to replace: " + options_.socketPath);
+        }
+        SocketFd probe(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (probe.fd >= 0 &&
+            ::connect(probe.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            throw CompositeServerException("A server is already listening on " + options_.socketPath);
+        }
+        ::unlink(options_.socketPath.c_str());
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw CompositeServerException(std::string("Can't create socket: ") + std::strerror(errno));
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, 16) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw CompositeServerException("Can't listen on " + options_.socketPath + ": " +
+                                       std::strerror(err));
+    }
+    listenFd_ = fd;
+}
+
+void CompositeServer::run() {
+    if (listenFd_ < 0) {
+        throw CompositeServerException("Server is not listening");
+    }
+    log("Listening on " + options_.socketPath + " (input cache " +
+        formatBytes(options_.cacheBudgetBytes) + ")");
+
+    while (!stopping_) {
+        int fd = ::accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (!stopping_) {
+                logError(std::string("accept failed: ") + std::strerror(errno));
+            }
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(activeMutex_);
+            active_++;
+        }
+        std::thread([this, fd]() {
+            serveConnection(fd);
+            std::lock_guard<std::mutex> lock(activeMutex_);
+            active_--;
+            idle_.notify_all();
+        }).detach();
+    }
+
+    std::unique_lock<std::mutex> lock(activeMutex_);
+    idle_.wait(lock, [&] { return active_ == 0; });
+    ::unlink(options_.socketPath.c_str());
+    log("Server stopped after " + std::to_string(requests_.load()) + " requests");
+}
+
+void CompositeServer::stop() {
+    stopping_ = true;
+    // Wakes a blocked accept()
+    if (listenFd_ >= 0) {
+        ::shutdown(listenFd_, SHUT_RDWR);
+    }
+}
+
+CompositeReply CompositeServer::composite(const CompositeRequest& request) {
+    Timer timer;
+    CompositeReply reply;
+    requests_++;
+
+    try {
+        size_t count = request.inputs.size();
+        std::vector<std::shared_ptr<const DeepImage>> images(count);
+        std::vector<InputKey> keys(count);
+        std::vector<std::string> missingFiles;
+        std::vector<size_t> missing;
+
+        for (size_t i = 0; i < count; ++i) {
+            // Inputs are cached whole so requests for other regions share them
+            images[i] = cache_.find(request.inputs[i], PixelBox(), keys[i]);
+            if (images[i]) {
+                reply.cachedInputs++;
+            } else {
+                missing.push_back(i);
+                missingFiles.push_back(request.inputs[i]);
+            }
+        }
+
+        LoaderOptions loaderOpts;
+        loaderOpts.maxConcurrent = options_.loadThreads;
+        std::vector<LoadResult> results = loadDeepEXRFiles(missingFiles, loaderOpts);
+        for (size_t m = 0; m < results.size(); ++m) {
+            LoadResult& entry = results[m];
+            if (!entry.success) {
+                reply.error = "Failed to load " + entry.filename + ": " + entry.error;
+                return reply;
+            }
+            size_t i = missing[m];
+            images[i] = std::make_shared<const DeepImage>(std::move(entry.image));
+            cache_.insert(keys[i], images[i]);
+        }
+
+        std::vector<const DeepImage*> ptrs;
+        ptrs.reserve(count);
+        for (const auto& img : images) {
+            ptrs.push_back(img.get());
+        }
+
+        CompositorOptions compOpts;
+        compOpts.mergeThreshold = request.mergeThreshold;
+        compOpts.enableMerging = (request.mergeThreshold > 0.0f);
+        compOpts.roi = request.roi;
+        CompositorStats stats;
+        DeepImage merged = deepMerge(ptrs, compOpts, &stats);
+        reply.outputSamples = stats.totalOutputSamples;
+
+        if (request.deepOutput) {
+            DeepWriteOptions writeOpts;
+            writeOpts.tiled = request.tiled;
+            writeOpts.tileWidth = request.tileSize;
+            writeOpts.tileHeight = request.tileSize;
+            MemoryOStream stream("<deep reply>");
+            writeDeepEXR(merged, stream, writeOpts);
+            reply.deepExr = stream.release();
+        }
+        if (request.flatOutput) {
+            std::vector<float> flat = flattenImage(merged, merged.dataWindow());
+            MemoryOStream stream("<flat reply>");
+            if (merged.hasExtraChannels()) {
+                std::vector<float> extras;
+                flattenExtraChannels(merged, merged.dataWindow(), extras);
+                writeFlatEXR(flat, extras, merged.channels(), merged.dataWindow(),
+                             merged.displayWindow(), stream);
+            } else {
+                writeFlatEXR(flat, merged.dataWindow(), merged.displayWindow(), stream);
+            }
+            reply.flatExr = stream.release();
+        }
+        reply.success = true;
+    } catch (const std::exception& e) {
+        reply.error = e.what();
+    }
+
+    reply.timeMs = timer.elapsedMs();
+    logVerbose("Request: " + std::to_string(request.inputs.size()) + " inputs (" +
+               std::to_string(reply.cachedInputs) + " cached) in " + formatDuration(reply.timeMs));
+    return reply;
+}
+
+std::string CompositeServer::statsText() const {
+    return "requests: " + std::to_string(requests_.load()) + "\n" +
+           "cache hits: " + std::to_string(cache_.hits()) + "\n" +
+           "cache misses: " + std::to_string(cache_.misses()) + "\n" +
+           "cached inputs: " + std::to_string(cache_.entryCount()) + "\n" +
+           "cache memory: " + formatBytes(cache_.memoryUsage()) + " of " +
+           formatBytes(cache_.budget()) + "\n";
+}
+
+void CompositeServer::serveConnection(int fd) {
+    SocketFd connection(fd);
+    try {
+        SocketReader reader(fd);
+        std::string command;
+        if (!reader.readLine(command)) {
+            return;
+        }
+
+        if (command == "COMPOSITE") {
+            std::vector<std::string> lines;
+            std::string line;
+            while (true) {
+                if (!reader.readLine(line)) {
+                    throw CompositeServerException("Connection closed mid-request");
+                }
+                if (line == "end") {
+                    break;
+                }
+                lines.push_back(line);
+            }
+
+            CompositeRequest request;
+            std::string error;
+            if (!parseRequest(lines, request, error)) {
+                sendError(fd, error);
+                return;
+            }
+
+            CompositeReply reply = composite(request);
+            if (!reply.success) {
+                sendError(fd, reply.error);
+                return;
+            }
+            sendAll(fd, "OK\nsamples " + std::to_string(reply.outputSamples) +
+                        "\ncached " + std::to_string(reply.cachedInputs) +
+                        "\ntime " + std::to_string(reply.timeMs) + "\n");
+            if (request.deepOutput) {
+                sendBlob(fd, "deep", reply.deepExr);
+            }
+            if (request.flatOutput) {
+                sendBlob(fd, "flat", reply.flatExr);
+            }
+            sendAll(fd, "end\n");
+        } else if (command == "STATS") {
+            std::string text = statsText();
+            sendAll(fd, "OK\n");
+            sendBlob(fd, "text", std::vector<char>(text.begin(), text.end()));
+            sendAll(fd, "end\n");
+        } else if (command == "SHUTDOWN") {
+            sendAll(fd, "OK\nend\n");
+            log("Shutdown requested");
+            stop();
+        } else {
+            sendError(fd, "Unknown command: " + command);
+        }
+    } catch (const std::exception& e) {
+        logError(std::string("Connection: ") + e.what());
+    }
+}
+
+// ============================================================================
+// CompositeClient
+// ============================================================================
+
+CompositeClient::CompositeClient(const std::string& socketPath)
+    : socketPath_(socketPath) {}
+
+int CompositeClient::connect() {
+    sockaddr_un addr = socketAddress(socketPath_);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw CompositeServerException(std::string("Can't create socket: ") + std::strerror(errno));
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw CompositeServerException("Can't connect to server at " + socketPath_ + ": " +
+                                       std::strerror(err));
+    }
+    return fd;
+}
+
+CompositeReply CompositeClient::composite(const CompositeRequest& request) {
+    SocketFd connection(connect());
+    sendAll(connection.fd, formatRequest(request));
+
+    SocketReader reader(connection.fd);
+    CompositeReply reply;
+    readReply(reader, reply, nullptr);
+    return reply;
+}
+
+std::string CompositeClient::stats() {
+    SocketFd connection(connect());
+    sendAll(connection.fd, "STATS\n");
+
+    SocketReader reader(connection.fd);
+    CompositeReply reply;
+    std::string text;
+    readReply(reader, reply, &text);
+    if (!reply.success) {
+        throw CompositeServerException(reply.error);
+    }
+    return text;
+}
+
+void CompositeClient::shutdownServer() {
+    SocketFd connection(connect());
+    sendAll(connection.fd, "SHUTDOWN\n");
+
+    SocketReader reader(connection.fd);
+    CompositeReply reply;
+    readReply(reader, reply, nullptr);
+    if (!reply.success) {
+        throw CompositeServerException(reply.error);
+    }
+}
+
+} // namespace deep_compositor
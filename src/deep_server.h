@@ -0,0 +1,183 @@
+#pragma once
+
+#include "deep_compositor.h"
+#include "deep_image.h"
+#include "deep_input_cache.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * Exception thrown for composite server and client errors (socket setup,
+ * broken connections, malformed messages)
+ */
+class CompositeServerException : public std::runtime_error {
+public:
+    explicit CompositeServerException(const std::string& message)
+        : std::runtime_error(message) {}
+};
+
+/**
+ * One composite job sent to the server
+ */
+struct CompositeRequest {
+    std::vector<std::string> inputs;  // Input paths as seen by the server
+    PixelBox roi;                     // Only load, merge and return this region (empty = all)
+    float mergeThreshold = 0.001f;    // 0 disables merging
+    bool deepOutput = false;          // Return the merged deep EXR
+    bool flatOutput = true;           // Return the flattened EXR
+    bool tiled = false;               // Deep EXR layout
+    int tileSize = 64;
+};
+
+/**
+ * The server's answer to a CompositeRequest
+ */
+struct CompositeReply {
+    bool success = false;
+    std::string error;                // Set when success is false
+    std::vector<char> deepExr;        // Encoded deep EXR (if requested)
+    std::vector<char> flatExr;        // Encoded flat EXR (if requested)
+    size_t outputSamples = 0;
+    size_t cachedInputs = 0;          // Inputs served from the server's cache
+    double timeMs = 0.0;              // Server-side time for the request
+};
+
+/**
+ * Request text as sent over the socket
+ *
+ * Line based: "COMPOSITE", then one "key value" line per field
+ * ("input PATH" repeated, "roi X0 Y0 X1 Y1", "merge-threshold T",
+ * "deep", "flat", "tiled N"), then "end". Paths run to the end of
+ * their line, so they may contain spaces but not line breaks.
+ *
+ * @throws CompositeServerException if an input path contains '\n' or '\r'
+ */
+std::string formatRequest(const CompositeRequest& request);
+
+/**
+ * Parse the body of a COMPOSITE request (the lines after "COMPOSITE",
+ * without "end")
+ *
+ * @return false if a line is malformed (including an input path with a
+ *         '\r'); error then names it
+ */
+bool parseRequest(const std::vector<std::string>& lines, CompositeRequest& request,
+                  std::string& error);
+
+/**
+ * Server settings
+ */
+struct ServerOptions {
+    std::string socketPath;
+    size_t cacheBudgetBytes = size_t(4) << 30;  // Decoded inputs kept between requests
+    int loadThreads = 4;                         // Max inputs decoded concurrently per request
+};
+
+/**
+ * Long-running compositor behind a Unix domain socket
+ *
+ * Keeps decoded, depth-sorted inputs in a DeepImageLRU between requests
+ * (whole data windows; a request's ROI is applied while merging), so an
+ * interactive client that re-composites the same layers (a new ROI,
+ * a tweaked merge threshold, one layer re-rendered) only pays for merging
+ * and encoding. Inputs are matched by file identity, so a layer rewritten
+ * on disk is decoded again on its next use.
+ *
+ * Every connection carries one request and is served on its own thread;
+ * the results are encoded in memory and streamed back on the connection.
+ * The socket is local-only and unauthenticated: anyone who can reach it
+ * can make the server read any file it can read.
+ */
+class CompositeServer {
+public:
+    explicit CompositeServer(const ServerOptions& options);
+    ~CompositeServer();
+
+    CompositeServer(const CompositeServer&) = delete;
+    CompositeServer& operator=(const CompositeServer&) = delete;
+
+    /**
+     * Bind and listen on the socket. A stale socket file left by a dead
+     * server is replaced; a live server on the same path is an error.
+     *
+     * @throws CompositeServerException on socket errors
+     */
+    void listen();
+
+    /**
+     * Accept connections until stop() or a SHUTDOWN request, then wait for
+     * in-flight requests and remove the socket file
+     */
+    void run();
+
+    /**
+     * Ask run() to return (safe to call from any thread)
+     */
+    void stop();
+
+    /**
+     * Composite one request against the input cache (what a connection
+     * runs; exposed for in-process use)
+     */
+    CompositeReply composite(const CompositeRequest& request);
+
+    /**
+     * Human-readable cache and request counters
+     */
+    std::string statsText() const;
+
+    const DeepImageLRU& cache() const { return cache_; }
+
+private:
+    void serveConnection(int fd);
+
+    ServerOptions options_;
+    DeepImageLRU cache_;
+    int listenFd_;
+    std::atomic<bool> stopping_;
+    std::atomic<size_t> requests_;
+    std::mutex activeMutex_;
+    std::condition_variable idle_;
+    size_t active_;  // Connections being served
+};
+
+/**
+ * Client side of CompositeServer's protocol (one connection per call)
+ */
+class CompositeClient {
+public:
+    explicit CompositeClient(const std::string& socketPath);
+
+    /**
+     * Send a composite request and wait for its results
+     *
+     * @throws CompositeServerException if the server can't be reached or
+     *         the connection breaks; a failed composite is returned as a
+     *         reply with success = false
+     */
+    CompositeReply composite(const CompositeRequest& request);
+
+    /**
+     * @see CompositeServer::statsText
+     */
+    std::string stats();
+
+    /**
+     * Ask the server to exit once in-flight requests are done
+     */
+    void shutdownServer();
+
+private:
+    int connect();
+
+    std::string socketPath_;
+};
+
+} // namespace deep_compositor
@@ -0,0 +1,174 @@
+#include "deep_server.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void printUsage(const char* programName) {
+    std::cout << "Deep compositor server\n\n"
+              << "Usage:\n"
+              << "  " << programName << " serve <socket> [--cache-mb N] [--load-threads N] [--verbose]\n"
+              << "  " << programName << " composite <socket> [options] <input1> [input2 ...] <output_prefix>\n"
+              << "  " << programName << " stats <socket>\n"
+              << "  " << programName << " stop <socket>\n\n"
+              << "serve keeps decoded inputs in memory (least recently used first out once\n"
+              << "--cache-mb is exceeded, default 4096), so repeated composites of the same\n"
+              << "layers skip reading and decoding them. Inputs are re-read when their file\n"
+              << "changes on disk.\n\n"
+              << "composite options:\n"
+              << "  --deep-output        Also fetch the merged deep EXR (<prefix>_merged.exr)\n"
+              << "  --no-flat-output     Don't fetch the flattened EXR (<prefix>_flat.exr)\n"
+              << "  --tiled-output       Tiled deep EXR layout\n"
+              << "  --tile-size N        Tile width/height for --tiled-output (default: 64)\n"
+              << "  --merge-threshold N  Depth epsilon for merging samples (default: 0.001)\n"
+              << "  --roi x0,y0,x1,y1    Only composite this region\n";
+}
+
+bool parseInt(const char* text, int& value) {
+    char tail;
+    return std::sscanf(text, "%d%c", &value, &tail) == 1 && value > 0;
+}
+
+void writeFile(const std::string& path, const std::vector<char>& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    deep_compositor::log("  Wrote: " + path);
+}
+
+int runServe(const std::string& socketPath, int argc, char* argv[]) {
+    using namespace deep_compositor;
+
+    ServerOptions options;
+    options.socketPath = socketPath;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        int value;
+        if (arg == "--cache-mb" && i + 1 < argc && parseInt(argv[i + 1], value)) {
+            options.cacheBudgetBytes = static_cast<size_t>(value) << 20;
+            ++i;
+        } else if (arg == "--load-threads" && i + 1 < argc && parseInt(argv[i + 1], value)) {
+            options.loadThreads = value;
+            ++i;
+        } else if (arg == "--verbose" || arg == "-v") {
+            setVerbose(true);
+        } else {
+            logError("Invalid serve option: " + arg);
+            return 1;
+        }
+    }
+
+    CompositeServer server(options);
+    server.listen();
+    server.run();
+    return 0;
+}
+
+int runComposite(const std::string& socketPath, int argc, char* argv[]) {
+    using namespace deep_compositor;
+
+    CompositeRequest request;
+    std::vector<std::string> positional;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        char tail;
+        if (arg == "--deep-output") {
+            request.deepOutput = true;
+        } else if (arg == "--no-flat-output") {
+            request.flatOutput = false;
+        } else if (arg == "--tiled-output") {
+            request.tiled = true;
+        } else if (arg == "--tile-size" && i + 1 < argc && parseInt(argv[i + 1], request.tileSize)) {
+            ++i;
+        } else if (arg == "--merge-threshold" && i + 1 < argc &&
+                   std::sscanf(argv[i + 1], "%f%c", &request.mergeThreshold, &tail) == 1) {
+            ++i;
+        } else if (arg == "--roi" && i + 1 < argc) {
+            int x0, y0, x1, y1;
+            if (std::sscanf(argv[++i], "%d,%d,%d,%d%c", &x0, &y0, &x1, &y1, &tail) != 4 ||
+                PixelBox(x0, y0, x1, y1).isEmpty()) {
+                logError("Invalid ROI, expected x0,y0,x1,y1 with x0<=x1 and y0<=y1");
+                return 1;
+            }
+            request.roi = PixelBox(x0, y0, x1, y1);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            logError("Invalid composite option: " + arg);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.size() < 2) {
+        logError("Need at least one input file and an output prefix");
+        return 1;
+    }
+    std::string prefix = positional.back();
+    positional.pop_back();
+
+    // The server resolves paths against its own working directory
+    for (const std::string& input : positional) {
+        request.inputs.push_back(std::filesystem::absolute(input).string());
+    }
+
+    Timer timer;
+    CompositeReply reply = CompositeClient(socketPath).composite(request);
+    if (!reply.success) {
+        logError(reply.error);
+        return 1;
+    }
+
+    if (request.deepOutput) {
+        writeFile(prefix + "_merged.exr", reply.deepExr);
+    }
+    if (request.flatOutput) {
+        writeFile(prefix + "_flat.exr", reply.flatExr);
+    }
+    log("Composited " + formatNumber(reply.outputSamples) + " samples (" +
+        std::to_string(reply.cachedInputs) + " of " + std::to_string(request.inputs.size()) +
+        " inputs cached, server " + formatDuration(reply.timeMs) + ", total " +
+        timer.elapsedString() + ")");
+    return 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    using namespace deep_compositor;
+
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string command = argv[1];
+    std::string socketPath = argv[2];
+
+    try {
+        if (command == "serve") {
+            return runServe(socketPath, argc - 3, argv + 3);
+        } else if (command == "composite") {
+            return runComposite(socketPath, argc - 3, argv + 3);
+        } else if (command == "stats" && argc == 3) {
+            std::cout << CompositeClient(socketPath).stats();
+        } else if (command == "stop" && argc == 3) {
+            CompositeClient(socketPath).shutdownServer();
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        logError(e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "deep_session.h"
+#include "deep_cache.h"
+#include "deep_input_cache.h"
+#include "deep_writer.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+namespace deep_compositor {
+
+namespace {
+
+const char kStateMagic[8] = {'D', 'C', 'S', 'E', 'S', 'S', 'N', '2'};
+
+// Starting hash of every tile
+const uint64_t kHashSeed = 14695981039346656037ull;
+
+/**
+ * Hash a block of bytes, chained onto `hash`
+ */
+uint64_t hashChained(uint64_t hash, const void* data, size_t size) {
+    return hashBytes(static_cast<const char*>(data), size, hash);
+}
+
+template<typename T>
+uint64_t hashValue(uint64_t hash, const T& value) {
+    return hashChained(hash, &value, sizeof(value));
+}
+
+uint64_t hashOptions(const CompositorOptions& options, int tileSize) {
+    uint64_t hash = kHashSeed;
+    hash = hashValue(hash, options.mergeThreshold);
+    hash = hashValue(hash, options.enableMerging);
+    hash = hashValue(hash, tileSize);
+    return hash;
+}
+
+template<typename T>
+void writeValue(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool readValue(std::ifstream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+} // anonymous namespace
+
+CompositeSession::CompositeSession(const std::string& directory, int tileSize)
+    : directory_(directory), tileSize_(tileSize > 0 ? tileSize : 64), optionsHash_(0),
+      dirtyTiles_(0), loaded_(false) {}
+
+std::string CompositeSession::path(const char* name) const {
+    return (std::filesystem::path(directory_) / name).string();
+}
+
+PixelBox CompositeSession::tileBox(size_t tile) const {
+    size_t tilesX = static_cast<size_t>((window_.width() + tileSize_ - 1) / tileSize_);
+    int tx = static_cast<int>(tile % tilesX);
+    int ty = static_cast<int>(tile / tilesX);
+    PixelBox box(window_.minX + tx * tileSize_, window_.minY + ty * tileSize_,
+                 window_.minX + (tx + 1) * tileSize_ - 1, window_.minY + (ty + 1) * tileSize_ - 1);
+    return box.intersect(window_);
+}
+
+bool CompositeSession::load() {
+    loaded_ = false;
+    std::ifstream in(path("session.state"), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    char magic[sizeof(kStateMagic)];
+    int32_t tileSize = 0;
+    int32_t box[4];
+    uint64_t tileCount = 0;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kStateMagic, sizeof(magic)) != 0 ||
+        !readValue(in, tileSize) || !readValue(in, optionsHash_) || !readValue(in, box) ||
+        !readValue(in, tileCount) || tileSize != tileSize_) {
+        logVerbose("  Session state in " + directory_ + " is unusable, rebuilding");
+        return false;
+    }
+
+    window_ = PixelBox(box[0], box[1], box[2], box[3]);
+    uint64_t expectedTiles = 0;
+    if (!window_.isEmpty()) {
+        expectedTiles = (static_cast<uint64_t>(window_.width()) + tileSize_ - 1) / tileSize_ *
+                        ((static_cast<uint64_t>(window_.height()) + tileSize_ - 1) / tileSize_);
+    }
+    // Per tile: a hash and a depth range
+    std::streamoff tilesStart = in.tellg();
+    in.seekg(0, std::ios::end);
+    uint64_t tileBytes = static_cast<uint64_t>(in.tellg() - tilesStart);
+    in.seekg(tilesStart);
+    if (tileCount != expectedTiles ||
+        tileCount > tileBytes / (sizeof(uint64_t) + 2 * sizeof(float))) {
+        logVerbose("  Session state in " + directory_ + " is corrupt, rebuilding");
+        return false;
+    }
+
+    tileHashes_.resize(static_cast<size_t>(tileCount));
+    tileDepths_.resize(static_cast<size_t>(tileCount) * 2);
+    if (!in.read(reinterpret_cast<char*>(tileHashes_.data()),
+                 static_cast<std::streamsize>(tileCount * sizeof(uint64_t))) ||
+        !in.read(reinterpret_cast<char*>(tileDepths_.data()),
+                 static_cast<std::streamsize>(tileDepths_.size() * sizeof(float)))) {
+        logVerbose("  Session state in " + directory_ + " is truncated, rebuilding");
+        return false;
+    }
+
+    try {
+        merged_ = loadDeepCache(path("merged.dcache"));
+    } catch (const std::exception& e) {
+        logVerbose("  Session result unusable (" + std::string(e.what()) + "), rebuilding");
+        return false;
+    }
+
+    std::ifstream flatIn(path("flat.rgba"), std::ios::binary);
+    flat_.resize(static_cast<size_t>(window_.width()) * window_.height() * 4);
+    if (merged_.dataWindow() != window_ ||
+        !flatIn.read(reinterpret_cast<char*>(flat_.data()),
+                     static_cast<std::streamsize>(flat_.size() * sizeof(float)))) {
+        logVerbose("  Session flat result missing or stale, rebuilding");
+        return false;
+    }
+
+    loaded_ = true;
+    return true;
+}
+
+void CompositeSession::update(const std::vector<const DeepImage*>& inputs,
+                              const CompositorOptions& options, CompositorStats* stats) {
+    Timer timer;
+
+    // Result window, as deepMerge would produce it
+    PixelBox window;
+    for (const auto* img : inputs) {
+        window = window.unite(img->dataWindow());
+    }
+    if (!options.roi.isEmpty()) {
+        window = window.intersect(options.roi);
+    }
+
+    // Hash the non-empty pixels of every input, per tile of the result
+    PixelBox previousWindow = window_;
+    window_ = window;
+    size_t tilesX = static_cast<size_t>((window.width() + tileSize_ - 1) / tileSize_);
+    size_t tilesY = static_cast<size_t>((window.height() + tileSize_ - 1) / tileSize_);
+    std::vector<uint64_t> hashes(tilesX * tilesY, kHashSeed);
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const DeepImage& img = *inputs[i];
+        PixelBox area = img.dataWindow().intersect(window);
+        for (int y = area.minY; y <= area.maxY; ++y) {
+            size_t tileRow = static_cast<size_t>((y - window.minY) / tileSize_) * tilesX;
+            for (int x = area.minX; x <= area.maxX; ++x) {
+                const DeepPixel& pixel = img.pixel(x - img.originX(), y - img.originY());
+                if (pixel.isEmpty()) {
+                    continue;
+                }
+                uint64_t& hash = hashes[tileRow + static_cast<size_t>((x - window.minX) / tileSize_)];
+                hash = hashValue(hash, i);
+                hash = hashValue(hash, x);
+                hash = hashValue(hash, y);
+                hash = hashChained(hash, pixel.samples().data(),
+                                   pixel.sampleCount() * sizeof(DeepSample));
+            }
+        }
+    }
+    logVerbose("    Hashed " + std::to_string(inputs.size()) + " inputs in " +
+               std::to_string(tilesX * tilesY) + " tiles (" + timer.elapsedString() + ")");
+
+    uint64_t optionsHash = hashOptions(options, tileSize_);
+    // The saved merge (a deep cache) has no extra channels to update
+    bool extraChannels = std::any_of(inputs.begin(), inputs.end(),
+                                     [](const DeepImage* img) { return img->hasExtraChannels(); });
+    bool rebuild = !loaded_ || window != previousWindow || optionsHash != optionsHash_ ||
+                   hashes.size() != tileHashes_.size() || extraChannels;
+
+    if (rebuild) {
+        merged_ = deepMerge(inputs, options, stats);
+        flat_ = flattenImage(merged_);
+        dirtyTiles_ = hashes.size();
+
+        const DeepImage& result = merged_;
+        tileDepths_.resize(hashes.size() * 2);
+        for (size_t t = 0; t < hashes.size(); ++t) {
+            PixelBox box = tileBox(t);
+            float minDepth = std::numeric_limits<float>::infinity();
+            float maxDepth = -std::numeric_limits<float>::infinity();
+            for (int y = box.minY; y <= box.maxY; ++y) {
+                for (int x = box.minX; x <= box.maxX; ++x) {
+                    const DeepPixel& pixel = result.pixel(x - result.originX(), y - result.originY());
+                    if (!pixel.isEmpty()) {
+                        minDepth = std::min(minDepth, pixel.minDepth());
+                        maxDepth = std::max(maxDepth, pixel.maxDepth());
+                    }
+                }
+            }
+            tileDepths_[t * 2] = minDepth;
+            tileDepths_[t * 2 + 1] = maxDepth;
+        }
+    } else {
+        CompositorStats tileStats;
+        CompositorStats total;
+        dirtyTiles_ = 0;
+        int width = window.width();
+
+        for (size_t t = 0; t < hashes.size(); ++t) {
+            if (hashes[t] == tileHashes_[t]) {
+                continue;
+            }
+            dirtyTiles_++;
+
+            PixelBox box = tileBox(t);
+            remergeRegion(merged_, inputs, box, options, &tileStats);
+            total.totalInputSamples += tileStats.totalInputSamples;
+            total.totalOutputSamples += tileStats.totalOutputSamples;
+            total.remergedPixels += tileStats.remergedPixels;
+            tileDepths_[t * 2] = tileStats.minDepth;
+            tileDepths_[t * 2 + 1] = tileStats.maxDepth;
+
+            // Re-flatten the tile into the persistent flat buffer
+            std::vector<float> rgba = flattenImage(merged_, box);
+            for (int y = 0; y < box.height(); ++y) {
+                size_t dst = (static_cast<size_t>(box.minY - window.minY + y) * width +
+                              static_cast<size_t>(box.minX - window.minX)) * 4;
+                std::copy(rgba.begin() + static_cast<size_t>(y) * box.width() * 4,
+                          rgba.begin() + static_cast<size_t>(y + 1) * box.width() * 4,
+                          flat_.begin() + dst);
+            }
+        }
+
+        PixelBox display;
+        for (const auto* img : inputs) {
+            display = display.unite(img->displayWindow());
+        }
+        merged_.setDisplayWindow(display);
+
+        if (stats) {
+            // Untouched tiles keep the depth range saved with them
+            total.minDepth = std::numeric_limits<float>::infinity();
+            total.maxDepth = -std::numeric_limits<float>::infinity();
+            for (size_t t = 0; t < tileDepths_.size(); t += 2) {
+                total.minDepth = std::min(total.minDepth, tileDepths_[t]);
+                total.maxDepth = std::max(total.maxDepth, tileDepths_[t + 1]);
+            }
+            total.inputImageCount = inputs.size();
+            total.mergeTimeMs = timer.elapsedMs();
+            *stats = total;
+        }
+    }
+
+    tileHashes_ = std::move(hashes);
+    optionsHash_ = optionsHash;
+    loaded_ = true;
+
+    log("  Session: " + std::to_string(dirtyTiles_) + "/" + std::to_string(tileHashes_.size()) +
+        " tiles recomputed" + (rebuild ? " (full rebuild)" : ""));
+}
+
+void CompositeSession::save() const {
+    std::error_code ec;
+    std::filesystem::create_directories(directory_, ec);
+    if (ec) {
+        throw DeepWriterException("Cannot create session directory " + directory_ + ": " +
+                                  ec.message());
+    }
+
+    // Drop the old state first so a failed save can't pair stale hashes
+    // with a newer result
+    std::filesystem::remove(path("session.state"), ec);
+    
+    // merged_ may be mapped from merged.dcache, so write beside it and
+    // rename over it; the old mapping stays valid until it is released
+    std::string cachePath = path("merged.dcache");
+    writeDeepCache(merged_, cachePath + ".tmp");
+    std::filesystem::rename(cachePath + ".tmp", cachePath, ec);
+    if (ec) {
+        throw DeepWriterException("Cannot replace " + cachePath + ": " + ec.message());
+    }
+
+    std::ofstream flatOut(path("flat.rgba"), std::ios::binary | std::ios::trunc);
+    flatOut.write(reinterpret_cast<const char*>(flat_.data()),
+                  static_cast<std::streamsize>(flat_.size() * sizeof(float)));
+
+    std::ofstream out(path("session.state"), std::ios::binary | std::ios::trunc);
+    out.write(kStateMagic, sizeof(kStateMagic));
+    writeValue(out, static_cast<int32_t>(tileSize_));
+    writeValue(out, optionsHash_);
+    int32_t box[4] = {window_.minX, window_.minY, window_.maxX, window_.maxY};
+    writeValue(out, box);
+    writeValue(out, static_cast<uint64_t>(tileHashes_.size()));
+    out.write(reinterpret_cast<const char*>(tileHashes_.data()),
+              static_cast<std::streamsize>(tileHashes_.size() * sizeof(uint64_t)));
+    out.write(reinterpret_cast<const char*>(tileDepths_.data()),
+              static_cast<std::streamsize>(tileDepths_.size() * sizeof(float)));
+
+    if (!flatOut || !out) {
+        throw DeepWriterException("Failed to write session state to " + directory_);
+    }
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "deep_compositor.h"
+#include "deep_image.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * Persistent composite session
+ *
+ * Keeps the merged and flattened result of a composite in a directory
+ * between runs, together with a content hash of every input per tile.
+ * On the next run only tiles whose hash changed are re-merged and
+ * re-flattened; the rest of the previous result is reused. A change of
+ * data window, tile size or merge options rebuilds everything.
+ *
+ * Directory layout:
+ *   session.state   tile grid, option hash, per-tile input hashes and
+ *                   depth ranges
+ *   merged.dcache   merged deep result (deep cache format, mapped on load)
+ *   flat.rgba       flattened RGBA floats for the data window
+ */
+class CompositeSession {
+public:
+    /**
+     * @param directory Session directory (created on save)
+     * @param tileSize Tile width and height for change tracking
+     */
+    explicit CompositeSession(const std::string& directory, int tileSize = 64);
+
+    /**
+     * Load the previous run's state, if any
+     *
+     * @return false if there is no usable state (the next update rebuilds)
+     */
+    bool load();
+
+    /**
+     * Bring the result up to date with `inputs`
+     *
+     * Hashes every input per tile, then re-merges and re-flattens only the
+     * tiles whose hash differs from the previous run.
+     */
+    void update(const std::vector<const DeepImage*>& inputs,
+                const CompositorOptions& options = CompositorOptions(),
+                CompositorStats* stats = nullptr);
+
+    /**
+     * Persist the current result and hashes
+     *
+     * @throws DeepWriterException on file errors
+     */
+    void save() const;
+
+    DeepImage& merged() { return merged_; }
+    const DeepImage& merged() const { return merged_; }
+    const std::vector<float>& flat() const { return flat_; }
+
+    /**
+     * Tiles recomputed by the last update (equals tileCount() on a rebuild)
+     */
+    size_t dirtyTileCount() const { return dirtyTiles_; }
+    size_t tileCount() const { return tileHashes_.size(); }
+
+private:
+    std::string directory_;
+    int tileSize_;
+    uint64_t optionsHash_;
+    PixelBox window_;
+    std::vector<uint64_t> tileHashes_;  // Row-major over the tile grid
+    std::vector<float> tileDepths_;     // Min and max merged depth per tile
+    DeepImage merged_;
+    std::vector<float> flat_;
+    size_t dirtyTiles_;
+    bool loaded_;
+
+    std::string path(const char* name) const;
+    PixelBox tileBox(size_t tile) const;
+};
+
+} // namespace deep_compositor
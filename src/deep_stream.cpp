@@ -0,0 +1,167 @@
+#include "deep_stream.h"
+
+#include <OpenEXR/Iex.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace deep_compositor {
+
+// ============================================================================
+// MappedIStream
+// ============================================================================
+
+MappedIStream::MappedIStream(const std::string& filename, MapAccess access)
+    : Imf::IStream(filename.c_str()), data_(nullptr), size_(0), pos_(0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw IEX_NAMESPACE::InputExc("Cannot open " + filename + ": " + std::strerror(errno));
+    }
+    
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int err = errno;
+        ::close(fd);
+        throw IEX_NAMESPACE::InputExc("Cannot stat " + filename + ": " + std::strerror(err));
+    }
+    
+    size_ = static_cast<uint64_t>(st.st_size);
+    
+    // mmap rejects zero-length mappings; an empty stream just fails on read
+    if (size_ > 0) {
+        void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            int err = errno;
+            ::close(fd);
+            throw IEX_NAMESPACE::InputExc("Cannot map " + filename + ": " + std::strerror(err));
+        }
+        data_ = static_cast<char*>(mapped);
+        
+        if (access == MapAccess::Sequential) {
+            ::madvise(mapped, size_, MADV_SEQUENTIAL);
+            ::madvise(mapped, size_, MADV_WILLNEED);
+        } else if (access == MapAccess::Random) {
+            ::madvise(mapped, size_, MADV_RANDOM);
+        }
+    }
+    
+    // The mapping keeps the file contents alive
+    ::close(fd);
+}
+
+MappedIStream::~MappedIStream() {
+    if (data_) {
+        ::munmap(data_, size_);
+    }
+}
+
+bool MappedIStream::read(char c[], int n) {
+    if (n < 0 || pos_ + static_cast<uint64_t>(n) > size_) {
+        throw IEX_NAMESPACE::InputExc(std::string("Unexpected end of file: ") + fileName());
+    }
+    
+    std::memcpy(c, data_ + pos_, static_cast<size_t>(n));
+    pos_ += static_cast<uint64_t>(n);
+    
+    return pos_ < size_;
+}
+
+char* MappedIStream::readMemoryMapped(int n) {
+    if (n < 0 || pos_ + static_cast<uint64_t>(n) > size_) {
+        throw IEX_NAMESPACE::InputExc(std::string("Unexpected end of file: ") + fileName());
+    }
+    
+    char* result = data_ + pos_;
+    pos_ += static_cast<uint64_t>(n);
+    
+    return result;
+}
+
+void MappedIStream::seekg(uint64_t pos) {
+    // Seeking past the end is allowed; the next read fails
+    pos_ = pos;
+}
+
+// ============================================================================
+// MemoryIStream
+// ============================================================================
+
+MemoryIStream::MemoryIStream(std::vector<char> data, const std::string& name)
+    : Imf::IStream(name.c_str()), data_(std::move(data)), pos_(0) {}
+
+bool MemoryIStream::read(char c[], int n) {
+    if (n < 0 || pos_ + static_cast<uint64_t>(n) > data_.size()) {
+        throw IEX_NAMESPACE::InputExc(std::string("Unexpected end of stream: ") + fileName());
+    }
+    
+    std::memcpy(c, data_.data() + pos_, static_cast<size_t>(n));
+    pos_ += static_cast<uint64_t>(n);
+    
+    return pos_ < data_.size();
+}
+
+char* MemoryIStream::readMemoryMapped(int n) {
+    if (n < 0 || pos_ + static_cast<uint64_t>(n) > data_.size()) {
+        throw IEX_NAMESPACE::InputExc(std::string("Unexpected end of stream: ") + fileName());
+    }
+    
+    char* result = data_.data() + pos_;
+    pos_ += static_cast<uint64_t>(n);
+    
+    return result;
+}
+
+// ============================================================================
+// CountingIStream
+// ============================================================================
+
+CountingIStream::CountingIStream(Imf::IStream& inner)
+    : Imf::IStream(inner.fileName()), inner_(inner), bytesRead_(0) {}
+
+bool CountingIStream::read(char c[], int n) {
+    bool more = inner_.read(c, n);
+    bytesRead_ += static_cast<uint64_t>(n);
+    return more;
+}
+
+char* CountingIStream::readMemoryMapped(int n) {
+    char* result = inner_.readMemoryMapped(n);
+    bytesRead_ += static_cast<uint64_t>(n);
+    return result;
+}
+
+// ============================================================================
+// MemoryOStream
+// ============================================================================
+
+MemoryOStream::MemoryOStream(const std::string& name)
+    : Imf::OStream(name.c_str()), pos_(0) {}
+
+void MemoryOStream::write(const char c[], int n) {
+    if (n <= 0) {
+        return;
+    }
+    
+    uint64_t end = pos_ + static_cast<uint64_t>(n);
+    if (end > data_.size()) {
+        data_.resize(static_cast<size_t>(end));
+    }
+    
+    std::memcpy(data_.data() + pos_, c, static_cast<size_t>(n));
+    pos_ = end;
+}
+
+std::vector<char> MemoryOStream::release() {
+    std::vector<char> result = std::move(data_);
+    data_.clear();
+    pos_ = 0;
+    return result;
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <OpenEXR/ImfIO.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * How a mapped file will be read, passed to the kernel as madvise() advice
+ */
+enum class MapAccess {
+    Normal,      // No advice (header probes, caches read as touched)
+    Sequential,  // The whole file, front to back: read it all ahead
+    Random       // Scattered blocks (region loads): no read-ahead
+};
+
+/**
+ * Read-only Imf::IStream backed by an mmap of the whole file
+ *
+ * OpenEXR's default stream copies through a small std::ifstream buffer with
+ * a read() syscall per refill. This stream maps the file once and serves
+ * reads from the page cache; isMemoryMapped() is true, so OpenEXR can use
+ * readMemoryMapped() to decode straight from the mapping without copying.
+ */
+class MappedIStream : public Imf::IStream {
+public:
+    /**
+     * Map a file for reading
+     *
+     * @param filename Path to the file
+     * @param access How the file will be read. Sequential reads the whole
+     *               file ahead (sequential + willneed); Random turns
+     *               read-ahead off so a region load only faults in the
+     *               blocks it decodes.
+     * @throws IEX_NAMESPACE::InputExc if the file can't be opened or mapped
+     */
+    explicit MappedIStream(const std::string& filename,
+                           MapAccess access = MapAccess::Sequential);
+    ~MappedIStream() override;
+
+    MappedIStream(const MappedIStream&) = delete;
+    MappedIStream& operator=(const MappedIStream&) = delete;
+
+    bool isMemoryMapped() const override { return true; }
+    bool read(char c[], int n) override;
+    char* readMemoryMapped(int n) override;
+    uint64_t tellg() override { return pos_; }
+    void seekg(uint64_t pos) override;
+
+    /**
+     * Mapped file contents
+     */
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+
+private:
+    char* data_;
+    uint64_t size_;
+    uint64_t pos_;
+};
+
+/**
+ * Imf::IStream over an in-memory EXR file
+ *
+ * Lets pipeline stages and tests decode EXR data without touching the
+ * filesystem. Like MappedIStream it reports isMemoryMapped(), so OpenEXR
+ * reads straight from the buffer.
+ */
+class MemoryIStream : public Imf::IStream {
+public:
+    /**
+     * @param data File contents (the stream takes ownership)
+     * @param name Name reported in error messages
+     */
+    explicit MemoryIStream(std::vector<char> data, const std::string& name = "<memory>");
+
+    bool isMemoryMapped() const override { return true; }
+    bool read(char c[], int n) override;
+    char* readMemoryMapped(int n) override;
+    uint64_t tellg() override { return pos_; }
+    void seekg(uint64_t pos) override { pos_ = pos; }
+
+    const std::vector<char>& buffer() const { return data_; }
+
+private:
+    std::vector<char> data_;
+    uint64_t pos_;
+};
+
+/**
+ * Imf::IStream that forwards to another stream and counts the bytes read
+ * through it
+ *
+ * Region loads only read the chunks they decode; this reports how much
+ * that was. Seeks are not counted.
+ */
+class CountingIStream : public Imf::IStream {
+public:
+    /**
+     * @param inner Stream to read from; must outlive this one
+     */
+    explicit CountingIStream(Imf::IStream& inner);
+
+    bool isMemoryMapped() const override { return inner_.isMemoryMapped(); }
+    bool read(char c[], int n) override;
+    char* readMemoryMapped(int n) override;
+    uint64_t tellg() override { return inner_.tellg(); }
+    void seekg(uint64_t pos) override { inner_.seekg(pos); }
+    void clear() override { inner_.clear(); }
+
+    uint64_t bytesRead() const { return bytesRead_; }
+
+private:
+    Imf::IStream& inner_;
+    uint64_t bytesRead_;
+};
+
+/**
+ * Imf::OStream that writes an EXR file into memory
+ *
+ * Supports the seeks OpenEXR needs to patch offset tables. The finished
+ * bytes can be handed to a MemoryIStream, a socket or stdout.
+ */
+class MemoryOStream : public Imf::OStream {
+public:
+    explicit MemoryOStream(const std::string& name = "<memory>");
+
+    void write(const char c[], int n) override;
+    uint64_t tellp() override { return pos_; }
+    void seekp(uint64_t pos) override { pos_ = pos; }
+
+    const std::vector<char>& buffer() const { return data_; }
+
+    /**
+     * Move the written bytes out, leaving the stream empty
+     */
+    std::vector<char> release();
+
+private:
+    std::vector<char> data_;
+    uint64_t pos_;
+};
+
+} // namespace deep_compositor
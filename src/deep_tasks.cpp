@@ -0,0 +1,383 @@
+#include "deep_tasks.h"
+#include "deep_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace deep_compositor {
+
+namespace {
+
+thread_local TaskScheduler* tl_scheduler = nullptr;
+thread_local size_t tl_queue = 0;
+
+std::atomic<int> g_sharedThreadCount{0};
+
+#ifdef __linux__
+/**
+ * CPUs allowed by a cgroup quota of `quota` per `period` (0 = no limit)
+ */
+int cgroupQuotaCpus(long long quota, long long period) {
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    return std::max(1, static_cast<int>(std::ceil(static_cast<double>(quota) / period)));
+}
+
+/**
+ * CPUs allowed by one cgroup directory's own quota (0 = none set there)
+ */
+int cgroupDirCpuLimit(const std::string& dir, bool v2) {
+    if (v2) {
+        // "<quota|max> <period>"
+        std::ifstream max(dir + "/cpu.max");
+        std::string quota;
+        long long period = 0;
+        if (max >> quota >> period && quota != "max") {
+            return cgroupQuotaCpus(std::atoll(quota.c_str()), period);
+        }
+        return 0;
+    }
+    
+    // v1: quota is -1 when unlimited
+    std::ifstream quotaFile(dir + "/cpu.cfs_quota_us");
+    std::ifstream periodFile(dir + "/cpu.cfs_period_us");
+    long long quota = 0;
+    long long period = 0;
+    if (quotaFile >> quota && periodFile >> period) {
+        return cgroupQuotaCpus(quota, period);
+    }
+    return 0;
+}
+
+/**
+ * Tightest quota on cgroup `path` or any of its parents, under `mount`
+ *
+ * Parents count because their quotas cap every child. Without a cgroup
+ * namespace the path may not exist under the mount at all; the mount's
+ * root is still checked.
+ */
+int cgroupPathCpuLimit(const std::string& mount, std::string path, bool v2) {
+    int limit = 0;
+    while (true) {
+        int level = cgroupDirCpuLimit(mount + path, v2);
+        if (level > 0 && (limit == 0 || level < limit)) {
+            limit = level;
+        }
+        size_t slash = path.find_last_of('/');
+        if (path.empty() || path == "/" || slash == std::string::npos) {
+            break;
+        }
+        path.erase(slash);
+    }
+    return limit;
+}
+
+#endif
+
+} // anonymous namespace
+
+int cgroupCpuLimit(const std::string& root, const std::string& membershipFile) {
+#ifdef __linux__
+    // One "<id>:<controllers>:<path>" line per hierarchy; v2's has no
+    // controllers
+    std::ifstream membership(membershipFile);
+    std::string line;
+    int limit = 0;
+    auto tighten = [&limit](int found) {
+        if (found > 0 && (limit == 0 || found < limit)) {
+            limit = found;
+        }
+    };
+    while (std::getline(membership, line)) {
+        size_t first = line.find(':');
+        size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+        if (second == std::string::npos) {
+            continue;
+        }
+        std::string controllers = line.substr(first + 1, second - first - 1);
+        std::string path = line.substr(second + 1);
+        if (controllers.empty()) {
+            tighten(cgroupPathCpuLimit(root, path, true));
+            continue;
+        }
+        
+        // v1: the cpu controller is mounted alone or joined with cpuacct
+        bool hasCpu = false;
+        size_t start = 0;
+        while (start <= controllers.size()) {
+            size_t comma = controllers.find(',', start);
+            if (comma == std::string::npos) comma = controllers.size();
+            hasCpu = hasCpu || controllers.compare(start, comma - start, "cpu") == 0;
+            start = comma + 1;
+        }
+        if (!hasCpu) {
+            continue;
+        }
+        for (const std::string& mount : {controllers, std::string("cpu,cpuacct"), std::string("cpu")}) {
+            tighten(cgroupPathCpuLimit(root + "/" + mount, path, false));
+        }
+    }
+    return limit;
+#else
+    (void)root;
+    (void)membershipFile;
+    return 0;
+#endif
+}
+
+int availableCpuCount() {
+    int cpus = static_cast<int>(std::thread::hardware_concurrency());
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpus = CPU_COUNT(&set);
+    }
+    int limit = cgroupCpuLimit("/sys/fs/cgroup", "/proc/self/cgroup");
+    if (limit > 0) {
+        cpus = std::min(cpus, limit);
+    }
+#endif
+    return std::max(1, cpus);
+}
+
+// ============================================================================
+// TaskScheduler
+// ============================================================================
+
+TaskScheduler::TaskScheduler(int threads)
+    : nextQueue_(0), queued_(0), stopping_(false) {
+    size_t workerCount = static_cast<size_t>(std::max(threads, 1) - 1);
+    for (size_t i = 0; i < std::max<size_t>(workerCount, 1); ++i) {
+        queues_.emplace_back(new Queue());
+    }
+    for (size_t i = 0; i < workerCount; ++i) {
+        workers_.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::shared() {
+    // Never destroyed: detached threads may still use it during exit
+    static TaskScheduler* instance = new TaskScheduler(
+        g_sharedThreadCount.load() > 0 ? g_sharedThreadCount.load() : availableCpuCount());
+    return *instance;
+}
+
+void TaskScheduler::setSharedThreadCount(int threads) {
+    g_sharedThreadCount.store(threads);
+}
+
+void TaskScheduler::submit(Task task) {
+    size_t q = tl_scheduler == this ? tl_queue
+                                    : nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+        queues_[q]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    
+    // Taking the lock orders this against a worker checking queued_ before sleeping
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    wake_.notify_one();
+}
+
+bool TaskScheduler::take(size_t home, Task& task) {
+    size_t count = queues_.size();
+    bool worker = home < count;
+    if (worker) {
+        Queue& own = *queues_[home];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    
+    // Steal the oldest task of another queue
+    size_t start = worker ? home + 1 : 0;
+    for (size_t i = 0; i < count; ++i) {
+        Queue& victim = *queues_[(start + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskScheduler::runOne() {
+    if (queued_.load() == 0) {
+        return false;
+    }
+    Task task;
+    if (!take(tl_scheduler == this ? tl_queue : queues_.size(), task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void TaskScheduler::workerLoop(size_t index) {
+    tl_scheduler = this;
+    tl_queue = index;
+    bool named = false;
+    
+    for (;;) {
+        Task task;
+        if (take(index, task)) {
+            if (!named && isTracing()) {
+                setTraceThreadName("worker " + std::to_string(index + 1));
+                named = true;
+            }
+            task();
+            continue;
+        }
+        
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [this]() { return stopping_ || queued_.load() > 0; });
+        if (stopping_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+// ============================================================================
+// TaskGroup
+// ============================================================================
+
+TaskGroup::TaskGroup(TaskScheduler& scheduler)
+    : scheduler_(scheduler), pending_(0), failed_(false) {}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // Errors are only reported by an explicit wait()
+    }
+}
+
+void TaskGroup::run(std::function<void()> fn) {
+    pending_.fetch_add(1);
+    scheduler_.submit([this, fn = std::move(fn)]() {
+        if (!failed()) {
+            try {
+                fn();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                failed_.store(true, std::memory_order_relaxed);
+            }
+        }
+        finishOne();
+    });
+}
+
+void TaskGroup::finishOne() {
+    // Under the lock, so wait() can't return (and the group go away)
+    // between the decrement and the notify
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.fetch_sub(1) == 1) {
+        done_.notify_all();
+    }
+}
+
+void TaskGroup::wait() {
+    while (pending_.load() > 0) {
+        if (scheduler_.runOne()) {
+            continue;
+        }
+        // Nothing queued: our remaining tasks are running elsewhere. Wake
+        // up now and then in case new work is queued we could help with.
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait_for(lock, std::chrono::milliseconds(1), [this]() { return pending_.load() == 0; });
+    }
+    
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(error, error_);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// ============================================================================
+// Parallel loops
+// ============================================================================
+
+void parallelFor(size_t begin, size_t end, size_t grain,
+                 const std::function<void(size_t begin, size_t end)>& fn) {
+    if (end <= begin) {
+        return;
+    }
+    size_t count = end - begin;
+    TaskScheduler& scheduler = TaskScheduler::shared();
+    if (grain == 0) {
+        grain = std::max<size_t>(1, count / (static_cast<size_t>(scheduler.threadCount()) * 4));
+    }
+    if (scheduler.threadCount() == 1 || count <= grain) {
+        fn(begin, end);
+        return;
+    }
+    
+    TaskGroup group(scheduler);
+    for (size_t b = begin; b < end; b += grain) {
+        size_t e = std::min(end, b + grain);
+        group.run([&fn, b, e]() { fn(b, e); });
+    }
+    group.wait();
+}
+
+void parallelForRows(const PixelBox& box, const std::function<void(int y)>& fn) {
+    parallelFor(0, static_cast<size_t>(box.height()), 0, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; ++r) {
+            fn(box.minY + static_cast<int>(r));
+        }
+    });
+}
+
+void parallelForTiles(const PixelBox& box, int tileSize,
+                      const std::function<void(const PixelBox& tile)>& fn) {
+    if (box.isEmpty() || tileSize <= 0) {
+        return;
+    }
+    size_t tilesX = static_cast<size_t>((box.width() + tileSize - 1) / tileSize);
+    size_t tilesY = static_cast<size_t>((box.height() + tileSize - 1) / tileSize);
+    parallelFor(0, tilesX * tilesY, 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            int x0 = box.minX + static_cast<int>(t % tilesX) * tileSize;
+            int y0 = box.minY + static_cast<int>(t / tilesX) * tileSize;
+            fn(PixelBox(x0, y0, std::min(x0 + tileSize - 1, box.maxX),
+                        std::min(y0 + tileSize - 1, box.maxY)));
+        }
+    });
+}
+
+} // namespace deep_compositor
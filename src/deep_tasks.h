@@ -0,0 +1,161 @@
+#pragma once
+
+#include "deep_image.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * CPUs this process may actually use: the smaller of its CPU affinity mask
+ * and its cgroup CPU quota (v1 or v2), so containerised jobs don't
+ * oversubscribe. At least 1.
+ */
+int availableCpuCount();
+
+/**
+ * CPUs allowed by the cgroup quotas of the process whose membership file
+ * (/proc/<pid>/cgroup) is `membershipFile`, with cgroup filesystems
+ * mounted under `root` (normally /sys/fs/cgroup). Checks v2's cpu.max and
+ * v1's cfs quota on the process's own cgroup and its parents, and returns
+ * the tightest. 0 = no limit found (always, off Linux).
+ */
+int cgroupCpuLimit(const std::string& root, const std::string& membershipFile);
+
+/**
+ * Work-stealing thread pool shared by every parallel stage
+ *
+ * Each worker owns a deque: tasks it submits go on the back and it takes
+ * from the back (newest first, cache-warm), while idle workers steal from
+ * the front of other deques (oldest first, usually the biggest pieces).
+ * Tasks submitted from outside the pool are spread round-robin. Threads
+ * waiting on a TaskGroup run queued tasks meanwhile, so parallel loops may
+ * nest without deadlocking.
+ *
+ * A pool of N threads starts N - 1 workers; the thread that waits makes up
+ * the Nth, and a pool of 1 runs everything on the waiting thread.
+ */
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+    
+    explicit TaskScheduler(int threads);
+    ~TaskScheduler();
+    
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+    
+    /**
+     * The pool used by the library, created on first use with
+     * setSharedThreadCount()'s value or availableCpuCount()
+     */
+    static TaskScheduler& shared();
+    
+    /**
+     * Size of the shared pool; only effective before its first use
+     * (0 = availableCpuCount())
+     */
+    static void setSharedThreadCount(int threads);
+    
+    /**
+     * Threads working on tasks, counting the waiting caller
+     */
+    int threadCount() const { return static_cast<int>(workers_.size()) + 1; }
+    
+    /**
+     * Queue a task. Prefer TaskGroup, which tracks completion and errors.
+     */
+    void submit(Task task);
+    
+    /**
+     * Run one queued task on the calling thread, if there is one
+     *
+     * @return false if every queue was empty
+     */
+    bool runOne();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    
+    void workerLoop(size_t index);
+    bool take(size_t home, Task& task);
+    
+    std::vector<std::unique_ptr<Queue>> queues_;  // One per worker (at least one)
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> nextQueue_;               // Round-robin for outside submissions
+    std::atomic<size_t> queued_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+};
+
+/**
+ * A set of tasks to wait for together
+ *
+ * wait() runs queued tasks (of any group) until all of this group's tasks
+ * have finished, then rethrows the first exception one of them threw.
+ * The destructor waits too but swallows errors.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskScheduler& scheduler = TaskScheduler::shared());
+    ~TaskGroup();
+    
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    
+    void run(std::function<void()> fn);
+    void wait();
+    
+    /**
+     * True once a task has thrown; long loops can check it to stop early
+     */
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+    
+    TaskScheduler& scheduler() { return scheduler_; }
+
+private:
+    void finishOne();
+    
+    TaskScheduler& scheduler_;
+    std::atomic<size_t> pending_;
+    std::atomic<bool> failed_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::exception_ptr error_;
+};
+
+/**
+ * Call fn(begin, end) over pieces of [begin, end) in parallel
+ *
+ * @param grain Items per piece (0 = a few pieces per thread)
+ */
+void parallelFor(size_t begin, size_t end, size_t grain,
+                 const std::function<void(size_t begin, size_t end)>& fn);
+
+/**
+ * Call fn(y) for every row of `box` in parallel
+ */
+void parallelForRows(const PixelBox& box, const std::function<void(int y)>& fn);
+
+/**
+ * Call fn(tile) for every tileSize x tileSize tile of `box` (clipped to
+ * it, same coordinates) in parallel
+ */
+void parallelForTiles(const PixelBox& box, int tileSize,
+                      const std::function<void(const PixelBox& tile)>& fn);
+
+} // namespace deep_compositor
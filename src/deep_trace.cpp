@@ -0,0 +1,161 @@
+#include "deep_trace.h"
+#include "utils.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace deep_compositor {
+
+namespace detail {
+std::atomic<bool> g_tracing{false};
+} // namespace detail
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    int64_t startUs;
+    int64_t durationUs;
+    int argCount;
+    const char* keys[TraceZone::kMaxArgs];
+    int64_t values[TraceZone::kMaxArgs];
+    std::string detail;
+};
+
+/**
+ * Events of one thread. Kept alive by the registry after the thread exits
+ * so loader and pool threads still show up in the trace.
+ */
+struct ThreadBuffer {
+    int id = 0;
+    std::string name;
+    std::mutex mutex;  // Only contended while writeTrace() copies it
+    std::vector<TraceEvent> events;
+};
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+ThreadBuffer& threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffer->id = static_cast<int>(reg.threads.size()) + 1;
+        reg.threads.push_back(buffer);
+    }
+    return *buffer;
+}
+
+int64_t microsecondsSinceOrigin(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t - registry().origin).count();
+}
+
+} // anonymous namespace
+
+void startTrace() {
+    registry();  // Fix the time origin before the first event
+    detail::g_tracing.store(true, std::memory_order_relaxed);
+}
+
+void setTraceThreadName(const std::string& name) {
+    if (!isTracing()) {
+        return;
+    }
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+bool traceSample(unsigned period) {
+    thread_local unsigned counter = 0;
+    return ++counter % period == 0;
+}
+
+void TraceZone::finish() {
+    auto end = std::chrono::steady_clock::now();
+
+    TraceEvent event;
+    event.name = name_;
+    event.startUs = microsecondsSinceOrigin(start_);
+    event.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
+    event.argCount = argCount_;
+    for (int i = 0; i < argCount_; ++i) {
+        event.keys[i] = keys_[i];
+        event.values[i] = values_[i];
+    }
+    event.detail = std::move(detail_);
+
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(std::move(event));
+}
+
+bool writeTrace(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    {
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        threads = reg.threads;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+    };
+
+    for (const auto& thread : threads) {
+        std::lock_guard<std::mutex> lock(thread->mutex);
+        if (!thread->name.empty()) {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+                << ",\"args\":{\"name\":";
+            out << jsonString(thread->name);
+            out << "}}";
+        }
+
+        for (const TraceEvent& event : thread->events) {
+            separator();
+            out << "{\"name\":";
+            out << jsonString(event.name);
+            out << ",\"cat\":\"compositor\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs
+                << ",\"args\":{";
+            for (int i = 0; i < event.argCount; ++i) {
+                out << (i ? "," : "");
+                out << jsonString(event.keys[i]);
+                out << ":" << event.values[i];
+            }
+            if (!event.detail.empty()) {
+                out << (event.argCount ? "," : "") << "\"detail\":";
+                out << jsonString(event.detail);
+            }
+            out << "}}";
+        }
+    }
+
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+} // namespace deep_compositor
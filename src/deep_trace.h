@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace deep_compositor {
+
+/**
+ * Phase tracing in Chrome trace format (chrome://tracing, ui.perfetto.dev)
+ *
+ * Code marks its phases with TraceZone objects. While tracing is off (the
+ * default) a zone costs one relaxed atomic load; once startTrace() is called
+ * every zone records its thread, start, duration and a few numeric
+ * arguments into a per-thread buffer, and writeTrace() emits them all.
+ */
+void startTrace();
+
+/**
+ * True between startTrace() and the end of the process
+ */
+inline bool isTracing();
+
+/**
+ * Write everything recorded so far as Chrome trace JSON
+ *
+ * @return false if the file couldn't be written
+ */
+bool writeTrace(const std::string& filename);
+
+/**
+ * Name the calling thread in the trace (e.g. "load 2")
+ */
+void setTraceThreadName(const std::string& name);
+
+/**
+ * True once every `period` calls on the calling thread, for zones around
+ * functions called too often to trace every time
+ */
+bool traceSample(unsigned period);
+
+/**
+ * A complete ("X") trace event covering the zone object's lifetime
+ */
+class TraceZone {
+public:
+    /**
+     * @param name Static string (not copied)
+     * @param enabled Record only if also true (see traceSample)
+     */
+    explicit TraceZone(const char* name, bool enabled = true)
+        : name_(name), active_(enabled && isTracing()), argCount_(0) {
+        if (active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceZone() {
+        end();
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+    /**
+     * Attach a numeric argument (e.g. "samples", "bytes", "tiles"); `key`
+     * must be a static string. At most kMaxArgs are kept.
+     */
+    void arg(const char* key, int64_t value) {
+        if (active_ && argCount_ < kMaxArgs) {
+            keys_[argCount_] = key;
+            values_[argCount_] = value;
+            argCount_++;
+        }
+    }
+
+    /**
+     * Attach a free-form description (e.g. the file being loaded)
+     */
+    void detail(const std::string& text) {
+        if (active_) {
+            detail_ = text;
+        }
+    }
+
+    /**
+     * Close the zone before the object goes out of scope
+     */
+    void end() {
+        if (active_) {
+            finish();
+            active_ = false;
+        }
+    }
+
+    bool active() const { return active_; }
+
+    static constexpr int kMaxArgs = 4;
+
+private:
+    void finish();
+
+    const char* name_;
+    bool active_;
+    int argCount_;
+    std::chrono::steady_clock::time_point start_;
+    const char* keys_[kMaxArgs];
+    int64_t values_[kMaxArgs];
+    std::string detail_;
+};
+
+namespace detail {
+extern std::atomic<bool> g_tracing;
+} // namespace detail
+
+inline bool isTracing() {
+    return detail::g_tracing.load(std::memory_order_relaxed);
+}
+
+} // namespace deep_compositor
@@ -1,8 +1,11 @@
 #include "deep_volume.h"
+#include "deep_channels.h"
+#include "deep_trace.h"
 
 #include <algorithm>
 #include <cmath>
-#include <set>
+#include <cstring>
+#include <type_traits>
 
 namespace deep_compositor {
 
@@ -21,46 +24,15 @@ std::pair<DeepSample, DeepSample> splitSample(const DeepSample& sample, float z_
         return {sample, zero};
     }
 
-    float alpha = sample.alpha;
-
-    // Clamp alpha to avoid log(0)
-    if (alpha >= 1.0f) alpha = 1.0f - kEpsilon;
-
-    float frontThick = z_split - sample.depth;
-    float backThick  = sample.depth_back - z_split;
-
-    float alphaFront, alphaBack;
-
-    if (alpha <= 0.0f) {
-        // Fully transparent -- two zero-alpha fragments
-        alphaFront = 0.0f;
-        alphaBack  = 0.0f;
-    } else {
-        // sigma = -ln(1 - alpha) / thickness
-        float sigma = -std::log(1.0f - alpha) / thick;
-        alphaFront = 1.0f - std::exp(-sigma * frontThick);
-        alphaBack  = 1.0f - std::exp(-sigma * backThick);
-    }
-
-    // Premultiplied RGB scales with alpha ratio
-    float ratioFront = (alpha > 0.0f) ? alphaFront / alpha : 0.0f;
-    float ratioBack  = (alpha > 0.0f) ? alphaBack  / alpha : 0.0f;
-
+    // The dispatched split kernel, so a split here matches the merge's
+    // pieces bit for bit (sigma = -ln(1 - alpha) / thickness; premultiplied
+    // RGB scales with each piece's share of the alpha)
     DeepSample front;
-    front.depth      = sample.depth;
-    front.depth_back = z_split;
-    front.red        = sample.red * ratioFront;
-    front.green      = sample.green * ratioFront;
-    front.blue       = sample.blue * ratioFront;
-    front.alpha      = alphaFront;
-
     DeepSample back;
-    back.depth      = z_split;
-    back.depth_back = sample.depth_back;
-    back.red        = sample.red * ratioBack;
-    back.green      = sample.green * ratioBack;
-    back.blue       = sample.blue * ratioBack;
-    back.alpha      = alphaBack;
+    float pieces[2 * kSampleFloats];
+    kernels().splitVolume(sampleFloats(&sample), &z_split, 1, pieces);
+    std::memcpy(sampleFloats(&front), pieces, kSampleFloats * sizeof(float));
+    std::memcpy(sampleFloats(&back), pieces + kSampleFloats, kSampleFloats * sizeof(float));
 
     return {front, back};
 }
@@ -91,98 +63,170 @@ DeepSample blendCoincidentSamples(const DeepSample& a, const DeepSample& b) {
 // mergePixelsVolumetric -- main volumetric merge algorithm
 // ============================================================================
 
-DeepPixel mergePixelsVolumetric(const std::vector<const DeepPixel*>& pixels,
-                                float epsilon) {
+namespace {
+
+/**
+ * Gather the samples of `pixels` in a layout's sample type, merge them and
+ * store the result as DeepSamples
+ */
+template<class Layout>
+DeepPixel mergePixelsLayout(const std::vector<const DeepPixel*>& pixels,
+                            float epsilon, VolumeMergeCounts* counts) {
+    // Called per pixel: trace one call in 1024
+    TraceZone zone("mergePixelsVolumetric", isTracing() && traceSample(1024));
     DeepPixel result;
 
-    // 1. Collect all samples
     size_t totalSamples = 0;
     for (const auto* pixel : pixels) {
         totalSamples += pixel->sampleCount();
     }
     if (totalSamples == 0) return result;
 
-    std::vector<DeepSample> allSamples;
-    allSamples.reserve(totalSamples);
-    for (const auto* pixel : pixels) {
-        for (const auto& s : pixel->samples()) {
-            allSamples.push_back(s);
+    VolumeMergeCounts merged;
+    std::vector<SampleFor<Layout>> samples;
+    std::vector<SampleFor<Layout>> fragments;
+    samples.reserve(totalSamples);
+    if constexpr (std::is_same_v<Layout, RGBAZBackLayout>) {
+        for (const auto* pixel : pixels) {
+            samples.insert(samples.end(), pixel->samples().begin(), pixel->samples().end());
+        }
+        mergeLayoutSamples<Layout>(samples, fragments, epsilon, &merged);
+        result.samples() = std::move(samples);
+    } else {
+        static_assert(Layout::kAovs == 0, "DeepPixel has no AOV channels");
+        for (const auto* pixel : pixels) {
+            for (const auto& s : pixel->samples()) {
+                samples.push_back({{s.depth, s.red, s.green, s.blue, s.alpha}});
+            }
+        }
+        mergeLayoutSamples<Layout>(samples, fragments, epsilon, &merged);
+        result.samples().reserve(samples.size());
+        for (const auto& s : samples) {
+            result.samples().emplace_back(s.values[0], s.values[1], s.values[2], s.values[3], s.values[4]);
         }
     }
 
-    // 2. Gather split points: every unique depth and depth_back
-    std::set<float> splitPointSet;
-    for (const auto& s : allSamples) {
-        splitPointSet.insert(s.depth);
-        splitPointSet.insert(s.depth_back);
+    if (counts) {
+        counts->fragments += merged.fragments;
+        counts->blends += merged.blends;
     }
-    std::vector<float> splitPoints(splitPointSet.begin(), splitPointSet.end());
-    // Already sorted by std::set
-
-    // 3. Split each volumetric sample at every split point inside its range
-    std::vector<DeepSample> fragments;
-    fragments.reserve(allSamples.size() * 2); // rough estimate
-
-    for (const auto& sample : allSamples) {
-        if (!sample.isVolume()) {
-            // Point / hard-surface sample -- never split
-            fragments.push_back(sample);
-            continue;
-        }
-
-        // Find split points strictly inside (depth, depth_back)
-        // Use lower_bound on depth + epsilon to skip the front boundary
-        auto it = std::upper_bound(splitPoints.begin(), splitPoints.end(),
-                                   sample.depth);
-
-        // Collect interior split points
-        std::vector<float> cuts;
-        while (it != splitPoints.end() && *it < sample.depth_back - 1e-7f) {
-            cuts.push_back(*it);
-            ++it;
-        }
+    zone.arg("inputs", static_cast<int64_t>(pixels.size()));
+    zone.arg("samples", static_cast<int64_t>(totalSamples));
+    zone.arg("fragments", static_cast<int64_t>(totalSamples + merged.fragments));
+    zone.arg("output", static_cast<int64_t>(result.sampleCount()));
+    return result;
+}
 
-        if (cuts.empty()) {
-            fragments.push_back(sample);
-            continue;
+/**
+ * Merge `inputs` carrying extra channels first .. first + count - 1 as the
+ * layout's AOVs (unused AOVs are zero), storing those channels' columns
+ * and, if `beauty` is set, the samples
+ */
+template<class Layout>
+void mergeExtrasPass(const std::vector<ExtraMergeInput>& inputs, const ChannelSet& channels,
+                     size_t first, size_t count, float epsilon, DeepPixel* beauty,
+                     std::vector<float>& columns, VolumeMergeCounts* counts) {
+    constexpr size_t kAovStart = Layout::kAlpha + 1;
+    using Sample = LayoutSample<Layout>;
+    
+    AovMask idAovs = 0;
+    for (size_t a = 0; a < count; ++a) {
+        if (channels.extras[first + a].isId) {
+            idAovs |= AovMask(1) << a;
         }
-
-        // Iteratively split the sample at each cut point
-        DeepSample remainder = sample;
-        for (float z : cuts) {
-            if (z <= remainder.depth + 1e-7f || z >= remainder.depth_back - 1e-7f) {
-                continue;
+    }
+    
+    std::vector<Sample> samples;
+    std::vector<Sample> fragments;
+    for (const ExtraMergeInput& input : inputs) {
+        const std::vector<DeepSample>& pixelSamples = input.pixel->samples();
+        const std::vector<float>& inputColumns = *input.columns;
+        const std::vector<int>& map = *input.channelMap;
+        size_t n = pixelSamples.size();
+        for (size_t s = 0; s < n; ++s) {
+            Sample sample = {};
+            float* v = sample.values;
+            loadLayoutSample<Layout>(pixelSamples[s], v);
+            if (!inputColumns.empty()) {
+                for (size_t a = 0; a < count; ++a) {
+                    int column = map[first + a];
+                    if (column >= 0) {
+                        v[kAovStart + a] = inputColumns[static_cast<size_t>(column) * n + s];
+                    }
+                }
             }
-            auto [front, back] = splitSample(remainder, z);
-            fragments.push_back(front);
-            remainder = back;
+            samples.push_back(sample);
         }
-        fragments.push_back(remainder);
     }
-
-    // 4. Sort fragments by (depth, depth_back)
-    std::sort(fragments.begin(), fragments.end());
-
-    // 5. Blend consecutive fragments with matching intervals
-    std::vector<DeepSample> blended;
-    blended.reserve(fragments.size());
-
-    size_t i = 0;
-    while (i < fragments.size()) {
-        DeepSample current = fragments[i];
-        i++;
-
-        // Merge all subsequent fragments that share the same interval
-        while (i < fragments.size() && current.isNearDepth(fragments[i], epsilon)) {
-            current = blendCoincidentSamples(current, fragments[i]);
-            i++;
+    
+    mergeLayoutSamples<Layout>(samples, fragments, epsilon, counts, idAovs);
+    
+    size_t m = samples.size();
+    columns.resize(channels.extras.size() * m);
+    for (size_t a = 0; a < count; ++a) {
+        float* column = columns.data() + (first + a) * m;
+        for (size_t s = 0; s < m; ++s) {
+            column[s] = samples[s].values[kAovStart + a];
         }
-
-        blended.push_back(current);
     }
+    if (beauty) {
+        std::vector<DeepSample>& out = beauty->samples();
+        out.resize(m);
+        for (size_t s = 0; s < m; ++s) {
+            const float* v = samples[s].values;
+            out[s] = DeepSample(v[0], v[Layout::kDepths - 1], v[Layout::kDepths], v[Layout::kDepths + 1],
+                                v[Layout::kDepths + 2], v[Layout::kDepths + 3]);
+        }
+    }
+}
 
-    result.samples() = std::move(blended);
+} // anonymous namespace
+
+DeepPixel mergePixelsWithExtras(const std::vector<ExtraMergeInput>& inputs,
+                                const ChannelSet& channels, float epsilon,
+                                std::vector<float>& columns, VolumeMergeCounts* counts) {
+    columns.clear();
+    size_t total = channels.extras.size();
+    if (total == 0) {
+        std::vector<const DeepPixel*> pixels;
+        pixels.reserve(inputs.size());
+        for (const ExtraMergeInput& input : inputs) {
+            pixels.push_back(input.pixel);
+        }
+        return pixelMergeFunction(channels)(pixels, epsilon, counts);
+    }
+    
+    TraceZone zone("mergePixelsWithExtras", isTracing() && traceSample(1024));
+    DeepPixel result;
+    
+    // Every pass merges the samples the same way, so the first pass's
+    // samples and counts stand for all of them
+    for (size_t first = 0; first < total; first += kMaxLayoutAovs) {
+        size_t count = std::min(kMaxLayoutAovs, total - first);
+        DeepPixel* beauty = first == 0 ? &result : nullptr;
+        VolumeMergeCounts* passCounts = first == 0 ? counts : nullptr;
+        auto pass = [&](auto layout) {
+            using Layout = decltype(layout);
+            mergeExtrasPass<Layout>(inputs, channels, first, count, epsilon, beauty, columns, passCounts);
+        };
+        if (channels.zBack) {
+            withAovLayout<true>(count, pass);
+        } else {
+            withAovLayout<false>(count, pass);
+        }
+    }
+    zone.arg("inputs", static_cast<int64_t>(inputs.size()));
+    zone.arg("output", static_cast<int64_t>(result.sampleCount()));
     return result;
 }
 
+DeepPixel mergePixelsVolumetric(const std::vector<const DeepPixel*>& pixels,
+                                float epsilon, VolumeMergeCounts* counts) {
+    return mergePixelsLayout<RGBAZBackLayout>(pixels, epsilon, counts);
+}
+
+PixelMergeFn pixelMergeFunction(const ChannelSet& channels) {
+    return channels.zBack ? &mergePixelsLayout<RGBAZBackLayout> : &mergePixelsLayout<RGBALayout>;
+}
+
 } // namespace deep_compositor
@@ -12,6 +12,9 @@ namespace deep_compositor {
  *
  * Invariant: (1 - front.alpha) * (1 - back.alpha) == (1 - sample.alpha)
  *
+ * Runs the dispatched splitVolume kernel, so the pieces are the ones a
+ * merge produces for the same cut.
+ *
  * If z_split is not strictly inside the sample's range, returns the
  * original sample unchanged in the first element and a zero sample
  * in the second.
@@ -24,6 +27,14 @@ std::pair<DeepSample, DeepSample> splitSample(const DeepSample& sample, float z_
  */
 DeepSample blendCoincidentSamples(const DeepSample& a, const DeepSample& b);
 
+/**
+ * Work counters of volumetric merging, accumulated across calls
+ */
+struct VolumeMergeCounts {
+    size_t fragments = 0;  // Extra fragments created by splitting volumes
+    size_t blends = 0;     // Coincident fragment pairs blended together
+};
+
 /**
  * Volumetric merge of multiple deep pixels.
  *
@@ -35,8 +46,47 @@ DeepSample blendCoincidentSamples(const DeepSample& a, const DeepSample& b);
  *
  * The result is a single DeepPixel with non-overlapping, sorted intervals
  * ready for front-to-back Over compositing.
+ *
+ * @param counts If set, split and blend counts are added to it
  */
 DeepPixel mergePixelsVolumetric(const std::vector<const DeepPixel*>& pixels,
-                                float epsilon = 0.001f);
+                                float epsilon = 0.001f,
+                                VolumeMergeCounts* counts = nullptr);
+
+/**
+ * A per-pixel merge with mergePixelsVolumetric's signature
+ */
+using PixelMergeFn = DeepPixel (*)(const std::vector<const DeepPixel*>& pixels,
+                                   float epsilon, VolumeMergeCounts* counts);
+
+/**
+ * mergePixelsVolumetric compiled for the channel layout of images with
+ * these channels (see deep_channels.h). Images without ZBack hold only
+ * points, so their merge skips gathering split points and splitting.
+ */
+PixelMergeFn pixelMergeFunction(const ChannelSet& channels);
+
+/**
+ * One input pixel of mergePixelsWithExtras
+ */
+struct ExtraMergeInput {
+    const DeepPixel* pixel;
+    const std::vector<float>* columns;   // Its extra channel columns (DeepImage::extraColumns)
+    const std::vector<int>* channelMap;  // Its column of each result extra channel, -1 if absent
+};
+
+/**
+ * Volumetric merge of pixels with extra channels. The samples merge as
+ * pixelMergeFunction(channels) merges them; the extra channels follow
+ * their samples through splits and blends (see ExtraChannel). Channels an
+ * input lacks are zero in its samples.
+ *
+ * @param columns Set to the result's extra channel columns
+ * @param counts If set, split and blend counts are added to it
+ */
+DeepPixel mergePixelsWithExtras(const std::vector<ExtraMergeInput>& inputs,
+                                const ChannelSet& channels, float epsilon,
+                                std::vector<float>& columns,
+                                VolumeMergeCounts* counts = nullptr);
 
 } // namespace deep_compositor
@@ -1,7 +1,14 @@
 #include "deep_writer.h"
+#include "deep_channels.h"
+#include "deep_pager.h"
+#include "deep_tasks.h"
+#include "deep_trace.h"
+#include "kernels/kernels.h"
 #include "utils.h"
 
 #include <OpenEXR/ImfDeepScanLineOutputFile.h>
+#include <OpenEXR/ImfDeepTiledOutputFile.h>
+#include <OpenEXR/ImfTileDescription.h>
 #include <OpenEXR/ImfDeepFrameBuffer.h>
 #include <OpenEXR/ImfOutputFile.h>
 #include <OpenEXR/ImfChannelList.h>
@@ -15,6 +22,9 @@
 
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
 
 namespace deep_compositor {
 
@@ -22,62 +32,176 @@ namespace deep_compositor {
 // Flattening Operations
 // ============================================================================
 
-std::array<float, 4> flattenPixel(const DeepPixel& pixel) {
-    // Front-to-back over operation
-    // accum_rgb = accum_rgb + sample_rgb * (1 - accum_alpha)
-    // accum_alpha = accum_alpha + sample_alpha * (1 - accum_alpha)
-    
-    float accumR = 0.0f;
-    float accumG = 0.0f;
-    float accumB = 0.0f;
-    float accumA = 0.0f;
-    
-    for (const auto& sample : pixel.samples()) {
-        float oneMinusAccumA = 1.0f - accumA;
-        
-        // Since colors are premultiplied, we composite directly
-        accumR += sample.red * oneMinusAccumA;
-        accumG += sample.green * oneMinusAccumA;
-        accumB += sample.blue * oneMinusAccumA;
-        accumA += sample.alpha * oneMinusAccumA;
-        
-        // Early out if fully opaque
-        if (accumA >= 0.9999f) {
-            accumA = 1.0f;
-            break;
+namespace {
+
+// Tile edge for parallel flattening: small enough to balance, big enough
+// that scheduling overhead vanishes
+constexpr int kFlattenTileSize = 64;
+
+/**
+ * Flatten a pixel, setting `used` to the number of samples composited
+ * before it became opaque. DeepPixel stores DeepSamples whatever the
+ * image's channels, so this is the RGBA+ZBack layout.
+ */
+std::array<float, 4> flattenSamples(const DeepPixel& pixel, size_t& used) {
+    // Front-to-back over operation on premultiplied colour
+    // accum_rgba = accum_rgba + sample_rgba * (1 - accum_alpha)
+    std::array<float, 4> rgba;
+    used = flattenLayout<RGBAZBackLayout>(sampleFloats(pixel.samples().data()),
+                                          pixel.sampleCount(), rgba.data());
+    return rgba;
+}
+
+/**
+ * Flatten extra channels first .. first + count - 1 of the pixels of
+ * `tile` as the layout's AOVs into `out` (see flattenExtraChannels)
+ */
+template<class Layout>
+void flattenExtrasPass(const DeepImage& img, const PixelBox& tile, const PixelBox& local,
+                       size_t first, size_t count, AovMask idAovs, std::vector<float>& out) {
+    constexpr size_t kAovStart = Layout::kAlpha + 1;
+    size_t channelCount = img.channels().extras.size();
+    size_t width = static_cast<size_t>(local.width());
+    std::vector<LayoutSample<Layout>> samples;
+    float flat[Layout::kChannels];
+    for (int y = tile.minY; y <= tile.maxY; ++y) {
+        for (int x = tile.minX; x <= tile.maxX; ++x) {
+            const std::vector<DeepSample>& pixelSamples = img.pixelUnchecked(x, y).samples();
+            const std::vector<float>& columns = img.extraColumns(x, y);
+            if (columns.empty()) {
+                continue;
+            }
+            
+            size_t n = pixelSamples.size();
+            samples.assign(n, LayoutSample<Layout>{});
+            for (size_t s = 0; s < n; ++s) {
+                float* v = samples[s].values;
+                loadLayoutSample<Layout>(pixelSamples[s], v);
+                for (size_t a = 0; a < count; ++a) {
+                    v[kAovStart + a] = columns[(first + a) * n + s];
+                }
+            }
+            flattenLayout<Layout>(sampleFloats(samples.data()), n, flat, idAovs);
+            
+            float* dst = &out[(static_cast<size_t>(y - local.minY) * width + (x - local.minX)) *
+                              channelCount + first];
+            std::copy(flat + 4, flat + 4 + count, dst);
         }
     }
-    
-    return {accumR, accumG, accumB, accumA};
+}
+
+} // anonymous namespace
+
+std::array<float, 4> flattenPixel(const DeepPixel& pixel) {
+    size_t used;
+    return flattenSamples(pixel, used);
 }
 
 std::vector<float> flattenImage(const DeepImage& img) {
-    int width = img.width();
-    int height = img.height();
-    
-    std::vector<float> result(static_cast<size_t>(width) * height * 4);
-    
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            auto rgba = flattenPixel(img.pixel(x, y));
-            
-            size_t idx = (static_cast<size_t>(y) * width + x) * 4;
-            result[idx + 0] = rgba[0];
-            result[idx + 1] = rgba[1];
-            result[idx + 2] = rgba[2];
-            result[idx + 3] = rgba[3];
+    return flattenImage(img, img.dataWindow());
+}
+
+std::vector<float> flattenImage(const DeepImage& img, const PixelBox& region) {
+    std::vector<float> result;
+    flattenImage(img, region, result);
+    return result;
+}
+
+void flattenImage(const DeepImage& img, const PixelBox& region, std::vector<float>& out,
+                  size_t* culledSamples) {
+    PixelBox window = region.intersect(img.dataWindow());
+    int width = window.width();
+    int height = window.height();
+    
+    TraceZone zone("flattenImage");
+    zone.arg("pixels", static_cast<int64_t>(width) * height);
+    
+    // resize() keeps the existing capacity, so a recycled buffer doesn't reallocate
+    out.resize(static_cast<size_t>(width) * height * 4);
+    std::atomic<size_t> culled{0};
+    
+    // Tiles are independent (paged images are walked tile by tile)
+    PixelBox local(window.minX - img.originX(), window.minY - img.originY(),
+                   window.maxX - img.originX(), window.maxY - img.originY());
+    img.forEachTile(local, kFlattenTileSize, [&](const PixelBox& tile) {
+        size_t tileCulled = 0;
+        for (int y = tile.minY; y <= tile.maxY; ++y) {
+            for (int x = tile.minX; x <= tile.maxX; ++x) {
+                const DeepPixel& pixel = img.pixelUnchecked(x, y);
+                size_t used;
+                auto rgba = flattenSamples(pixel, used);
+                tileCulled += pixel.sampleCount() - used;
+                
+                size_t idx = (static_cast<size_t>(y - local.minY) * width + (x - local.minX)) * 4;
+                out[idx + 0] = rgba[0];
+                out[idx + 1] = rgba[1];
+                out[idx + 2] = rgba[2];
+                out[idx + 3] = rgba[3];
+            }
         }
+        culled.fetch_add(tileCulled, std::memory_order_relaxed);
+    });
+    
+    if (culledSamples) {
+        *culledSamples += culled.load();
+    }
+}
+
+void flattenExtraChannels(const DeepImage& img, const PixelBox& region, std::vector<float>& out) {
+    PixelBox window = region.intersect(img.dataWindow());
+    int width = window.width();
+    const std::vector<ExtraChannel>& extras = img.channels().extras;
+    size_t channelCount = extras.size();
+    out.assign(static_cast<size_t>(width) * window.height() * channelCount, 0.0f);
+    if (channelCount == 0) {
+        return;
     }
     
-    return result;
+    TraceZone zone("flattenExtraChannels");
+    zone.arg("channels", static_cast<int64_t>(channelCount));
+    
+    PixelBox local(window.minX - img.originX(), window.minY - img.originY(),
+                   window.maxX - img.originX(), window.maxY - img.originY());
+    img.forEachTile(local, kFlattenTileSize, [&](const PixelBox& tile) {
+        // Up to kMaxLayoutAovs channels per pass, with the layout for the
+        // image's channels, as deepMerge merges them
+        for (size_t first = 0; first < channelCount; first += kMaxLayoutAovs) {
+            size_t count = std::min(kMaxLayoutAovs, channelCount - first);
+            AovMask idAovs = 0;
+            for (size_t a = 0; a < count; ++a) {
+                if (extras[first + a].isId) {
+                    idAovs |= AovMask(1) << a;
+                }
+            }
+            auto pass = [&](auto layout) {
+                using Layout = decltype(layout);
+                flattenExtrasPass<Layout>(img, tile, local, first, count, idAovs, out);
+            };
+            if (img.channels().zBack) {
+                withAovLayout<true>(count, pass);
+            } else {
+                withAovLayout<false>(count, pass);
+            }
+        }
+    });
 }
 
 // ============================================================================
 // Deep EXR Writing
 // ============================================================================
 
-void writeDeepEXR(const DeepImage& img, const std::string& filename) {
-    logVerbose("  Writing deep EXR: " + filename);
+namespace {
+
+/**
+ * Shared deep writer. Target is a file path (const char*) or an Imf::OStream;
+ * the OpenEXR output file classes accept either. `name` is used in messages.
+ */
+template<typename Target>
+void writeDeepEXRImpl(const DeepImage& img, Target& target, const std::string& name,
+                      const DeepWriteOptions& options) {
+    logVerbose("  Writing deep EXR: " + name);
+    TraceZone zone("writeDeepEXR");
+    zone.detail(name);
     
     int width = img.width();
     int height = img.height();
@@ -86,176 +210,213 @@ void writeDeepEXR(const DeepImage& img, const std::string& filename) {
         throw DeepWriterException("Invalid image dimensions");
     }
     
+    if (options.tiled && (options.tileWidth <= 0 || options.tileHeight <= 0)) {
+        throw DeepWriterException("Invalid tile size");
+    }
+    
     // Set up header
-    Imf::Header header(width, height);
-    header.setType(Imf::DEEPSCANLINE);
+    PixelBox window = img.dataWindow();
+    PixelBox display = img.displayWindow();
+    Imf::Header header(
+        Imath::Box2i(Imath::V2i(display.minX, display.minY),
+                     Imath::V2i(display.maxX, display.maxY)),
+        Imath::Box2i(Imath::V2i(window.minX, window.minY),
+                     Imath::V2i(window.maxX, window.maxY)));
+    
+    if (options.tiled) {
+        header.setType(Imf::DEEPTILE);
+        header.setTileDescription(
+            Imf::TileDescription(options.tileWidth, options.tileHeight, Imf::ONE_LEVEL));
+    } else {
+        header.setType(Imf::DEEPSCANLINE);
+    }
     
     // Deep images require ZIPS compression (or NO_COMPRESSION)
     header.compression() = Imf::ZIPS_COMPRESSION;
     
-    header.channels().insert("R", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("G", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("B", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("A", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("Z", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("ZBack", Imf::Channel(Imf::FLOAT));
+    // Only the channels the image carries (points-only images have no ZBack)
+    const ChannelSet& channels = img.channels();
+    std::vector<std::string> names = channels.names();
+    size_t extraCount = channels.extras.size();
+    for (size_t i = 0; i < names.size(); ++i) {
+        size_t extra = i + extraCount - names.size();  // Wraps for the fixed channels
+        bool isUint = extra < extraCount && channels.extras[extra].isUint;
+        header.channels().insert(names[i], Imf::Channel(isUint ? Imf::UINT : Imf::FLOAT));
+    }
     
-    // Prepare sample count array
+    // Sample counts of the whole window (the file reads them per band)
     std::vector<unsigned int> sampleCounts(static_cast<size_t>(width) * height);
-    
-    // Count total samples
+    img.forEachPixel([&](int x, int y, const DeepPixel& pixel) {
+        sampleCounts[static_cast<size_t>(y) * width + x] = static_cast<unsigned int>(pixel.sampleCount());
+    });
+    std::vector<size_t> rowSamples(height, 0);
     size_t totalSamples = 0;
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            size_t idx = static_cast<size_t>(y) * width + x;
-            sampleCounts[idx] = static_cast<unsigned int>(img.pixel(x, y).sampleCount());
-            totalSamples += sampleCounts[idx];
+            rowSamples[y] += sampleCounts[static_cast<size_t>(y) * width + x];
         }
+        totalSamples += rowSamples[y];
     }
     
-    // Allocate sample data arrays
-    std::vector<float> rData(totalSamples);
-    std::vector<float> gData(totalSamples);
-    std::vector<float> bData(totalSamples);
-    std::vector<float> aData(totalSamples);
-    std::vector<float> zData(totalSamples);
-    std::vector<float> zBackData(totalSamples);
-
-    // Allocate pointer arrays
-    std::vector<float*> rPtrs(sampleCounts.size());
-    std::vector<float*> gPtrs(sampleCounts.size());
-    std::vector<float*> bPtrs(sampleCounts.size());
-    std::vector<float*> aPtrs(sampleCounts.size());
-    std::vector<float*> zPtrs(sampleCounts.size());
-    std::vector<float*> zBackPtrs(sampleCounts.size());
-    
-    // Fill data and set up pointers
-    size_t offset = 0;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            size_t idx = static_cast<size_t>(y) * width + x;
-            const DeepPixel& pixel = img.pixel(x, y);
+    // Samples are staged and written a band of rows (whole tile rows when
+    // tiled) at a time. Under a pager's budget a band stages at most about
+    // a quarter of it, beyond a single row of tiles or scanlines; otherwise
+    // the whole window is one band.
+    size_t channelCount = names.size();
+    size_t bandBudget = std::numeric_limits<size_t>::max();
+    if (std::shared_ptr<TilePager> pager = outOfCorePager()) {
+        bandBudget = std::max<size_t>(pager->budget() / 4, 1);
+    }
+    int step = options.tiled ? options.tileHeight : 1;
+    auto stagedBytes = [&](int y0, int y1) {
+        size_t bytes = static_cast<size_t>(y1 - y0) * width * channelCount * sizeof(float*);
+        for (int y = y0; y < y1; ++y) {
+            bytes += rowSamples[y] * channelCount * sizeof(float);
+        }
+        return bytes;
+    };
+    
+    // Staging arrays, one per channel (UINT channels write their bits),
+    // reused across bands
+    std::vector<std::vector<float>> data(channelCount);
+    std::vector<std::vector<float*>> ptrs(channelCount);
+    std::vector<size_t> offsets;
+    
+    try {
+        std::unique_ptr<Imf::DeepTiledOutputFile> tiledFile;
+        std::unique_ptr<Imf::DeepScanLineOutputFile> scanLineFile;
+        if (options.tiled) {
+            tiledFile.reset(new Imf::DeepTiledOutputFile(target, header));
+        } else {
+            scanLineFile.reset(new Imf::DeepScanLineOutputFile(target, header));
+        }
+        
+        int bands = 0;
+        for (int y0 = 0; y0 < height;) {
+            size_t bytes = 0;
+            int y1 = y0;
+            while (y1 < height) {
+                int next = std::min(height, y1 + step);
+                size_t more = stagedBytes(y1, next);
+                if (y1 > y0 && bytes + more > bandBudget) {
+                    break;
+                }
+                bytes += more;
+                y1 = next;
+            }
             
-            if (sampleCounts[idx] > 0) {
-                rPtrs[idx] = rData.data() + offset;
-                gPtrs[idx] = gData.data() + offset;
-                bPtrs[idx] = bData.data() + offset;
-                aPtrs[idx] = aData.data() + offset;
-                zPtrs[idx] = zData.data() + offset;
-                zBackPtrs[idx] = zBackData.data() + offset;
-
-                for (size_t s = 0; s < pixel.sampleCount(); ++s) {
-                    const DeepSample& sample = pixel[s];
-                    rData[offset + s] = sample.red;
-                    gData[offset + s] = sample.green;
-                    bData[offset + s] = sample.blue;
-                    aData[offset + s] = sample.alpha;
-                    zData[offset + s] = sample.depth;
-                    zBackData[offset + s] = sample.depth_back;
+            // Give each pixel of the band its offset into the arrays
+            size_t bandPixels = static_cast<size_t>(y1 - y0) * width;
+            const unsigned int* bandCounts = sampleCounts.data() + static_cast<size_t>(y0) * width;
+            offsets.resize(bandPixels);
+            size_t bandSamples = 0;
+            for (size_t i = 0; i < bandPixels; ++i) {
+                offsets[i] = bandSamples;
+                bandSamples += bandCounts[i];
+            }
+            for (size_t c = 0; c < channelCount; ++c) {
+                data[c].assign(bandSamples, 0.0f);  // Empty extra columns are zeros
+                ptrs[c].assign(bandPixels, nullptr);
+            }
+            
+            // Fill the arrays; pixels write disjoint ranges. Channel order
+            // is names(): R, G, B, A, Z, [ZBack], extras.
+            size_t firstExtra = channelCount - extraCount;
+            img.forEachTile(PixelBox(0, y0, width - 1, y1 - 1), 64, [&](const PixelBox& box) {
+                for (int y = box.minY; y <= box.maxY; ++y) {
+                    for (int x = box.minX; x <= box.maxX; ++x) {
+                        const DeepPixel& pixel = img.pixelUnchecked(x, y);
+                        size_t n = pixel.sampleCount();
+                        if (n == 0) {
+                            continue;
+                        }
+                        size_t idx = static_cast<size_t>(y - y0) * width + x;
+                        size_t offset = offsets[idx];
+                        for (size_t c = 0; c < channelCount; ++c) {
+                            ptrs[c][idx] = data[c].data() + offset;
+                        }
+                        for (size_t s = 0; s < n; ++s) {
+                            const DeepSample& sample = pixel[s];
+                            data[0][offset + s] = sample.red;
+                            data[1][offset + s] = sample.green;
+                            data[2][offset + s] = sample.blue;
+                            data[3][offset + s] = sample.alpha;
+                            data[4][offset + s] = sample.depth;
+                        }
+                        if (channels.zBack) {
+                            for (size_t s = 0; s < n; ++s) {
+                                data[5][offset + s] = pixel[s].depth_back;
+                            }
+                        }
+                        if (extraCount > 0) {
+                            const std::vector<float>& columns = img.extraColumns(x, y);
+                            for (size_t c = 0; c < extraCount && !columns.empty(); ++c) {
+                                std::copy_n(columns.begin() + c * n, n,
+                                            data[firstExtra + c].begin() + offset);
+                            }
+                        }
+                    }
                 }
-
-                offset += sampleCounts[idx];
+            });
+            
+            // Slices are addressed in absolute coordinates, so shift each
+            // base pointer back by the band's origin
+            long originOffset = window.minX + static_cast<long>(window.minY + y0) * width;
+            Imf::DeepFrameBuffer frameBuffer;
+            frameBuffer.insertSampleCountSlice(
+                Imf::Slice(
+                    Imf::UINT,
+                    reinterpret_cast<char*>(const_cast<unsigned int*>(bandCounts) - originOffset),
+                    sizeof(unsigned int),
+                    sizeof(unsigned int) * width
+                )
+            );
+            for (size_t c = 0; c < channelCount; ++c) {
+                bool isUint = c >= firstExtra && channels.extras[c - firstExtra].isUint;
+                frameBuffer.insert(names[c], Imf::DeepSlice(
+                    isUint ? Imf::UINT : Imf::FLOAT,
+                    reinterpret_cast<char*>(ptrs[c].data() - originOffset),
+                    sizeof(float*),
+                    sizeof(float*) * width,
+                    sizeof(float)
+                ));
+            }
+            
+            if (tiledFile) {
+                tiledFile->setFrameBuffer(frameBuffer);
+                tiledFile->writeTiles(0, tiledFile->numXTiles(0) - 1,
+                                      y0 / options.tileHeight, (y1 - 1) / options.tileHeight);
             } else {
-                rPtrs[idx] = nullptr;
-                gPtrs[idx] = nullptr;
-                bPtrs[idx] = nullptr;
-                aPtrs[idx] = nullptr;
-                zPtrs[idx] = nullptr;
-                zBackPtrs[idx] = nullptr;
+                scanLineFile->setFrameBuffer(frameBuffer);
+                scanLineFile->writePixels(y1 - y0);
             }
+            bands++;
+            y0 = y1;
         }
-    }
-    
-    // Create output file
-    try {
-        Imf::DeepScanLineOutputFile outFile(filename.c_str(), header);
-        
-        // Set up frame buffer
-        Imf::DeepFrameBuffer frameBuffer;
-        
-        frameBuffer.insertSampleCountSlice(
-            Imf::Slice(
-                Imf::UINT,
-                reinterpret_cast<char*>(sampleCounts.data()),
-                sizeof(unsigned int),
-                sizeof(unsigned int) * width
-            )
-        );
-        
-        frameBuffer.insert(
-            "R",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(rPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-        
-        frameBuffer.insert(
-            "G",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(gPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-        
-        frameBuffer.insert(
-            "B",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(bPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-        
-        frameBuffer.insert(
-            "A",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(aPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-        
-        frameBuffer.insert(
-            "Z",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(zPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-
-        frameBuffer.insert(
-            "ZBack",
-            Imf::DeepSlice(
-                Imf::FLOAT,
-                reinterpret_cast<char*>(zBackPtrs.data()),
-                sizeof(float*),
-                sizeof(float*) * width,
-                sizeof(float)
-            )
-        );
-
-        outFile.setFrameBuffer(frameBuffer);
-        outFile.writePixels(height);
+        zone.arg("bands", static_cast<int64_t>(bands));
         
     } catch (const std::exception& e) {
         throw DeepWriterException("Failed to write deep EXR: " + std::string(e.what()));
     }
     
-    logVerbose("    Wrote " + formatNumber(totalSamples) + " samples");
+    zone.arg("samples", static_cast<int64_t>(totalSamples));
+    zone.arg("bytes", static_cast<int64_t>(totalSamples * names.size() * sizeof(float)));  // Uncompressed
+    logVerbose("    Wrote " + formatNumber(totalSamples) + " samples" +
+               (options.tiled ? " (tiled " + std::to_string(options.tileWidth) + "x" +
+                                std::to_string(options.tileHeight) + ")" : ""));
+}
+
+} // anonymous namespace
+
+void writeDeepEXR(const DeepImage& img, const std::string& filename,
+                  const DeepWriteOptions& options) {
+    const char* path = filename.c_str();
+    writeDeepEXRImpl(img, path, filename, options);
+}
+
+void writeDeepEXR(const DeepImage& img, Imf::OStream& stream,
+                  const DeepWriteOptions& options) {
+    writeDeepEXRImpl(img, stream, stream.fileName(), options);
 }
 
 // ============================================================================
@@ -264,79 +425,82 @@ void writeDeepEXR(const DeepImage& img, const std::string& filename) {
 
 void writeFlatEXR(const DeepImage& img, const std::string& filename) {
     auto rgba = flattenImage(img);
-    writeFlatEXR(rgba, img.width(), img.height(), filename);
+    writeFlatEXR(rgba, img.dataWindow(), img.displayWindow(), filename);
 }
 
 void writeFlatEXR(const std::vector<float>& rgba, 
                   int width, int height, 
                   const std::string& filename) {
-    logVerbose("  Writing flat EXR: " + filename);
+    PixelBox window(0, 0, width - 1, height - 1);
+    writeFlatEXR(rgba, window, window, filename);
+}
+
+namespace {
+
+/**
+ * Shared flat writer. `uintChannels` marks channels written as UINT (their
+ * floats hold the bits); empty means all FLOAT.
+ */
+template<typename Target>
+void writeFlatEXRImpl(const std::vector<float>& values, const std::vector<std::string>& channels,
+                      const PixelBox& dataWindow, const PixelBox& displayWindow,
+                      Target& target, const std::string& name,
+                      const std::vector<bool>& uintChannels = {}) {
+    logVerbose("  Writing flat EXR: " + name);
+    TraceZone zone("writeFlatEXR");
+    zone.detail(name);
+    zone.arg("pixels", static_cast<int64_t>(dataWindow.width()) * dataWindow.height());
+    
+    int width = dataWindow.width();
+    int height = dataWindow.height();
     
     if (width <= 0 || height <= 0) {
         throw DeepWriterException("Invalid image dimensions");
     }
     
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    size_t channelCount = channels.size();
+    if (values.size() != pixelCount * channelCount) {
+        throw DeepWriterException("Flat buffer size doesn't match " + name + "'s data window");
+    }
+    
     // Set up header
-    Imf::Header header(width, height);
-    header.channels().insert("R", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("G", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("B", Imf::Channel(Imf::FLOAT));
-    header.channels().insert("A", Imf::Channel(Imf::FLOAT));
+    Imf::Header header(
+        Imath::Box2i(Imath::V2i(displayWindow.minX, displayWindow.minY),
+                     Imath::V2i(displayWindow.maxX, displayWindow.maxY)),
+        Imath::Box2i(Imath::V2i(dataWindow.minX, dataWindow.minY),
+                     Imath::V2i(dataWindow.maxX, dataWindow.maxY)));
+    auto channelType = [&](size_t c) {
+        return !uintChannels.empty() && uintChannels[c] ? Imf::UINT : Imf::FLOAT;
+    };
+    for (size_t c = 0; c < channelCount; ++c) {
+        header.channels().insert(channels[c], Imf::Channel(channelType(c)));
+    }
     
     // Separate channels
-    std::vector<float> rData(static_cast<size_t>(width) * height);
-    std::vector<float> gData(static_cast<size_t>(width) * height);
-    std::vector<float> bData(static_cast<size_t>(width) * height);
-    std::vector<float> aData(static_cast<size_t>(width) * height);
-    
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            size_t srcIdx = (static_cast<size_t>(y) * width + x) * 4;
-            size_t dstIdx = static_cast<size_t>(y) * width + x;
-            
-            rData[dstIdx] = rgba[srcIdx + 0];
-            gData[dstIdx] = rgba[srcIdx + 1];
-            bData[dstIdx] = rgba[srcIdx + 2];
-            aData[dstIdx] = rgba[srcIdx + 3];
+    std::vector<std::vector<float>> planes(channelCount, std::vector<float>(pixelCount));
+    for (size_t i = 0; i < pixelCount; ++i) {
+        for (size_t c = 0; c < channelCount; ++c) {
+            planes[c][i] = values[i * channelCount + c];
         }
     }
     
+    // Slices are addressed in absolute coordinates
+    long originOffset = dataWindow.minX + static_cast<long>(dataWindow.minY) * width;
+    
     try {
-        Imf::OutputFile outFile(filename.c_str(), header);
+        Imf::OutputFile outFile(target, header);
         
         Imf::FrameBuffer frameBuffer;
-        
-        frameBuffer.insert("R",
-            Imf::Slice(Imf::FLOAT,
-                reinterpret_cast<char*>(rData.data()),
-                sizeof(float),
-                sizeof(float) * width
-            )
-        );
-        
-        frameBuffer.insert("G",
-            Imf::Slice(Imf::FLOAT,
-                reinterpret_cast<char*>(gData.data()),
-                sizeof(float),
-                sizeof(float) * width
-            )
-        );
-        
-        frameBuffer.insert("B",
-            Imf::Slice(Imf::FLOAT,
-                reinterpret_cast<char*>(bData.data()),
-                sizeof(float),
-                sizeof(float) * width
-            )
-        );
-        
-        frameBuffer.insert("A",
-            Imf::Slice(Imf::FLOAT,
-                reinterpret_cast<char*>(aData.data()),
-                sizeof(float),
-                sizeof(float) * width
-            )
-        );
+        for (size_t c = 0; c < channelCount; ++c) {
+            frameBuffer.insert(channels[c],
+                Imf::Slice(channelType(c),
+                    reinterpret_cast<char*>(planes[c].data() - originOffset),
+                    sizeof(float),
+                    sizeof(float) * width
+                )
+            );
+        }
         
         outFile.setFrameBuffer(frameBuffer);
         outFile.writePixels(height);
@@ -346,6 +510,79 @@ void writeFlatEXR(const std::vector<float>& rgba,
     }
 }
 
+const std::vector<std::string>& rgbaChannels() {
+    static const std::vector<std::string> channels = {"R", "G", "B", "A"};
+    return channels;
+}
+
+/**
+ * Interleave flattened RGBA and extra channels for writeFlatEXRImpl
+ */
+struct FlatWithExtras {
+    std::vector<float> values;
+    std::vector<std::string> names;
+    std::vector<bool> uintChannels;
+    
+    FlatWithExtras(const std::vector<float>& rgba, const std::vector<float>& extras,
+                   const ChannelSet& channels)
+        : names(rgbaChannels()), uintChannels(4, false) {
+        size_t extraCount = channels.extras.size();
+        for (const ExtraChannel& extra : channels.extras) {
+            names.push_back(extra.name);
+            uintChannels.push_back(extra.isUint);
+        }
+        size_t pixels = rgba.size() / 4;
+        if (extras.size() != pixels * extraCount) {
+            throw DeepWriterException("Flat extra channels don't match the RGBA buffer");
+        }
+        values.resize(pixels * names.size());
+        for (size_t i = 0; i < pixels; ++i) {
+            float* dst = &values[i * names.size()];
+            std::copy_n(&rgba[i * 4], 4, dst);
+            std::copy_n(extras.begin() + i * extraCount, extraCount, dst + 4);
+        }
+    }
+};
+
+} // anonymous namespace
+
+void writeFlatEXR(const std::vector<float>& rgba,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  const std::string& filename) {
+    const char* path = filename.c_str();
+    writeFlatEXRImpl(rgba, rgbaChannels(), dataWindow, displayWindow, path, filename);
+}
+
+void writeFlatEXR(const std::vector<float>& rgba,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  Imf::OStream& stream) {
+    writeFlatEXRImpl(rgba, rgbaChannels(), dataWindow, displayWindow, stream, stream.fileName());
+}
+
+void writeFlatEXR(const std::vector<float>& rgba, const std::vector<float>& extras,
+                  const ChannelSet& channels, const PixelBox& dataWindow,
+                  const PixelBox& displayWindow, const std::string& filename) {
+    FlatWithExtras flat(rgba, extras, channels);
+    const char* path = filename.c_str();
+    writeFlatEXRImpl(flat.values, flat.names, dataWindow, displayWindow, path, filename,
+                     flat.uintChannels);
+}
+
+void writeFlatEXR(const std::vector<float>& rgba, const std::vector<float>& extras,
+                  const ChannelSet& channels, const PixelBox& dataWindow,
+                  const PixelBox& displayWindow, Imf::OStream& stream) {
+    FlatWithExtras flat(rgba, extras, channels);
+    writeFlatEXRImpl(flat.values, flat.names, dataWindow, displayWindow, stream, stream.fileName(),
+                     flat.uintChannels);
+}
+
+void writeFlatEXR(const std::vector<float>& values, const std::vector<std::string>& channels,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  const std::string& filename) {
+    const char* path = filename.c_str();
+    writeFlatEXRImpl(values, channels, dataWindow, displayWindow, path, filename);
+}
+
 // ============================================================================
 // PNG Writing
 // ============================================================================
@@ -379,6 +616,14 @@ void writePNG(const std::vector<float>& rgba,
         throw DeepWriterException("Invalid image dimensions");
     }
     
+    // Convert float RGBA to 8-bit with simple tone mapping, rows in parallel
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    const KernelTable& kernel = kernels();
+    parallelForRows(PixelBox(0, 0, width - 1, height - 1), [&](int y) {
+        size_t row = static_cast<size_t>(y) * width * 4;
+        kernel.quantizeRGBA8(rgba.data() + row, static_cast<size_t>(width), pixels.data() + row);
+    });
+    
     // Open file
     FILE* fp = fopen(filename.c_str(), "wb");
     if (!fp) {
@@ -421,55 +666,8 @@ void writePNG(const std::vector<float>& rgba,
     
     png_write_info(png, info);
     
-    // Convert float RGBA to 8-bit with simple tone mapping
-    std::vector<uint8_t> rowData(static_cast<size_t>(width) * 4);
-    
     for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            size_t srcIdx = (static_cast<size_t>(y) * width + x) * 4;
-            size_t dstIdx = static_cast<size_t>(x) * 4;
-            
-            // Get premultiplied colors
-            float r = rgba[srcIdx + 0];
-            float g = rgba[srcIdx + 1];
-            float b = rgba[srcIdx + 2];
-            float a = rgba[srcIdx + 3];
-            
-            // Un-premultiply for display (if alpha > 0)
-            if (a > 0.0001f) {
-                r /= a;
-                g /= a;
-                b /= a;
-            }
-            
-            // Simple Reinhard tone mapping for HDR values
-            auto toneMap = [](float v) -> float {
-                return v / (1.0f + v);
-            };
-            
-            // Apply tone mapping only if values exceed 1.0
-            if (r > 1.0f || g > 1.0f || b > 1.0f) {
-                float maxVal = std::max({r, g, b});
-                if (maxVal > 1.0f) {
-                    float scale = toneMap(maxVal) / maxVal;
-                    r *= scale;
-                    g *= scale;
-                    b *= scale;
-                }
-            }
-            
-            // Clamp and convert to 8-bit
-            auto toU8 = [](float v) -> uint8_t {
-                return static_cast<uint8_t>(clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
-            };
-            
-            rowData[dstIdx + 0] = toU8(r);
-            rowData[dstIdx + 1] = toU8(g);
-            rowData[dstIdx + 2] = toU8(b);
-            rowData[dstIdx + 3] = toU8(a);
-        }
-        
-        png_bytep rowPtr = rowData.data();
+        png_bytep rowPtr = pixels.data() + static_cast<size_t>(y) * width * 4;
         png_write_row(png, rowPtr);
     }
     
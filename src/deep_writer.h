@@ -1,8 +1,10 @@
 #pragma once
 
 #include "deep_image.h"
+#include <OpenEXR/ImfIO.h>
 #include <string>
 #include <array>
+#include <vector>
 
 namespace deep_compositor {
 
@@ -15,14 +17,41 @@ public:
         : std::runtime_error(message) {}
 };
 
+/**
+ * Layout options for deep EXR output
+ */
+struct DeepWriteOptions {
+    bool tiled = false;   // Write a DEEPTILE part instead of DEEPSCANLINE
+    int tileWidth = 64;   // Tile size when tiled
+    int tileHeight = 64;
+};
+
 /**
  * Write a deep image to an OpenEXR file
  * 
+ * The file's data window is the image's data window, and its channels the
+ * image's (see DeepImage::channels()). With an out-of-core pager set (see
+ * setOutOfCorePager) samples are staged and written in bands of rows
+ * sized from its budget, so peak memory doesn't grow with the frame.
+ * 
  * @param img The deep image to write
  * @param filename Output path
+ * @param options Scanline or tiled layout
  * @throws DeepWriterException on file errors
  */
-void writeDeepEXR(const DeepImage& img, const std::string& filename);
+void writeDeepEXR(const DeepImage& img, const std::string& filename,
+                  const DeepWriteOptions& options = DeepWriteOptions());
+
+/**
+ * Write a deep image to an output stream (e.g. a MemoryOStream)
+ * 
+ * @param img The deep image to write
+ * @param stream Destination stream
+ * @param options Scanline or tiled layout
+ * @throws DeepWriterException on encode errors
+ */
+void writeDeepEXR(const DeepImage& img, Imf::OStream& stream,
+                  const DeepWriteOptions& options = DeepWriteOptions());
 
 /**
  * Write a flattened version of a deep image to a standard EXR file
@@ -45,6 +74,56 @@ void writeFlatEXR(const std::vector<float>& rgba,
                   int width, int height, 
                   const std::string& filename);
 
+/**
+ * Write a pre-flattened RGBA buffer covering a data window to a standard EXR
+ * file, placed within the given display window
+ * 
+ * @param rgba Flattened RGBA data (dataWindow.width() * dataWindow.height() * 4 floats)
+ * @param dataWindow Pixels covered by rgba, in absolute coordinates
+ * @param displayWindow Full frame the data window sits in
+ * @param filename Output path
+ */
+void writeFlatEXR(const std::vector<float>& rgba,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  const std::string& filename);
+
+/**
+ * Write a pre-flattened RGBA buffer as a standard EXR to an output stream
+ */
+void writeFlatEXR(const std::vector<float>& rgba,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  Imf::OStream& stream);
+
+/**
+ * Write flattened RGBA and flattened extra channels (see
+ * flattenExtraChannels) to a standard EXR file. UINT extra channels are
+ * written as UINT.
+ * 
+ * @param rgba Flattened RGBA data, 4 floats per pixel of dataWindow
+ * @param extras channels.extras.size() floats per pixel of dataWindow
+ */
+void writeFlatEXR(const std::vector<float>& rgba, const std::vector<float>& extras,
+                  const ChannelSet& channels, const PixelBox& dataWindow,
+                  const PixelBox& displayWindow, const std::string& filename);
+
+/**
+ * Write flattened RGBA and extra channels as a standard EXR to an output stream
+ */
+void writeFlatEXR(const std::vector<float>& rgba, const std::vector<float>& extras,
+                  const ChannelSet& channels, const PixelBox& dataWindow,
+                  const PixelBox& displayWindow, Imf::OStream& stream);
+
+/**
+ * Write an interleaved float buffer with arbitrary channels (e.g. a
+ * diagnostic map) to a standard EXR file
+ * 
+ * @param values channels.size() floats per pixel of dataWindow, row-major
+ * @param channels EXR channel names, in the order they are interleaved
+ */
+void writeFlatEXR(const std::vector<float>& values, const std::vector<std::string>& channels,
+                  const PixelBox& dataWindow, const PixelBox& displayWindow,
+                  const std::string& filename);
+
 /**
  * Write a flattened, tone-mapped PNG image
  * 
@@ -83,4 +162,33 @@ std::array<float, 4> flattenPixel(const DeepPixel& pixel);
  */
 std::vector<float> flattenImage(const DeepImage& img);
 
+/**
+ * Flatten only a region of a deep image
+ * 
+ * @param img The deep image to flatten
+ * @param region Region in absolute coordinates, clipped to the data window
+ * @return Buffer of region.width() * region.height() * 4 floats for the clipped region
+ */
+std::vector<float> flattenImage(const DeepImage& img, const PixelBox& region);
+
+/**
+ * Flatten a region into an existing buffer, reusing its allocation
+ * 
+ * @param out Resized to region.width() * region.height() * 4 floats
+ * @param culledSamples If set, the number of samples hidden behind full
+ *        opacity (and so never composited) is added to it
+ */
+void flattenImage(const DeepImage& img, const PixelBox& region, std::vector<float>& out,
+                  size_t* culledSamples = nullptr);
+
+/**
+ * Flatten the extra channels of a region, weighting each sample as
+ * flattenImage does: AOVs are composited front to back like colour, and
+ * ID channels take the ID of the sample that contributes the most alpha.
+ * 
+ * @param out Resized to region.width() * region.height() floats per extra
+ *        channel, interleaved in channels().extras order
+ */
+void flattenExtraChannels(const DeepImage& img, const PixelBox& region, std::vector<float>& out);
+
 } // namespace deep_compositor
@@ -0,0 +1,113 @@
+#include "kernels/kernels.h"
+#include "kernels/kernels_variants.h"
+#include "deep_image.h"
+#include "utils.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace deep_compositor {
+
+// Kernels read DeepSample arrays as plain floats
+static_assert(sizeof(DeepSample) == kSampleFloats * sizeof(float), "DeepSample must be 6 packed floats");
+static_assert(offsetof(DeepSample, red) == kSampleColorOffset * sizeof(float), "DeepSample colour offset");
+static_assert(offsetof(DeepSample, alpha) == (kSampleColorOffset + 3) * sizeof(float), "DeepSample alpha offset");
+
+namespace detail {
+std::atomic<const KernelTable*> g_kernels{nullptr};
+} // namespace detail
+
+namespace {
+
+constexpr KernelIsa kAllIsas[] = {KernelIsa::Scalar, KernelIsa::SSE4, KernelIsa::AVX2, KernelIsa::AVX512};
+
+bool cpuSupports(KernelIsa isa) {
+#ifdef DEEP_KERNELS_X86
+    __builtin_cpu_init();
+    switch (isa) {
+        case KernelIsa::Scalar: return true;
+        case KernelIsa::SSE4: return __builtin_cpu_supports("sse4.1");
+        case KernelIsa::AVX2: return __builtin_cpu_supports("avx2");
+        case KernelIsa::AVX512: return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+#else
+    return isa == KernelIsa::Scalar;
+#endif
+}
+
+} // anonymous namespace
+
+const char* kernelIsaName(KernelIsa isa) {
+    switch (isa) {
+        case KernelIsa::Scalar: return "scalar";
+        case KernelIsa::SSE4: return "sse4";
+        case KernelIsa::AVX2: return "avx2";
+        case KernelIsa::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+bool parseKernelIsa(const std::string& name, KernelIsa& isa) {
+    for (KernelIsa candidate : kAllIsas) {
+        if (name == kernelIsaName(candidate)) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool kernelIsaSupported(KernelIsa isa) {
+    return cpuSupports(isa);
+}
+
+std::vector<KernelIsa> supportedKernelIsas() {
+    std::vector<KernelIsa> isas;
+    for (KernelIsa isa : kAllIsas) {
+        if (kernelIsaSupported(isa)) {
+            isas.push_back(isa);
+        }
+    }
+    return isas;
+}
+
+const KernelTable& kernelTable(KernelIsa isa) {
+    if (!kernelIsaSupported(isa)) {
+        throw std::invalid_argument(std::string("Kernel instruction set not supported on this CPU: ") +
+                                    kernelIsaName(isa));
+    }
+    switch (isa) {
+#ifdef DEEP_KERNELS_X86
+        case KernelIsa::SSE4: return kernel_variants::sse4();
+        case KernelIsa::AVX2: return kernel_variants::avx2();
+        case KernelIsa::AVX512: return kernel_variants::avx512();
+#endif
+        default: return kernel_variants::scalar();
+    }
+}
+
+void setKernelIsa(KernelIsa isa) {
+    detail::g_kernels.store(&kernelTable(isa), std::memory_order_release);
+}
+
+const KernelTable& detail::selectKernels() {
+    KernelIsa isa = supportedKernelIsas().back();
+    if (const char* forced = std::getenv("DEEP_COMPOSITOR_ISA")) {
+        KernelIsa requested;
+        if (parseKernelIsa(forced, requested) && kernelIsaSupported(requested)) {
+            isa = requested;
+        } else {
+            logError(std::string("Ignoring DEEP_COMPOSITOR_ISA=") + forced +
+                     " (not an instruction set this CPU supports)");
+        }
+    }
+    
+    // Keep a choice forced meanwhile by setKernelIsa()
+    const KernelTable* expected = nullptr;
+    g_kernels.compare_exchange_strong(expected, &kernelTable(isa), std::memory_order_acq_rel);
+    return *g_kernels.load(std::memory_order_acquire);
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace deep_compositor {
+
+/**
+ * Hot per-sample loops, built once per instruction set
+ *
+ * Each kernel is compiled for scalar code, SSE4.1, AVX2 and AVX-512F (the
+ * SIMD variants only on x86). The best variant the CPU supports is picked
+ * on first use, so one binary runs everywhere on a mixed farm. Every
+ * variant performs the same float operations in the same order (kernel
+ * sources are built without FMA contraction), so results are bit-identical
+ * whichever one runs.
+ *
+ * splitVolume and quantizeRGBA8 fill the widest vector (several pieces or
+ * pixels per register). flatten and blendCoincident carry alpha from one
+ * sample to the next, so every SIMD variant runs them one sample's RGBA
+ * (four lanes) at a time and AVX2/AVX-512 gain nothing over SSE4.1 there.
+ *
+ * Sample arrays use the DeepSample layout: kSampleFloats floats per sample
+ * (depth, depth_back, red, green, blue, alpha).
+ */
+enum class KernelIsa {
+    Scalar,
+    SSE4,
+    AVX2,
+    AVX512
+};
+
+constexpr size_t kSampleFloats = 6;
+constexpr size_t kSampleColorOffset = 2;  // red, green, blue, alpha follow
+
+/**
+ * One instruction set's kernels
+ */
+struct KernelTable {
+    KernelIsa isa;
+
+    /**
+     * Front-to-back over of `count` samples into rgba[4], stopping once
+     * alpha reaches 0.9999 (alpha is then set to 1)
+     *
+     * @return Samples composited
+     */
+    size_t (*flatten)(const float* samples, size_t count, float* rgba);
+
+    /**
+     * Blend runs of consecutive samples whose depth and depth_back both lie
+     * within `epsilon` of the run's first sample (uniform interspersion),
+     * in place
+     *
+     * @return Samples left
+     */
+    size_t (*blendCoincident)(float* samples, size_t count, float epsilon);
+
+    /**
+     * Split one volumetric sample at `cutCount` increasing depths strictly
+     * inside it (Beer-Lambert), writing cutCount + 1 samples to `out`
+     */
+    void (*splitVolume)(const float* sample, const float* cuts, size_t cutCount, float* out);
+
+    /**
+     * Premultiplied float RGBA to 8-bit display RGBA: unpremultiply,
+     * Reinhard-compress colours above 1, clamp, round
+     */
+    void (*quantizeRGBA8)(const float* rgba, size_t pixels, uint8_t* out);
+};
+
+/**
+ * Short name ("scalar", "sse4", "avx2", "avx512")
+ */
+const char* kernelIsaName(KernelIsa isa);
+
+/**
+ * Parse a short name
+ *
+ * @return false if `name` isn't one
+ */
+bool parseKernelIsa(const std::string& name, KernelIsa& isa);
+
+/**
+ * True if the variant was built and the CPU can run it
+ */
+bool kernelIsaSupported(KernelIsa isa);
+
+/**
+ * Every runnable variant, slowest first
+ */
+std::vector<KernelIsa> supportedKernelIsas();
+
+/**
+ * The variant a given instruction set runs (any supported one)
+ */
+const KernelTable& kernelTable(KernelIsa isa);
+
+/**
+ * Force the variant used from now on (for tests and benchmarks; the
+ * DEEP_COMPOSITOR_ISA environment variable does the same at startup).
+ * Throws std::invalid_argument if it isn't supported.
+ */
+void setKernelIsa(KernelIsa isa);
+
+namespace detail {
+extern std::atomic<const KernelTable*> g_kernels;
+const KernelTable& selectKernels();
+} // namespace detail
+
+/**
+ * The kernels in use: the best supported variant unless forced
+ */
+inline const KernelTable& kernels() {
+    const KernelTable* table = detail::g_kernels.load(std::memory_order_acquire);
+    return table ? *table : detail::selectKernels();
+}
+
+} // namespace deep_compositor
@@ -0,0 +1,74 @@
+#include "kernels/kernels_variants.h"
+
+#ifdef DEEP_KERNELS_X86
+
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+#ifndef __AVX2__
+#error "kernels_avx2.cpp must be built with -mavx2"
+#endif
+
+namespace deep_compositor {
+namespace kernel_variants {
+
+namespace avx2_isa {
+
+constexpr KernelIsa kIsa = KernelIsa::AVX2;
+
+#include "kernels/kernels_vec_sse.h"
+
+/**
+ * Eight floats: two samples or pixels per register
+ */
+struct Vec8 {
+    static constexpr size_t kLanes = 8;
+    using Mask = __m256;
+    __m256 v;
+
+    static Vec8 load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    static void store(float* p, Vec8 a) { _mm256_storeu_ps(p, a.v); }
+    static Vec8 set1(float x) { return {_mm256_set1_ps(x)}; }
+    static Vec8 add(Vec8 a, Vec8 b) { return {_mm256_add_ps(a.v, b.v)}; }
+    static Vec8 sub(Vec8 a, Vec8 b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    static Vec8 mul(Vec8 a, Vec8 b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    static Vec8 div(Vec8 a, Vec8 b) { return {_mm256_div_ps(a.v, b.v)}; }
+    static Vec8 min(Vec8 a, Vec8 b) { return {_mm256_min_ps(a.v, b.v)}; }
+    static Vec8 max(Vec8 a, Vec8 b) { return {_mm256_max_ps(a.v, b.v)}; }
+    static Mask gt(Vec8 a, Vec8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OS); }
+    static Vec8 select(Mask m, Vec8 a, Vec8 b) { return {_mm256_blendv_ps(b.v, a.v, m)}; }
+    static Vec8 floor(Vec8 a) { return {_mm256_floor_ps(a.v)}; }
+
+    static Vec8 pow2(Vec8 n) {
+        __m256i e = _mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+        return {_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))};
+    }
+
+    template<int i>
+    static Vec8 splatLane(Vec8 a) { return {_mm256_permute_ps(a.v, _MM_SHUFFLE(i, i, i, i))}; }
+
+    static Vec8 keepAlpha(Vec8 a, Vec8 src) { return {_mm256_blend_ps(a.v, src.v, 0x88)}; }
+
+    static void storeBytes(Vec8 a, uint8_t* out) {
+        a = min(max(a, set1(0.0f)), set1(255.0f));
+        __m256i ints = _mm256_cvttps_epi32(a.v);
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(ints), _mm256_extracti128_si256(ints, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(words, words));
+    }
+};
+
+using VecN = Vec8;
+
+#include "kernels/kernels_impl.h"
+
+} // namespace avx2_isa
+
+const KernelTable& avx2() {
+    return avx2_isa::table();
+}
+
+} // namespace kernel_variants
+} // namespace deep_compositor
+
+#endif // DEEP_KERNELS_X86
@@ -0,0 +1,83 @@
+#include "kernels/kernels_variants.h"
+
+#ifdef DEEP_KERNELS_X86
+
+// GCC 12's AVX-512 headers trip -Wmaybe-uninitialized on their own
+// placeholder operands (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#include <math.h>
+#include <string.h>
+
+#ifndef __AVX512F__
+#error "kernels_avx512.cpp must be built with -mavx512f"
+#endif
+
+namespace deep_compositor {
+namespace kernel_variants {
+
+namespace avx512_isa {
+
+constexpr KernelIsa kIsa = KernelIsa::AVX512;
+
+#include "kernels/kernels_vec_sse.h"
+
+/**
+ * Sixteen floats: four samples or pixels per register
+ */
+struct Vec16 {
+    static constexpr size_t kLanes = 16;
+    using Mask = __mmask16;
+    __m512 v;
+
+    static Vec16 load(const float* p) { return {_mm512_loadu_ps(p)}; }
+    static void store(float* p, Vec16 a) { _mm512_storeu_ps(p, a.v); }
+    static Vec16 set1(float x) { return {_mm512_set1_ps(x)}; }
+    static Vec16 add(Vec16 a, Vec16 b) { return {_mm512_add_ps(a.v, b.v)}; }
+    static Vec16 sub(Vec16 a, Vec16 b) { return {_mm512_sub_ps(a.v, b.v)}; }
+    static Vec16 mul(Vec16 a, Vec16 b) { return {_mm512_mul_ps(a.v, b.v)}; }
+    static Vec16 div(Vec16 a, Vec16 b) { return {_mm512_div_ps(a.v, b.v)}; }
+    static Vec16 min(Vec16 a, Vec16 b) { return {_mm512_min_ps(a.v, b.v)}; }
+    static Vec16 max(Vec16 a, Vec16 b) { return {_mm512_max_ps(a.v, b.v)}; }
+    static Mask gt(Vec16 a, Vec16 b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OS); }
+    static Vec16 select(Mask m, Vec16 a, Vec16 b) { return {_mm512_mask_blend_ps(m, b.v, a.v)}; }
+    static Vec16 floor(Vec16 a) {
+        return {_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)};
+    }
+
+    static Vec16 pow2(Vec16 n) {
+        __m512i e = _mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127));
+        return {_mm512_castsi512_ps(_mm512_slli_epi32(e, 23))};
+    }
+
+    template<int i>
+    static Vec16 splatLane(Vec16 a) { return {_mm512_permute_ps(a.v, _MM_SHUFFLE(i, i, i, i))}; }
+
+    static Vec16 keepAlpha(Vec16 a, Vec16 src) { return {_mm512_mask_blend_ps(0x8888, a.v, src.v)}; }
+
+    static void storeBytes(Vec16 a, uint8_t* out) {
+        a = min(max(a, set1(0.0f)), set1(255.0f));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(a.v)));
+    }
+};
+
+using VecN = Vec16;
+
+#include "kernels/kernels_impl.h"
+
+} // namespace avx512_isa
+
+const KernelTable& avx512() {
+    return avx512_isa::table();
+}
+
+} // namespace kernel_variants
+} // namespace deep_compositor
+
+#endif // DEEP_KERNELS_X86
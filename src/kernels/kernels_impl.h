@@ -0,0 +1,179 @@
+// Kernel bodies shared by every instruction set variant.
+//
+// No include guard: each kernels_<isa>.cpp includes this inside its own
+// namespace after defining two vector types, so every variant gets its own
+// copy of these templates compiled for its instruction set:
+//
+//   Vec4  4 floats (one sample's RGBA or one pixel)
+//   VecN  the widest vector, Vec4::kLanes multiple of 4 lanes
+//
+// Both provide kLanes, a Mask type and static load, store, set1, add, sub,
+// mul, div, min, max, gt, select, floor, pow2 (2^n for integral n),
+// splatLane<i> and keepAlpha (lane i / alpha taken per group of 4 lanes),
+// and storeBytes (clamp to 0-255 with NaN as 0, truncate to integers and
+// store as bytes). Vec4
+// also has alpha() (lane 3 as a float).
+//
+// Only + - * / and exactly rounded operations are used, in the same order
+// in every variant, so results are bit-identical across instruction sets.
+// Library calls are limited to C functions (logf, fabsf): an inline C++
+// helper instantiated here could be merged by the linker with a baseline
+// copy and run AVX code on a CPU without it.
+
+inline size_t smaller(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+template<class V>
+V expApprox(V x) {
+    // Cephes expf: range reduction by ln 2, degree 5 polynomial, 2 ulp
+    const V one = V::set1(1.0f);
+    x = V::min(V::max(x, V::set1(-87.0f)), V::set1(88.0f));
+    V fx = V::floor(V::add(V::mul(x, V::set1(1.44269504088896341f)), V::set1(0.5f)));
+    x = V::sub(x, V::mul(fx, V::set1(0.693359375f)));
+    x = V::sub(x, V::mul(fx, V::set1(-2.12194440e-4f)));
+    V z = V::mul(x, x);
+    V y = V::set1(1.9875691500e-4f);
+    y = V::add(V::mul(y, x), V::set1(1.3981999507e-3f));
+    y = V::add(V::mul(y, x), V::set1(8.3334519073e-3f));
+    y = V::add(V::mul(y, x), V::set1(4.1665795894e-2f));
+    y = V::add(V::mul(y, x), V::set1(1.6666665459e-1f));
+    y = V::add(V::mul(y, x), V::set1(5.0000001201e-1f));
+    y = V::add(V::add(V::mul(y, z), x), one);
+    return V::mul(y, V::pow2(fx));
+}
+
+// flatten and blendCoincident use Vec4 only: each sample depends on the
+// alpha accumulated in front of it, and reordering the sums to fill wider
+// lanes would break bit-identity with the scalar variant.
+
+size_t flatten(const float* samples, size_t count, float* rgba) {
+    // accum += sample * (1 - accum.alpha), all four channels at once
+    const Vec4 one = Vec4::set1(1.0f);
+    Vec4 accum = Vec4::set1(0.0f);
+    for (size_t i = 0; i < count; ++i) {
+        Vec4 sample = Vec4::load(samples + i * kSampleFloats + kSampleColorOffset);
+        Vec4 oneMinusAccumA = Vec4::sub(one, Vec4::splatLane<3>(accum));
+        accum = Vec4::add(accum, Vec4::mul(sample, oneMinusAccumA));
+        if (Vec4::alpha(accum) >= 0.9999f) {
+            Vec4::store(rgba, accum);
+            rgba[3] = 1.0f;
+            return i + 1;
+        }
+    }
+    Vec4::store(rgba, accum);
+    return count;
+}
+
+size_t blendCoincident(float* samples, size_t count, float epsilon) {
+    size_t kept = 0;
+    size_t i = 0;
+    while (i < count) {
+        const float* first = samples + i * kSampleFloats;
+        float depth = first[0];
+        float depthBack = first[1];
+        Vec4 color = Vec4::load(first + kSampleColorOffset);
+        float alpha = first[5];
+        i++;
+
+        while (i < count) {
+            const float* next = samples + i * kSampleFloats;
+            if (!(fabsf(depth - next[0]) < epsilon && fabsf(depthBack - next[1]) < epsilon)) {
+                break;
+            }
+            // alpha_combined = 1 - (1 - a)(1 - b); colours share it by alpha
+            float combined = alpha + next[5] - alpha * next[5];
+            float alphaSum = alpha + next[5];
+            float scale = alphaSum > 0.0f ? combined / alphaSum : 0.0f;
+            color = Vec4::mul(Vec4::add(color, Vec4::load(next + kSampleColorOffset)), Vec4::set1(scale));
+            alpha = combined;
+            i++;
+        }
+
+        // Never ahead of the read position, so in place is safe
+        float* out = samples + kept * kSampleFloats;
+        out[0] = depth;
+        out[1] = depthBack;
+        Vec4::store(out + kSampleColorOffset, color);
+        out[5] = alpha;
+        kept++;
+    }
+    return kept;
+}
+
+void splitVolume(const float* sample, const float* cuts, size_t cutCount, float* out) {
+    constexpr float kEpsilon = 1e-7f;
+    constexpr size_t kLanes = VecN::kLanes;
+
+    // sigma = -ln(1 - alpha) / thickness; each piece keeps the extinction
+    // and takes alpha = 1 - exp(-sigma * length), colour scaled to match
+    float alpha = sample[5] >= 1.0f ? 1.0f - kEpsilon : sample[5];
+    float sigma = alpha > 0.0f ? -logf(1.0f - alpha) / (sample[1] - sample[0]) : 0.0f;
+    const VecN negSigma = VecN::set1(-sigma);
+    const VecN one = VecN::set1(1.0f);
+
+    size_t pieces = cutCount + 1;
+    float front[kLanes];
+    float back[kLanes];
+    float length[kLanes];
+    float pieceAlpha[kLanes];
+    for (size_t base = 0; base < pieces; base += kLanes) {
+        size_t n = smaller(kLanes, pieces - base);
+        for (size_t j = 0; j < kLanes; ++j) {
+            size_t p = base + smaller(j, n - 1);
+            front[j] = p == 0 ? sample[0] : cuts[p - 1];
+            back[j] = p == cutCount ? sample[1] : cuts[p];
+            length[j] = back[j] - front[j];
+        }
+        VecN transmit = expApprox(VecN::mul(negSigma, VecN::load(length)));
+        VecN::store(pieceAlpha, VecN::sub(one, transmit));
+
+        for (size_t j = 0; j < n; ++j) {
+            float ratio = alpha > 0.0f ? pieceAlpha[j] / alpha : 0.0f;
+            float* piece = out + (base + j) * kSampleFloats;
+            piece[0] = front[j];
+            piece[1] = back[j];
+            piece[2] = sample[2] * ratio;
+            piece[3] = sample[3] * ratio;
+            piece[4] = sample[4] * ratio;
+            piece[5] = alpha > 0.0f ? pieceAlpha[j] : 0.0f;
+        }
+    }
+}
+
+template<class V>
+size_t quantizeBlock(const float* rgba, size_t pixels, uint8_t* out) {
+    constexpr size_t kPixels = V::kLanes / 4;
+    const V zero = V::set1(0.0f);
+    const V one = V::set1(1.0f);
+    size_t p = 0;
+    for (; p + kPixels <= pixels; p += kPixels) {
+        V premult = V::load(rgba + p * 4);
+
+        // Un-premultiply for display (if alpha > 0)
+        V alpha = V::template splatLane<3>(premult);
+        V color = V::select(V::gt(alpha, V::set1(0.0001f)), V::div(premult, alpha), premult);
+
+        // Reinhard tone mapping, scaled by the brightest channel above 1
+        V maxVal = V::max(V::max(V::template splatLane<0>(color), V::template splatLane<1>(color)),
+                          V::template splatLane<2>(color));
+        V scale = V::div(V::div(maxVal, V::add(one, maxVal)), maxVal);
+        color = V::select(V::gt(maxVal, one), V::mul(color, scale), color);
+        color = V::keepAlpha(color, premult);
+
+        // Clamp and convert to 8-bit
+        color = V::max(zero, V::min(one, color));
+        V::storeBytes(V::add(V::mul(color, V::set1(255.0f)), V::set1(0.5f)), out + p * 4);
+    }
+    return p;
+}
+
+void quantizeRGBA8(const float* rgba, size_t pixels, uint8_t* out) {
+    size_t done = quantizeBlock<VecN>(rgba, pixels, out);
+    quantizeBlock<Vec4>(rgba + done * 4, pixels - done, out + done * 4);
+}
+
+const KernelTable& table() {
+    static const KernelTable instance = {kIsa, flatten, blendCoincident, splitVolume, quantizeRGBA8};
+    return instance;
+}
@@ -0,0 +1,92 @@
+#include "kernels/kernels_variants.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace deep_compositor {
+namespace kernel_variants {
+
+namespace scalar_isa {
+
+constexpr KernelIsa kIsa = KernelIsa::Scalar;
+
+/**
+ * Four floats in plain C++, matching the SSE operations lane for lane
+ * (min/max pick the second operand on ties and NaN, like minps/maxps)
+ */
+struct Vec4 {
+    static constexpr size_t kLanes = 4;
+    struct Mask {
+        bool lane[4];
+    };
+    float v[4];
+
+    template<typename F>
+    static Vec4 map(Vec4 a, Vec4 b, F fn) {
+        Vec4 r;
+        for (int i = 0; i < 4; ++i) {
+            r.v[i] = fn(a.v[i], b.v[i]);
+        }
+        return r;
+    }
+
+    static Vec4 load(const float* p) { Vec4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    static void store(float* p, Vec4 a) { memcpy(p, a.v, sizeof(a.v)); }
+    static Vec4 set1(float x) { return {{x, x, x, x}}; }
+    static Vec4 add(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x + y; }); }
+    static Vec4 sub(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x - y; }); }
+    static Vec4 mul(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x * y; }); }
+    static Vec4 div(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x / y; }); }
+    static Vec4 min(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    static Vec4 max(Vec4 a, Vec4 b) { return map(a, b, [](float x, float y) { return x > y ? x : y; }); }
+
+    static Mask gt(Vec4 a, Vec4 b) {
+        return {{a.v[0] > b.v[0], a.v[1] > b.v[1], a.v[2] > b.v[2], a.v[3] > b.v[3]}};
+    }
+
+    static Vec4 select(Mask m, Vec4 a, Vec4 b) {
+        Vec4 r;
+        for (int i = 0; i < 4; ++i) {
+            r.v[i] = m.lane[i] ? a.v[i] : b.v[i];
+        }
+        return r;
+    }
+
+    static Vec4 floor(Vec4 a) { return {{floorf(a.v[0]), floorf(a.v[1]), floorf(a.v[2]), floorf(a.v[3])}}; }
+
+    static Vec4 pow2(Vec4 n) {
+        Vec4 r;
+        for (int i = 0; i < 4; ++i) {
+            uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(n.v[i]) + 127) << 23;
+            memcpy(&r.v[i], &bits, sizeof(bits));
+        }
+        return r;
+    }
+
+    template<int i>
+    static Vec4 splatLane(Vec4 a) { return set1(a.v[i]); }
+
+    static Vec4 keepAlpha(Vec4 a, Vec4 src) { a.v[3] = src.v[3]; return a; }
+    static float alpha(Vec4 a) { return a.v[3]; }
+
+    static void storeBytes(Vec4 a, uint8_t* out) {
+        // max returns 0 for NaN, so the cast below is always in range
+        a = min(max(a, set1(0.0f)), set1(255.0f));
+        for (int i = 0; i < 4; ++i) {
+            out[i] = static_cast<uint8_t>(static_cast<int32_t>(a.v[i]));
+        }
+    }
+};
+
+using VecN = Vec4;
+
+#include "kernels/kernels_impl.h"
+
+} // namespace scalar_isa
+
+const KernelTable& scalar() {
+    return scalar_isa::table();
+}
+
+} // namespace kernel_variants
+} // namespace deep_compositor
@@ -0,0 +1,35 @@
+#include "kernels/kernels_variants.h"
+
+#ifdef DEEP_KERNELS_X86
+
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+#ifndef __SSE4_1__
+#error "kernels_sse4.cpp must be built with -msse4.1"
+#endif
+
+namespace deep_compositor {
+namespace kernel_variants {
+
+namespace sse4_isa {
+
+constexpr KernelIsa kIsa = KernelIsa::SSE4;
+
+#include "kernels/kernels_vec_sse.h"
+
+using VecN = Vec4;
+
+#include "kernels/kernels_impl.h"
+
+} // namespace sse4_isa
+
+const KernelTable& sse4() {
+    return sse4_isa::table();
+}
+
+} // namespace kernel_variants
+} // namespace deep_compositor
+
+#endif // DEEP_KERNELS_X86
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "kernels/kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DEEP_KERNELS_X86 1
+#endif
+
+namespace deep_compositor {
+namespace kernel_variants {
+
+/**
+ * Each instruction set's table, one per kernels_<isa>.cpp. The SIMD
+ * variants only exist on x86 and must only be called once the CPU is
+ * known to support them.
+ */
+const KernelTable& scalar();
+#ifdef DEEP_KERNELS_X86
+const KernelTable& sse4();
+const KernelTable& avx2();
+const KernelTable& avx512();
+#endif
+
+} // namespace kernel_variants
+} // namespace deep_compositor
@@ -0,0 +1,43 @@
+// Vec4 on SSE4.1 registers, for kernels_impl.h.
+//
+// No include guard: included inside each x86 variant's namespace (after
+// <immintrin.h> and <string.h>), so the AVX builds get their own
+// VEX-encoded copy.
+
+struct Vec4 {
+    static constexpr size_t kLanes = 4;
+    using Mask = __m128;
+    __m128 v;
+
+    static Vec4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+    static void store(float* p, Vec4 a) { _mm_storeu_ps(p, a.v); }
+    static Vec4 set1(float x) { return {_mm_set1_ps(x)}; }
+    static Vec4 add(Vec4 a, Vec4 b) { return {_mm_add_ps(a.v, b.v)}; }
+    static Vec4 sub(Vec4 a, Vec4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+    static Vec4 mul(Vec4 a, Vec4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+    static Vec4 div(Vec4 a, Vec4 b) { return {_mm_div_ps(a.v, b.v)}; }
+    static Vec4 min(Vec4 a, Vec4 b) { return {_mm_min_ps(a.v, b.v)}; }
+    static Vec4 max(Vec4 a, Vec4 b) { return {_mm_max_ps(a.v, b.v)}; }
+    static Mask gt(Vec4 a, Vec4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+    static Vec4 select(Mask m, Vec4 a, Vec4 b) { return {_mm_blendv_ps(b.v, a.v, m)}; }
+    static Vec4 floor(Vec4 a) { return {_mm_floor_ps(a.v)}; }
+
+    static Vec4 pow2(Vec4 n) {
+        __m128i e = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+        return {_mm_castsi128_ps(_mm_slli_epi32(e, 23))};
+    }
+
+    template<int i>
+    static Vec4 splatLane(Vec4 a) { return {_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(i, i, i, i))}; }
+
+    static Vec4 keepAlpha(Vec4 a, Vec4 src) { return {_mm_blend_ps(a.v, src.v, 0x8)}; }
+    static float alpha(Vec4 a) { return _mm_cvtss_f32(_mm_shuffle_ps(a.v, a.v, 0xFF)); }
+
+    static void storeBytes(Vec4 a, uint8_t* out) {
+        // maxps returns its second operand for NaN, so NaN becomes 0
+        a = min(max(a, set1(0.0f)), set1(255.0f));
+        __m128i words = _mm_packus_epi32(_mm_cvttps_epi32(a.v), _mm_setzero_si128());
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(out, &bytes, 4);
+    }
+};
@@ -1,11 +1,29 @@
 #include "deep_image.h"
 #include "deep_reader.h"
+#include "deep_loader.h"
 #include "deep_writer.h"
 #include "deep_compositor.h"
+#include "deep_pager.h"
+#include "deep_report.h"
+#include "deep_result_cache.h"
+#include "deep_select.h"
+#include "deep_sequence.h"
+#include "deep_session.h"
+#include "deep_stream.h"
+#include "deep_tasks.h"
+#include "deep_trace.h"
+#include "kernels/kernels.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 #include <cstring>
 
@@ -17,25 +35,142 @@ struct Options {
     std::vector<std::string> inputFiles;
     std::string outputPrefix;
     bool deepOutput = false;
+    bool tiledOutput = false;
+    int tileSize = 64;
     bool flatOutput = true;
     bool pngOutput = true;
     bool verbose = false;
     float mergeThreshold = 0.001f;
+    deep_compositor::PixelBox roi; // Empty = full data window
+    int loadThreads = 4;
+    int threads = 0;        // Shared pool size (0 = CPUs available to the process)
+    std::string isa;        // Forced kernel instruction set (empty = best supported)
+    bool memoryMappedInput = true;
+    bool extraChannels = true;  // Load, merge and write AOV/ID channels
+    deep_compositor::IdSelection idSelection;  // Samples to keep or drop (no IDs = all)
     bool showHelp = false;
+    
+    // Incremental update of a previous merge (--base plus one edit)
+    std::string basePath;
+    std::string insertPath;
+    std::string removePath;
+    std::string replaceOldPath;
+    std::string replaceNewPath;
+    
+    bool isUpdate() const { return !basePath.empty(); }
+    bool selectsIds() const { return !idSelection.ids.empty(); }
+    
+    std::string sessionDir;  // Persistent session (re-merge only changed tiles)
+    
+    std::vector<int> frames;  // Sequence mode when non-empty
+    bool reuseInputs = true;  // Share unchanged inputs across frames
+    bool hashInputs = false;  // Also match unchanged inputs by content
+    
+    std::string resultCacheDir;     // Reuse outputs of identical earlier composites
+    bool resultCacheLink = false;   // Hard-link cached outputs instead of copying
+    
+    int memoryBudgetMb = 0;         // Page sample data beyond this (0 = in memory)
+    std::string scratchDir;         // Where paged-out tiles go (default: $TMPDIR)
+    
+    std::string tracePath;          // Chrome trace JSON output (empty = no tracing)
+    std::string statsJsonPath;      // Run statistics JSON output (empty = none)
+    bool costMap = false;           // Write the per-pixel merge cost map
 };
 
+/**
+ * Parse "x0,y0,x1,y1" (inclusive corners) into a PixelBox
+ */
+bool parseBox(const std::string& text, deep_compositor::PixelBox& box) {
+    int values[4];
+    size_t pos = 0;
+    for (int i = 0; i < 4; ++i) {
+        size_t comma = text.find(',', pos);
+        if ((i < 3) != (comma != std::string::npos)) {
+            return false;
+        }
+        try {
+            size_t used = 0;
+            std::string field = text.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            values[i] = std::stoi(field, &used);
+            if (used != field.size()) {
+                return false;
+            }
+        } catch (...) {
+            return false;
+        }
+        pos = comma + 1;
+    }
+    box = deep_compositor::PixelBox(values[0], values[1], values[2], values[3]);
+    return !box.isEmpty();
+}
+
 void printUsage(const char* programName) {
     std::cout << "Deep Image Compositor v" << VERSION << "\n\n"
               << "Usage: " << programName << " [options] <input1.exr> [input2.exr ...] <output_prefix>\n\n"
               << "Options:\n"
               << "  --deep-output        Write merged deep EXR (default: off)\n"
+              << "  --tiled-output       Write the merged deep EXR as tiles (default: scanlines)\n"
+              << "  --tile-size N        Tile width/height for --tiled-output (default: 64)\n"
               << "  --flat-output        Write flattened EXR (default: on)\n"
               << "  --no-flat-output     Don't write flattened EXR\n"
               << "  --png-output         Write PNG preview (default: on)\n"
               << "  --no-png-output      Don't write PNG preview\n"
               << "  --verbose, -v        Detailed logging\n"
               << "  --merge-threshold N  Depth epsilon for merging samples (default: 0.001)\n"
+              << "  --load-threads N     Max input files loaded concurrently (default: 4)\n"
+              << "  --threads N          Worker threads for loading, merging, flattening and PNG\n"
+              << "                       conversion (default: CPUs available to the process,\n"
+              << "                       honouring CPU affinity and cgroup quotas)\n"
+              << "  --isa NAME           Force the kernel instruction set: scalar, sse4, avx2 or\n"
+              << "                       avx512 (default: the best this CPU supports)\n"
+              << "  --no-mmap            Read inputs through OpenEXR's stock file stream\n"
+              << "  --no-extra-channels  Ignore input channels other than R, G, B, A, Z and ZBack\n"
+              << "                       (by default AOVs and IDs are merged and written)\n"
+              << "  --keep-ids LIST      Isolate objects: keep only samples whose ID is in LIST\n"
+              << "                       (e.g. 3,7,12-15); inputs without IDs are kept whole\n"
+              << "  --drop-ids LIST      Remove objects: drop the samples whose ID is in LIST\n"
+              << "  --id-channel NAME    Channel --keep-ids/--drop-ids match (default: each\n"
+              << "                       input's first ID channel)\n"
+              << "  --roi x0,y0,x1,y1    Only load, merge and write this region (inclusive pixel\n"
+              << "                       corners in data window coordinates)\n"
+              << "  --frames LIST        Sequence mode: composite each frame in LIST (e.g. 1-100,\n"
+              << "                       1-100x2, 1-10,20-30). Inputs and the output prefix may\n"
+              << "                       contain a frame token (%04d or ####); a prefix without\n"
+              << "                       one gets .NNNN appended\n"
+              << "  --no-input-reuse     Sequence mode: decode every input on every frame instead\n"
+              << "                       of reusing unchanged files (matched by inode/size/mtime)\n"
+              << "  --hash-inputs        Sequence mode: also reuse inputs with identical content\n"
+              << "                       under a different name (hashes each new input file);\n"
+              << "                       with --result-cache: key inputs by content\n"
+              << "  --result-cache DIR   Reuse the outputs of an earlier composite with the same\n"
+              << "                       inputs and settings from DIR instead of recomputing\n"
+              << "                       (inputs matched by inode/size/mtime, or by content with\n"
+              << "                       --hash-inputs); hit/miss counts are kept in DIR\n"
+              << "  --result-cache-link  Hard-link cached outputs instead of copying them\n"
+              << "  --memory-budget MB   Keep at most about MB of samples in memory; colder tiles\n"
+              << "                       are paged to a scratch file (default: no limit)\n"
+              << "  --scratch-dir DIR    Directory for the --memory-budget scratch file\n"
+              << "                       (default: $TMPDIR or /tmp)\n"
+              << "  --trace FILE         Record the run's phases per thread as Chrome trace JSON\n"
+              << "                       (open in chrome://tracing or ui.perfetto.dev)\n"
+              << "  --stats-json FILE    Write run statistics as JSON: per-input load time and\n"
+              << "                       throughput, merge counters, per-phase wall/CPU time,\n"
+              << "                       output sizes and peak memory\n"
+              << "  --cost-map           Write <output_prefix>_cost.exr: per-pixel input samples,\n"
+              << "                       fragments after splitting, output samples and merge\n"
+              << "                       time in CPU cycles\n"
+              << "  --session DIR        Keep the result in DIR between runs and only re-merge\n"
+              << "                       tiles whose inputs changed (tile size: --tile-size)\n"
               << "  --help, -h           Show this help message\n\n"
+              << "Incremental update (re-merges only the pixels the changed layer covers):\n"
+              << "  --base FILE          Previously merged deep EXR to update\n"
+              << "  --insert FILE        Add a layer to the base\n"
+              << "  --remove FILE        Take a layer out of the base\n"
+              << "  --replace OLD NEW    Swap one layer of the base for a new version\n"
+              << "  With --remove/--replace the input files are the base's other layers;\n"
+              << "  --insert needs none, but merges exactly only if they are given.\n"
+              << "  e.g. " << programName << " --deep-output --base out/shot_merged.exr \\\n"
+              << "      --replace fx_v1.exr fx_v2.exr bg.exr char.exr out/shot\n\n"
               << "Example:\n"
               << "  " << programName << " --deep-output --verbose \\\n"
               << "      test_data/sphere_front.exr \\\n"
@@ -45,7 +180,15 @@ void printUsage(const char* programName) {
               << "Outputs:\n"
               << "  <output_prefix>_merged.exr  (deep EXR, if --deep-output)\n"
               << "  <output_prefix>_flat.exr    (standard EXR)\n"
-              << "  <output_prefix>.png         (preview image)\n";
+              << "  <output_prefix>.png         (preview image)\n"
+              << "  <output_prefix>_cost.exr    (merge cost map, if --cost-map)\n\n"
+              << "Inputs may be deep EXRs or deep caches (.dcache, see the deep_cache tool);\n"
+              << "caches are memory-mapped and load without decompression.\n\n"
+              << "Piping:\n"
+              << "  An input of '-' reads a deep EXR from stdin. An output prefix of '-'\n"
+              << "  writes one EXR to stdout (the merged deep EXR with --deep-output,\n"
+              << "  otherwise the flattened EXR) and sends logs to stderr.\n"
+              << "  e.g. " << programName << " --deep-output a.exr b.exr - | " << programName << " - c.exr out\n";
 }
 
 bool parseArgs(int argc, char* argv[], Options& opts) {
@@ -63,6 +206,23 @@ bool parseArgs(int argc, char* argv[], Options& opts) {
             opts.verbose = true;
         } else if (arg == "--deep-output") {
             opts.deepOutput = true;
+        } else if (arg == "--tiled-output") {
+            opts.tiledOutput = true;
+        } else if (arg == "--tile-size") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --tile-size requires a value\n";
+                return false;
+            }
+            try {
+                opts.tileSize = std::stoi(argv[++i]);
+            } catch (...) {
+                std::cerr << "Error: Invalid tile size value\n";
+                return false;
+            }
+            if (opts.tileSize <= 0) {
+                std::cerr << "Error: Tile size must be positive\n";
+                return false;
+            }
         } else if (arg == "--flat-output") {
             opts.flatOutput = true;
         } else if (arg == "--no-flat-output") {
@@ -82,7 +242,163 @@ bool parseArgs(int argc, char* argv[], Options& opts) {
                 std::cerr << "Error: Invalid merge threshold value\n";
                 return false;
             }
-        } else if (arg[0] == '-') {
+        } else if (arg == "--no-mmap") {
+            opts.memoryMappedInput = false;
+        } else if (arg == "--no-extra-channels") {
+            opts.extraChannels = false;
+        } else if (arg == "--keep-ids" || arg == "--drop-ids") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires an ID list\n";
+                return false;
+            }
+            if (opts.selectsIds()) {
+                std::cerr << "Error: Only one of --keep-ids or --drop-ids can be used\n";
+                return false;
+            }
+            if (!deep_compositor::parseIdSet(argv[++i], opts.idSelection.ids)) {
+                std::cerr << "Error: Invalid ID list '" << argv[i] << "'\n";
+                return false;
+            }
+            opts.idSelection.keep = (arg == "--keep-ids");
+        } else if (arg == "--id-channel") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --id-channel requires a channel name\n";
+                return false;
+            }
+            opts.idSelection.channel = argv[++i];
+        } else if (arg == "--load-threads") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --load-threads requires a value\n";
+                return false;
+            }
+            try {
+                opts.loadThreads = std::stoi(argv[++i]);
+            } catch (...) {
+                std::cerr << "Error: Invalid load thread count\n";
+                return false;
+            }
+            if (opts.loadThreads <= 0) {
+                std::cerr << "Error: Load thread count must be positive\n";
+                return false;
+            }
+        } else if (arg == "--threads") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --threads requires a value\n";
+                return false;
+            }
+            try {
+                opts.threads = std::stoi(argv[++i]);
+            } catch (...) {
+                std::cerr << "Error: Invalid thread count\n";
+                return false;
+            }
+            if (opts.threads <= 0) {
+                std::cerr << "Error: Thread count must be positive\n";
+                return false;
+            }
+        } else if (arg == "--isa") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --isa requires a value\n";
+                return false;
+            }
+            opts.isa = argv[++i];
+            deep_compositor::KernelIsa isa;
+            if (!deep_compositor::parseKernelIsa(opts.isa, isa)) {
+                std::cerr << "Error: Unknown instruction set '" << opts.isa
+                          << "' (expected scalar, sse4, avx2 or avx512)\n";
+                return false;
+            }
+            if (!deep_compositor::kernelIsaSupported(isa)) {
+                std::cerr << "Error: This CPU doesn't support " << opts.isa << "\n";
+                return false;
+            }
+        } else if (arg == "--roi") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --roi requires a value\n";
+                return false;
+            }
+            if (!parseBox(argv[++i], opts.roi)) {
+                std::cerr << "Error: Invalid ROI, expected x0,y0,x1,y1 with x0<=x1 and y0<=y1\n";
+                return false;
+            }
+        } else if (arg == "--base" || arg == "--insert" || arg == "--remove") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a file\n";
+                return false;
+            }
+            std::string& target = arg == "--base" ? opts.basePath
+                                : arg == "--insert" ? opts.insertPath : opts.removePath;
+            target = argv[++i];
+        } else if (arg == "--frames") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --frames requires a frame list\n";
+                return false;
+            }
+            if (!deep_compositor::parseFrameList(argv[++i], opts.frames)) {
+                std::cerr << "Error: Invalid frame list, expected e.g. 1-100, 1-100x2 or 1,5,9\n";
+                return false;
+            }
+        } else if (arg == "--no-input-reuse") {
+            opts.reuseInputs = false;
+        } else if (arg == "--hash-inputs") {
+            opts.hashInputs = true;
+        } else if (arg == "--result-cache") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --result-cache requires a directory\n";
+                return false;
+            }
+            opts.resultCacheDir = argv[++i];
+        } else if (arg == "--result-cache-link") {
+            opts.resultCacheLink = true;
+        } else if (arg == "--memory-budget") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --memory-budget requires a value in MB\n";
+                return false;
+            }
+            try {
+                opts.memoryBudgetMb = std::stoi(argv[++i]);
+            } catch (...) {
+                std::cerr << "Error: Invalid memory budget\n";
+                return false;
+            }
+            if (opts.memoryBudgetMb <= 0) {
+                std::cerr << "Error: Memory budget must be positive\n";
+                return false;
+            }
+        } else if (arg == "--trace") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --trace requires a file\n";
+                return false;
+            }
+            opts.tracePath = argv[++i];
+        } else if (arg == "--cost-map") {
+            opts.costMap = true;
+        } else if (arg == "--stats-json") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --stats-json requires a file\n";
+                return false;
+            }
+            opts.statsJsonPath = argv[++i];
+        } else if (arg == "--scratch-dir") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --scratch-dir requires a directory\n";
+                return false;
+            }
+            opts.scratchDir = argv[++i];
+        } else if (arg == "--session") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --session requires a directory\n";
+                return false;
+            }
+            opts.sessionDir = argv[++i];
+        } else if (arg == "--replace") {
+            if (i + 2 >= argc) {
+                std::cerr << "Error: --replace requires the old and new layer files\n";
+                return false;
+            }
+            opts.replaceOldPath = argv[++i];
+            opts.replaceNewPath = argv[++i];
+        } else if (arg[0] == '-' && arg != "-") {
             std::cerr << "Error: Unknown option: " << arg << "\n";
             return false;
         } else {
@@ -91,8 +407,53 @@ bool parseArgs(int argc, char* argv[], Options& opts) {
         }
     }
     
-    // Need at least one input and one output prefix
-    if (opts.inputFiles.size() < 2) {
+    int edits = !opts.insertPath.empty() + !opts.removePath.empty() + !opts.replaceOldPath.empty();
+    if (opts.isUpdate() != (edits > 0)) {
+        std::cerr << "Error: --base needs one of --insert, --remove or --replace (and vice versa)\n";
+        return false;
+    }
+    if (opts.isUpdate() && !opts.sessionDir.empty()) {
+        std::cerr << "Error: --session can't be combined with --base\n";
+        return false;
+    }
+    // (the output prefix is still in inputFiles here, so "-" covers both directions)
+    if (!opts.frames.empty() && (opts.isUpdate() || !opts.sessionDir.empty() ||
+                                 std::count(opts.inputFiles.begin(), opts.inputFiles.end(), "-") > 0)) {
+        std::cerr << "Error: --frames can't be combined with --base, --session or piping\n";
+        return false;
+    }
+    if (opts.costMap && (opts.isUpdate() || !opts.sessionDir.empty() || !opts.frames.empty() ||
+                         !opts.resultCacheDir.empty() ||
+                         (!opts.inputFiles.empty() && opts.inputFiles.back() == "-"))) {
+        std::cerr << "Error: --cost-map needs a full merge written to files (no --base, --session,\n"
+                  << "       --frames, --result-cache or piped output)\n";
+        return false;
+    }
+    if (opts.selectsIds() && (opts.isUpdate() || !opts.frames.empty() || !opts.extraChannels)) {
+        std::cerr << "Error: --keep-ids/--drop-ids can't be combined with --base, --frames or\n"
+                  << "       --no-extra-channels\n";
+        return false;
+    }
+    if (!opts.idSelection.channel.empty() && !opts.selectsIds()) {
+        std::cerr << "Error: --id-channel needs --keep-ids or --drop-ids\n";
+        return false;
+    }
+    if (!opts.statsJsonPath.empty() && !opts.frames.empty()) {
+        std::cerr << "Error: --stats-json can't be combined with --frames\n";
+        return false;
+    }
+    if (!opts.resultCacheDir.empty() && (!opts.frames.empty() || !opts.sessionDir.empty() ||
+                                         std::count(opts.inputFiles.begin(), opts.inputFiles.end(), "-") > 0)) {
+        std::cerr << "Error: --result-cache can't be combined with --frames, --session or piping\n";
+        return false;
+    }
+    if (edits > 1) {
+        std::cerr << "Error: Only one of --insert, --remove or --replace can be used at a time\n";
+        return false;
+    }
+    
+    // Need at least one input (the base counts in update mode) and an output prefix
+    if (opts.inputFiles.size() < (opts.isUpdate() ? 1u : 2u)) {
         std::cerr << "Error: Need at least one input file and an output prefix\n";
         return false;
     }
@@ -101,9 +462,198 @@ bool parseArgs(int argc, char* argv[], Options& opts) {
     opts.outputPrefix = opts.inputFiles.back();
     opts.inputFiles.pop_back();
     
+    if (std::count(opts.inputFiles.begin(), opts.inputFiles.end(), "-") > 1) {
+        std::cerr << "Error: Standard input can only be used for one input\n";
+        return false;
+    }
+    
     return true;
 }
 
+/**
+ * Write the deep/flat/PNG outputs selected in opts under a prefix
+ *
+ * @param written If set, the size and write time of each file is appended
+ * @throws DeepWriterException on write errors
+ */
+void writeOutputFiles(const Options& opts, const std::string& prefix,
+                      const deep_compositor::DeepImage& merged,
+                      const std::vector<float>& flatRgba,
+                      const deep_compositor::DeepWriteOptions& writeOpts,
+                      std::vector<deep_compositor::FileStats>* written = nullptr) {
+    using namespace deep_compositor;
+    
+    Timer timer;
+    double cpuStart = 0.0;
+    // Unlinked first: a result cache hit may have hard-linked the old file
+    auto begin = [&](const std::string& path) {
+        detachOutput(path);
+        timer.reset();
+        cpuStart = threadCpuMs();
+    };
+    auto record = [&](const std::string& path, size_t samples) {
+        log("  Wrote: " + path);
+        if (written) {
+            FileStats file{path, IOStats()};
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(path, ec);
+            file.io.bytes = ec ? 0 : size;
+            file.io.samples = samples;
+            file.io.wallMs = timer.elapsedMs();
+            file.io.cpuMs = threadCpuMs() - cpuStart;
+            written->push_back(std::move(file));
+        }
+    };
+    
+    // Write deep output if requested
+    if (opts.deepOutput) {
+        std::string deepPath = prefix + "_merged.exr";
+        begin(deepPath);
+        writeDeepEXR(merged, deepPath, writeOpts);
+        record(deepPath, merged.totalSampleCount());
+    }
+    
+    // Write flat EXR if requested
+    if (opts.flatOutput) {
+        std::string flatPath = prefix + "_flat.exr";
+        begin(flatPath);
+        if (merged.hasExtraChannels()) {
+            std::vector<float> extras;
+            flattenExtraChannels(merged, merged.dataWindow(), extras);
+            writeFlatEXR(flatRgba, extras, merged.channels(), merged.dataWindow(),
+                         merged.displayWindow(), flatPath);
+        } else {
+            writeFlatEXR(flatRgba, merged.dataWindow(), merged.displayWindow(), flatPath);
+        }
+        record(flatPath, 0);
+    }
+    
+    // Write PNG if requested
+    if (opts.pngOutput) {
+        std::string pngPath = prefix + ".png";
+        
+        if (hasPNGSupport()) {
+            begin(pngPath);
+            writePNG(flatRgba, merged.width(), merged.height(), pngPath);
+            record(pngPath, 0);
+        } else {
+            log("  Skipped PNG (libpng not available)");
+        }
+    }
+}
+
+/**
+ * Files writeOutputFiles produces under a prefix, named as stored in a
+ * result cache entry
+ */
+std::vector<deep_compositor::CachedOutput> resultCacheOutputs(const Options& opts,
+                                                              const std::string& prefix) {
+    std::vector<deep_compositor::CachedOutput> outputs;
+    if (opts.deepOutput) {
+        outputs.push_back({"merged.exr", prefix + "_merged.exr"});
+    }
+    if (opts.flatOutput) {
+        outputs.push_back({"flat.exr", prefix + "_flat.exr"});
+    }
+    if (opts.pngOutput && deep_compositor::hasPNGSupport()) {
+        outputs.push_back({"preview.png", prefix + ".png"});
+    }
+    return outputs;
+}
+
+/**
+ * Everything besides the inputs that decides the output bytes
+ */
+std::string resultCacheSettings(const Options& opts) {
+    char threshold[32];
+    std::snprintf(threshold, sizeof(threshold), "%.9g", opts.mergeThreshold);
+    
+    std::string mode = !opts.insertPath.empty() ? "insert"
+                     : !opts.removePath.empty() ? "remove"
+                     : !opts.replaceOldPath.empty() ? "replace" : "merge";
+    std::string settings = "deep_compositor " + std::string(VERSION) + "\n" +
+                           "mode " + mode + "\n" +
+                           "merge-threshold " + threshold + "\n";
+    if (!opts.roi.isEmpty()) {
+        settings += "roi " + std::to_string(opts.roi.minX) + " " + std::to_string(opts.roi.minY) +
+                    " " + std::to_string(opts.roi.maxX) + " " + std::to_string(opts.roi.maxY) + "\n";
+    }
+    if (opts.selectsIds()) {
+        settings += std::string(opts.idSelection.keep ? "keep-ids" : "drop-ids");
+        for (const auto& range : opts.idSelection.ids.ranges) {
+            settings += " " + std::to_string(range.first) + "-" + std::to_string(range.second);
+        }
+        settings += "\nid-channel " + opts.idSelection.channel + "\n";
+    }
+    if (opts.deepOutput) {
+        settings += opts.tiledOutput ? "deep tiled " + std::to_string(opts.tileSize) + "\n"
+                                     : "deep scanline\n";
+    }
+    for (const auto& output : resultCacheOutputs(opts, "")) {
+        settings += "output " + output.name + "\n";
+    }
+    return settings;
+}
+
+/**
+ * Log the result cache's cumulative statistics
+ */
+void logResultCacheStats(const deep_compositor::ResultCache& cache, bool hit) {
+    size_t hits, misses;
+    cache.statistics(hits, misses);
+    deep_compositor::log(std::string("Result cache: ") + (hit ? "hit" : "miss") + " (" +
+                         std::to_string(hits) + " hits, " + std::to_string(misses) +
+                         " misses in " + cache.directory() + ")");
+}
+
+/**
+ * Sequence mode: composite every frame in opts.frames through the
+ * pipelined load/merge/write stages
+ */
+int runSequence(const Options& opts) {
+    using namespace deep_compositor;
+    
+    log("Sequence: " + std::to_string(opts.frames.size()) + " frames, " +
+        std::to_string(opts.inputFiles.size()) + " layers");
+    
+    SequenceOptions seqOpts;
+    seqOpts.loader.maxConcurrent = opts.loadThreads;
+    seqOpts.loader.roi = opts.roi;
+    seqOpts.compositor.mergeThreshold = opts.mergeThreshold;
+    seqOpts.compositor.enableMerging = (opts.mergeThreshold > 0.0f);
+    seqOpts.compositor.roi = opts.roi;
+    seqOpts.flatten = opts.flatOutput || opts.pngOutput;
+    seqOpts.reuseInputs = opts.reuseInputs;
+    seqOpts.hashInputs = opts.hashInputs;
+    
+    DeepWriteOptions writeOpts;
+    writeOpts.tiled = opts.tiledOutput;
+    writeOpts.tileWidth = opts.tileSize;
+    writeOpts.tileHeight = opts.tileSize;
+    
+    // Without a frame token in the prefix, append .NNNN
+    std::string prefixPattern = opts.outputPrefix;
+    if (!hasFramePattern(prefixPattern)) {
+        prefixPattern += ".%04d";
+    }
+    
+    SequenceSummary summary = compositeSequence(opts.inputFiles, opts.frames, seqOpts,
+        [&](FrameResult& frame) {
+            log("Frame " + std::to_string(frame.frame) + ": " +
+                formatNumber(frame.stats.totalOutputSamples) + " samples (load " +
+                formatDuration(frame.loadTimeMs) + ", merge " +
+                formatDuration(frame.stats.mergeTimeMs) + ", " +
+                std::to_string(frame.reusedInputs) + " inputs reused)");
+            writeOutputFiles(opts, expandFramePattern(prefixPattern, frame.frame),
+                             frame.merged, frame.flat, writeOpts);
+        });
+    
+    log("\nDone! " + std::to_string(summary.framesWritten) + " frames written, " +
+        std::to_string(summary.framesFailed) + " failed in " + formatDuration(summary.totalTimeMs));
+    
+    return summary.framesFailed == 0 ? 0 : 1;
+}
+
 } // anonymous namespace
 
 int main(int argc, char* argv[]) {
@@ -121,82 +671,272 @@ int main(int argc, char* argv[]) {
         return 0;
     }
     
+    // stdout carries image data when piping, so keep logs off it
+    bool pipeOutput = (opts.outputPrefix == "-");
+    setLogToStderr(pipeOutput);
+    
     // Set verbose mode
     setVerbose(opts.verbose);
+    setMemoryMappedInput(opts.memoryMappedInput);
+    setLoadExtraChannels(opts.extraChannels);
+    TaskScheduler::setSharedThreadCount(opts.threads);
+    if (!opts.isa.empty()) {
+        KernelIsa isa;
+        parseKernelIsa(opts.isa, isa);
+        setKernelIsa(isa);
+    }
+    logVerbose("Kernels: " + std::string(kernelIsaName(kernels().isa)));
+    
+    std::shared_ptr<TilePager> pager;
+    if (opts.memoryBudgetMb > 0) {
+        pager = std::make_shared<TilePager>(static_cast<size_t>(opts.memoryBudgetMb) << 20,
+                                            opts.scratchDir);
+        setOutOfCorePager(pager);
+    }
+    
+    // Written on every exit path, so failed runs can be inspected too
+    struct TraceOutput {
+        std::string path;
+        ~TraceOutput() {
+            if (!path.empty() && !writeTrace(path)) {
+                logError("Failed to write trace: " + path);
+            }
+        }
+    } traceOutput{opts.tracePath};
+    if (!opts.tracePath.empty()) {
+        startTrace();
+        setTraceThreadName("main");
+    }
     
     log("Deep Compositor v" + std::string(VERSION));
     
+    if (!opts.roi.isEmpty()) {
+        log("ROI: " + std::to_string(opts.roi.minX) + "," + std::to_string(opts.roi.minY) +
+            " - " + std::to_string(opts.roi.maxX) + "," + std::to_string(opts.roi.maxY));
+    }
+    
+    if (!opts.frames.empty()) {
+        return runSequence(opts);
+    }
+    
     Timer totalTimer;
     
+    // --stats-json: filled in as the phases run, written on success
+    RunReport report;
+    report.version = VERSION;
+    PhaseClock totalClock;
+    auto finishReport = [&]() {
+        if (opts.statsJsonPath.empty()) {
+            return;
+        }
+        report.phases.push_back(totalClock.finish("total", TaskScheduler::shared().threadCount()));
+        if (!writeStatsJson(opts.statsJsonPath, report, pager.get())) {
+            logError("Failed to write run statistics: " + opts.statsJsonPath);
+        }
+    };
+    
     // ========================================================================
     // Load Phase
     // ========================================================================
+    // In update mode the base and edited layers load alongside the inputs:
+    // [base, inputs..., edit layer(s)]
+    std::vector<std::string> loadList;
+    if (opts.isUpdate()) {
+        loadList.push_back(opts.basePath);
+    }
+    loadList.insert(loadList.end(), opts.inputFiles.begin(), opts.inputFiles.end());
+    for (const std::string* path : {&opts.insertPath, &opts.removePath,
+                                    &opts.replaceOldPath, &opts.replaceNewPath}) {
+        if (!path->empty()) {
+            loadList.push_back(*path);
+        }
+    }
+    
+    // An identical earlier composite makes loading and merging unnecessary
+    std::unique_ptr<ResultCache> resultCache;
+    std::string resultKey;
+    if (!opts.resultCacheDir.empty()) {
+        resultCache.reset(new ResultCache(opts.resultCacheDir, opts.hashInputs));
+        report.resultCache = "miss";
+        if (!resultCache->computeKey(loadList, resultCacheSettings(opts), resultKey)) {
+            log("Result cache: can't key inputs, not caching");
+            resultCache.reset();
+        } else if (resultCache->fetch(resultKey, resultCacheOutputs(opts, opts.outputPrefix),
+                                      opts.resultCacheLink)) {
+            logResultCacheStats(*resultCache, true);
+            for (const auto& output : resultCacheOutputs(opts, opts.outputPrefix)) {
+                log("  Restored: " + output.path);
+            }
+            report.resultCache = "hit";
+            finishReport();
+            log("\nDone! Total time: " + totalTimer.elapsedString());
+            return 0;
+        }
+    }
+    
     log("Loading inputs...");
     Timer loadTimer;
+    PhaseClock loadClock;
+    TraceZone loadZone("loadPhase");
+    
+    // Files are opened, probed and decoded concurrently
+    LoaderOptions loaderOpts;
+    loaderOpts.maxConcurrent = opts.loadThreads;
+    loaderOpts.roi = opts.roi;
+    
+    size_t loadThreads = loadConcurrency(loadList.size(), loaderOpts);
+    report.loadThreads = static_cast<int>(loadThreads);
+    logVerbose("  Loading " + std::to_string(loadList.size()) + " files, " +
+               std::to_string(loadThreads) + " at a time");
+    std::vector<LoadResult> loaded = loadDeepEXRFiles(loadList, loaderOpts);
     
     std::vector<DeepImage> images;
-    images.reserve(opts.inputFiles.size());
+    images.reserve(loaded.size());
     
-    for (size_t i = 0; i < opts.inputFiles.size(); ++i) {
-        const std::string& filename = opts.inputFiles[i];
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        LoadResult& entry = loaded[i];
+        
+        if (!entry.success) {
+            logError("Failed to load " + entry.filename + ": " + entry.error);
+            return 1;
+        }
+        
+        const DeepImage& img = entry.image;
         
         logVerbose("  [" + std::to_string(i + 1) + "/" + 
-                   std::to_string(opts.inputFiles.size()) + "] " + filename);
+                   std::to_string(loaded.size()) + "] " + entry.filename);
         
-        try {
-            // Check if it's a deep EXR
-            if (!isDeepEXR(filename)) {
-                logError("File is not a deep EXR: " + filename);
-                return 1;
-            }
-            
-            DeepImage img = loadDeepEXR(filename);
-            
-            // Log statistics
-            std::string stats = "    " + std::to_string(img.width()) + "x" + 
-                               std::to_string(img.height()) + ", " +
-                               formatNumber(img.totalSampleCount()) + " total samples (avg " +
-                               std::to_string(img.averageSamplesPerPixel()).substr(0, 4) + 
-                               " samples/pixel)";
-            logVerbose(stats);
-            
-            // Validate dimensions match
-            if (!images.empty()) {
-                if (img.width() != images[0].width() || 
-                    img.height() != images[0].height()) {
-                    logError("Image dimensions mismatch: " + filename);
-                    logError("  Expected: " + std::to_string(images[0].width()) + "x" + 
-                            std::to_string(images[0].height()));
-                    logError("  Got: " + std::to_string(img.width()) + "x" + 
-                            std::to_string(img.height()));
-                    return 1;
-                }
+        // Log statistics
+        PixelBox window = img.dataWindow();
+        std::string stats = "    " + std::to_string(img.width()) + "x" + 
+                           std::to_string(img.height()) + " at " +
+                           std::to_string(window.minX) + "," + std::to_string(window.minY) + ", " +
+                           formatNumber(img.totalSampleCount()) + " total samples (avg " +
+                           std::to_string(img.averageSamplesPerPixel()).substr(0, 4) + 
+                           " samples/pixel), " + formatDuration(entry.loadTimeMs);
+        logVerbose(stats);
+        
+        report.inputs.push_back({entry.filename, entry.io});
+        images.push_back(std::move(entry.image));
+    }
+    
+    logVerbose("  Load time: " + loadTimer.elapsedString());
+    loadZone.end();
+    report.phases.push_back(loadClock.finish("load", static_cast<int>(loadThreads)));
+    
+    // ========================================================================
+    // Select Phase
+    // ========================================================================
+    // Inputs are cut down to the selected samples before merging, so the
+    // merge and the outputs only cover them
+    if (opts.selectsIds()) {
+        log(std::string("\nSelecting IDs (") + (opts.idSelection.keep ? "keep" : "drop") + ")...");
+        PhaseClock selectClock;
+        TraceZone selectZone("selectPhase");
+        
+        size_t keptSamples = 0;
+        for (size_t i = 0; i < images.size(); ++i) {
+            DeepImage& img = images[i];
+            int channel = findIdChannel(img.channels(), opts.idSelection.channel);
+            if (channel < 0) {
+                log("  Warning: " + loadList[i] + " has no " +
+                    (opts.idSelection.channel.empty() ? "ID channel"
+                                                      : "channel " + opts.idSelection.channel) +
+                    ", kept whole");
+                keptSamples += img.totalSampleCount();
+                continue;
             }
             
-            images.push_back(std::move(img));
-            
-        } catch (const DeepReaderException& e) {
-            logError("Failed to load " + filename + ": " + e.what());
+            SelectStats selectStats;
+            IdPresenceIndex index(img, channel);
+            img = selectById(img, opts.idSelection, index, &selectStats);
+            keptSamples += selectStats.keptSamples;
+            logVerbose("  " + loadList[i] + ": " + formatNumber(selectStats.keptSamples) +
+                       " samples kept (" + img.channels().extras[channel].name + "), " +
+                       std::to_string(selectStats.skippedTiles + selectStats.copiedTiles) + "/" +
+                       std::to_string(selectStats.tiles) + " tiles without selected IDs");
+        }
+        
+        selectZone.end();
+        report.phases.push_back(selectClock.finish("select", TaskScheduler::shared().threadCount()));
+        if (keptSamples == 0) {
+            logError("No samples left after the ID selection");
             return 1;
         }
+        log("  Kept: " + formatNumber(keptSamples) + " samples");
     }
     
-    logVerbose("  Load time: " + loadTimer.elapsedString());
-    
     // ========================================================================
     // Merge Phase
     // ========================================================================
     log("\nMerging...");
+    PhaseClock mergeClock;
+    TraceZone mergeZone("mergePhase");
     
     CompositorOptions compOpts;
     compOpts.mergeThreshold = opts.mergeThreshold;
     compOpts.enableMerging = (opts.mergeThreshold > 0.0f);
+    compOpts.roi = opts.roi;
+    compOpts.threads = opts.threads;
     
     CompositorStats stats;
+    MergeCostMap costMap;
+    DeepImage merged;
+    std::vector<float> sessionFlat;  // Already flattened by a session
     
-    DeepImage merged = deepMerge(images, compOpts, &stats);
+    if (opts.isUpdate()) {
+        // images = [base, other layers..., edit layer(s)]
+        size_t otherCount = opts.inputFiles.size();
+        std::vector<const DeepImage*> others;
+        for (size_t i = 1; i <= otherCount; ++i) {
+            others.push_back(&images[i]);
+        }
+        const DeepImage& edited = images[otherCount + 1];
+        
+        merged = std::move(images[0]);
+        if (!opts.insertPath.empty() && otherCount > 0) {
+            insertLayer(merged, others, edited, compOpts, &stats);
+        } else if (!opts.insertPath.empty()) {
+            // Without the base's layers, merge into the base (approximate)
+            insertLayer(merged, edited, compOpts, &stats);
+        } else if (!opts.removePath.empty()) {
+            removeLayer(merged, others, edited, compOpts, &stats);
+        } else {
+            replaceLayer(merged, others, edited, images[otherCount + 2], compOpts, &stats);
+        }
+        
+        log("  Re-merged: " + formatNumber(stats.remergedPixels) + " pixels (" +
+            formatNumber(stats.totalOutputSamples) + " samples)");
+        log("  Combined: " + formatNumber(merged.totalSampleCount()) + " total samples");
+    } else if (!opts.sessionDir.empty()) {
+        CompositeSession session(opts.sessionDir, opts.tileSize);
+        session.load();
+        
+        std::vector<const DeepImage*> inputs;
+        for (const auto& img : images) {
+            inputs.push_back(&img);
+        }
+        session.update(inputs, compOpts, &stats);
+        
+        try {
+            session.save();
+        } catch (const DeepWriterException& e) {
+            logError("Failed to save session: " + std::string(e.what()));
+            return 1;
+        }
+        
+        merged = std::move(session.merged());
+        sessionFlat = session.flat();
+        log("  Combined: " + formatNumber(merged.totalSampleCount()) + " total samples");
+    } else {
+        merged = deepMerge(images, compOpts, &stats, opts.costMap ? &costMap : nullptr);
+        log("  Combined: " + formatNumber(stats.totalOutputSamples) + " total samples");
+        log("  Threads: " + std::to_string(stats.mergeThreads) + " (" +
+            std::to_string(stats.workUnits) + " work units, " + std::to_string(stats.steals) +
+            " stolen, " + std::to_string(static_cast<int>(stats.loadBalance * 100.0 + 0.5)) +
+            "% balanced)");
+    }
     
-    log("  Combined: " + formatNumber(stats.totalOutputSamples) + " total samples");
     log("  Depth range: " + std::to_string(stats.minDepth) + " to " + 
         std::to_string(stats.maxDepth));
     log("  Merge time: " + std::to_string(static_cast<int>(stats.mergeTimeMs)) + " ms");
@@ -204,15 +944,22 @@ int main(int argc, char* argv[]) {
     // ========================================================================
     // Flatten Phase
     // ========================================================================
+    mergeZone.end();
+    report.phases.push_back(mergeClock.finish("merge", static_cast<int>(std::max<size_t>(1, stats.mergeThreads))));
     std::vector<float> flatRgba;
     
-    if (opts.flatOutput || opts.pngOutput) {
+    bool needFlat = pipeOutput ? !opts.deepOutput : (opts.flatOutput || opts.pngOutput);
+    if (needFlat && !opts.sessionDir.empty()) {
+        flatRgba = std::move(sessionFlat);
+    } else if (needFlat) {
         log("\nFlattening...");
         Timer flattenTimer;
+        PhaseClock flattenClock;
         
-        flatRgba = flattenImage(merged);
+        flattenImage(merged, merged.dataWindow(), flatRgba, &stats.culledSamples);
         
         logVerbose("  Flatten time: " + flattenTimer.elapsedString());
+        report.phases.push_back(flattenClock.finish("flatten", TaskScheduler::shared().threadCount()));
     }
     
     // ========================================================================
@@ -220,32 +967,62 @@ int main(int argc, char* argv[]) {
     // ========================================================================
     log("\nWriting outputs...");
     Timer writeTimer;
+    PhaseClock writeClock;
+    TraceZone writeZone("writePhase");
+    report.merge = stats;
+    
+    DeepWriteOptions writeOpts;
+    writeOpts.tiled = opts.tiledOutput;
+    writeOpts.tileWidth = opts.tileSize;
+    writeOpts.tileHeight = opts.tileSize;
     
     try {
-        // Write deep output if requested
-        if (opts.deepOutput) {
-            std::string deepPath = opts.outputPrefix + "_merged.exr";
-            writeDeepEXR(merged, deepPath);
-            log("  Wrote: " + deepPath);
+        if (pipeOutput) {
+            // One EXR on stdout: deep if requested, flat otherwise
+            MemoryOStream stream("<stdout>");
+            double cpuStart = threadCpuMs();
+            if (opts.deepOutput) {
+                writeDeepEXR(merged, stream, writeOpts);
+            } else if (merged.hasExtraChannels()) {
+                std::vector<float> extras;
+                flattenExtraChannels(merged, merged.dataWindow(), extras);
+                writeFlatEXR(flatRgba, extras, merged.channels(), merged.dataWindow(),
+                             merged.displayWindow(), stream);
+            } else {
+                writeFlatEXR(flatRgba, merged.dataWindow(), merged.displayWindow(), stream);
+            }
+            
+            const std::vector<char>& bytes = stream.buffer();
+            std::cout.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            std::cout.flush();
+            if (!std::cout) {
+                logError("Failed to write output to stdout");
+                return 1;
+            }
+            
+            log("  Wrote " + formatBytes(bytes.size()) + " to stdout (" +
+                (opts.deepOutput ? "deep" : "flat") + " EXR)");
+            
+            FileStats written{"-", IOStats()};
+            written.io.bytes = bytes.size();
+            written.io.samples = opts.deepOutput ? merged.totalSampleCount() : 0;
+            written.io.wallMs = writeTimer.elapsedMs();
+            written.io.cpuMs = threadCpuMs() - cpuStart;
+            report.outputs.push_back(std::move(written));
+            report.phases.push_back(writeClock.finish("write"));
+            finishReport();
+            log("\nDone! Total time: " + totalTimer.elapsedString());
+            return 0;
         }
         
-        // Write flat EXR if requested
-        if (opts.flatOutput) {
-            std::string flatPath = opts.outputPrefix + "_flat.exr";
-            writeFlatEXR(flatRgba, merged.width(), merged.height(), flatPath);
-            log("  Wrote: " + flatPath);
-        }
+        writeOutputFiles(opts, opts.outputPrefix, merged, flatRgba, writeOpts,
+                         opts.statsJsonPath.empty() ? nullptr : &report.outputs);
         
-        // Write PNG if requested
-        if (opts.pngOutput) {
-            std::string pngPath = opts.outputPrefix + ".png";
-            
-            if (hasPNGSupport()) {
-                writePNG(flatRgba, merged.width(), merged.height(), pngPath);
-                log("  Wrote: " + pngPath);
-            } else {
-                log("  Skipped PNG (libpng not available)");
-            }
+        if (opts.costMap) {
+            std::string costPath = opts.outputPrefix + "_cost.exr";
+            writeFlatEXR(costMap.values, MergeCostMap::channelNames(), costMap.window,
+                         merged.displayWindow(), costPath);
+            log("  Wrote: " + costPath);
         }
         
     } catch (const DeepWriterException& e) {
@@ -254,10 +1031,28 @@ int main(int argc, char* argv[]) {
     }
     
     logVerbose("  Write time: " + writeTimer.elapsedString());
+    writeZone.end();
+    report.phases.push_back(writeClock.finish("write"));
+    
+    if (resultCache) {
+        try {
+            resultCache->store(resultKey, resultCacheOutputs(opts, opts.outputPrefix));
+        } catch (const DeepWriterException& e) {
+            logError(e.what());  // The outputs themselves are fine
+        }
+        logResultCacheStats(*resultCache, false);
+    }
     
     // ========================================================================
     // Summary
     // ========================================================================
+    if (pager) {
+        log("Paging: peak " + formatBytes(pager->peakResidentBytes()) + " resident, " +
+            formatNumber(pager->pageOuts()) + " tiles paged out, " +
+            formatNumber(pager->pageIns()) + " read back, " +
+            formatBytes(pager->scratchBytes()) + " scratch");
+    }
+    finishReport();
     log("\nDone! Total time: " + totalTimer.elapsedString());
     
     return 0;
@@ -1,9 +1,13 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include "deep_image.h"
 #include "deep_compositor.h"
+#include "deep_select.h"
 #include "deep_writer.h"
+#include "deep_tasks.h"
 #include "../test_helpers.h"
 
 using namespace deep_compositor;
@@ -42,11 +46,12 @@ TEST_F(CompositorIntegrationTest, SingleImagePassesThroughCorrectly) {
     EXPECT_FLOAT_EQ(result.pixel(0, 0)[0].alpha, 0.9f);
 }
 
-TEST_F(CompositorIntegrationTest, MismatchedDimensionsThrowsRuntimeError) {
+TEST_F(CompositorIntegrationTest, MismatchedDimensionsMergeOverUnion) {
     std::vector<DeepImage> inputs;
     inputs.emplace_back(4, 4);
     inputs.emplace_back(8, 8);
-    EXPECT_THROW(deepMerge(inputs), std::runtime_error);
+    DeepImage result = deepMerge(inputs);
+    EXPECT_EQ(result.dataWindow(), PixelBox(0, 0, 7, 7));
 }
 
 TEST_F(CompositorIntegrationTest, TwoImagesWithDisjointDepthsMergeInDepthOrder) {
@@ -243,3 +248,508 @@ TEST_F(CompositorIntegrationTest, PointerVersionProducesSameResultAsValueVersion
         EXPECT_NEAR(flatValue[i], flatPtr[i], 1e-5f);
     }
 }
+
+// ============================================================================
+// Region-of-interest tests
+// ============================================================================
+
+TEST_F(CompositorIntegrationTest, RoiLimitsMergeToRegion) {
+    DeepImage imgA(8, 8);
+    DeepImage imgB(8, 8);
+    imgA.pixel(1, 1).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    imgA.pixel(5, 5).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    imgB.pixel(5, 5).addSample(makePoint(2.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    std::vector<DeepImage> inputs = {imgA, imgB};
+
+    CompositorOptions opts;
+    opts.roi = PixelBox(4, 4, 6, 7);
+    CompositorStats stats;
+    DeepImage result = deepMerge(inputs, opts, &stats);
+
+    EXPECT_EQ(result.dataWindow(), PixelBox(4, 4, 6, 7));
+    EXPECT_EQ(result.displayWindow(), PixelBox(0, 0, 7, 7));
+    EXPECT_EQ(result.pixel(1, 1).sampleCount(), 2u);
+    // Only samples inside the ROI are counted
+    EXPECT_EQ(stats.totalInputSamples, 2u);
+    EXPECT_EQ(stats.totalOutputSamples, 2u);
+}
+
+TEST_F(CompositorIntegrationTest, RoiIsClippedToInputs) {
+    DeepImage img(4, 4);
+    std::vector<DeepImage> inputs = {img};
+    CompositorOptions opts;
+    opts.roi = PixelBox(2, 2, 50, 50);
+    DeepImage result = deepMerge(inputs, opts);
+    EXPECT_EQ(result.dataWindow(), PixelBox(2, 2, 3, 3));
+}
+
+TEST_F(CompositorIntegrationTest, FlattenRegionMatchesFullFlatten) {
+    DeepImage img(4, 4);
+    img.pixel(2, 3).addSample(makePoint(1.0f, 0.4f, 0.2f, 0.1f, 0.5f));
+    auto full = flattenImage(img);
+    auto region = flattenImage(img, PixelBox(2, 2, 3, 3));
+    ASSERT_EQ(region.size(), 2u * 2u * 4u);
+    // Region pixel (0, 1) is image pixel (2, 3)
+    size_t regionIdx = (1 * 2 + 0) * 4;
+    size_t fullIdx = (3 * 4 + 2) * 4;
+    for (int c = 0; c < 4; ++c) {
+        EXPECT_FLOAT_EQ(region[regionIdx + c], full[fullIdx + c]);
+    }
+}
+
+// ============================================================================
+// Data window tests
+// ============================================================================
+
+TEST_F(CompositorIntegrationTest, OffsetInputsMergeOverUnionBoundingBox) {
+    // Full-frame backdrop plus a small element cropped to its bbox
+    DeepImage backdrop(PixelBox(0, 0, 9, 9));
+    backdrop.pixel(6, 6).addSample(makePoint(10.0f, 0.0f, 0.0f, 0.5f, 1.0f));
+    DeepImage element(PixelBox(5, 5, 7, 7));
+    element.pixel(1, 1).addSample(makePoint(2.0f, 0.5f, 0.0f, 0.0f, 0.5f));
+
+    std::vector<DeepImage> inputs = {backdrop, element};
+    CompositorStats stats;
+    DeepImage result = deepMerge(inputs, CompositorOptions{}, &stats);
+
+    EXPECT_EQ(result.dataWindow(), PixelBox(0, 0, 9, 9));
+    // Element pixel (1, 1) lands on absolute (6, 6) in front of the backdrop
+    const auto& px = result.pixel(6, 6);
+    ASSERT_EQ(px.sampleCount(), 2u);
+    EXPECT_FLOAT_EQ(px[0].depth, 2.0f);
+    EXPECT_FLOAT_EQ(px[1].depth, 10.0f);
+    EXPECT_EQ(stats.totalInputSamples, 2u);
+    EXPECT_EQ(stats.totalOutputSamples, 2u);
+}
+
+TEST_F(CompositorIntegrationTest, DisjointInputsProduceEmptyGap) {
+    DeepImage left(PixelBox(0, 0, 1, 0));
+    left.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    DeepImage right(PixelBox(4, 0, 5, 0));
+    right.pixel(1, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+
+    std::vector<DeepImage> inputs = {left, right};
+    DeepImage result = deepMerge(inputs);
+
+    EXPECT_EQ(result.dataWindow(), PixelBox(0, 0, 5, 0));
+    EXPECT_EQ(result.pixel(0, 0).sampleCount(), 1u);
+    EXPECT_TRUE(result.pixel(2, 0).isEmpty());
+    EXPECT_TRUE(result.pixel(3, 0).isEmpty());
+    EXPECT_EQ(result.pixel(5, 0).sampleCount(), 1u);
+}
+
+TEST_F(CompositorIntegrationTest, RoiAppliesToUnionOfOffsetInputs) {
+    DeepImage a(PixelBox(0, 0, 3, 3));
+    DeepImage b(PixelBox(10, 10, 13, 13));
+    b.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+
+    std::vector<DeepImage> inputs = {a, b};
+    CompositorOptions opts;
+    opts.roi = PixelBox(8, 8, 11, 11);
+    DeepImage result = deepMerge(inputs, opts);
+
+    EXPECT_EQ(result.dataWindow(), PixelBox(8, 8, 11, 11));
+    EXPECT_EQ(result.pixel(2, 2).sampleCount(), 1u);
+}
+
+TEST_F(CompositorIntegrationTest, ParallelMergeMatchesSerial) {
+    // Offset inputs, one with a dense volumetric band
+    DeepImage a(PixelBox(0, 0, 199, 99));
+    DeepImage b(PixelBox(50, 30, 249, 129));
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); x += 3) {
+            a.pixel(x, y).addSample(makePoint(1.0f + x * 0.01f, 0.2f, 0.3f, 0.4f, 0.5f));
+        }
+    }
+    for (int y = 40; y < 60; ++y) {
+        for (int x = 0; x < b.width(); ++x) {
+            for (int s = 0; s < 6; ++s) {
+                b.pixel(x, y).addSample(makeVolume(0.5f + s, 2.0f + s, 0.1f, 0.1f, 0.1f, 0.3f));
+            }
+        }
+    }
+    std::vector<DeepImage> inputs = {a, b};
+
+    CompositorOptions serialOpts;
+    serialOpts.threads = 1;
+    CompositorStats serialStats;
+    DeepImage serial = deepMerge(inputs, serialOpts, &serialStats);
+
+    CompositorOptions parallelOpts;
+    parallelOpts.threads = 4;
+    CompositorStats parallelStats;
+    DeepImage parallel = deepMerge(inputs, parallelOpts, &parallelStats);
+
+    ASSERT_EQ(parallel.dataWindow(), serial.dataWindow());
+    for (int y = 0; y < serial.height(); ++y) {
+        for (int x = 0; x < serial.width(); ++x) {
+            const auto& s = serial.pixel(x, y).samples();
+            const auto& p = parallel.pixel(x, y).samples();
+            ASSERT_EQ(s.size(), p.size()) << "at " << x << "," << y;
+            for (size_t i = 0; i < s.size(); ++i) {
+                EXPECT_FLOAT_EQ(s[i].depth, p[i].depth);
+                EXPECT_FLOAT_EQ(s[i].alpha, p[i].alpha);
+            }
+        }
+    }
+    EXPECT_EQ(parallelStats.totalInputSamples, serialStats.totalInputSamples);
+    EXPECT_EQ(parallelStats.totalOutputSamples, serialStats.totalOutputSamples);
+    EXPECT_EQ(parallelStats.splitFragments, serialStats.splitFragments);
+    EXPECT_EQ(parallelStats.remergedPixels, serialStats.remergedPixels);
+    EXPECT_FLOAT_EQ(parallelStats.minDepth, serialStats.minDepth);
+    // Merge threads come from the shared pool, sized to the machine
+    size_t poolThreads = static_cast<size_t>(TaskScheduler::shared().threadCount());
+    EXPECT_EQ(parallelStats.mergeThreads, std::min<size_t>(4, poolThreads));
+    EXPECT_GT(parallelStats.workUnits, 4u);
+}
+
+TEST_F(CompositorIntegrationTest, CostMapRecordsPerPixelWork) {
+    // Overlapping volumes at (1,0) split into 4 fragments; (0,0) has one point
+    DeepImage a(PixelBox(5, 5, 7, 5));
+    DeepImage b(PixelBox(6, 5, 7, 5));
+    a.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    a.pixel(1, 0).addSample(makeVolume(1.0f, 3.0f, 0.6f, 0.6f, 0.6f, 0.8f));
+    b.pixel(0, 0).addSample(makeVolume(2.0f, 4.0f, 0.4f, 0.4f, 0.4f, 0.6f));
+
+    MergeCostMap cost;
+    DeepImage result = deepMerge(std::vector<DeepImage>{a, b}, CompositorOptions(), nullptr, &cost);
+
+    ASSERT_EQ(cost.window, result.dataWindow());
+    ASSERT_EQ(cost.values.size(), 3u * MergeCostMap::kChannels);
+    const float* point = &cost.values[0];
+    const float* overlap = &cost.values[MergeCostMap::kChannels];
+    const float* empty = &cost.values[2 * MergeCostMap::kChannels];
+    EXPECT_FLOAT_EQ(point[0], 1.0f);
+    EXPECT_FLOAT_EQ(point[1], 1.0f);
+    EXPECT_FLOAT_EQ(point[2], 1.0f);
+    EXPECT_FLOAT_EQ(overlap[0], 2.0f);
+    EXPECT_FLOAT_EQ(overlap[1], 4.0f);
+    EXPECT_FLOAT_EQ(overlap[2], 3.0f);
+    EXPECT_GT(overlap[3], 0.0f);
+    for (int c = 0; c < MergeCostMap::kChannels; ++c) {
+        EXPECT_FLOAT_EQ(empty[c], 0.0f);
+    }
+}
+
+TEST_F(CompositorIntegrationTest, PointOnlyInputsKeepTheirChannels) {
+    // Files without ZBack merge with the point layout, to the same result
+    ChannelSet points;
+    points.zBack = false;
+    DeepImage a(PixelBox(0, 0, 7, 3));
+    DeepImage b(PixelBox(2, 0, 9, 3));
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            a.pixel(x, y).addSample(makePoint(1.0f + (x % 3), 0.2f, 0.1f, 0.0f, 0.4f));
+            b.pixel(x, y).addSample(makePoint(1.0f + (y % 2), 0.0f, 0.3f, 0.1f, 0.5f));
+        }
+    }
+    DeepImage general = deepMerge(std::vector<const DeepImage*>{&a, &b});
+    a.setChannels(points);
+    b.setChannels(points);
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&a, &b});
+
+    EXPECT_TRUE(general.channels().zBack);
+    EXPECT_EQ(merged.channels(), points);
+    ASSERT_EQ(merged.dataWindow(), general.dataWindow());
+    for (int y = 0; y < merged.height(); ++y) {
+        for (int x = 0; x < merged.width(); ++x) {
+            const auto& m = merged.pixel(x, y).samples();
+            const auto& g = general.pixel(x, y).samples();
+            ASSERT_EQ(m.size(), g.size()) << "at " << x << "," << y;
+            for (size_t i = 0; i < m.size(); ++i) {
+                EXPECT_FLOAT_EQ(m[i].depth, g[i].depth);
+                EXPECT_FLOAT_EQ(m[i].green, g[i].green);
+                EXPECT_FLOAT_EQ(m[i].alpha, g[i].alpha);
+            }
+        }
+    }
+
+    // A layer that may hold volumes brings ZBack back
+    DeepImage fog = make1x1Volume(0.5f, 3.0f, 0.1f, 0.1f, 0.1f, 0.3f);
+    insertLayer(merged, fog);
+    EXPECT_TRUE(merged.channels().zBack);
+    EXPECT_EQ(merged.pixel(0, 0).sampleCount(), 3u);  // Fog split at the point
+}
+
+TEST_F(CompositorIntegrationTest, ExtraChannelsFollowTheirSamples) {
+    // Two renders with an AOV copying red; only one has an object ID
+    ChannelSet withId;
+    withId.extras = {ExtraChannel::fromFile("aov", false), ExtraChannel::fromFile("objectId", false)};
+    ChannelSet aovOnly;
+    aovOnly.extras = {withId.extras[0]};
+    DeepImage a(PixelBox(0, 0, 5, 3));
+    DeepImage b(PixelBox(2, 1, 7, 3));
+    a.setChannels(withId);
+    b.setChannels(aovOnly);
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            DeepSample s = makeVolume(1.0f + x, 4.0f + x, 0.2f, 0.1f, 0.0f, 0.5f);
+            a.pixel(x, y).addSample(s);
+            a.extraColumns(x, y) = {s.red, 5.0f};
+        }
+    }
+    for (int y = 0; y < b.height(); ++y) {
+        for (int x = 0; x < b.width(); ++x) {
+            DeepSample s = makePoint(3.0f, 0.3f, 0.0f, 0.1f, 0.6f);
+            b.pixel(x, y).addSample(s);
+            b.extraColumns(x, y) = {s.red};
+        }
+    }
+
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&a, &b});
+    ASSERT_EQ(merged.channels(), withId);
+    ASSERT_EQ(merged.dataWindow(), PixelBox(0, 0, 7, 3));
+    for (int y = 0; y < merged.height(); ++y) {
+        for (int x = 0; x < merged.width(); ++x) {
+            const DeepPixel& pixel = merged.pixel(x, y);
+            const std::vector<float>& columns = merged.extraColumns(x, y);
+            size_t n = pixel.sampleCount();
+            ASSERT_EQ(columns.size(), 2 * n) << "at " << x << "," << y;
+            for (size_t s = 0; s < n; ++s) {
+                EXPECT_EQ(columns[s], pixel[s].red);
+                // b's point at depth 3 has no ID
+                bool fromB = pixel[s].depth == 3.0f && pixel[s].depth_back == 3.0f;
+                EXPECT_EQ(columns[n + s], fromB ? 0.0f : 5.0f) << "at " << x << "," << y;
+            }
+        }
+    }
+
+    // Inserting b into a merge of a alone gives the same channels
+    DeepImage incremental = deepMerge(std::vector<const DeepImage*>{&a});
+    insertLayer(incremental, b);
+    ASSERT_EQ(incremental.channels(), withId);
+    for (int y = 0; y < merged.height(); ++y) {
+        for (int x = 0; x < merged.width(); ++x) {
+            EXPECT_EQ(incremental.extraColumns(x, y), merged.extraColumns(x, y)) << "at " << x << "," << y;
+        }
+    }
+}
+
+TEST_F(CompositorIntegrationTest, SelectedIdsMergeAsIfRenderedAlone) {
+    // Two renders of objects 1 and 2, interleaved in depth
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("objectId", false)};
+    DeepImage a(PixelBox(0, 0, 3, 3));
+    DeepImage b(PixelBox(2, 0, 5, 3));
+    DeepImage alone(PixelBox(0, 0, 5, 3));  // Object 1's samples only
+    for (DeepImage* img : {&a, &b, &alone}) {
+        img->setChannels(channels);
+    }
+    auto add = [&](DeepImage& img, int x, int y, float depth, float id) {
+        // Added front to back, so the column is appended in sample order
+        img.pixel(x, y).addSample(makeVolume(depth, depth + 1.5f, 0.2f * id, 0.1f, 0.0f, 0.4f));
+        img.extraColumns(x, y).push_back(id);
+    };
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            add(a, x, y, 1.0f + x, 1.0f);
+            add(a, x, y, 5.0f, 2.0f);
+            add(b, x, y, 2.0f, x == 0 ? 1.0f : 2.0f);
+            if (x == 2) {
+                add(alone, x, y, 2.0f, 1.0f);  // b's object 1, in front of a's
+            }
+            add(alone, x, y, 1.0f + x, 1.0f);
+        }
+    }
+
+    IdSelection selection;
+    selection.ids.add(1, 1);
+    std::vector<DeepImage> selected;
+    for (const DeepImage* img : {&a, &b}) {
+        selected.push_back(selectById(*img, selection));
+    }
+    DeepImage merged = deepMerge(selected);
+    DeepImage expected = deepMerge(std::vector<const DeepImage*>{&alone});
+    ASSERT_EQ(merged.dataWindow(), PixelBox(0, 0, 3, 3));
+
+    std::vector<float> flat, expectedFlat;
+    flattenImage(merged, merged.dataWindow(), flat);
+    flattenImage(expected, merged.dataWindow(), expectedFlat);
+    ASSERT_EQ(flat.size(), expectedFlat.size());
+    for (size_t i = 0; i < flat.size(); ++i) {
+        EXPECT_FLOAT_EQ(flat[i], expectedFlat[i]) << "at " << i;
+    }
+}
+
+// ============================================================================
+// Incremental update tests
+// ============================================================================
+
+class IncrementalCompositeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        // Static plates covering the frame, plus a small FX element
+        bg = DeepImage(PixelBox(0, 0, 15, 15));
+        mid = DeepImage(PixelBox(0, 0, 15, 15));
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                bg.pixel(x, y).addSample(makePoint(20.0f, 0.0f, 0.0f, 0.5f, 1.0f));
+                if ((x + y) % 3 == 0) {
+                    mid.pixel(x, y).addSample(makeVolume(5.0f, 8.0f, 0.2f, 0.1f, 0.0f, 0.4f));
+                }
+            }
+        }
+        fx = DeepImage(PixelBox(4, 4, 9, 9));
+        fx.pixel(1, 1).addSample(makeVolume(6.0f, 7.0f, 0.5f, 0.0f, 0.0f, 0.5f));
+        fx.pixel(3, 2).addSample(makePoint(2.0f, 0.0f, 0.5f, 0.0f, 0.5f));
+    }
+
+    void expectSameImage(const DeepImage& actual, const DeepImage& expected) {
+        ASSERT_EQ(actual.dataWindow(), expected.dataWindow());
+        for (int y = 0; y < expected.height(); ++y) {
+            for (int x = 0; x < expected.width(); ++x) {
+                const DeepPixel& a = actual.pixel(x, y);
+                const DeepPixel& e = expected.pixel(x, y);
+                ASSERT_EQ(a.sampleCount(), e.sampleCount()) << "at " << x << "," << y;
+                for (size_t i = 0; i < e.sampleCount(); ++i) {
+                    EXPECT_NEAR(a[i].depth, e[i].depth, 1e-5f);
+                    EXPECT_NEAR(a[i].depth_back, e[i].depth_back, 1e-5f);
+                    EXPECT_NEAR(a[i].red, e[i].red, 1e-5f);
+                    EXPECT_NEAR(a[i].alpha, e[i].alpha, 1e-5f);
+                }
+            }
+        }
+    }
+
+    // A volume cutting mid's, and points just behind bg's
+    DeepImage cuttingLayer() {
+        DeepImage cutting(PixelBox(0, 0, 15, 15));
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                if ((x + y) % 3 == 0) {
+                    cutting.pixel(x, y).addSample(makeVolume(6.0f, 7.0f, 0.0f, 0.3f, 0.0f, 0.3f));
+                } else if ((x + y) % 3 == 1) {
+                    cutting.pixel(x, y).addSample(makePoint(20.0008f, 0.4f, 0.0f, 0.0f, 0.5f));
+                }
+            }
+        }
+        return cutting;
+    }
+
+    // Volumes within the merge threshold of mid's, volumes cutting the
+    // merged pieces, and points just in front of bg's
+    DeepImage nearLayer() {
+        DeepImage near(PixelBox(0, 0, 15, 15));
+        for (int y = 0; y < 16; ++y) {
+            for (int x = 0; x < 16; ++x) {
+                if ((x + y) % 3 == 0) {
+                    near.pixel(x, y).addSample(makeVolume(5.0004f, 8.0006f, 0.1f, 0.3f, 0.2f, 0.35f));
+                    near.pixel(x, y).addSample(makeVolume(6.5f, 9.0f, 0.0f, 0.2f, 0.3f, 0.6f));
+                } else if ((x + y) % 3 == 1) {
+                    near.pixel(x, y).addSample(makePoint(19.9995f, 0.0f, 0.4f, 0.0f, 0.5f));
+                }
+            }
+        }
+        return near;
+    }
+
+    DeepImage bg, mid, fx;
+};
+
+TEST_F(IncrementalCompositeTest, LayerFootprintBoundsNonEmptyPixels) {
+    EXPECT_EQ(layerFootprint(fx), PixelBox(5, 5, 7, 6));
+    EXPECT_TRUE(layerFootprint(DeepImage(4, 4)).isEmpty());
+}
+
+TEST_F(IncrementalCompositeTest, InsertMatchesFullMerge) {
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid});
+    CompositorStats stats;
+    insertLayer(merged, fx, CompositorOptions(), &stats, 2);
+
+    EXPECT_EQ(stats.remergedPixels, 2u);
+    EXPECT_EQ(stats.inputImageCount, 3u);
+    expectSameImage(merged, deepMerge(std::vector<const DeepImage*>{&bg, &mid, &fx}));
+}
+
+TEST_F(IncrementalCompositeTest, InsertWithOtherLayersIsExact) {
+    DeepImage cutting = cuttingLayer();
+    DeepImage near = nearLayer();
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &cutting});
+    CompositorStats stats;
+    insertLayer(merged, {&bg, &mid, &cutting}, near, CompositorOptions(), &stats);
+
+    EXPECT_EQ(stats.inputImageCount, 4u);
+    DeepImage expected = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &cutting, &near});
+    ASSERT_EQ(merged.dataWindow(), expected.dataWindow());
+    for (int y = 0; y < expected.height(); ++y) {
+        for (int x = 0; x < expected.width(); ++x) {
+            const DeepPixel& a = merged.pixel(x, y);
+            const DeepPixel& e = expected.pixel(x, y);
+            ASSERT_EQ(a.sampleCount(), e.sampleCount()) << "at " << x << "," << y;
+            EXPECT_EQ(std::memcmp(a.samples().data(), e.samples().data(),
+                                  e.sampleCount() * sizeof(DeepSample)), 0) << "at " << x << "," << y;
+        }
+    }
+}
+
+TEST_F(IncrementalCompositeTest, InsertWithoutOtherLayersDriftsBoundedly) {
+    // bg's and cutting's points were blended before near's arrived, so
+    // near's point joins both instead of only bg's. Regrouping trades
+    // colour between the grouped samples but keeps their coverage.
+    DeepImage cutting = cuttingLayer();
+    DeepImage near = nearLayer();
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &cutting});
+    insertLayer(merged, near);
+
+    DeepImage expected = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &cutting, &near});
+    std::vector<float> flat = flattenImage(merged);
+    std::vector<float> expectedFlat = flattenImage(expected);
+    ASSERT_EQ(flat.size(), expectedFlat.size());
+    float colorDrift = 0.0f;
+    for (size_t i = 0; i < flat.size(); i += 4) {
+        for (size_t c = 0; c < 3; ++c) {
+            colorDrift = std::max(colorDrift, std::abs(flat[i + c] - expectedFlat[i + c]));
+        }
+        EXPECT_NEAR(flat[i + 3], expectedFlat[i + 3], 1e-5f) << "at pixel " << i / 4;
+    }
+    EXPECT_GT(colorDrift, 0.0f);
+    EXPECT_LE(colorDrift, 0.2f);
+}
+
+TEST_F(IncrementalCompositeTest, RemoveMatchesFullMerge) {
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &fx});
+    CompositorStats stats;
+    removeLayer(merged, {&bg, &mid}, fx, CompositorOptions(), &stats);
+
+    EXPECT_EQ(stats.remergedPixels, 2u);
+    EXPECT_EQ(stats.inputImageCount, 2u);
+    expectSameImage(merged, deepMerge(std::vector<const DeepImage*>{&bg, &mid}));
+}
+
+TEST_F(IncrementalCompositeTest, ReplaceRemergesBothVersionsFootprints) {
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid, &fx});
+
+    DeepImage fx2(PixelBox(10, 10, 11, 11));
+    fx2.pixel(0, 0).addSample(makePoint(1.0f, 0.3f, 0.3f, 0.3f, 0.3f));
+    CompositorStats stats;
+    replaceLayer(merged, {&bg, &mid}, fx, fx2, CompositorOptions(), &stats);
+
+    EXPECT_EQ(stats.remergedPixels, 3u);
+    EXPECT_EQ(stats.inputImageCount, 3u);
+    expectSameImage(merged, deepMerge(std::vector<const DeepImage*>{&bg, &mid, &fx2}));
+}
+
+TEST_F(IncrementalCompositeTest, InsertGrowsDataWindow) {
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg});
+    DeepImage outside(PixelBox(18, 2, 19, 3));
+    outside.pixel(1, 1).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+
+    insertLayer(merged, outside);
+
+    EXPECT_EQ(merged.dataWindow(), PixelBox(0, 0, 19, 15));
+    expectSameImage(merged, deepMerge(std::vector<const DeepImage*>{&bg, &outside}));
+}
+
+TEST_F(IncrementalCompositeTest, RemergeRegionOnlyTouchesRegion) {
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&bg, &mid});
+    DeepImage stale = merged;
+    mid.pixel(0, 0).clear();
+
+    CompositorStats stats;
+    remergeRegion(merged, {&bg, &mid}, PixelBox(0, 0, 1, 1), CompositorOptions(), &stats);
+
+    EXPECT_EQ(stats.remergedPixels, 4u);
+    EXPECT_EQ(merged.pixel(0, 0).sampleCount(), 1u);
+    expectSameImage(merged, deepMerge(std::vector<const DeepImage*>{&bg, &mid}));
+    EXPECT_NE(stale.pixel(0, 0).sampleCount(), merged.pixel(0, 0).sampleCount());
+}
@@ -1,10 +1,17 @@
 #include <gtest/gtest.h>
 #include <cmath>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <memory>
 #include <string>
 #include "deep_image.h"
+#include "deep_compositor.h"
 #include "deep_reader.h"
+#include "deep_loader.h"
+#include "deep_pager.h"
+#include "deep_stream.h"
 #include "deep_writer.h"
 #include "../test_helpers.h"
 
@@ -17,29 +24,8 @@ namespace fs = std::filesystem;
 
 class IORoundtripTest : public ::testing::Test {
 protected:
-    void SetUp() override {
-        // Use std::filesystem to get a reliable, writable temp directory.
-        // Create a per-test subdirectory so parallel or repeated runs don't collide.
-        auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
-        std::string dirName = std::string(info->name());
-        for (auto& c : dirName) {
-            if (!std::isalnum(static_cast<unsigned char>(c))) c = '_';
-        }
-        testDir_ = fs::temp_directory_path() / "dc_tests" / dirName;
-        fs::create_directories(testDir_);
-        tempDir_ = testDir_.string();
-        if (tempDir_.back() != '/' && tempDir_.back() != '\\') {
-            tempDir_ += '/';
-        }
-    }
-
-    void TearDown() override {
-        std::error_code ec;
-        fs::remove_all(testDir_, ec);  // best-effort cleanup; ignore errors
-    }
-
     std::string tempPath(const std::string& name) {
-        return tempDir_ + name;
+        return temp_.path(name);
     }
 
     // Write a known deep image and load it back
@@ -48,8 +34,7 @@ protected:
         return loadDeepEXR(filename);
     }
 
-    fs::path testDir_;
-    std::string tempDir_;
+    TestTempDir temp_;
 };
 
 // ============================================================================
@@ -119,6 +104,44 @@ TEST_F(IORoundtripTest, WriteAndReadPreservesDepthSortOrder) {
     EXPECT_TRUE(loaded.isValid());
 }
 
+TEST_F(IORoundtripTest, WriteAndReadPreservesExtraChannels) {
+    // A float AOV and a UINT ID, on samples written out of depth order
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("N.x", false), ExtraChannel::fromFile("object", true)};
+    DeepImage img(2, 1);
+    img.setChannels(channels);
+    img.pixel(1, 0).samples() = {makePoint(2.0f, 0.1f, 0.1f, 0.1f, 0.5f),
+                                 makePoint(1.0f, 0.2f, 0.2f, 0.2f, 0.5f)};
+    uint32_t ids[2] = {42u, 0xdeadbeefu};
+    float idBits[2];
+    std::memcpy(idBits, ids, sizeof(ids));
+    img.extraColumns(1, 0) = {0.25f, -0.5f, idBits[0], idBits[1]};
+
+    DeepImage loaded = roundtrip(img, tempPath("extra_channels.exr"));
+    ASSERT_EQ(loaded.channels(), channels);
+    ASSERT_EQ(loaded.pixel(1, 0).sampleCount(), 2u);
+    EXPECT_EQ(loaded.pixel(1, 0)[0].depth, 1.0f);
+    const std::vector<float>& columns = loaded.extraColumns(1, 0);
+    ASSERT_EQ(columns.size(), 4u);
+    EXPECT_EQ(columns[0], -0.5f);  // Sorted along with its sample
+    EXPECT_EQ(columns[1], 0.25f);
+    uint32_t loadedIds[2];
+    std::memcpy(loadedIds, &columns[2], sizeof(loadedIds));
+    EXPECT_EQ(loadedIds[0], 0xdeadbeefu);
+    EXPECT_EQ(loadedIds[1], 42u);
+
+    setLoadExtraChannels(false);
+    DeepImage beautyOnly = loadDeepEXR(tempPath("extra_channels.exr"));
+    setLoadExtraChannels(true);
+    EXPECT_FALSE(beautyOnly.hasExtraChannels());
+    EXPECT_EQ(beautyOnly.pixel(1, 0).sampleCount(), 2u);
+
+    std::vector<float> extras;
+    flattenExtraChannels(loaded, loaded.dataWindow(), extras);
+    EXPECT_NO_THROW(writeFlatEXR(flattenImage(loaded), extras, loaded.channels(), loaded.dataWindow(),
+                                 loaded.displayWindow(), tempPath("extra_channels_flat.exr")));
+}
+
 // ============================================================================
 // Error handling tests
 // ============================================================================
@@ -180,3 +203,296 @@ TEST_F(IORoundtripTest, FlattenAndWriteRoundtripFileExists) {
     std::ifstream f(path);
     EXPECT_TRUE(f.good());
 }
+
+// ============================================================================
+// Tiled and region read tests
+// ============================================================================
+
+TEST_F(IORoundtripTest, TiledWriteAndReadPreservesSamples) {
+    DeepImage img(9, 7);
+    img.pixel(0, 0).addSample(makePoint(1.0f, 0.25f, 0.5f, 0.75f, 0.6f));
+    img.pixel(8, 6).addSample(makeVolume(2.0f, 5.0f, 0.1f, 0.2f, 0.3f, 0.4f));
+    img.pixel(4, 3).addSample(makePoint(3.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    img.pixel(4, 3).addSample(makePoint(4.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+
+    DeepWriteOptions tiled;
+    tiled.tiled = true;
+    tiled.tileWidth = 4;
+    tiled.tileHeight = 4;
+    std::string path = tempPath("tiled.exr");
+    writeDeepEXR(img, path, tiled);
+
+    DeepImage loaded = loadDeepEXR(path);
+    EXPECT_EQ(loaded.width(), 9);
+    EXPECT_EQ(loaded.height(), 7);
+    EXPECT_EQ(loaded.totalSampleCount(), 4u);
+    ASSERT_EQ(loaded.pixel(8, 6).sampleCount(), 1u);
+    EXPECT_NEAR(loaded.pixel(8, 6)[0].depth_back, 5.0f, 1e-6f);
+    EXPECT_EQ(loaded.pixel(4, 3).sampleCount(), 2u);
+}
+
+TEST_F(IORoundtripTest, BandedWriteUnderBudgetPreservesSamples) {
+    // A tiny pager budget makes the writer stage one tile row or scanline
+    // at a time; every band must land in the right place
+    DeepImage img(PixelBox(3, 5, 12, 24));
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("aov", false)};
+    img.setChannels(channels);
+    for (int y = 0; y < img.height(); ++y) {
+        for (int x = 0; x < img.width(); x += 3) {
+            img.pixel(x, y).addSample(makeVolume(1.0f + y, 2.0f + y, 0.1f, 0.2f, 0.3f, 0.4f));
+            img.extraColumns(x, y) = {static_cast<float>(x + 100 * y)};
+        }
+    }
+
+    auto pager = std::make_shared<TilePager>(1);
+    setOutOfCorePager(pager);
+    DeepWriteOptions tiled;
+    tiled.tiled = true;
+    tiled.tileWidth = 4;
+    tiled.tileHeight = 4;
+    std::string scanPath = tempPath("banded_scan.exr");
+    std::string tiledPath = tempPath("banded_tiled.exr");
+    writeDeepEXR(img, scanPath);
+    writeDeepEXR(img, tiledPath, tiled);
+    setOutOfCorePager(nullptr);
+
+    for (const std::string& path : {scanPath, tiledPath}) {
+        DeepImage loaded = loadDeepEXR(path);
+        ASSERT_EQ(loaded.dataWindow(), img.dataWindow()) << path;
+        for (int y = 0; y < img.height(); ++y) {
+            for (int x = 0; x < img.width(); ++x) {
+                ASSERT_EQ(loaded.pixel(x, y).sampleCount(), img.pixel(x, y).sampleCount()) << path;
+                if (!img.pixel(x, y).isEmpty()) {
+                    EXPECT_EQ(loaded.pixel(x, y)[0].depth, img.pixel(x, y)[0].depth);
+                    EXPECT_EQ(loaded.extraColumns(x, y), img.extraColumns(x, y));
+                }
+            }
+        }
+    }
+}
+
+TEST_F(IORoundtripTest, RegionReadFromScanLineFileReturnsOnlyRegion) {
+    DeepImage img(8, 8);
+    img.pixel(1, 1).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    img.pixel(5, 6).addSample(makePoint(2.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    std::string path = tempPath("region_scanline.exr");
+    writeDeepEXR(img, path);
+
+    DeepImage region = loadDeepEXR(path, PixelBox(4, 4, 7, 7));
+    EXPECT_EQ(region.dataWindow(), PixelBox(4, 4, 7, 7));
+    EXPECT_EQ(region.totalSampleCount(), 1u);
+    EXPECT_EQ(region.pixel(1, 2).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, RegionReadFromTiledFileReturnsOnlyRegion) {
+    DeepImage img(16, 16);
+    img.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    img.pixel(10, 9).addSample(makePoint(2.0f, 0.25f, 0.5f, 0.5f, 0.8f));
+
+    DeepWriteOptions tiled;
+    tiled.tiled = true;
+    tiled.tileWidth = 8;
+    tiled.tileHeight = 8;
+    std::string path = tempPath("region_tiled.exr");
+    writeDeepEXR(img, path, tiled);
+
+    DeepImage region = loadDeepEXR(path, PixelBox(9, 9, 12, 10));
+    EXPECT_EQ(region.dataWindow(), PixelBox(9, 9, 12, 10));
+    EXPECT_EQ(region.totalSampleCount(), 1u);
+    ASSERT_EQ(region.pixel(1, 0).sampleCount(), 1u);
+    EXPECT_NEAR(region.pixel(1, 0)[0].red, 0.25f, 1e-6f);
+}
+
+TEST_F(IORoundtripTest, RegionIsClippedToDataWindow) {
+    DeepImage img(4, 4);
+    img.pixel(3, 3).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    std::string path = tempPath("region_clip.exr");
+    writeDeepEXR(img, path);
+
+    DeepImage region = loadDeepEXR(path, PixelBox(2, 2, 100, 100));
+    EXPECT_EQ(region.dataWindow(), PixelBox(2, 2, 3, 3));
+    EXPECT_EQ(region.pixel(1, 1).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, RegionOutsideDataWindowIsEmpty) {
+    DeepImage img(4, 4);
+    std::string path = tempPath("region_outside.exr");
+    writeDeepEXR(img, path);
+    DeepImage outside = loadDeepEXR(path, PixelBox(10, 10, 12, 12));
+    EXPECT_TRUE(outside.dataWindow().isEmpty());
+    EXPECT_EQ(outside.displayWindow(), PixelBox(0, 0, 3, 3));
+}
+
+TEST_F(IORoundtripTest, RoiMissingACroppedLayerStillComposites) {
+    // A bbox-cropped element far from the ROI loads empty and merges as nothing
+    DeepImage plate(16, 16);
+    plate.pixel(5, 5).addSample(makePoint(2.0f, 0.2f, 0.2f, 0.2f, 0.5f));
+    DeepImage element(PixelBox(12, 12, 15, 15));
+    element.setDisplayWindow(PixelBox(0, 0, 15, 15));
+    element.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.0f, 0.0f, 1.0f));
+    std::string platePath = tempPath("plate.exr");
+    std::string elementPath = tempPath("element.exr");
+    writeDeepEXR(plate, platePath);
+    writeDeepEXR(element, elementPath);
+
+    LoaderOptions options;
+    options.roi = PixelBox(2, 2, 8, 8);
+    std::vector<LoadResult> loaded = loadDeepEXRFiles({platePath, elementPath}, options);
+    ASSERT_EQ(loaded.size(), 2u);
+    ASSERT_TRUE(loaded[0].success) << loaded[0].error;
+    ASSERT_TRUE(loaded[1].success) << loaded[1].error;
+    EXPECT_TRUE(loaded[1].image.dataWindow().isEmpty());
+
+    CompositorOptions compOpts;
+    compOpts.roi = options.roi;
+    DeepImage merged = deepMerge(std::vector<const DeepImage*>{&loaded[0].image, &loaded[1].image},
+                                 compOpts);
+    EXPECT_EQ(merged.dataWindow(), options.roi);
+    EXPECT_EQ(merged.totalSampleCount(), 1u);
+    EXPECT_EQ(merged.pixel(3, 3).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, WritePreservesDataWindowOrigin) {
+    DeepImage img(PixelBox(10, 20, 13, 22));
+    img.pixel(0, 0).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    std::string path = tempPath("origin.exr");
+    DeepImage loaded = roundtrip(img, path);
+    EXPECT_EQ(loaded.dataWindow(), PixelBox(10, 20, 13, 22));
+    EXPECT_EQ(loaded.pixel(0, 0).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, RoiLoadMergeWriteKeepsRegionDataWindow) {
+    DeepImage img(16, 16);
+    img.pixel(6, 7).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.8f));
+    std::string inPath = tempPath("roi_in.exr");
+    writeDeepEXR(img, inPath);
+
+    PixelBox roi(4, 4, 9, 11);
+    DeepImage cropped = loadDeepEXR(inPath, roi);
+    EXPECT_EQ(cropped.displayWindow(), PixelBox(0, 0, 15, 15));
+
+    std::string outPath = tempPath("roi_out.exr");
+    DeepImage loaded = roundtrip(cropped, outPath);
+    EXPECT_EQ(loaded.dataWindow(), roi);
+    EXPECT_EQ(loaded.displayWindow(), PixelBox(0, 0, 15, 15));
+    EXPECT_EQ(loaded.pixel(2, 3).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, StockAndMappedStreamsLoadTheSameSamples) {
+    DeepImage img(3, 3);
+    img.pixel(2, 1).addSample(makeVolume(1.0f, 2.0f, 0.25f, 0.5f, 0.75f, 0.6f));
+    std::string path = tempPath("streams.exr");
+    writeDeepEXR(img, path);
+
+    setMemoryMappedInput(false);
+    DeepImage stock = loadDeepEXR(path);
+    setMemoryMappedInput(true);
+    DeepImage mapped = loadDeepEXR(path);
+
+    ASSERT_EQ(stock.pixel(2, 1).sampleCount(), 1u);
+    ASSERT_EQ(mapped.pixel(2, 1).sampleCount(), 1u);
+    EXPECT_FLOAT_EQ(stock.pixel(2, 1)[0].depth_back, mapped.pixel(2, 1)[0].depth_back);
+    EXPECT_FLOAT_EQ(stock.pixel(2, 1)[0].red, mapped.pixel(2, 1)[0].red);
+}
+
+// ============================================================================
+// In-memory stream tests
+// ============================================================================
+
+TEST_F(IORoundtripTest, InMemoryRoundtripPreservesSamplesAndWindow) {
+    DeepImage img(PixelBox(3, 4, 6, 8));
+    img.pixel(1, 2).addSample(makeVolume(1.0f, 2.5f, 0.25f, 0.5f, 0.75f, 0.6f));
+    img.pixel(3, 4).addSample(makePoint(4.0f, 0.1f, 0.2f, 0.3f, 0.4f));
+
+    MemoryOStream out;
+    writeDeepEXR(img, out);
+    ASSERT_FALSE(out.buffer().empty());
+
+    MemoryIStream in(out.release());
+    DeepImage loaded = loadDeepEXR(in);
+    EXPECT_EQ(loaded.dataWindow(), img.dataWindow());
+    EXPECT_EQ(loaded.totalSampleCount(), 2u);
+    ASSERT_EQ(loaded.pixel(1, 2).sampleCount(), 1u);
+    EXPECT_NEAR(loaded.pixel(1, 2)[0].depth_back, 2.5f, 1e-6f);
+}
+
+TEST_F(IORoundtripTest, InMemoryTiledRegionRead) {
+    DeepImage img(16, 16);
+    img.pixel(12, 12).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    DeepWriteOptions tiled;
+    tiled.tiled = true;
+    tiled.tileWidth = 8;
+    tiled.tileHeight = 8;
+
+    MemoryOStream out;
+    writeDeepEXR(img, out, tiled);
+    MemoryIStream in(out.release());
+    DeepImage region = loadDeepEXR(in, PixelBox(8, 8, 15, 15));
+    EXPECT_EQ(region.totalSampleCount(), 1u);
+    EXPECT_EQ(region.pixel(4, 4).sampleCount(), 1u);
+}
+
+TEST_F(IORoundtripTest, InMemoryBytesMatchFileBytes) {
+    DeepImage img(4, 4);
+    img.pixel(2, 2).addSample(makePoint(1.0f, 0.5f, 0.5f, 0.5f, 0.5f));
+    std::string path = tempPath("memory_vs_file.exr");
+    writeDeepEXR(img, path);
+
+    MemoryOStream out;
+    writeDeepEXR(img, out);
+
+    std::ifstream f(path, std::ios::binary);
+    std::vector<char> fileBytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(fileBytes, out.buffer());
+}
+
+TEST_F(IORoundtripTest, GarbageStreamThrowsDeepReaderException) {
+    MemoryIStream in(std::vector<char>(64, 'x'));
+    EXPECT_THROW(loadDeepEXR(in), DeepReaderException);
+}
+
+// ============================================================================
+// Concurrent loader tests
+// ============================================================================
+
+TEST_F(IORoundtripTest, LoadFilesConcurrentlyPreservesInputOrder) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < 6; ++i) {
+        DeepImage img(2, 2);
+        img.pixel(0, 0).addSample(makePoint(static_cast<float>(i + 1), 0.5f, 0.5f, 0.5f, 0.5f));
+        paths.push_back(tempPath("concurrent_" + std::to_string(i) + ".exr"));
+        writeDeepEXR(img, paths.back());
+    }
+
+    LoaderOptions opts;
+    opts.maxConcurrent = 3;
+    std::vector<LoadResult> results = loadDeepEXRFiles(paths, opts);
+
+    ASSERT_EQ(results.size(), paths.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        ASSERT_TRUE(results[i].success) << results[i].error;
+        EXPECT_EQ(results[i].filename, paths[i]);
+        EXPECT_GE(results[i].loadTimeMs, 0.0);
+        ASSERT_EQ(results[i].image.pixel(0, 0).sampleCount(), 1u);
+        EXPECT_FLOAT_EQ(results[i].image.pixel(0, 0)[0].depth, static_cast<float>(i + 1));
+    }
+}
+
+TEST_F(IORoundtripTest, LoadFilesReportsFailuresPerFile) {
+    DeepImage img(1, 1);
+    std::string good = tempPath("good.exr");
+    writeDeepEXR(img, good);
+
+    std::string flat = tempPath("flat_only.exr");
+    writeFlatEXR(img, flat);
+
+    std::vector<std::string> paths = {good, tempPath("missing.exr"), flat};
+    std::vector<LoadResult> results = loadDeepEXRFiles(paths);
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_TRUE(results[0].success);
+    EXPECT_FALSE(results[1].success);
+    EXPECT_FALSE(results[1].error.empty());
+    EXPECT_FALSE(results[2].success);
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "deep_cache.h"
+#include "deep_compositor.h"
+#include "deep_sequence.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+namespace fs = std::filesystem;
+
+// ============================================================================
+// compositeSequence tests (inputs written as deep caches)
+// ============================================================================
+
+class SequenceTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = temp_.dir();
+
+        // Static backdrop plus an element that moves one pixel per frame
+        writeDeepCache(makeBackdrop(8, 8), (dir_ / "bg.dcache").string());
+        for (int frame = 1; frame <= 4; ++frame) {
+            writeDeepCache(makeElement(8, 8, frame, frame),
+                           expandFramePattern((dir_ / "fx.%04d.dcache").string(), frame));
+        }
+    }
+
+    std::vector<std::string> patterns() const {
+        return {(dir_ / "bg.dcache").string(), (dir_ / "fx.####.dcache").string()};
+    }
+
+    TestTempDir temp_;
+    fs::path dir_;
+};
+
+TEST_F(SequenceTest, WritesEveryFrameInOrder) {
+    std::vector<int> written;
+    std::vector<size_t> samples;
+    SequenceSummary summary = compositeSequence(patterns(), {1, 2, 3, 4}, SequenceOptions(),
+        [&](FrameResult& result) {
+            written.push_back(result.frame);
+            samples.push_back(result.merged.pixel(result.frame, result.frame).sampleCount());
+            EXPECT_EQ(result.flat.size(), 8u * 8u * 4u);
+        });
+
+    EXPECT_EQ(summary.framesWritten, 4u);
+    EXPECT_EQ(summary.framesFailed, 0u);
+    EXPECT_EQ(written, (std::vector<int>{1, 2, 3, 4}));
+    for (size_t count : samples) {
+        EXPECT_EQ(count, 2u);
+    }
+}
+
+TEST_F(SequenceTest, AtMostThreeFramesAreInFlight) {
+    // A slow writer lets the load and merge stages run as far ahead as they can
+    SequenceSummary summary = compositeSequence(patterns(), {1, 2, 3, 4}, SequenceOptions(),
+        [&](FrameResult&) { std::this_thread::sleep_for(std::chrono::milliseconds(50)); });
+
+    EXPECT_EQ(summary.framesWritten, 4u);
+    EXPECT_EQ(summary.peakFramesInFlight, 3u);
+}
+
+TEST_F(SequenceTest, MatchesSingleFrameMerge) {
+    compositeSequence(patterns(), {3}, SequenceOptions(), [&](FrameResult& result) {
+        DeepImage bg = loadDeepCache((dir_ / "bg.dcache").string());
+        DeepImage fx = loadDeepCache((dir_ / "fx.0003.dcache").string());
+        DeepImage expected = deepMerge(std::vector<const DeepImage*>{&bg, &fx});
+        EXPECT_EQ(result.merged.totalSampleCount(), expected.totalSampleCount());
+        EXPECT_EQ(result.flat, flattenImage(expected));
+    });
+}
+
+TEST_F(SequenceTest, MissingFrameFailsWithoutStoppingTheRange) {
+    fs::remove(dir_ / "fx.0002.dcache");
+
+    std::vector<int> written;
+    SequenceSummary summary = compositeSequence(patterns(), {1, 2, 3}, SequenceOptions(),
+        [&](FrameResult& result) { written.push_back(result.frame); });
+
+    EXPECT_EQ(summary.framesWritten, 2u);
+    EXPECT_EQ(summary.framesFailed, 1u);
+    EXPECT_EQ(written, (std::vector<int>{1, 3}));
+}
+
+TEST_F(SequenceTest, WriterExceptionMarksFrameFailed) {
+    SequenceSummary summary = compositeSequence(patterns(), {1, 2}, SequenceOptions(),
+        [&](FrameResult& result) {
+            if (result.frame == 1) {
+                throw std::runtime_error("disk full");
+            }
+        });
+
+    EXPECT_EQ(summary.framesWritten, 1u);
+    EXPECT_EQ(summary.framesFailed, 1u);
+}
+
+TEST_F(SequenceTest, StaticInputIsDecodedOnce) {
+    std::vector<size_t> reused;
+    compositeSequence(patterns(), {1, 2, 3, 4}, SequenceOptions(),
+        [&](FrameResult& result) { reused.push_back(result.reusedInputs); });
+
+    // bg.dcache is the same file every frame; fx changes
+    EXPECT_EQ(reused, (std::vector<size_t>{0, 1, 1, 1}));
+}
+
+TEST_F(SequenceTest, InputReuseCanBeDisabled) {
+    SequenceOptions options;
+    options.reuseInputs = false;
+    std::vector<size_t> reused;
+    compositeSequence(patterns(), {1, 2}, options,
+        [&](FrameResult& result) { reused.push_back(result.reusedInputs); });
+
+    EXPECT_EQ(reused, (std::vector<size_t>{0, 0}));
+}
+
+TEST_F(SequenceTest, HeldFrameCopiesAreReusedByContent) {
+    // Frame 3 is a byte-identical copy of frame 2 (a held frame)
+    fs::copy_file(dir_ / "fx.0002.dcache", dir_ / "fx.0003.dcache",
+                  fs::copy_options::overwrite_existing);
+
+    SequenceOptions options;
+    options.hashInputs = true;
+    std::vector<size_t> reused;
+    compositeSequence(patterns(), {2, 3}, options,
+        [&](FrameResult& result) { reused.push_back(result.reusedInputs); });
+
+    EXPECT_EQ(reused, (std::vector<size_t>{0, 2}));
+}
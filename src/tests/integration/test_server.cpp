@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "deep_cache.h"
+#include "deep_compositor.h"
+#include "deep_server.h"
+#include "deep_stream.h"
+#include "deep_writer.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+namespace fs = std::filesystem;
+
+// ============================================================================
+// CompositeServer / CompositeClient tests (inputs written as deep caches)
+// ============================================================================
+
+class CompositeServerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        bg = makeBackdrop(8, 8);
+        fx = makeElement(8, 8, 2, 3);
+        writeDeepCache(bg, path("bg.dcache"));
+        writeDeepCache(fx, path("fx.dcache"));
+
+        ServerOptions options;
+        options.socketPath = path("server.sock");
+        server_.reset(new CompositeServer(options));
+        server_->listen();
+        thread_ = std::thread([this]() { server_->run(); });
+    }
+
+    void TearDown() override {
+        server_->stop();
+        thread_.join();
+        server_.reset();
+    }
+
+    std::string path(const std::string& name) const { return temp_.path(name); }
+
+    std::vector<const DeepImage*> inputs() const { return {&bg, &fx}; }
+
+    CompositeRequest request() const {
+        CompositeRequest req;
+        req.inputs = {path("bg.dcache"), path("fx.dcache")};
+        return req;
+    }
+
+    TestTempDir temp_;
+    DeepImage bg, fx;
+    std::unique_ptr<CompositeServer> server_;
+    std::thread thread_;
+};
+
+TEST_F(CompositeServerTest, RepeatedRequestUsesCachedInputs) {
+    CompositeClient client(path("server.sock"));
+
+    CompositeReply first = client.composite(request());
+    ASSERT_TRUE(first.success) << first.error;
+    EXPECT_EQ(first.cachedInputs, 0u);
+    EXPECT_EQ(first.outputSamples, deepMerge(inputs()).totalSampleCount());
+
+    CompositeReply second = client.composite(request());
+    ASSERT_TRUE(second.success) << second.error;
+    EXPECT_EQ(second.cachedInputs, 2u);
+    EXPECT_EQ(server_->cache().hits(), 2u);
+}
+
+TEST_F(CompositeServerTest, RequestsForOtherRegionsShareCachedInputs) {
+    CompositeClient client(path("server.sock"));
+    CompositeRequest req = request();
+    req.roi = PixelBox(0, 0, 3, 3);
+    ASSERT_TRUE(client.composite(req).success);
+
+    req.roi = PixelBox(2, 2, 7, 7);
+    CompositeReply reply = client.composite(req);
+    ASSERT_TRUE(reply.success) << reply.error;
+    EXPECT_EQ(reply.cachedInputs, 2u);
+    EXPECT_EQ(server_->cache().entryCount(), 2u);
+
+    CompositorOptions opts;
+    opts.roi = req.roi;
+    EXPECT_EQ(reply.outputSamples, deepMerge(inputs(), opts).totalSampleCount());
+}
+
+TEST_F(CompositeServerTest, ReturnsEncodedOutputs) {
+    CompositeRequest req = request();
+    req.deepOutput = true;
+    req.roi = PixelBox(0, 0, 3, 3);
+    CompositeReply reply = CompositeClient(path("server.sock")).composite(req);
+    ASSERT_TRUE(reply.success) << reply.error;
+
+    // Same bytes as encoding the local composite
+    CompositorOptions opts;
+    opts.roi = req.roi;
+    DeepImage expected = deepMerge(inputs(), opts);
+    MemoryOStream deep, flat;
+    writeDeepEXR(expected, deep);
+    writeFlatEXR(flattenImage(expected, expected.dataWindow()),
+                 expected.dataWindow(), expected.displayWindow(), flat);
+    EXPECT_EQ(reply.deepExr, deep.buffer());
+    EXPECT_EQ(reply.flatExr, flat.buffer());
+}
+
+TEST_F(CompositeServerTest, MissingInputIsReported) {
+    CompositeRequest req = request();
+    req.inputs.push_back(path("missing.dcache"));
+    CompositeReply reply = CompositeClient(path("server.sock")).composite(req);
+    EXPECT_FALSE(reply.success);
+    EXPECT_NE(reply.error.find("missing.dcache"), std::string::npos);
+}
+
+TEST_F(CompositeServerTest, StatsAndShutdown) {
+    CompositeClient client(path("server.sock"));
+    client.composite(request());
+    EXPECT_NE(client.stats().find("requests: 1"), std::string::npos);
+
+    client.shutdownServer();
+    thread_.join();
+    thread_ = std::thread([]() {});
+    EXPECT_FALSE(fs::exists(path("server.sock")));
+    EXPECT_THROW(client.stats(), CompositeServerException);
+}
+
+TEST_F(CompositeServerTest, SecondServerOnSameSocketFails) {
+    ServerOptions options;
+    options.socketPath = path("server.sock");
+    CompositeServer other(options);
+    EXPECT_THROW(other.listen(), CompositeServerException);
+}
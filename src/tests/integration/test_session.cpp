@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "deep_image.h"
+#include "deep_compositor.h"
+#include "deep_session.h"
+#include "deep_writer.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+// ============================================================================
+// CompositeSession tests
+// ============================================================================
+
+class CompositeSessionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = temp_.path("session");
+
+        bg = makeBackdrop(32, 32);
+        fx = makeElement(32, 32, 3, 3);
+        fx.pixel(20, 20).addSample(makeVolume(4.0f, 12.0f, 0.0f, 0.5f, 0.0f, 0.5f));
+    }
+
+    std::vector<const DeepImage*> inputs() { return {&bg, &fx}; }
+
+    TestTempDir temp_;
+    std::string dir_;
+    DeepImage bg, fx;
+};
+
+TEST_F(CompositeSessionTest, FirstRunIsFullRebuild) {
+    CompositeSession session(dir_, 8);
+    EXPECT_FALSE(session.load());
+    session.update(inputs());
+
+    EXPECT_EQ(session.tileCount(), 16u);
+    EXPECT_EQ(session.dirtyTileCount(), 16u);
+    EXPECT_EQ(session.flat(), flattenImage(deepMerge(inputs())));
+}
+
+TEST_F(CompositeSessionTest, UnchangedInputsRecomputeNothing) {
+    {
+        CompositeSession session(dir_, 8);
+        session.update(inputs());
+        session.save();
+    }
+
+    CompositeSession session(dir_, 8);
+    ASSERT_TRUE(session.load());
+    EXPECT_TRUE(session.merged().isCacheBacked());
+    session.update(inputs());
+    EXPECT_EQ(session.dirtyTileCount(), 0u);
+    EXPECT_EQ(session.flat(), flattenImage(deepMerge(inputs())));
+}
+
+TEST_F(CompositeSessionTest, ChangedPixelRecomputesOnlyItsTile) {
+    {
+        CompositeSession session(dir_, 8);
+        session.update(inputs());
+        session.save();
+    }
+
+    fx.pixel(20, 20).clear();
+    fx.pixel(21, 21).addSample(makePoint(1.0f, 0.2f, 0.2f, 0.2f, 0.8f));
+
+    CompositeSession session(dir_, 8);
+    ASSERT_TRUE(session.load());
+    CompositorStats stats;
+    session.update(inputs(), CompositorOptions(), &stats);
+
+    EXPECT_EQ(session.dirtyTileCount(), 1u);
+    EXPECT_EQ(stats.remergedPixels, 64u);
+
+    // The depth range covers the whole result, not just the recomputed tile
+    CompositorStats full;
+    DeepImage expected = deepMerge(inputs(), CompositorOptions(), &full);
+    EXPECT_EQ(stats.minDepth, full.minDepth);
+    EXPECT_EQ(stats.maxDepth, full.maxDepth);
+    EXPECT_EQ(session.flat(), flattenImage(expected));
+    EXPECT_EQ(session.merged().pixel(20, 20).sampleCount(), expected.pixel(20, 20).sampleCount());
+    EXPECT_EQ(session.merged().pixel(21, 21).sampleCount(), expected.pixel(21, 21).sampleCount());
+
+    // The update is persisted for the next run
+    session.save();
+    CompositeSession next(dir_, 8);
+    ASSERT_TRUE(next.load());
+    next.update(inputs());
+    EXPECT_EQ(next.dirtyTileCount(), 0u);
+}
+
+TEST_F(CompositeSessionTest, OptionChangeForcesRebuild) {
+    {
+        CompositeSession session(dir_, 8);
+        session.update(inputs());
+        session.save();
+    }
+
+    CompositeSession session(dir_, 8);
+    ASSERT_TRUE(session.load());
+    CompositorOptions opts;
+    opts.mergeThreshold = 0.5f;
+    session.update(inputs(), opts);
+    EXPECT_EQ(session.dirtyTileCount(), session.tileCount());
+}
+
+TEST_F(CompositeSessionTest, DifferentTileSizeIgnoresState) {
+    {
+        CompositeSession session(dir_, 8);
+        session.update(inputs());
+        session.save();
+    }
+
+    CompositeSession session(dir_, 16);
+    EXPECT_FALSE(session.load());
+}
+
+TEST_F(CompositeSessionTest, CorruptTileCountIgnoresState) {
+    const std::streamoff kTileCount = 36;  // After magic, tile size, options hash and window
+    for (uint64_t tileCount : {uint64_t(17), uint64_t(1) << 60}) {
+        {
+            CompositeSession session(dir_, 8);
+            session.update(inputs());
+            session.save();
+        }
+        {
+            std::fstream state(dir_ + "/session.state", std::ios::binary | std::ios::in | std::ios::out);
+            state.seekp(kTileCount);
+            state.write(reinterpret_cast<const char*>(&tileCount), sizeof(tileCount));
+        }
+
+        CompositeSession session(dir_, 8);
+        EXPECT_FALSE(session.load()) << "tile count " << tileCount;
+        session.update(inputs());
+        EXPECT_EQ(session.dirtyTileCount(), 16u);
+    }
+}
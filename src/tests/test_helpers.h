@@ -1,5 +1,10 @@
 #pragma once
 
+#include <gtest/gtest.h>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <string>
 #include "deep_image.h"
 
 namespace deep_compositor {
@@ -24,4 +29,65 @@ inline DeepImage makeVolumeImage1x1(float zFront, float zBack, float r, float g,
     return img;
 }
 
+// Opaque blue backdrop at depth 10 over every pixel
+inline DeepImage makeBackdrop(int width, int height) {
+    DeepImage img(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            img.pixel(x, y).addSample(makePoint(10.0f, 0.0f, 0.0f, 0.5f, 1.0f));
+        }
+    }
+    return img;
+}
+
+// Half-transparent red point at depth 2 on pixel (x, y), nothing elsewhere
+inline DeepImage makeElement(int width, int height, int x, int y) {
+    DeepImage img(width, height);
+    img.pixel(x, y).addSample(makePoint(2.0f, 0.5f, 0.0f, 0.0f, 0.5f));
+    return img;
+}
+
+/**
+ * Scratch directory of the running test, <temp>/dc_tests/<Suite>_<Test>,
+ * created empty and removed on destruction. ctest runs every test as its
+ * own process, so tests must not share paths.
+ */
+class TestTempDir {
+public:
+    TestTempDir() {
+        const auto* info = ::testing::UnitTest::GetInstance()->current_test_info();
+        std::string name = std::string(info->test_suite_name()) + "_" + info->name();
+        for (auto& c : name) {
+            if (!std::isalnum(static_cast<unsigned char>(c))) c = '_';
+        }
+        dir_ = std::filesystem::temp_directory_path() / "dc_tests" / name;
+        std::error_code ec;
+        std::filesystem::remove_all(dir_, ec);
+        std::filesystem::create_directories(dir_);
+    }
+
+    ~TestTempDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(dir_, ec);  // best-effort cleanup
+    }
+
+    TestTempDir(const TestTempDir&) = delete;
+    TestTempDir& operator=(const TestTempDir&) = delete;
+
+    const std::filesystem::path& dir() const { return dir_; }
+
+    std::string path(const std::string& name) const { return (dir_ / name).string(); }
+
+    std::string writeFile(const std::string& name, const std::string& contents) const {
+        std::string file = path(name);
+        std::filesystem::create_directories(std::filesystem::path(file).parent_path());
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out << contents;
+        return file;
+    }
+
+private:
+    std::filesystem::path dir_;
+};
+
 } // namespace deep_compositor
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "deep_cache.h"
+#include "deep_reader.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+namespace fs = std::filesystem;
+
+class DeepCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path_ = temp_.path("plate.dcache");
+    }
+
+    /**
+     * 200x130 image at origin (10, 20) spanning several materialisation bands
+     */
+    DeepImage makePlate() {
+        DeepImage img(PixelBox(10, 20, 209, 149));
+        img.setDisplayWindow(PixelBox(0, 0, 255, 255));
+        for (int y = 0; y < img.height(); y += 7) {
+            for (int x = 0; x < img.width(); x += 3) {
+                img.pixel(x, y).addSample(makePoint(1.0f + x, 0.1f, 0.2f, 0.3f, 0.5f));
+                if ((x + y) % 2 == 0) {
+                    img.pixel(x, y).addSample(makeVolume(0.5f, 0.75f, 0.4f, 0.3f, 0.2f, 0.25f));
+                }
+            }
+        }
+        return img;
+    }
+
+    void expectSameSamples(const DeepImage& a, const DeepImage& b) {
+        ASSERT_EQ(a.dataWindow(), b.dataWindow());
+        for (int y = 0; y < a.height(); ++y) {
+            for (int x = 0; x < a.width(); ++x) {
+                ASSERT_EQ(a.pixel(x, y).sampleCount(), b.pixel(x, y).sampleCount());
+                for (size_t i = 0; i < a.pixel(x, y).sampleCount(); ++i) {
+                    ASSERT_EQ(a.pixel(x, y)[i].depth, b.pixel(x, y)[i].depth);
+                    ASSERT_EQ(a.pixel(x, y)[i].depth_back, b.pixel(x, y)[i].depth_back);
+                    ASSERT_EQ(a.pixel(x, y)[i].alpha, b.pixel(x, y)[i].alpha);
+                }
+            }
+        }
+    }
+
+    TestTempDir temp_;
+    std::string path_;
+};
+
+TEST_F(DeepCacheTest, RoundtripPreservesSamplesAndWindows) {
+    DeepImage img = makePlate();
+    writeDeepCache(img, path_);
+
+    EXPECT_TRUE(isDeepCache(path_));
+    DeepImage loaded = loadDeepCache(path_);
+    EXPECT_TRUE(loaded.isCacheBacked());
+    EXPECT_EQ(loaded.displayWindow(), PixelBox(0, 0, 255, 255));
+    expectSameSamples(img, loaded);
+}
+
+TEST_F(DeepCacheTest, SectionsArePageAligned) {
+    writeDeepCache(makePlate(), path_);
+
+    DeepCache cache(path_);
+    EXPECT_EQ(cache.dataWindow(), PixelBox(10, 20, 209, 149));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(cache.samples(0, 0)) % kDeepCachePageSize, 0u);
+}
+
+TEST_F(DeepCacheTest, UntouchedImageCountsSamplesFromOffsetTable) {
+    DeepImage img = makePlate();
+    writeDeepCache(img, path_);
+
+    DeepImage loaded = loadDeepCache(path_);
+    EXPECT_EQ(loaded.totalSampleCount(), img.totalSampleCount());
+    // Counting doesn't copy any rows out of the mapping
+    EXPECT_LT(loaded.estimatedMemoryUsage(), img.estimatedMemoryUsage() / 4);
+}
+
+TEST_F(DeepCacheTest, WritesThroughCacheBackedImage) {
+    writeDeepCache(makePlate(), path_);
+    DeepImage loaded = loadDeepCache(path_);
+
+    size_t before = loaded.totalSampleCount();
+    loaded.pixel(1, 1).addSample(makePoint(9.0f, 0.1f, 0.1f, 0.1f, 0.1f));
+    EXPECT_EQ(loaded.totalSampleCount(), before + 1);
+}
+
+TEST_F(DeepCacheTest, RegionLoadMapsSubWindow) {
+    DeepImage img = makePlate();
+    writeDeepCache(img, path_);
+
+    DeepImage region = loadDeepCache(path_, PixelBox(100, 90, 400, 100));
+    EXPECT_EQ(region.dataWindow(), PixelBox(100, 90, 209, 100));
+    for (int y = 0; y < region.height(); ++y) {
+        for (int x = 0; x < region.width(); ++x) {
+            EXPECT_EQ(region.pixel(x, y).sampleCount(),
+                      img.pixel(x + 90, y + 70).sampleCount());
+        }
+    }
+
+    // A region missing the plate gives an empty image, not an error
+    DeepImage outside = loadDeepCache(path_, PixelBox(500, 500, 600, 600));
+    EXPECT_TRUE(outside.dataWindow().isEmpty());
+    EXPECT_EQ(outside.displayWindow(), img.displayWindow());
+}
+
+TEST_F(DeepCacheTest, CopyIsIndependentOfCache) {
+    DeepImage img = makePlate();
+    writeDeepCache(img, path_);
+
+    DeepImage copy;
+    {
+        DeepImage loaded = loadDeepCache(path_);
+        copy = loaded;
+    }
+    EXPECT_FALSE(copy.isCacheBacked());
+    expectSameSamples(img, copy);
+}
+
+TEST_F(DeepCacheTest, ConcurrentReadersSeeSameData) {
+    DeepImage img = makePlate();
+    writeDeepCache(img, path_);
+    const DeepImage loaded = loadDeepCache(path_);
+
+    std::vector<size_t> totals(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < totals.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            for (int y = 0; y < loaded.height(); ++y) {
+                for (int x = 0; x < loaded.width(); ++x) {
+                    totals[t] += loaded.pixel(x, y).sampleCount();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t total : totals) {
+        EXPECT_EQ(total, img.totalSampleCount());
+    }
+}
+
+TEST_F(DeepCacheTest, RejectsNonCacheFiles) {
+    {
+        std::ofstream out(path_, std::ios::binary);
+        out << std::string(8192, 'x');
+    }
+    EXPECT_FALSE(isDeepCache(path_));
+    EXPECT_THROW(DeepCache cache(path_), DeepReaderException);
+    EXPECT_THROW(loadDeepCache("/nonexistent/plate.dcache"), DeepReaderException);
+}
+
+TEST_F(DeepCacheTest, RejectsTruncatedCache) {
+    writeDeepCache(makePlate(), path_);
+    fs::resize_file(path_, fs::file_size(path_) - kDeepCachePageSize);
+    EXPECT_THROW(DeepCache cache(path_), DeepReaderException);
+}
+
+TEST_F(DeepCacheTest, RejectsSectionOffsetsPastEndOfFile) {
+    // Page-aligned offsets near 2^64 that wrap if added to a size
+    const uint64_t huge = ~uint64_t(0) - kDeepCachePageSize + 1;
+    const std::streamoff kOffsetsStart = 72;  // CacheHeader::offsetsStart
+    const std::streamoff kSamplesStart = 80;  // CacheHeader::samplesStart
+    for (std::streamoff field : {kOffsetsStart, kSamplesStart}) {
+        writeDeepCache(makePlate(), path_);
+        {
+            std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(field);
+            file.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+        }
+        EXPECT_THROW(DeepCache cache(path_), DeepReaderException) << "field at " << field;
+    }
+}
@@ -0,0 +1,350 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <type_traits>
+#include <vector>
+#include "deep_channels.h"
+#include "deep_writer.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+using TwoAovLayout = ChannelLayout<true, 2>;
+
+// Pixels of points, with repeated depths so some samples blend
+std::vector<DeepPixel> randomPointPixels(size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<DeepPixel> pixels(count);
+    for (size_t p = 0; p < count; ++p) {
+        for (int s = 0; s < 5; ++s) {
+            float alpha = unit(rng);
+            float depth = 1.0f + static_cast<float>(static_cast<int>(unit(rng) * 4.0f));
+            pixels[p].addSample(makePoint(depth, unit(rng) * alpha, unit(rng) * alpha,
+                                          unit(rng) * alpha, alpha));
+        }
+    }
+    return pixels;
+}
+
+// The samples of `pixel` with two AOVs: a copy of red and a copy of alpha
+std::vector<LayoutSample<TwoAovLayout>> withAovs(const DeepPixel& pixel) {
+    std::vector<LayoutSample<TwoAovLayout>> samples;
+    for (const DeepSample& s : pixel.samples()) {
+        samples.push_back({{s.depth, s.depth_back, s.red, s.green, s.blue, s.alpha, s.red, s.alpha}});
+    }
+    return samples;
+}
+
+// Extra channels named `names`, IDs as a file would declare them
+ChannelSet extraChannels(const std::vector<std::string>& names, bool zBack = true) {
+    ChannelSet channels;
+    channels.zBack = zBack;
+    for (const std::string& name : names) {
+        channels.extras.push_back(ExtraChannel::fromFile(name, false));
+    }
+    return channels;
+}
+
+// A 1x1 image of `samples` (in order) with extra channel columns
+DeepImage imageWithExtras(const std::vector<DeepSample>& samples, const ChannelSet& channels,
+                          const std::vector<float>& columns) {
+    DeepImage img(1, 1);
+    img.setChannels(channels);
+    img.pixel(0, 0).samples() = samples;
+    img.extraColumns(0, 0) = columns;
+    return img;
+}
+
+float floatFromBits(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t bitsOf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+} // anonymous namespace
+
+TEST(ChannelLayoutTest, LayoutsPackTheirChannels) {
+    EXPECT_EQ(RGBALayout::kFloats, 5u);
+    EXPECT_EQ(RGBAZBackLayout::kFloats, 6u);
+    EXPECT_EQ(TwoAovLayout::kChannels, 6u);
+    EXPECT_EQ(TwoAovLayout::kAlpha, 5u);
+    EXPECT_EQ(sizeof(LayoutSample<TwoAovLayout>), 8 * sizeof(float));
+    EXPECT_TRUE((std::is_same_v<SampleFor<RGBAZBackLayout>, DeepSample>));
+
+    ChannelSet points;
+    points.zBack = false;
+    EXPECT_EQ(points.names(), (std::vector<std::string>{"R", "G", "B", "A", "Z"}));
+    EXPECT_EQ(ChannelSet().names().back(), "ZBack");
+    EXPECT_TRUE(points.unite(ChannelSet()).zBack);
+    EXPECT_FALSE(points.unite(points).zBack);
+}
+
+TEST(ChannelLayoutTest, PointMergeMatchesVolumetricMerge) {
+    ChannelSet points;
+    points.zBack = false;
+    PixelMergeFn pointMerge = pixelMergeFunction(points);
+    ASSERT_NE(pointMerge, pixelMergeFunction(ChannelSet()));
+
+    std::vector<DeepPixel> pixels = randomPointPixels(3, 7);
+    std::vector<const DeepPixel*> ptrs = {&pixels[0], &pixels[1], &pixels[2]};
+    VolumeMergeCounts pointCounts;
+    VolumeMergeCounts volumeCounts;
+    DeepPixel point = pointMerge(ptrs, 0.001f, &pointCounts);
+    DeepPixel volume = mergePixelsVolumetric(ptrs, 0.001f, &volumeCounts);
+
+    ASSERT_EQ(point.sampleCount(), volume.sampleCount());
+    EXPECT_LT(point.sampleCount(), 15u);
+    for (size_t i = 0; i < point.sampleCount(); ++i) {
+        EXPECT_EQ(point[i].depth, volume[i].depth);
+        EXPECT_EQ(point[i].depth_back, point[i].depth);
+        EXPECT_FLOAT_EQ(point[i].red, volume[i].red);
+        EXPECT_FLOAT_EQ(point[i].blue, volume[i].blue);
+        EXPECT_FLOAT_EQ(point[i].alpha, volume[i].alpha);
+    }
+    EXPECT_EQ(pointCounts.fragments, 0u);
+    EXPECT_EQ(pointCounts.blends, volumeCounts.blends);
+}
+
+TEST(ChannelLayoutTest, AovsFollowColourThroughMerge) {
+    // Overlapping volumes split and blend; AOVs copied from red and alpha
+    // must come out equal to them
+    DeepPixel a;
+    DeepPixel b;
+    a.addSample(makeVolume(1.0f, 4.0f, 0.3f, 0.2f, 0.1f, 0.6f));
+    a.addSample(makePoint(5.0f, 0.1f, 0.1f, 0.1f, 0.2f));
+    b.addSample(makeVolume(2.0f, 3.0f, 0.4f, 0.1f, 0.0f, 0.5f));
+    b.addSample(makePoint(5.0f, 0.2f, 0.0f, 0.0f, 0.4f));
+
+    std::vector<LayoutSample<TwoAovLayout>> samples = withAovs(a);
+    for (const auto& s : withAovs(b)) {
+        samples.push_back(s);
+    }
+    std::vector<LayoutSample<TwoAovLayout>> scratch;
+    VolumeMergeCounts counts;
+    mergeLayoutSamples<TwoAovLayout>(samples, scratch, 0.001f, &counts);
+
+    DeepPixel beauty = mergePixelsVolumetric({&a, &b});
+    ASSERT_EQ(samples.size(), beauty.sampleCount());
+    EXPECT_EQ(counts.fragments, 2u);
+    EXPECT_EQ(counts.blends, 2u);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const float* v = samples[i].values;
+        EXPECT_EQ(v[0], beauty[i].depth);
+        EXPECT_EQ(v[1], beauty[i].depth_back);
+        EXPECT_EQ(v[2], beauty[i].red);
+        EXPECT_EQ(v[5], beauty[i].alpha);
+        EXPECT_EQ(v[6], v[2]);
+        EXPECT_EQ(v[7], v[5]);
+    }
+
+    float flat[TwoAovLayout::kChannels];
+    flattenLayout<TwoAovLayout>(sampleFloats(samples.data()), samples.size(), flat);
+    EXPECT_EQ(flat[4], flat[0]);
+    EXPECT_EQ(flat[5], flat[3]);
+}
+
+TEST(ChannelLayoutTest, FlattenKeepsTheIdOfTheStrongestSample) {
+    // Contributions 0.2, 0.4, 0.4 * 0.5: the second sample's ID wins
+    using TwoAovLayout = ChannelLayout<false, 2>;
+    std::vector<LayoutSample<TwoAovLayout>> samples = {
+        {{1.0f, 0.2f, 0.0f, 0.0f, 0.2f, 0.2f, 7.0f}},
+        {{2.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.5f, 8.0f}},
+        {{3.0f, 0.5f, 0.0f, 0.0f, 0.5f, 0.5f, 9.0f}},
+    };
+    float flat[TwoAovLayout::kChannels];
+    EXPECT_EQ(flattenLayout<TwoAovLayout>(sampleFloats(samples.data()), samples.size(), flat, 0b10), 3u);
+    EXPECT_EQ(flat[4], flat[0]);
+    EXPECT_EQ(flat[5], 8.0f);
+
+    EXPECT_EQ(flattenLayout<TwoAovLayout>(sampleFloats(samples.data()), 0, flat, 0b10), 0u);
+    EXPECT_EQ(flat[5], 0.0f);
+}
+
+TEST(ChannelLayoutTest, PointFlattenMatchesKernelFlatten) {
+    std::vector<DeepPixel> pixels = randomPointPixels(4, 11);
+    for (const DeepPixel& pixel : pixels) {
+        std::vector<LayoutSample<RGBALayout>> points;
+        for (const DeepSample& s : pixel.samples()) {
+            points.push_back({{s.depth, s.red, s.green, s.blue, s.alpha}});
+        }
+        float expected[4];
+        float actual[4];
+        size_t used = kernels().flatten(sampleFloats(pixel.samples().data()), pixel.sampleCount(), expected);
+        EXPECT_EQ(flattenLayout<RGBALayout>(sampleFloats(points.data()), points.size(), actual), used);
+        for (int c = 0; c < 4; ++c) {
+            EXPECT_FLOAT_EQ(actual[c], expected[c]);
+        }
+    }
+}
+
+// ============================================================================
+// Extra channels
+// ============================================================================
+
+TEST(ExtraChannelTest, IdsAreRecognisedByNameOrType) {
+    EXPECT_TRUE(ExtraChannel::fromFile("id", false).isId);
+    EXPECT_TRUE(ExtraChannel::fromFile("objectId", false).isId);
+    EXPECT_TRUE(ExtraChannel::fromFile("crypto.ID", false).isId);
+    EXPECT_TRUE(ExtraChannel::fromFile("mat_id", false).isId);
+    EXPECT_FALSE(ExtraChannel::fromFile("fluid", false).isId);
+    EXPECT_FALSE(ExtraChannel::fromFile("id.weight", false).isId);
+    EXPECT_FALSE(ExtraChannel::fromFile("N.x", false).isId);
+
+    ExtraChannel mask = ExtraChannel::fromFile("mask", true);
+    EXPECT_TRUE(mask.isUint);
+    EXPECT_TRUE(mask.isId);
+}
+
+TEST(ExtraChannelTest, UniteAppendsMissingChannelsInOrder) {
+    ChannelSet a = extraChannels({"N.x", "id"});
+    ChannelSet b = extraChannels({"P.y", "N.x"}, false);
+    ChannelSet both = a.unite(b);
+    EXPECT_TRUE(both.zBack);
+    ASSERT_EQ(both.extras.size(), 3u);
+    EXPECT_EQ(both.findExtra("P.y"), 2);
+    EXPECT_EQ(both.findExtra("Z"), -1);
+    EXPECT_EQ(both.names().back(), "P.y");
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a.unite(a), a);
+}
+
+TEST(ExtraChannelTest, SetChannelsRemapsColumnsByName) {
+    DeepImage img = imageWithExtras({makePoint(1.0f, 0.1f, 0.1f, 0.1f, 0.5f), makePoint(2.0f, 0.1f, 0.1f, 0.1f, 0.5f)},
+                                    extraChannels({"a", "b"}), {1.0f, 2.0f, 3.0f, 4.0f});
+    img.setChannels(extraChannels({"b", "c"}));
+    EXPECT_EQ(img.extraColumns(0, 0), (std::vector<float>{3.0f, 4.0f, 0.0f, 0.0f}));
+
+    img.setChannels(ChannelSet());
+    EXPECT_FALSE(img.hasExtraChannels());
+}
+
+TEST(ExtraChannelTest, SortingMovesColumnsWithSamples) {
+    std::vector<DeepSample> samples;
+    std::vector<float> columns;
+    for (float depth : {3.0f, 1.0f, 2.0f}) {
+        samples.push_back(makePoint(depth, 0.1f, 0.1f, 0.1f, 0.5f));
+        columns.push_back(depth * 10.0f);
+    }
+    DeepImage img = imageWithExtras(samples, extraChannels({"a"}), columns);
+    ASSERT_FALSE(img.isValid());
+    img.sortAllPixels();
+    EXPECT_TRUE(img.isValid());
+    EXPECT_EQ(img.extraColumns(0, 0), (std::vector<float>{10.0f, 20.0f, 30.0f}));
+}
+
+TEST(ExtraChannelTest, MergeScalesAovsAndCopiesIds) {
+    // Overlapping volumes: the AOV is a copy of red, so must stay equal to
+    // it; the UINT ID's bit patterns must survive untouched
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("aov", false), ExtraChannel::fromFile("object", true)};
+    DeepSample frontVolume = makeVolume(1.0f, 4.0f, 0.3f, 0.2f, 0.1f, 0.6f);
+    DeepSample backVolume = makeVolume(2.0f, 3.0f, 0.4f, 0.1f, 0.0f, 0.5f);
+    float idA = floatFromBits(7u);
+    float idB = floatFromBits(0xffffffffu);  // A NaN as a float
+    DeepImage a = imageWithExtras({frontVolume}, channels, {0.3f, idA});
+    DeepImage b = imageWithExtras({backVolume}, channels, {0.4f, idB});
+
+    std::vector<int> identity = {0, 1};
+    std::vector<ExtraMergeInput> inputs = {
+        {&a.pixel(0, 0), &a.extraColumns(0, 0), &identity},
+        {&b.pixel(0, 0), &b.extraColumns(0, 0), &identity}};
+    std::vector<float> columns;
+    VolumeMergeCounts counts;
+    DeepPixel merged = mergePixelsWithExtras(inputs, channels, 0.001f, columns, &counts);
+
+    DeepPixel beauty = mergePixelsVolumetric({&a.pixel(0, 0), &b.pixel(0, 0)});
+    ASSERT_EQ(merged.sampleCount(), 3u);
+    ASSERT_EQ(beauty.sampleCount(), 3u);
+    ASSERT_EQ(columns.size(), 6u);
+    EXPECT_EQ(counts.fragments, 2u);
+    for (size_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(merged[i].depth, beauty[i].depth);
+        EXPECT_EQ(merged[i].red, beauty[i].red);
+        EXPECT_EQ(merged[i].alpha, beauty[i].alpha);
+        EXPECT_EQ(columns[i], merged[i].red);
+    }
+
+    // [1, 2) and [3, 4) are pieces of the front volume; in [2, 3) the back
+    // volume is more opaque than the third of the front one it blends with
+    EXPECT_EQ(bitsOf(columns[3]), 7u);
+    EXPECT_EQ(bitsOf(columns[4]), 0xffffffffu);
+    EXPECT_EQ(bitsOf(columns[5]), 7u);
+}
+
+TEST(ExtraChannelTest, WideChannelSetsMergeInPassesAndMissingChannelsAreZero) {
+    // More AOVs than one layout carries, all copies of red, on points
+    std::vector<std::string> names;
+    for (int c = 0; c < 20; ++c) {
+        names.push_back("aov" + std::to_string(c));
+    }
+    ChannelSet channels = extraChannels(names, false);
+    std::vector<DeepPixel> pixels = randomPointPixels(2, 5);
+    std::vector<std::vector<float>> inputColumns(2);
+    for (int p = 0; p < 2; ++p) {
+        for (int c = 0; c < 20; ++c) {
+            for (const DeepSample& s : pixels[p].samples()) {
+                inputColumns[p].push_back(s.red);
+            }
+        }
+    }
+    std::vector<int> identity(20);
+    for (int c = 0; c < 20; ++c) {
+        identity[c] = c;
+    }
+
+    std::vector<ExtraMergeInput> inputs = {{&pixels[0], &inputColumns[0], &identity},
+                                           {&pixels[1], &inputColumns[1], &identity}};
+    std::vector<float> columns;
+    DeepPixel merged = mergePixelsWithExtras(inputs, channels, 0.001f, columns);
+    DeepPixel beauty = pixelMergeFunction(channels)({&pixels[0], &pixels[1]}, 0.001f, nullptr);
+    size_t n = merged.sampleCount();
+    ASSERT_EQ(n, beauty.sampleCount());
+    ASSERT_EQ(columns.size(), 20 * n);
+    for (size_t c = 0; c < 20; ++c) {
+        for (size_t s = 0; s < n; ++s) {
+            EXPECT_EQ(columns[c * n + s], beauty[s].red) << "channel " << c;
+        }
+    }
+
+    // An input without the channels merges as if its red were zero
+    std::vector<int> absent(20, -1);
+    std::vector<float> noColumns;
+    inputs[1] = {&pixels[1], &noColumns, &absent};
+    mergePixelsWithExtras(inputs, channels, 0.001f, columns);
+    DeepPixel noRed = pixels[1];
+    for (DeepSample& s : noRed.samples()) {
+        s.red = 0.0f;
+    }
+    DeepPixel expected = pixelMergeFunction(channels)({&pixels[0], &noRed}, 0.001f, nullptr);
+    ASSERT_EQ(expected.sampleCount(), n);
+    for (size_t s = 0; s < n; ++s) {
+        EXPECT_EQ(columns[s], expected[s].red);
+        EXPECT_EQ(columns[19 * n + s], expected[s].red);
+    }
+}
+
+TEST(ExtraChannelTest, FlattenWeightsExtrasLikeColour) {
+    // Contributions 0.1, 0.54, 0.36, then nothing behind the opaque sample
+    ChannelSet channels = extraChannels({"aov", "id"});
+    DeepImage img = imageWithExtras({makePoint(1.0f, 0.05f, 0.0f, 0.0f, 0.1f),
+                                     makePoint(2.0f, 0.3f, 0.0f, 0.0f, 0.6f),
+                                     makePoint(3.0f, 0.9f, 0.0f, 0.0f, 1.0f),
+                                     makePoint(4.0f, 0.5f, 0.0f, 0.0f, 0.5f)},
+                                    channels, {0.05f, 0.3f, 0.9f, 0.5f, 1.0f, 2.0f, 3.0f, 4.0f});
+
+    std::vector<float> rgba = flattenImage(img);
+    std::vector<float> extras;
+    flattenExtraChannels(img, img.dataWindow(), extras);
+    ASSERT_EQ(extras.size(), 2u);
+    EXPECT_EQ(extras[0], rgba[0]);
+    EXPECT_EQ(extras[1], 2.0f);
+}
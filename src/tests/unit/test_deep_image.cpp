@@ -2,6 +2,7 @@
 #include <cmath>
 #include <limits>
 #include <stdexcept>
+#include <vector>
 #include "deep_image.h"
 #include "../test_helpers.h"
 
@@ -33,6 +34,39 @@ TEST_F(DeepImageTest, ConstructorWithZeroDimensionsIsValid) {
     EXPECT_EQ(img.height(), 0);
 }
 
+TEST_F(DeepImageTest, DefaultDataWindowStartsAtOrigin) {
+    DeepImage img(4, 8);
+    EXPECT_EQ(img.dataWindow(), PixelBox(0, 0, 3, 7));
+}
+
+TEST_F(DeepImageTest, DataWindowConstructorSetsOriginAndSize) {
+    DeepImage img(PixelBox(10, 20, 13, 21));
+    EXPECT_EQ(img.width(), 4);
+    EXPECT_EQ(img.height(), 2);
+    EXPECT_EQ(img.originX(), 10);
+    EXPECT_EQ(img.originY(), 20);
+    // pixel() is relative to the data window
+    EXPECT_NO_THROW(img.pixel(3, 1));
+    EXPECT_THROW(img.pixel(10, 20), std::out_of_range);
+}
+
+TEST_F(DeepImageTest, PixelBoxIntersectAndEmpty) {
+    PixelBox a(0, 0, 9, 9);
+    PixelBox b(5, 5, 14, 14);
+    EXPECT_EQ(a.intersect(b), PixelBox(5, 5, 9, 9));
+    EXPECT_TRUE(a.intersect(PixelBox(20, 20, 30, 30)).isEmpty());
+    EXPECT_TRUE(PixelBox().isEmpty());
+    EXPECT_EQ(PixelBox().width(), 0);
+}
+
+TEST_F(DeepImageTest, PixelBoxUniteIgnoresEmptyBoxes) {
+    PixelBox a(0, 0, 3, 3);
+    PixelBox b(10, 2, 12, 8);
+    EXPECT_EQ(a.unite(b), PixelBox(0, 0, 12, 8));
+    EXPECT_EQ(PixelBox().unite(b), b);
+    EXPECT_EQ(a.unite(PixelBox()), a);
+}
+
 TEST_F(DeepImageTest, ConstructorWithNegativeDimensionThrows) {
     EXPECT_THROW(DeepImage img(-1, 4), std::invalid_argument);
     EXPECT_THROW(DeepImage img(4, -1), std::invalid_argument);
@@ -171,3 +205,131 @@ TEST_F(DeepImageTest, MemoryUsageIncreasesWithMoreSamples) {
     size_t after = img.estimatedMemoryUsage();
     EXPECT_GT(after, before);
 }
+
+TEST_F(DeepImageTest, StatisticsGatheredInOnePass) {
+    DeepImage img(3, 3);
+    img.pixel(0, 0).addSample(makeSample(2.0f));
+    img.pixel(0, 0).addSample(makeSample(5.0f));
+    img.pixel(2, 1).addSample(makeSample(1.0f));
+    ImageStats stats = img.statistics();
+    EXPECT_EQ(stats.totalSamples, 3u);
+    EXPECT_EQ(stats.nonEmptyPixels, 2u);
+    EXPECT_FLOAT_EQ(stats.minDepth, 1.0f);
+    EXPECT_FLOAT_EQ(stats.maxDepth, 5.0f);
+    EXPECT_TRUE(stats.depthOrdered);
+}
+
+TEST_F(DeepImageTest, StatisticsRefreshAfterMutableAccess) {
+    DeepImage img(2, 2);
+    img.pixel(0, 0).addSample(makeSample(1.0f));
+    EXPECT_EQ(img.totalSampleCount(), 1u);
+    img.pixel(1, 1).addSample(makeSample(3.0f));
+    EXPECT_EQ(img.totalSampleCount(), 2u);
+    EXPECT_EQ(img.nonEmptyPixelCount(), 2u);
+
+    img.pixel(1, 1).samples().push_back(makeSample(0.5f));
+    EXPECT_FALSE(img.isValid());
+    img.sortAllPixels();
+    EXPECT_TRUE(img.isValid());
+
+    img.clear();
+    EXPECT_EQ(img.totalSampleCount(), 0u);
+}
+
+TEST_F(DeepImageTest, StatisticsOverManyRowsMatchPixelSums) {
+    // Large enough to be split across the pool
+    DeepImage img(300, 200);
+    size_t samples = 0;
+    for (int y = 0; y < 200; y += 3) {
+        for (int x = y % 7; x < 300; x += 7) {
+            for (int s = 0; s <= (x + y) % 3; ++s) {
+                img.pixel(x, y).addSample(makeSample(1.0f + static_cast<float>(x + y + s)));
+                samples++;
+            }
+        }
+    }
+    img.pixel(150, 100).addSample(makeSample(0.125f));
+    // Out of order in the last pixel only
+    img.pixel(299, 199).samples().push_back(makeSample(0.5f));
+    img.pixel(299, 199).samples().push_back(makeSample(0.25f));
+
+    ImageStats stats = img.statistics();
+    EXPECT_EQ(stats.totalSamples, samples + 3);
+    EXPECT_FLOAT_EQ(stats.minDepth, 0.125f);
+    EXPECT_FALSE(stats.depthOrdered);
+}
+
+TEST_F(DeepImageTest, UncheckedWritesRefreshStatistics) {
+    DeepImage img(2, 2);
+    img.pixel(0, 0).addSample(makeSample(1.0f));
+    EXPECT_EQ(img.totalSampleCount(), 1u);
+
+    img.pixelUnchecked(1, 1).addSample(makeSample(3.0f));
+    EXPECT_EQ(img.totalSampleCount(), 2u);
+    EXPECT_FLOAT_EQ(img.statistics().maxDepth, 3.0f);
+}
+
+TEST_F(DeepImageTest, CopiesCarryStatistics) {
+    DeepImage img(2, 2);
+    img.pixel(1, 0).addSample(makeSample(4.0f));
+    img.statistics();
+
+    DeepImage copy = img;
+    DeepImage moved = std::move(img);
+    EXPECT_EQ(copy.totalSampleCount(), 1u);
+    EXPECT_EQ(moved.nonEmptyPixelCount(), 1u);
+    copy.pixel(0, 0).addSample(makeSample(2.0f));
+    EXPECT_EQ(copy.totalSampleCount(), 2u);
+    EXPECT_EQ(moved.totalSampleCount(), 1u);
+}
+
+TEST_F(DeepImageTest, ForEachPixelVisitsEveryPixelOnce) {
+    DeepImage img(37, 23);
+    img.forEachPixel([&](int x, int y, DeepPixel& pixel) {
+        pixel.addSample(makeSample(static_cast<float>(y * 100 + x)));
+    });
+    for (int y = 0; y < img.height(); ++y) {
+        for (int x = 0; x < img.width(); ++x) {
+            ASSERT_EQ(img.pixel(x, y).sampleCount(), 1u);
+            EXPECT_FLOAT_EQ(img.pixel(x, y)[0].depth, static_cast<float>(y * 100 + x));
+        }
+    }
+
+    const DeepImage& view = img;
+    std::vector<int> rowsSeen(img.height(), 0);
+    view.forEachRow([&](int y, const DeepPixel* row) {
+        rowsSeen[y]++;
+        EXPECT_FLOAT_EQ(row[5].samples()[0].depth, static_cast<float>(y * 100 + 5));
+    }, IterPolicy::Serial);
+    for (int count : rowsSeen) {
+        EXPECT_EQ(count, 1);
+    }
+}
+
+TEST_F(DeepImageTest, ForEachTileClipsToRegion) {
+    DeepImage img(50, 40);
+    PixelBox region(3, 5, 44, 30);
+    img.forEachTile(region, 16, [&](const PixelBox& tile) {
+        EXPECT_LE(tile.width(), 16);
+        EXPECT_LE(tile.height(), 16);
+        for (int y = tile.minY; y <= tile.maxY; ++y) {
+            for (int x = tile.minX; x <= tile.maxX; ++x) {
+                img.pixelUnchecked(x, y).addSample(makeSample(1.0f));
+            }
+        }
+    });
+    for (int y = 0; y < img.height(); ++y) {
+        for (int x = 0; x < img.width(); ++x) {
+            EXPECT_EQ(img.pixel(x, y).sampleCount(), region.contains(x, y) ? 1u : 0u);
+        }
+    }
+}
+
+TEST_F(DeepImageTest, MutableIterationRefreshesStatistics) {
+    DeepImage img(4, 4);
+    EXPECT_EQ(img.totalSampleCount(), 0u);
+    img.forEachPixel([&](int, int, DeepPixel& pixel) {
+        pixel.addSample(makeSample(2.0f));
+    });
+    EXPECT_EQ(img.totalSampleCount(), 16u);
+}
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "deep_cache.h"
+#include "deep_input_cache.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+class DeepInputCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        writeFile("a.bin", "plate contents");
+    }
+
+    std::string writeFile(const std::string& name, const std::string& contents) {
+        return temp_.writeFile(name, contents);
+    }
+
+    std::string path(const std::string& name) const { return temp_.path(name); }
+
+    TestTempDir temp_;
+};
+
+TEST_F(DeepInputCacheTest, SameFileHitsByIdentity) {
+    DeepInputCache cache;
+    InputKey key;
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(), key), nullptr);
+    auto image = std::make_shared<const DeepImage>(2, 2);
+    cache.insert(key, image);
+    cache.endFrame();
+
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(), key), image);
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 1u);
+}
+
+TEST_F(DeepInputCacheTest, RegionIsPartOfTheKey) {
+    DeepInputCache cache;
+    InputKey key;
+    cache.find(path("a.bin"), PixelBox(), key);
+    cache.insert(key, std::make_shared<const DeepImage>(2, 2));
+
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(0, 0, 0, 0), key), nullptr);
+}
+
+TEST_F(DeepInputCacheTest, CopiesHitOnlyWithContentHashing) {
+    writeFile("b.bin", "plate contents");
+
+    for (bool hashContent : {false, true}) {
+        DeepInputCache cache(hashContent);
+        InputKey key;
+        cache.find(path("a.bin"), PixelBox(), key);
+        auto image = std::make_shared<const DeepImage>(2, 2);
+        cache.insert(key, image);
+
+        auto hit = cache.find(path("b.bin"), PixelBox(), key);
+        EXPECT_EQ(hit, hashContent ? image : nullptr);
+    }
+}
+
+TEST_F(DeepInputCacheTest, UnusedEntriesAreDroppedAtFrameEnd) {
+    DeepInputCache cache;
+    InputKey key;
+    cache.find(path("a.bin"), PixelBox(), key);
+    cache.insert(key, std::make_shared<const DeepImage>(2, 2));
+    cache.endFrame();
+    EXPECT_EQ(cache.identityCount(), 1u);
+
+    // A frame that doesn't use a.bin
+    cache.endFrame();
+    EXPECT_EQ(cache.identityCount(), 0u);
+}
+
+TEST_F(DeepInputCacheTest, HashFileContentsDistinguishesContent) {
+    writeFile("b.bin", "plate contents");
+    writeFile("c.bin", "plate contentz");
+    uint64_t a = 0, b = 0, c = 0;
+    ASSERT_TRUE(hashFileContents(path("a.bin"), a));
+    ASSERT_TRUE(hashFileContents(path("b.bin"), b));
+    ASSERT_TRUE(hashFileContents(path("c.bin"), c));
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_FALSE(hashFileContents(path("missing.bin"), a));
+}
+
+// ============================================================================
+// DeepImageLRU tests
+// ============================================================================
+
+TEST_F(DeepInputCacheTest, LRUHitsByIdentity) {
+    DeepImageLRU cache(size_t(1) << 20);
+    InputKey key;
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(), key), nullptr);
+    auto image = std::make_shared<const DeepImage>(2, 2);
+    cache.insert(key, image);
+
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(), key), image);
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 1u);
+    EXPECT_EQ(cache.memoryUsage(), image->estimatedMemoryUsage());
+}
+
+TEST_F(DeepInputCacheTest, LRUEvictsLeastRecentlyUsed) {
+    writeFile("b.bin", "b");
+    writeFile("c.bin", "c");
+    auto image = std::make_shared<const DeepImage>(4, 4);
+    size_t bytes = image->estimatedMemoryUsage();
+    DeepImageLRU cache(bytes * 2);
+
+    InputKey key;
+    for (const char* name : {"a.bin", "b.bin"}) {
+        cache.find(path(name), PixelBox(), key);
+        cache.insert(key, std::make_shared<const DeepImage>(4, 4));
+    }
+    // Touch a, so b is the oldest when c arrives
+    EXPECT_NE(cache.find(path("a.bin"), PixelBox(), key), nullptr);
+    cache.find(path("c.bin"), PixelBox(), key);
+    cache.insert(key, std::make_shared<const DeepImage>(4, 4));
+
+    EXPECT_EQ(cache.entryCount(), 2u);
+    EXPECT_LE(cache.memoryUsage(), cache.budget());
+    EXPECT_NE(cache.find(path("a.bin"), PixelBox(), key), nullptr);
+    EXPECT_EQ(cache.find(path("b.bin"), PixelBox(), key), nullptr);
+    EXPECT_NE(cache.find(path("c.bin"), PixelBox(), key), nullptr);
+}
+
+TEST_F(DeepInputCacheTest, LRUSkipsImagesOverBudget) {
+    DeepImageLRU cache(16);
+    InputKey key;
+    cache.find(path("a.bin"), PixelBox(), key);
+    cache.insert(key, std::make_shared<const DeepImage>(64, 64));
+
+    EXPECT_EQ(cache.entryCount(), 0u);
+    EXPECT_EQ(cache.memoryUsage(), 0u);
+}
+
+TEST_F(DeepInputCacheTest, LRUChargesCacheBackedImagesTheirSamples) {
+    DeepImage img(16, 16);
+    for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+            img.pixel(x, y).addSample(makePoint(1.0f, 0.1f, 0.1f, 0.1f, 0.5f));
+            img.pixel(x, y).addSample(makePoint(2.0f, 0.1f, 0.1f, 0.1f, 0.5f));
+        }
+    }
+    writeDeepCache(img, path("plate.dcache"));
+    auto mapped = std::make_shared<const DeepImage>(loadDeepCache(path("plate.dcache")));
+    ASSERT_TRUE(mapped->isCacheBacked());
+
+    DeepImageLRU cache(size_t(1) << 20);
+    InputKey key;
+    cache.find(path("plate.dcache"), PixelBox(), key);
+    cache.insert(key, mapped);
+
+    // Nothing has been read yet, but the rows will be on first access
+    EXPECT_GE(cache.memoryUsage(), 512 * sizeof(DeepSample) + 256 * sizeof(DeepPixel));
+    EXPECT_GE(cache.memoryUsage(), mapped->estimatedMemoryUsage());
+}
+
+TEST_F(DeepInputCacheTest, LRUMissesRewrittenFile) {
+    DeepImageLRU cache(size_t(1) << 20);
+    InputKey key;
+    cache.find(path("a.bin"), PixelBox(), key);
+    cache.insert(key, std::make_shared<const DeepImage>(2, 2));
+
+    writeFile("a.bin", "re-rendered plate");
+    EXPECT_EQ(cache.find(path("a.bin"), PixelBox(), key), nullptr);
+}
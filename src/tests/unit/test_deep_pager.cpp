@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include "deep_compositor.h"
+#include "deep_pager.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+// A few samples per pixel, varying with position
+void fill(DeepImage& img) {
+    for (const PixelBox& tile : img.tileOrder()) {
+        for (int y = tile.minY; y <= tile.maxY; ++y) {
+            for (int x = tile.minX; x <= tile.maxX; ++x) {
+                for (int s = 0; s <= (x + y) % 4; ++s) {
+                    img.pixel(x, y).addSample(makePoint(1.0f + s + x * 0.01f, 0.1f, 0.2f,
+                                                        static_cast<float>(y), 0.5f));
+                }
+            }
+        }
+    }
+}
+
+void expectSamePixels(const DeepImage& a, const DeepImage& b) {
+    ASSERT_EQ(a.dataWindow(), b.dataWindow());
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            const auto& sa = a.pixel(x, y).samples();
+            const auto& sb = b.pixel(x, y).samples();
+            ASSERT_EQ(sa.size(), sb.size()) << "at " << x << "," << y;
+            for (size_t i = 0; i < sa.size(); ++i) {
+                EXPECT_FLOAT_EQ(sa[i].depth, sb[i].depth);
+                EXPECT_FLOAT_EQ(sa[i].blue, sb[i].blue);
+            }
+        }
+    }
+}
+
+// Sample bytes of a full tile of fill(): at most 4 samples per pixel
+size_t tileBytes(int tileSize) {
+    return static_cast<size_t>(tileSize) * tileSize * 4 * sizeof(DeepSample);
+}
+
+} // anonymous namespace
+
+TEST(TilePagerTest, PagedImageRoundTripsThroughScratch) {
+    DeepImage reference(200, 150);
+    fill(reference);
+
+    auto pager = std::make_shared<TilePager>(tileBytes(32) * 2);
+    DeepImage paged = reference;
+    paged.enableOutOfCore(pager, 32);
+    EXPECT_TRUE(paged.isOutOfCore());
+    EXPECT_GT(pager->pageOuts(), 0u);
+    EXPECT_GT(pager->scratchBytes(), 0u);
+
+    expectSamePixels(paged, reference);
+    EXPECT_GT(pager->pageIns(), 0u);
+    EXPECT_EQ(paged.totalSampleCount(), reference.totalSampleCount());
+    EXPECT_EQ(paged.nonEmptyPixelCount(), reference.nonEmptyPixelCount());
+}
+
+TEST(TilePagerTest, PagedImageIteratesTileByTile) {
+    DeepImage reference(120, 90);
+    fill(reference);
+
+    auto pager = std::make_shared<TilePager>(tileBytes(32) * 2);
+    DeepImage paged = reference;
+    paged.enableOutOfCore(pager, 32);
+    paged.forEachPixel([](int, int, DeepPixel& pixel) {
+        for (DeepSample& sample : pixel.samples()) {
+            sample.blue += 1.0f;
+        }
+    });
+    reference.forEachPixel([](int, int, DeepPixel& pixel) {
+        for (DeepSample& sample : pixel.samples()) {
+            sample.blue += 1.0f;
+        }
+    });
+    expectSamePixels(paged, reference);
+    EXPECT_THROW(paged.forEachRow([](int, DeepPixel*) {}), std::logic_error);
+}
+
+TEST(TilePagerTest, PeakStaysWithinBudget) {
+    const int tileSize = 16;
+    size_t budget = tileBytes(tileSize) * 4;
+    auto pager = std::make_shared<TilePager>(budget);
+
+    DeepImage img(256, 256);
+    img.enableOutOfCore(pager, tileSize);
+    fill(img);
+    img.sortAllPixels();
+
+    // The budget plus the pinned current tile
+    EXPECT_LE(pager->peakResidentBytes(), budget + tileBytes(tileSize));
+    EXPECT_LE(pager->residentBytes(), budget + tileBytes(tileSize));
+    EXPECT_LT(img.estimatedMemoryUsage(),
+              img.totalSampleCount() * sizeof(DeepSample));
+}
+
+TEST(TilePagerTest, ModificationsSurviveEviction) {
+    auto pager = std::make_shared<TilePager>(1);
+    DeepImage img(64, 64);
+    img.enableOutOfCore(pager, 8);
+
+    img.pixel(3, 3).addSample(makePoint(2.0f, 1.0f, 0.0f, 0.0f, 1.0f));
+    img.pixel(60, 60).addSample(makePoint(5.0f, 0.0f, 1.0f, 0.0f, 1.0f));
+    img.pixel(3, 3).addSample(makePoint(1.0f, 0.0f, 0.0f, 1.0f, 1.0f));
+    img.pixel(60, 60);
+
+    ASSERT_EQ(img.pixel(3, 3).sampleCount(), 2u);
+    EXPECT_FLOAT_EQ(img.pixel(3, 3)[0].depth, 1.0f);
+    EXPECT_FLOAT_EQ(img.pixel(3, 3)[1].depth, 2.0f);
+    EXPECT_EQ(img.totalSampleCount(), 3u);
+}
+
+TEST(TilePagerTest, PagedCountsDontReadTilesBack) {
+    auto pager = std::make_shared<TilePager>(0);
+    DeepImage img(128, 128);
+    fill(img);
+    size_t total = img.totalSampleCount();
+
+    img.enableOutOfCore(pager, 32);
+    size_t pageIns = pager->pageIns();
+    EXPECT_EQ(img.totalSampleCount(), total);
+    EXPECT_EQ(pager->pageIns(), pageIns);
+}
+
+TEST(TilePagerTest, CopyAndClearKeepPaging) {
+    auto pager = std::make_shared<TilePager>(tileBytes(16));
+    DeepImage img(100, 40);
+    img.enableOutOfCore(pager, 16);
+    fill(img);
+
+    DeepImage copy = img;
+    EXPECT_TRUE(copy.isOutOfCore());
+    expectSamePixels(copy, img);
+
+    copy.clear();
+    EXPECT_TRUE(copy.isOutOfCore());
+    EXPECT_EQ(copy.totalSampleCount(), 0u);
+    EXPECT_EQ(img.nonEmptyPixelCount(), 100u * 40u);
+
+    copy.resize(4, 4);
+    EXPECT_FALSE(copy.isOutOfCore());
+}
+
+TEST(TilePagerTest, MergeIntoPagedResultMatchesInMemory) {
+    DeepImage a(150, 90);
+    DeepImage b(PixelBox(40, 20, 199, 119));
+    fill(a);
+    fill(b);
+
+    CompositorOptions options;
+    DeepImage expected = deepMerge({a, b}, options);
+
+    auto pager = std::make_shared<TilePager>(tileBytes(64));
+    setOutOfCorePager(pager);
+    DeepImage merged = deepMerge({a, b}, options);
+    setOutOfCorePager(nullptr);
+
+    EXPECT_TRUE(merged.isOutOfCore());
+    EXPECT_GT(pager->pageOuts(), 0u);
+    expectSamePixels(merged, expected);
+}
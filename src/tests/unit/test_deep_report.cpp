@@ -0,0 +1,204 @@
+#include <gtest/gtest.h>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "deep_report.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+/**
+ * Just enough JSON to read a report back: objects, arrays, strings
+ * (with \" and \\ escapes), numbers and null
+ */
+struct Json {
+    enum Type { Null, Number, String, Array, Object } type = Null;
+    double number = 0.0;
+    std::string text;
+    std::vector<Json> items;
+    std::map<std::string, Json> fields;
+
+    const Json& operator[](const std::string& key) const {
+        auto it = fields.find(key);
+        if (it == fields.end()) {
+            throw std::runtime_error("missing field " + key);
+        }
+        return it->second;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : text_(text), pos_(0) {}
+
+    Json parseDocument() {
+        Json value = parseValue();
+        skipSpace();
+        if (pos_ != text_.size()) {
+            throw std::runtime_error("trailing text");
+        }
+        return value;
+    }
+
+private:
+    void skipSpace() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            pos_++;
+        }
+    }
+
+    void expect(char c) {
+        skipSpace();
+        if (pos_ >= text_.size() || text_[pos_] != c) {
+            throw std::runtime_error(std::string("expected ") + c + " at " + std::to_string(pos_));
+        }
+        pos_++;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string out;
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            if (text_[pos_] == '\\') {
+                pos_++;
+            }
+            out += text_[pos_++];
+        }
+        expect('"');
+        return out;
+    }
+
+    Json parseValue() {
+        skipSpace();
+        Json value;
+        if (pos_ >= text_.size()) {
+            throw std::runtime_error("unexpected end");
+        }
+        char c = text_[pos_];
+        if (c == '{') {
+            value.type = Json::Object;
+            pos_++;
+            skipSpace();
+            if (text_[pos_] == '}') {
+                pos_++;
+                return value;
+            }
+            do {
+                std::string key = parseString();
+                expect(':');
+                value.fields[key] = parseValue();
+                skipSpace();
+            } while (text_[pos_++] == ',');
+            if (text_[pos_ - 1] != '}') {
+                throw std::runtime_error("unterminated object");
+            }
+        } else if (c == '[') {
+            value.type = Json::Array;
+            pos_++;
+            skipSpace();
+            if (text_[pos_] == ']') {
+                pos_++;
+                return value;
+            }
+            do {
+                value.items.push_back(parseValue());
+                skipSpace();
+            } while (text_[pos_++] == ',');
+            if (text_[pos_ - 1] != ']') {
+                throw std::runtime_error("unterminated array");
+            }
+        } else if (c == '"') {
+            value.type = Json::String;
+            value.text = parseString();
+        } else if (text_.compare(pos_, 4, "null") == 0) {
+            pos_ += 4;
+        } else {
+            size_t used = 0;
+            value.type = Json::Number;
+            value.number = std::stod(text_.substr(pos_), &used);
+            pos_ += used;
+        }
+        return value;
+    }
+
+    const std::string& text_;
+    size_t pos_;
+};
+
+RunReport sampleReport() {
+    RunReport report;
+    report.version = "9.9";
+    FileStats input{"in \"a\".exr", IOStats()};
+    input.io.bytes = 2 * 1024 * 1024;
+    input.io.samples = 1234;
+    input.io.wallMs = 500.0;
+    report.inputs.push_back(input);
+    report.merge.totalInputSamples = 1234;
+    report.merge.totalOutputSamples = 1000;
+    report.merge.mergeThreads = 4;
+    report.merge.minDepth = 1.5f;
+    report.merge.maxDepth = std::numeric_limits<float>::infinity();
+    report.phases.push_back({"merge", 100.0, 200.0, 4});
+    report.loadThreads = 3;
+    report.resultCache = "miss";
+    return report;
+}
+
+} // anonymous namespace
+
+TEST(RunReportTest, WritesParseableJsonWithReportedValues) {
+    std::ostringstream out;
+    writeStatsJson(out, sampleReport());
+    Json json = JsonParser(out.str()).parseDocument();
+
+    EXPECT_EQ(json["version"].text, "9.9");
+    ASSERT_EQ(json["inputs"].items.size(), 1u);
+    const Json& input = json["inputs"].items[0];
+    EXPECT_EQ(input["file"].text, "in \"a\".exr");
+    EXPECT_EQ(input["bytes"].number, 2.0 * 1024 * 1024);
+    EXPECT_EQ(input["samples"].number, 1234.0);
+    EXPECT_DOUBLE_EQ(input["throughput_mb_s"].number, 4.0);
+
+    const Json& merge = json["merge"];
+    EXPECT_EQ(merge["input_samples"].number, 1234.0);
+    EXPECT_EQ(merge["output_samples"].number, 1000.0);
+    EXPECT_EQ(merge["threads"].number, 4.0);
+    EXPECT_EQ(merge["min_depth"].number, 1.5);
+    EXPECT_EQ(merge["max_depth"].type, Json::Null);  // Infinity isn't JSON
+    EXPECT_EQ(json["outputs"].type, Json::Array);
+    EXPECT_TRUE(json["outputs"].items.empty());
+
+    ASSERT_EQ(json["phases"].items.size(), 1u);
+    const Json& phase = json["phases"].items[0];
+    EXPECT_EQ(phase["name"].text, "merge");
+    EXPECT_EQ(phase["wall_ms"].number, 100.0);
+    EXPECT_EQ(phase["threads"].number, 4.0);
+    EXPECT_DOUBLE_EQ(phase["utilisation"].number, 0.5);
+
+    EXPECT_EQ(json["threads"]["load"].number, 3.0);
+    EXPECT_GE(json["threads"]["pool"].number, 1.0);
+    EXPECT_EQ(json["kernels"].type, Json::String);
+    EXPECT_GE(json["peak_rss_bytes"].number, 0.0);
+    EXPECT_EQ(json["result_cache"].text, "miss");
+    EXPECT_EQ(json.fields.count("paging"), 0u);
+}
+
+TEST(RunReportTest, ReportsPagingWithAPager) {
+    auto pager = std::make_shared<TilePager>(size_t(1) << 20);
+    std::ostringstream out;
+    writeStatsJson(out, RunReport(), pager.get());
+    Json json = JsonParser(out.str()).parseDocument();
+
+    const Json& paging = json["paging"];
+    EXPECT_EQ(paging["budget_bytes"].number, static_cast<double>(size_t(1) << 20));
+    EXPECT_EQ(paging["page_outs"].number, 0.0);
+    EXPECT_EQ(paging["page_ins"].number, 0.0);
+    EXPECT_EQ(json["result_cache"].text, "off");
+}
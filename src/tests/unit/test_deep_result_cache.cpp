@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "deep_reader.h"
+#include "deep_result_cache.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+namespace fs = std::filesystem;
+
+class ResultCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        fs::create_directories(temp_.dir() / "out");
+        writeFile("bg.exr", "background");
+        writeFile("fx.exr", "effect");
+    }
+
+    std::string writeFile(const std::string& name, const std::string& contents) {
+        return temp_.writeFile(name, contents);
+    }
+
+    std::string readFile(const std::string& path) const {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    std::string path(const std::string& name) const { return temp_.path(name); }
+    std::string cacheDir() const { return path("cache"); }
+    std::vector<std::string> inputs() const { return {path("bg.exr"), path("fx.exr")}; }
+
+    std::vector<CachedOutput> outputs() const {
+        return {{"flat.exr", path("out/shot_flat.exr")}, {"preview.png", path("out/shot.png")}};
+    }
+
+    TestTempDir temp_;
+};
+
+TEST_F(ResultCacheTest, KeyDependsOnSettingsAndInputOrder) {
+    ResultCache cache(cacheDir());
+    std::string a, b, c, again;
+    ASSERT_TRUE(cache.computeKey(inputs(), "merge-threshold 0.001", a));
+    ASSERT_TRUE(cache.computeKey(inputs(), "merge-threshold 0.001", again));
+    ASSERT_TRUE(cache.computeKey(inputs(), "merge-threshold 0.5", b));
+    ASSERT_TRUE(cache.computeKey({path("fx.exr"), path("bg.exr")}, "merge-threshold 0.001", c));
+
+    EXPECT_EQ(a, again);
+    EXPECT_EQ(a.size(), 32u);
+    EXPECT_NE(a, b);
+    EXPECT_NE(a, c);
+}
+
+TEST_F(ResultCacheTest, KeyDependsOnExtraChannelLoading) {
+    // --no-extra-channels output lacks the AOVs, so it must not be reused
+    ResultCache cache(cacheDir());
+    std::string with, without;
+    ASSERT_TRUE(cache.computeKey(inputs(), "merge-threshold 0.001", with));
+    setLoadExtraChannels(false);
+    ASSERT_TRUE(cache.computeKey(inputs(), "merge-threshold 0.001", without));
+    setLoadExtraChannels(true);
+    EXPECT_NE(with, without);
+
+    // And a run without them misses the entry a run with them stored
+    writeFile("out/shot_flat.exr", "flat with AOVs");
+    writeFile("out/shot.png", "png");
+    cache.store(with, outputs());
+    EXPECT_FALSE(cache.fetch(without, outputs(), false));
+    EXPECT_TRUE(cache.fetch(with, outputs(), false));
+}
+
+TEST_F(ResultCacheTest, MissingInputCannotBeKeyed) {
+    ResultCache cache(cacheDir());
+    std::string key;
+    EXPECT_FALSE(cache.computeKey({path("missing.exr")}, "", key));
+}
+
+TEST_F(ResultCacheTest, ContentKeyIgnoresFileIdentity) {
+    writeFile("bg_copy.exr", "background");
+
+    std::string original, copy;
+    ResultCache byIdentity(cacheDir(), false);
+    byIdentity.computeKey({path("bg.exr")}, "", original);
+    byIdentity.computeKey({path("bg_copy.exr")}, "", copy);
+    EXPECT_NE(original, copy);
+
+    ResultCache byContent(cacheDir(), true);
+    byContent.computeKey({path("bg.exr")}, "", original);
+    byContent.computeKey({path("bg_copy.exr")}, "", copy);
+    EXPECT_EQ(original, copy);
+}
+
+TEST_F(ResultCacheTest, StoreThenFetchRestoresOutputs) {
+    ResultCache cache(cacheDir());
+    std::string key;
+    ASSERT_TRUE(cache.computeKey(inputs(), "", key));
+
+    EXPECT_FALSE(cache.fetch(key, outputs(), false));
+
+    writeFile("out/shot_flat.exr", "flat pixels");
+    writeFile("out/shot.png", "png pixels");
+    cache.store(key, outputs());
+    fs::remove(path("out/shot_flat.exr"));
+    fs::remove(path("out/shot.png"));
+
+    ASSERT_TRUE(cache.fetch(key, outputs(), false));
+    EXPECT_EQ(readFile(path("out/shot_flat.exr")), "flat pixels");
+    EXPECT_EQ(readFile(path("out/shot.png")), "png pixels");
+    EXPECT_EQ(fs::hard_link_count(path("out/shot.png")), 1u);
+
+    size_t hits, misses;
+    cache.statistics(hits, misses);
+    EXPECT_EQ(hits, 1u);
+    EXPECT_EQ(misses, 1u);
+}
+
+TEST_F(ResultCacheTest, FetchCanHardLink) {
+    ResultCache cache(cacheDir());
+    std::string key;
+    cache.computeKey(inputs(), "", key);
+    writeFile("out/shot_flat.exr", "flat pixels");
+    writeFile("out/shot.png", "png pixels");
+    cache.store(key, outputs());
+
+    ASSERT_TRUE(cache.fetch(key, outputs(), true));
+    EXPECT_EQ(fs::hard_link_count(path("out/shot_flat.exr")), 2u);
+}
+
+TEST_F(ResultCacheTest, RewritingLinkedOutputsLeavesEntryIntact) {
+    ResultCache cache(cacheDir());
+    std::string key;
+    cache.computeKey(inputs(), "", key);
+    writeFile("out/shot_flat.exr", "flat pixels");
+    writeFile("out/shot.png", "png pixels");
+    cache.store(key, outputs());
+    ASSERT_TRUE(cache.fetch(key, outputs(), true));
+
+    // A later run with different inputs to the same prefix misses and
+    // writes its outputs the way the writers do: truncating in place
+    writeFile("fx.exr", "edited effect");
+    std::string edited;
+    cache.computeKey(inputs(), "", edited);
+    ASSERT_FALSE(cache.fetch(edited, outputs(), true));
+    for (const CachedOutput& output : outputs()) {
+        detachOutput(output.path);
+        std::ofstream(output.path, std::ios::binary | std::ios::trunc) << "edited " << output.name;
+    }
+    cache.store(edited, outputs());
+
+    ASSERT_TRUE(cache.fetch(key, outputs(), true));
+    EXPECT_EQ(readFile(path("out/shot_flat.exr")), "flat pixels");
+    EXPECT_EQ(readFile(path("out/shot.png")), "png pixels");
+    ASSERT_TRUE(cache.fetch(edited, outputs(), false));
+    EXPECT_EQ(readFile(path("out/shot_flat.exr")), "edited flat.exr");
+}
+
+TEST_F(ResultCacheTest, EntryMissingAnOutputIsAMiss) {
+    ResultCache cache(cacheDir());
+    std::string key;
+    cache.computeKey(inputs(), "", key);
+    writeFile("out/shot_flat.exr", "flat pixels");
+    cache.store(key, {outputs()[0]});
+
+    EXPECT_FALSE(cache.fetch(key, outputs(), false));
+}
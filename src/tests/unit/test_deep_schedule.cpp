@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include "deep_schedule.h"
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace deep_compositor;
+
+TEST(ScheduleTest, PartitionCoversAllBinsWithEqualCost) {
+    // Cheap "sky" followed by an expensive band
+    std::vector<uint64_t> costs(100, 1);
+    for (size_t i = 60; i < 80; ++i) {
+        costs[i] = 50;
+    }
+    std::vector<WorkUnit> units = partitionByCost(costs, 8);
+    
+    ASSERT_FALSE(units.empty());
+    EXPECT_LE(units.size(), 8u);
+    EXPECT_EQ(units.front().begin, 0u);
+    EXPECT_EQ(units.back().end, costs.size());
+    uint64_t total = 0;
+    for (size_t i = 0; i < units.size(); ++i) {
+        if (i > 0) {
+            EXPECT_EQ(units[i].begin, units[i - 1].end);
+        }
+        total += units[i].cost;
+        // No unit exceeds its share by more than one bin
+        EXPECT_LE(units[i].cost, 1080u / 8 + 50);
+    }
+    EXPECT_EQ(total, 1080u);
+    
+    // The expensive band is spread over several units
+    size_t inBand = 0;
+    for (const WorkUnit& unit : units) {
+        if (unit.begin < 80 && unit.end > 60) {
+            inBand++;
+        }
+    }
+    EXPECT_GE(inBand, 5u);
+}
+
+TEST(ScheduleTest, RunsEveryUnitExactlyOnce) {
+    std::vector<uint64_t> costs(1000, 1);
+    std::vector<WorkUnit> units = partitionByCost(costs, 64);
+    std::vector<std::atomic<int>> runs(costs.size());
+    TaskScheduler scheduler(4);
+    
+    ScheduleStats stats = runWorkUnits(units, 4, [&](const WorkUnit& unit, int worker) {
+        EXPECT_GE(worker, 0);
+        EXPECT_LT(worker, 4);
+        for (size_t i = unit.begin; i < unit.end; ++i) {
+            runs[i]++;
+        }
+    }, scheduler);
+    
+    for (const auto& count : runs) {
+        EXPECT_EQ(count.load(), 1);
+    }
+    EXPECT_EQ(stats.threads, 4u);
+    EXPECT_EQ(stats.units, units.size());
+    EXPECT_GT(stats.balance, 0.0);
+    EXPECT_LE(stats.balance, 1.0);
+}
+
+TEST(ScheduleTest, RethrowsWorkerException) {
+    std::vector<uint64_t> costs(16, 1);
+    std::vector<WorkUnit> units = partitionByCost(costs, 16);
+    TaskScheduler scheduler(3);
+    EXPECT_THROW(runWorkUnits(units, 3, [](const WorkUnit& unit, int) {
+        if (unit.begin == 7) {
+            throw std::runtime_error("unit failed");
+        }
+    }, scheduler), std::runtime_error);
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "deep_pager.h"
+#include "deep_select.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+// 128x64 at 10,20 (two 64px tiles) with an "objectId" and an AOV column:
+// pixel 5,5 holds objects 7 and 9, pixel 70,3 only object 9
+DeepImage twoTileImage() {
+    DeepImage img(PixelBox(10, 20, 137, 83));
+    img.setDisplayWindow(PixelBox(0, 0, 199, 99));
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("objectId", false), ExtraChannel::fromFile("aov", false)};
+    img.setChannels(channels);
+
+    img.pixel(5, 5).samples() = {makePoint(1.0f, 0.1f, 0.0f, 0.0f, 0.5f),
+                                 makePoint(2.0f, 0.2f, 0.0f, 0.0f, 0.5f)};
+    img.extraColumns(5, 5) = {7.0f, 9.0f, 0.1f, 0.2f};
+    img.pixel(70, 3).samples() = {makePoint(3.0f, 0.3f, 0.0f, 0.0f, 0.5f)};
+    img.extraColumns(70, 3) = {9.0f, 0.3f};
+    return img;
+}
+
+IdSelection selecting(const std::string& ids, bool keep) {
+    IdSelection selection;
+    EXPECT_TRUE(parseIdSet(ids, selection.ids));
+    selection.keep = keep;
+    return selection;
+}
+
+} // anonymous namespace
+
+TEST(IdSelectTest, ParsesIdLists) {
+    IdSet ids;
+    ASSERT_TRUE(parseIdSet("3,7,12-15", ids));
+    EXPECT_TRUE(ids.contains(3));
+    EXPECT_TRUE(ids.contains(12));
+    EXPECT_TRUE(ids.contains(15));
+    EXPECT_FALSE(ids.contains(4));
+    EXPECT_FALSE(ids.contains(16));
+
+    // Adjacent and overlapping ranges coalesce
+    ASSERT_TRUE(parseIdSet("4-6,1-3,5", ids));
+    ASSERT_EQ(ids.ranges.size(), 1u);
+    EXPECT_EQ(ids.ranges[0], std::make_pair(1u, 6u));
+    ASSERT_TRUE(parseIdSet("4294967295", ids));
+    EXPECT_TRUE(ids.contains(4294967295u));
+
+    for (const char* bad : {"", "3,", ",3", "5-2", "a", "3-", "4294967296", " 3"}) {
+        EXPECT_FALSE(parseIdSet(bad, ids)) << bad;
+    }
+}
+
+TEST(IdSelectTest, IndexOnlyFlagsTilesHoldingTheIds) {
+    DeepImage img = twoTileImage();
+    IdPresenceIndex index(img, 0);
+    ASSERT_EQ(index.tilesX(), 2);
+    ASSERT_EQ(index.tilesY(), 1);
+
+    IdSet seven, nine, zero;
+    seven.add(7, 7);
+    nine.add(9, 9);
+    zero.add(0, 0);
+    IdBits sevenBits, nineBits, zeroBits;
+    sevenBits.addAll(seven);
+    nineBits.addAll(nine);
+    zeroBits.addAll(zero);
+    EXPECT_TRUE(index.mayContain(0, 0, seven, sevenBits));
+    EXPECT_FALSE(index.mayContain(1, 0, seven, sevenBits));
+    EXPECT_TRUE(index.mayContain(1, 0, nine, nineBits));
+    // Empty pixels have no columns, so every tile may hold ID 0
+    EXPECT_TRUE(index.mayContain(1, 0, zero, zeroBits));
+}
+
+TEST(IdSelectTest, KeepIsolatesSamplesAndCropsTheWindow) {
+    DeepImage img = twoTileImage();
+    SelectStats stats;
+    DeepImage kept = selectById(img, selecting("7", true), &stats);
+
+    EXPECT_EQ(kept.dataWindow(), PixelBox(15, 25, 15, 25));
+    EXPECT_EQ(kept.displayWindow(), img.displayWindow());
+    EXPECT_EQ(kept.channels(), img.channels());
+    ASSERT_EQ(kept.pixel(0, 0).sampleCount(), 1u);
+    EXPECT_EQ(kept.pixel(0, 0)[0].depth, 1.0f);
+    EXPECT_EQ(kept.extraColumns(0, 0), (std::vector<float>{7.0f, 0.1f}));
+    EXPECT_EQ(stats.tiles, 2u);
+    EXPECT_EQ(stats.skippedTiles, 1u);
+    EXPECT_EQ(stats.keptSamples, 1u);
+
+    // Nothing selected leaves an empty image
+    DeepImage none = selectById(img, selecting("8", true));
+    EXPECT_TRUE(none.dataWindow().isEmpty());
+}
+
+TEST(IdSelectTest, DropRemovesSamplesAndCopiesOtherTiles) {
+    DeepImage img = twoTileImage();
+    SelectStats stats;
+    DeepImage rest = selectById(img, selecting("7", false), &stats);
+
+    EXPECT_EQ(rest.dataWindow(), PixelBox(15, 23, 80, 25));
+    const DeepPixel& first = rest.pixel(0, 2);
+    ASSERT_EQ(first.sampleCount(), 1u);
+    EXPECT_EQ(first[0].depth, 2.0f);
+    EXPECT_EQ(rest.extraColumns(0, 2), (std::vector<float>{9.0f, 0.2f}));
+    EXPECT_EQ(rest.pixel(65, 0).sampleCount(), 1u);
+    EXPECT_EQ(rest.extraColumns(65, 0), (std::vector<float>{9.0f, 0.3f}));
+    EXPECT_EQ(stats.copiedTiles, 1u);
+    EXPECT_EQ(stats.keptSamples, 2u);
+}
+
+TEST(IdSelectTest, UintIdsMatchByValue) {
+    DeepImage img(2, 1);
+    ChannelSet channels;
+    channels.extras = {ExtraChannel::fromFile("crypto", true)};
+    img.setChannels(channels);
+    uint32_t ids[2] = {123456789u, 5u};
+    for (int x = 0; x < 2; ++x) {
+        float bits;
+        std::memcpy(&bits, &ids[x], sizeof(bits));
+        img.pixel(x, 0).addSample(makePoint(1.0f, 0.1f, 0.1f, 0.1f, 0.5f));
+        img.extraColumns(x, 0) = {bits};
+    }
+
+    DeepImage kept = selectById(img, selecting("123456789", true));
+    EXPECT_EQ(kept.dataWindow(), PixelBox(0, 0, 0, 0));
+}
+
+TEST(IdSelectTest, PagedSelectionMatchesInMemory) {
+    DeepImage img = twoTileImage();
+    DeepImage expected = selectById(img, selecting("9", true));
+
+    auto pager = std::make_shared<TilePager>(1);
+    img.enableOutOfCore(pager);
+    setOutOfCorePager(pager);
+    DeepImage paged = selectById(img, selecting("9", true));
+    setOutOfCorePager(nullptr);
+
+    EXPECT_TRUE(paged.isOutOfCore());
+    ASSERT_EQ(paged.dataWindow(), expected.dataWindow());
+    for (int y = 0; y < expected.height(); ++y) {
+        for (int x = 0; x < expected.width(); ++x) {
+            ASSERT_EQ(paged.pixel(x, y).sampleCount(), expected.pixel(x, y).sampleCount());
+            EXPECT_EQ(paged.extraColumns(x, y), expected.extraColumns(x, y));
+        }
+    }
+}
+
+TEST(IdSelectTest, RejectsMissingChannelsAndForeignIndexes) {
+    DeepImage plain = makeImage1x1(1.0f, 0.1f, 0.1f, 0.1f, 0.5f);
+    EXPECT_THROW(selectById(plain, selecting("1", true)), std::invalid_argument);
+
+    DeepImage img = twoTileImage();
+    IdSelection byName = selecting("1", true);
+    byName.channel = "aov";
+    EXPECT_THROW(selectById(img, byName, IdPresenceIndex(img, 0)), std::invalid_argument);
+    EXPECT_NO_THROW(selectById(img, byName, IdPresenceIndex(img, 1)));
+}
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "deep_sequence.h"
+
+using namespace deep_compositor;
+
+TEST(FramePatternTest, ExpandsPrintfToken) {
+    EXPECT_EQ(expandFramePattern("layer.%04d.exr", 7), "layer.0007.exr");
+    EXPECT_EQ(expandFramePattern("layer.%d.exr", 1234), "layer.1234.exr");
+}
+
+TEST(FramePatternTest, ExpandsHashToken) {
+    EXPECT_EQ(expandFramePattern("layer.####.exr", 42), "layer.0042.exr");
+    EXPECT_EQ(expandFramePattern("shot/#.exr", 5), "shot/5.exr");
+}
+
+TEST(FramePatternTest, PatternWithoutTokenIsUnchanged) {
+    EXPECT_FALSE(hasFramePattern("static_set.exr"));
+    EXPECT_EQ(expandFramePattern("static_set.exr", 10), "static_set.exr");
+    EXPECT_EQ(expandFramePattern("100%.exr", 10), "100%.exr");
+    EXPECT_TRUE(hasFramePattern("fx.%03d.exr"));
+}
+
+TEST(FrameListTest, ParsesRangesStepsAndLists) {
+    std::vector<int> frames;
+    ASSERT_TRUE(parseFrameList("1-4", frames));
+    EXPECT_EQ(frames, (std::vector<int>{1, 2, 3, 4}));
+
+    ASSERT_TRUE(parseFrameList("1-9x4", frames));
+    EXPECT_EQ(frames, (std::vector<int>{1, 5, 9}));
+
+    ASSERT_TRUE(parseFrameList("3,10-11,20", frames));
+    EXPECT_EQ(frames, (std::vector<int>{3, 10, 11, 20}));
+}
+
+TEST(FrameListTest, RangesEndingNearIntMaxStop) {
+    std::vector<int> frames;
+    ASSERT_TRUE(parseFrameList("2147483640-2147483647x5", frames));
+    EXPECT_EQ(frames, (std::vector<int>{2147483640, 2147483645}));
+
+    ASSERT_TRUE(parseFrameList("2147483646-2147483647", frames));
+    EXPECT_EQ(frames, (std::vector<int>{2147483646, 2147483647}));
+}
+
+TEST(FrameListTest, RejectsMalformedLists) {
+    std::vector<int> frames;
+    EXPECT_FALSE(parseFrameList("", frames));
+    EXPECT_FALSE(parseFrameList("5-1", frames));
+    EXPECT_FALSE(parseFrameList("1-10x0", frames));
+    EXPECT_FALSE(parseFrameList("1-10y", frames));
+    EXPECT_FALSE(parseFrameList("a", frames));
+}
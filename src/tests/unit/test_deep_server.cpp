@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "deep_server.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+/**
+ * Split a formatted request into its body lines (without COMPOSITE/end)
+ */
+std::vector<std::string> bodyLines(const std::string& text) {
+    std::vector<std::string> lines;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t newline = text.find('\n', pos);
+        lines.push_back(text.substr(pos, newline - pos));
+        pos = newline + 1;
+    }
+    EXPECT_EQ(lines.front(), "COMPOSITE");
+    EXPECT_EQ(lines.back(), "end");
+    return std::vector<std::string>(lines.begin() + 1, lines.end() - 1);
+}
+
+} // anonymous namespace
+
+TEST(CompositeRequestTest, FormatParseRoundTrip) {
+    CompositeRequest request;
+    request.inputs = {"/shots/a b/bg.exr", "/shots/fx.dcache"};
+    request.roi = PixelBox(-4, 2, 100, 50);
+    request.mergeThreshold = 0.25f;
+    request.deepOutput = true;
+    request.flatOutput = false;
+    request.tiled = true;
+    request.tileSize = 32;
+
+    CompositeRequest parsed;
+    std::string error;
+    ASSERT_TRUE(parseRequest(bodyLines(formatRequest(request)), parsed, error)) << error;
+    EXPECT_EQ(parsed.inputs, request.inputs);
+    EXPECT_EQ(parsed.roi, request.roi);
+    EXPECT_FLOAT_EQ(parsed.mergeThreshold, 0.25f);
+    EXPECT_TRUE(parsed.deepOutput);
+    EXPECT_FALSE(parsed.flatOutput);
+    EXPECT_TRUE(parsed.tiled);
+    EXPECT_EQ(parsed.tileSize, 32);
+}
+
+TEST(CompositeRequestTest, RejectsMalformedLines) {
+    CompositeRequest parsed;
+    std::string error;
+    EXPECT_FALSE(parseRequest({"input /a.exr", "roi 1 2 3"}, parsed, error));
+    EXPECT_FALSE(parseRequest({"input /a.exr", "tiled 0"}, parsed, error));
+    EXPECT_FALSE(parseRequest({"input /a.exr", "bogus"}, parsed, error));
+    EXPECT_FALSE(parseRequest({"flat"}, parsed, error));
+    EXPECT_EQ(error, "Request has no inputs");
+}
+
+TEST(CompositeRequestTest, RejectsLineBreaksInPaths) {
+    CompositeRequest request;
+    request.inputs = {"/shots/bg.exr\nroi 0 0 1 1"};
+    EXPECT_THROW(formatRequest(request), CompositeServerException);
+    request.inputs = {"/shots/bg.exr\r"};
+    EXPECT_THROW(formatRequest(request), CompositeServerException);
+
+    CompositeRequest parsed;
+    std::string error;
+    EXPECT_FALSE(parseRequest({"input /shots/bg.exr\r"}, parsed, error));
+    EXPECT_FALSE(parseRequest({"input /shots/bg.exr\nflat"}, parsed, error));
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include "deep_stream.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+class MappedIStreamTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path_ = temp_.writeFile("mapped.bin", "0123456789");
+    }
+
+    TestTempDir temp_;
+    std::string path_;
+};
+
+TEST_F(MappedIStreamTest, ReportsMemoryMappedAndSize) {
+    MappedIStream stream(path_);
+    EXPECT_TRUE(stream.isMemoryMapped());
+    EXPECT_EQ(stream.size(), 10u);
+    EXPECT_EQ(stream.tellg(), 0u);
+}
+
+TEST_F(MappedIStreamTest, ReadCopiesAndAdvances) {
+    MappedIStream stream(path_);
+    char buf[4] = {};
+    EXPECT_TRUE(stream.read(buf, 4));
+    EXPECT_EQ(std::string(buf, 4), "0123");
+    EXPECT_EQ(stream.tellg(), 4u);
+    char rest[6] = {};
+    // Reading the last byte returns false
+    EXPECT_FALSE(stream.read(rest, 6));
+    EXPECT_EQ(std::string(rest, 6), "456789");
+}
+
+TEST_F(MappedIStreamTest, ReadMemoryMappedPointsIntoMapping) {
+    MappedIStream stream(path_);
+    stream.seekg(3);
+    char* p = stream.readMemoryMapped(2);
+    EXPECT_EQ(p, stream.data() + 3);
+    EXPECT_EQ(std::string(p, 2), "34");
+    EXPECT_EQ(stream.tellg(), 5u);
+}
+
+TEST_F(MappedIStreamTest, AccessAdviceDoesNotChangeContents) {
+    for (MapAccess access : {MapAccess::Normal, MapAccess::Sequential, MapAccess::Random}) {
+        MappedIStream stream(path_, access);
+        stream.seekg(6);
+        EXPECT_EQ(std::string(stream.readMemoryMapped(4), 4), "6789");
+    }
+}
+
+TEST_F(MappedIStreamTest, ReadPastEndThrows) {
+    MappedIStream stream(path_);
+    stream.seekg(8);
+    char buf[4];
+    EXPECT_ANY_THROW(stream.read(buf, 4));
+    EXPECT_ANY_THROW(stream.readMemoryMapped(4));
+}
+
+TEST_F(MappedIStreamTest, MissingFileThrows) {
+    EXPECT_ANY_THROW(MappedIStream("/nonexistent/dc_no_such_file.exr"));
+}
+
+// ============================================================================
+// In-memory stream tests
+// ============================================================================
+
+TEST(MemoryStreamTest, IStreamReadsOwnedBuffer) {
+    MemoryIStream stream(std::vector<char>{'a', 'b', 'c'}, "buf");
+    EXPECT_TRUE(stream.isMemoryMapped());
+    EXPECT_STREQ(stream.fileName(), "buf");
+    char c[2];
+    EXPECT_TRUE(stream.read(c, 2));
+    EXPECT_EQ(c[0], 'a');
+    EXPECT_EQ(*stream.readMemoryMapped(1), 'c');
+    EXPECT_ANY_THROW(stream.read(c, 1));
+}
+
+TEST(MemoryStreamTest, CountingIStreamCountsReadsNotSeeks) {
+    MemoryIStream inner(std::vector<char>{'a', 'b', 'c', 'd', 'e'});
+    CountingIStream stream(inner);
+    EXPECT_TRUE(stream.isMemoryMapped());
+    char c[2];
+    stream.read(c, 2);
+    stream.seekg(4);
+    EXPECT_EQ(*stream.readMemoryMapped(1), 'e');
+    EXPECT_EQ(stream.tellg(), 5u);
+    EXPECT_EQ(stream.bytesRead(), 3u);
+    EXPECT_ANY_THROW(stream.read(c, 1));
+    EXPECT_EQ(stream.bytesRead(), 3u);
+}
+
+TEST(MemoryStreamTest, OStreamSupportsSeekAndOverwrite) {
+    MemoryOStream stream;
+    stream.write("hello", 5);
+    EXPECT_EQ(stream.tellp(), 5u);
+    stream.seekp(1);
+    stream.write("EL", 2);
+    stream.seekp(5);
+    stream.write("!", 1);
+    const std::vector<char>& buf = stream.buffer();
+    EXPECT_EQ(std::string(buf.begin(), buf.end()), "hELlo!");
+}
+
+TEST(MemoryStreamTest, OStreamGrowsWhenSeekingPastEnd) {
+    MemoryOStream stream;
+    stream.seekp(3);
+    stream.write("x", 1);
+    EXPECT_EQ(stream.buffer().size(), 4u);
+    EXPECT_EQ(stream.buffer()[3], 'x');
+}
+
+TEST(MemoryStreamTest, ReleaseMovesBytesOut) {
+    MemoryOStream stream;
+    stream.write("abc", 3);
+    std::vector<char> bytes = stream.release();
+    EXPECT_EQ(bytes.size(), 3u);
+    EXPECT_TRUE(stream.buffer().empty());
+    EXPECT_EQ(stream.tellp(), 0u);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "deep_tasks.h"
+#include "../test_helpers.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace deep_compositor;
+
+TEST(TaskSchedulerTest, AvailableCpusIsPositive) {
+    EXPECT_GE(availableCpuCount(), 1);
+    EXPECT_GE(TaskScheduler::shared().threadCount(), 1);
+}
+
+#ifdef __linux__
+TEST(TaskSchedulerTest, CgroupV2LimitComesFromNestedPathAndParents) {
+    TestTempDir temp;
+    temp.writeFile("cgroup", "0::/kubepods/pod1/ctr\n");
+    temp.writeFile("fs/cpu.max", "max 100000\n");
+    temp.writeFile("fs/kubepods/pod1/cpu.max", "300000 100000\n");
+    temp.writeFile("fs/kubepods/pod1/ctr/cpu.max", "max 100000\n");
+    EXPECT_EQ(cgroupCpuLimit(temp.path("fs"), temp.path("cgroup")), 3);
+
+    temp.writeFile("fs/kubepods/pod1/ctr/cpu.max", "150000 100000\n");
+    EXPECT_EQ(cgroupCpuLimit(temp.path("fs"), temp.path("cgroup")), 2);
+}
+
+TEST(TaskSchedulerTest, CgroupV1LimitTriesBothCpuMounts) {
+    TestTempDir temp;
+    temp.writeFile("cgroup", "4:memory:/job\n3:cpu,cpuacct:/job\n");
+    temp.writeFile("fs/cpu,cpuacct/job/cpu.cfs_quota_us", "200000\n");
+    temp.writeFile("fs/cpu,cpuacct/job/cpu.cfs_period_us", "100000\n");
+    EXPECT_EQ(cgroupCpuLimit(temp.path("fs"), temp.path("cgroup")), 2);
+
+    // cpu mounted alone, with the namespace hiding the path: the mount's root applies
+    temp.writeFile("cgroup", "2:cpuacct:/job\n1:cpu:/job\n");
+    temp.writeFile("alone/cpu/cpu.cfs_quota_us", "400000\n");
+    temp.writeFile("alone/cpu/cpu.cfs_period_us", "100000\n");
+    EXPECT_EQ(cgroupCpuLimit(temp.path("alone"), temp.path("cgroup")), 4);
+}
+
+TEST(TaskSchedulerTest, CgroupWithoutQuotaHasNoLimit) {
+    TestTempDir temp;
+    temp.writeFile("cgroup", "1:cpu:/\n0::/\n");
+    temp.writeFile("fs/cpu.max", "max 100000\n");
+    temp.writeFile("fs/cpu/cpu.cfs_quota_us", "-1\n");
+    temp.writeFile("fs/cpu/cpu.cfs_period_us", "100000\n");
+    EXPECT_EQ(cgroupCpuLimit(temp.path("fs"), temp.path("cgroup")), 0);
+    EXPECT_EQ(cgroupCpuLimit(temp.path("fs"), temp.path("missing")), 0);
+}
+#endif
+
+TEST(TaskSchedulerTest, GroupRunsEveryTaskAndRethrows) {
+    TaskScheduler scheduler(4);
+    std::atomic<int> runs{0};
+    {
+        TaskGroup group(scheduler);
+        for (int i = 0; i < 100; ++i) {
+            group.run([&]() { runs++; });
+        }
+        group.wait();
+    }
+    EXPECT_EQ(runs.load(), 100);
+    
+    TaskGroup failing(scheduler);
+    failing.run([]() { throw std::runtime_error("task failed"); });
+    EXPECT_THROW(failing.wait(), std::runtime_error);
+    EXPECT_TRUE(failing.failed());
+}
+
+TEST(TaskSchedulerTest, SingleThreadPoolRunsOnWaiter) {
+    TaskScheduler scheduler(1);
+    EXPECT_EQ(scheduler.threadCount(), 1);
+    std::atomic<int> runs{0};
+    TaskGroup group(scheduler);
+    for (int i = 0; i < 10; ++i) {
+        group.run([&]() { runs++; });
+    }
+    group.wait();
+    EXPECT_EQ(runs.load(), 10);
+}
+
+TEST(TaskSchedulerTest, NestedParallelForCoversRangeOnce) {
+    const size_t outer = 16;
+    const size_t inner = 200;
+    std::vector<std::atomic<int>> hits(outer * inner);
+    parallelFor(0, outer, 1, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+            parallelFor(0, inner, 7, [&](size_t ib, size_t ie) {
+                for (size_t j = ib; j < ie; ++j) {
+                    hits[i * inner + j]++;
+                }
+            });
+        }
+    });
+    for (const auto& h : hits) {
+        EXPECT_EQ(h.load(), 1);
+    }
+}
+
+TEST(TaskSchedulerTest, TilesCoverBoxExactly) {
+    PixelBox box(-5, 10, 94, 52);
+    std::vector<std::atomic<int>> hits(static_cast<size_t>(box.width()) * box.height());
+    parallelForTiles(box, 16, [&](const PixelBox& tile) {
+        EXPECT_LE(tile.width(), 16);
+        EXPECT_LE(tile.height(), 16);
+        for (int y = tile.minY; y <= tile.maxY; ++y) {
+            for (int x = tile.minX; x <= tile.maxX; ++x) {
+                hits[static_cast<size_t>(y - box.minY) * box.width() + (x - box.minX)]++;
+            }
+        }
+    });
+    for (const auto& h : hits) {
+        EXPECT_EQ(h.load(), 1);
+    }
+}
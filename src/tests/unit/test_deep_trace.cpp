@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "deep_trace.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+namespace fs = std::filesystem;
+
+namespace {
+
+std::string readFile(const fs::path& path) {
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+} // anonymous namespace
+
+TEST(TraceTest, RecordsZonesFromAllThreads) {
+    if (!isTracing()) {
+        TraceZone off("beforeStart");
+        EXPECT_FALSE(off.active());
+    }
+
+    startTrace();
+    {
+        TraceZone zone("traceTestMain");
+        EXPECT_TRUE(zone.active());
+        zone.arg("samples", 42);
+        zone.detail("quote\" and \\ backslash");
+    }
+    std::thread worker([]() {
+        setTraceThreadName("trace test worker");
+        TraceZone zone("traceTestWorker");
+        zone.arg("tiles", 7);
+    });
+    worker.join();
+
+    TestTempDir temp;
+    fs::path path = temp.path("trace.json");
+    ASSERT_TRUE(writeTrace(path.string()));
+    std::string json = readFile(path);
+
+    EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"traceTestMain\""), std::string::npos);
+    EXPECT_NE(json.find("\"samples\":42"), std::string::npos);
+    EXPECT_NE(json.find("quote\\\" and \\\\ backslash"), std::string::npos);
+    EXPECT_NE(json.find("\"name\":\"traceTestWorker\""), std::string::npos);
+    EXPECT_NE(json.find("\"tiles\":7"), std::string::npos);
+    EXPECT_NE(json.find("\"trace test worker\""), std::string::npos);
+}
+
+TEST(TraceTest, SampledZonesRecordOneInPeriod) {
+    int taken = 0;
+    for (int i = 0; i < 100; ++i) {
+        taken += traceSample(10) ? 1 : 0;
+    }
+    EXPECT_EQ(taken, 10);
+
+    TraceZone skipped("traceTestSkipped", false);
+    EXPECT_FALSE(skipped.active());
+}
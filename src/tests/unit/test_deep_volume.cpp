@@ -302,3 +302,16 @@ TEST_F(MergePixelsVolumetricTest, MergeThreeOverlappingVolumes) {
     EXPECT_EQ(result.sampleCount(), 5u);
     EXPECT_TRUE(result.isValidSortOrder());
 }
+
+TEST_F(MergePixelsVolumetricTest, CountsSplitFragmentsAndBlends) {
+    // A:[1,3], B:[2,4] → A splits into 2, B into 2 (2 extra); [2,3] blends once
+    DeepPixel pA, pB;
+    pA.addSample(makeVolume(1.0f, 3.0f, 0.6f, 0.6f, 0.6f, 0.8f));
+    pB.addSample(makeVolume(2.0f, 4.0f, 0.4f, 0.4f, 0.4f, 0.6f));
+    std::vector<const DeepPixel*> pixels = {&pA, &pB};
+    VolumeMergeCounts counts;
+    mergePixelsVolumetric(pixels, 0.001f, &counts);
+    mergePixelsVolumetric(pixels, 0.001f, &counts);
+    EXPECT_EQ(counts.fragments, 4u);
+    EXPECT_EQ(counts.blends, 2u);
+}
@@ -132,3 +132,18 @@ TEST_F(FlattenTest, AllEmptyPixelsProduceZeroBuffer) {
         EXPECT_FLOAT_EQ(v, 0.0f);
     }
 }
+
+TEST_F(FlattenTest, CountsSamplesCulledBehindOpaqueCoverage) {
+    DeepImage img(2, 1);
+    img.pixel(0, 0).addSample(makePoint(1.0f, 0.8f, 0.0f, 0.0f, 1.0f));
+    img.pixel(0, 0).addSample(makePoint(2.0f, 0.0f, 0.0f, 0.9f, 0.9f));
+    img.pixel(0, 0).addSample(makePoint(3.0f, 0.0f, 0.9f, 0.0f, 0.9f));
+    img.pixel(1, 0).addSample(makePoint(1.0f, 0.2f, 0.0f, 0.0f, 0.5f));
+    img.pixel(1, 0).addSample(makePoint(2.0f, 0.2f, 0.0f, 0.0f, 0.5f));
+    
+    std::vector<float> buf;
+    size_t culled = 0;
+    flattenImage(img, img.dataWindow(), buf, &culled);
+    EXPECT_EQ(culled, 2u);
+    EXPECT_EQ(buf, flattenImage(img));
+}
@@ -0,0 +1,257 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+#include "deep_volume.h"
+#include "kernels/kernels.h"
+#include "../test_helpers.h"
+
+using namespace deep_compositor;
+
+namespace {
+
+// Mixed opacities and depths, some fully transparent or opaque
+std::vector<DeepSample> randomSamples(size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<DeepSample> samples;
+    for (size_t i = 0; i < count; ++i) {
+        float alpha = (i % 7 == 0) ? 0.0f : (i % 11 == 0 ? 1.0f : unit(rng));
+        float depth = 1.0f + unit(rng) * 10.0f;
+        samples.emplace_back(depth, depth + unit(rng) * 3.0f, unit(rng) * 2.0f * alpha,
+                             unit(rng) * alpha, unit(rng) * 4.0f * alpha, alpha);
+    }
+    return samples;
+}
+
+const float* floats(const std::vector<DeepSample>& samples) {
+    return reinterpret_cast<const float*>(samples.data());
+}
+
+// Flat RGBA with HDR colours, zero and tiny alphas
+std::vector<float> randomRGBA(size_t pixels, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> rgba(pixels * 4);
+    for (size_t p = 0; p < pixels; ++p) {
+        float alpha = (p % 5 == 0) ? 0.0f : (p % 9 == 0 ? 0.00005f : unit(rng));
+        rgba[p * 4 + 0] = unit(rng) * 3.0f * alpha;
+        rgba[p * 4 + 1] = unit(rng) * alpha;
+        rgba[p * 4 + 2] = unit(rng) * 0.5f;
+        rgba[p * 4 + 3] = alpha;
+    }
+    return rgba;
+}
+
+} // anonymous namespace
+
+TEST(KernelTest, IsaNamesRoundTrip) {
+    for (KernelIsa isa : {KernelIsa::Scalar, KernelIsa::SSE4, KernelIsa::AVX2, KernelIsa::AVX512}) {
+        KernelIsa parsed;
+        ASSERT_TRUE(parseKernelIsa(kernelIsaName(isa), parsed));
+        EXPECT_EQ(parsed, isa);
+    }
+    KernelIsa parsed;
+    EXPECT_FALSE(parseKernelIsa("neon", parsed));
+
+    std::vector<KernelIsa> supported = supportedKernelIsas();
+    ASSERT_FALSE(supported.empty());
+    EXPECT_EQ(supported.front(), KernelIsa::Scalar);
+    EXPECT_TRUE(kernelIsaSupported(kernels().isa));
+}
+
+TEST(KernelTest, ForcingAnIsaSwitchesKernels) {
+    KernelIsa best = supportedKernelIsas().back();
+    setKernelIsa(KernelIsa::Scalar);
+    EXPECT_EQ(kernels().isa, KernelIsa::Scalar);
+    setKernelIsa(best);
+    EXPECT_EQ(kernels().isa, best);
+}
+
+TEST(KernelTest, FlattenMatchesFrontToBackOver) {
+    std::vector<DeepSample> samples = {
+        makePoint(1.0f, 0.2f, 0.1f, 0.0f, 0.4f),
+        makePoint(2.0f, 0.0f, 0.3f, 0.1f, 0.5f),
+        makePoint(3.0f, 0.5f, 0.5f, 0.5f, 1.0f),
+        makePoint(4.0f, 1.0f, 0.0f, 0.0f, 1.0f),  // Hidden
+    };
+    float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+    for (size_t i = 0; i < 3; ++i) {
+        float t = 1.0f - a;
+        r += samples[i].red * t;
+        g += samples[i].green * t;
+        b += samples[i].blue * t;
+        a += samples[i].alpha * t;
+    }
+
+    float rgba[4];
+    size_t used = kernelTable(KernelIsa::Scalar).flatten(floats(samples), samples.size(), rgba);
+    EXPECT_EQ(used, 3u);
+    EXPECT_EQ(rgba[0], r);
+    EXPECT_EQ(rgba[1], g);
+    EXPECT_EQ(rgba[2], b);
+    EXPECT_EQ(rgba[3], 1.0f);
+}
+
+TEST(KernelTest, SplitVolumeMatchesRepeatedSplitSample) {
+    DeepSample volume = makeVolume(1.0f, 5.0f, 0.4f, 0.2f, 0.1f, 0.7f);
+    std::vector<float> cuts = {1.5f, 2.0f, 3.25f, 4.9f};
+
+    std::vector<DeepSample> expected;
+    DeepSample remainder = volume;
+    for (float z : cuts) {
+        auto [front, back] = splitSample(remainder, z);
+        expected.push_back(front);
+        remainder = back;
+    }
+    expected.push_back(remainder);
+
+    std::vector<DeepSample> pieces(cuts.size() + 1);
+    kernelTable(KernelIsa::Scalar).splitVolume(reinterpret_cast<const float*>(&volume), cuts.data(),
+                                              cuts.size(), reinterpret_cast<float*>(pieces.data()));
+    float transmittance = 1.0f;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        EXPECT_FLOAT_EQ(pieces[i].depth, expected[i].depth);
+        EXPECT_FLOAT_EQ(pieces[i].depth_back, expected[i].depth_back);
+        EXPECT_NEAR(pieces[i].alpha, expected[i].alpha, 1e-5f);
+        EXPECT_NEAR(pieces[i].red, expected[i].red, 1e-5f);
+        transmittance *= 1.0f - pieces[i].alpha;
+    }
+    EXPECT_NEAR(transmittance, 1.0f - volume.alpha, 1e-5f);
+}
+
+TEST(KernelTest, SplitSampleMatchesTheDispatchedKernel) {
+    for (const DeepSample& volume : randomSamples(40, 5)) {
+        if (!(volume.depth_back > volume.depth + 0.01f)) {
+            continue;
+        }
+        float cut = volume.depth + (volume.depth_back - volume.depth) * 0.37f;
+        auto [front, back] = splitSample(volume, cut);
+        DeepSample pieces[2];
+        kernels().splitVolume(reinterpret_cast<const float*>(&volume), &cut, 1,
+                              reinterpret_cast<float*>(pieces));
+        EXPECT_EQ(std::memcmp(&front, &pieces[0], sizeof(DeepSample)), 0);
+        EXPECT_EQ(std::memcmp(&back, &pieces[1], sizeof(DeepSample)), 0);
+    }
+}
+
+TEST(KernelTest, BlendCoincidentMatchesPairwiseBlend) {
+    std::vector<DeepSample> samples = {
+        makeVolume(1.0f, 2.0f, 0.1f, 0.2f, 0.3f, 0.3f),
+        makeVolume(1.0f, 2.0f, 0.2f, 0.1f, 0.0f, 0.5f),
+        makeVolume(1.0f, 2.0f, 0.0f, 0.0f, 0.4f, 0.6f),
+        makeVolume(2.0f, 3.0f, 0.1f, 0.1f, 0.1f, 0.2f),
+    };
+    DeepSample first = blendCoincidentSamples(blendCoincidentSamples(samples[0], samples[1]), samples[2]);
+
+    size_t kept = kernelTable(KernelIsa::Scalar).blendCoincident(
+        reinterpret_cast<float*>(samples.data()), samples.size(), 0.001f);
+    ASSERT_EQ(kept, 2u);
+    EXPECT_EQ(samples[0].red, first.red);
+    EXPECT_EQ(samples[0].blue, first.blue);
+    EXPECT_EQ(samples[0].alpha, first.alpha);
+    EXPECT_EQ(samples[1].depth, 2.0f);
+    EXPECT_EQ(samples[1].alpha, 0.2f);
+}
+
+TEST(KernelTest, QuantizeUnpremultipliesAndCompresses) {
+    std::vector<float> rgba = {
+        0.25f, 0.5f, 0.0f, 0.5f,   // Unpremultiplied to 0.5, 1.0, 0.0
+        0.2f, 0.2f, 0.2f, 0.0f,    // No alpha: left premultiplied
+        4.0f, 1.0f, 0.0f, 1.0f,    // Brightest channel 4 -> 0.8
+        -1.0f, 0.0f, 2.0f, 0.00005f,
+    };
+    std::vector<uint8_t> bytes(16);
+    kernelTable(KernelIsa::Scalar).quantizeRGBA8(rgba.data(), 4, bytes.data());
+    std::vector<uint8_t> expected = {
+        128, 255, 0, 128,
+        51, 51, 51, 0,
+        204, 51, 0, 255,
+        0, 0, 170, 0,
+    };
+    EXPECT_EQ(bytes, expected);
+}
+
+TEST(KernelTest, QuantizeMapsNonFiniteValuesAlikeOnEveryIsa) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> rgba;
+    for (int i = 0; i < 8; ++i) {
+        std::vector<float> pixels[] = {
+            {nan, inf, 1e30f, nan},
+            {nan, 0.5f, -inf, 1.0f},
+            {1e30f, -1e30f, 0.25f, 1.0f},
+            {inf, 0.0f, 0.0f, 0.0f},
+        };
+        rgba.insert(rgba.end(), pixels[i % 4].begin(), pixels[i % 4].end());
+    }
+    std::vector<uint8_t> expected(rgba.size());
+    kernelTable(KernelIsa::Scalar).quantizeRGBA8(rgba.data(), rgba.size() / 4, expected.data());
+    EXPECT_EQ(expected[0], 0);
+    EXPECT_EQ(expected[3], 0);
+    EXPECT_EQ(expected[4], 0);
+
+    for (KernelIsa isa : supportedKernelIsas()) {
+        SCOPED_TRACE(kernelIsaName(isa));
+        std::vector<uint8_t> bytes(rgba.size());
+        kernelTable(isa).quantizeRGBA8(rgba.data(), rgba.size() / 4, bytes.data());
+        EXPECT_EQ(bytes, expected);
+    }
+}
+
+TEST(KernelTest, VariantsAgreeBitForBit) {
+    const KernelTable& scalar = kernelTable(KernelIsa::Scalar);
+    for (KernelIsa isa : supportedKernelIsas()) {
+        SCOPED_TRACE(kernelIsaName(isa));
+        const KernelTable& variant = kernelTable(isa);
+
+        for (size_t count : {1u, 3u, 8u, 17u, 37u}) {
+            std::vector<DeepSample> samples = randomSamples(count, static_cast<unsigned>(count));
+            float expected[4];
+            float actual[4];
+            EXPECT_EQ(variant.flatten(floats(samples), count, actual),
+                      scalar.flatten(floats(samples), count, expected));
+            EXPECT_EQ(std::memcmp(actual, expected, sizeof(actual)), 0);
+
+            // Sorted, with runs of coincident samples
+            std::vector<DeepSample> runs = samples;
+            for (size_t i = 1; i < runs.size(); i += 3) {
+                runs[i].depth = runs[i - 1].depth;
+                runs[i].depth_back = runs[i - 1].depth_back;
+            }
+            std::sort(runs.begin(), runs.end());
+            std::vector<DeepSample> blendedScalar = runs;
+            std::vector<DeepSample> blendedVariant = runs;
+            size_t kept = scalar.blendCoincident(reinterpret_cast<float*>(blendedScalar.data()), count, 0.001f);
+            ASSERT_EQ(variant.blendCoincident(reinterpret_cast<float*>(blendedVariant.data()), count, 0.001f),
+                      kept);
+            EXPECT_EQ(std::memcmp(blendedScalar.data(), blendedVariant.data(), kept * sizeof(DeepSample)), 0);
+
+            // A thick volume cut into count + 1 pieces
+            DeepSample volume = makeVolume(0.0f, 100.0f, 0.3f, 0.6f, 0.9f, 0.95f);
+            std::vector<float> cuts;
+            for (size_t i = 0; i < count; ++i) {
+                cuts.push_back(100.0f * static_cast<float>(i + 1) * static_cast<float>(i + 1) /
+                               static_cast<float>((count + 1) * (count + 1)));
+            }
+            std::vector<DeepSample> piecesScalar(count + 1);
+            std::vector<DeepSample> piecesVariant(count + 1);
+            scalar.splitVolume(reinterpret_cast<const float*>(&volume), cuts.data(), count,
+                               reinterpret_cast<float*>(piecesScalar.data()));
+            variant.splitVolume(reinterpret_cast<const float*>(&volume), cuts.data(), count,
+                                reinterpret_cast<float*>(piecesVariant.data()));
+            EXPECT_EQ(std::memcmp(piecesScalar.data(), piecesVariant.data(),
+                                  piecesScalar.size() * sizeof(DeepSample)), 0);
+
+            std::vector<float> rgba = randomRGBA(count, static_cast<unsigned>(count) + 100);
+            std::vector<uint8_t> bytesScalar(count * 4);
+            std::vector<uint8_t> bytesVariant(count * 4);
+            scalar.quantizeRGBA8(rgba.data(), count, bytesScalar.data());
+            variant.quantizeRGBA8(rgba.data(), count, bytesVariant.data());
+            EXPECT_EQ(bytesScalar, bytesVariant);
+        }
+    }
+}
@@ -1,11 +1,24 @@
 #include "utils.h"
+#include <cstdio>
 #include <fstream>
 #include <algorithm>
+#include <cmath>
+#include <ctime>
+
+#include <sys/resource.h>
 
 namespace deep_compositor {
 
 bool g_verbose = false;
 
+namespace {
+bool g_logToStderr = false;
+
+std::ostream& logStream() {
+    return g_logToStderr ? std::cerr : std::cout;
+}
+} // anonymous namespace
+
 void setVerbose(bool verbose) {
     g_verbose = verbose;
 }
@@ -14,14 +27,18 @@ bool isVerbose() {
     return g_verbose;
 }
 
+void setLogToStderr(bool enabled) {
+    g_logToStderr = enabled;
+}
+
 void logVerbose(const std::string& message) {
     if (g_verbose) {
-        std::cout << message << std::endl;
+        logStream() << message << std::endl;
     }
 }
 
 void log(const std::string& message) {
-    std::cout << message << std::endl;
+    logStream() << message << std::endl;
 }
 
 void logError(const std::string& message) {
@@ -42,7 +59,66 @@ double Timer::elapsedMs() const {
 }
 
 std::string Timer::elapsedString() const {
-    double ms = elapsedMs();
+    return formatDuration(elapsedMs());
+}
+
+double processCpuMs() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+double threadCpuMs() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0.0;
+    }
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
+
+size_t peakRssBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);  // Bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;  // Kilobytes on Linux
+#endif
+}
+
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+std::string jsonNumber(double value) {
+    if (!std::isfinite(value)) {
+        return "null";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", value);
+    return text;
+}
+
+std::string formatDuration(double ms) {
     std::ostringstream oss;
     
     if (ms < 1000.0) {
@@ -2,10 +2,15 @@
 
 #include <string>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 namespace deep_compositor {
 
 /**
@@ -23,6 +28,12 @@ void setVerbose(bool verbose);
  */
 bool isVerbose();
 
+/**
+ * Send log() and logVerbose() output to stderr instead of stdout
+ * (for when stdout carries image data)
+ */
+void setLogToStderr(bool enabled);
+
 /**
  * Log a message (only in verbose mode)
  */
@@ -64,11 +75,70 @@ private:
     std::chrono::high_resolution_clock::time_point start_;
 };
 
+/**
+ * CPU time (user + system) used so far by the whole process / the calling
+ * thread, in milliseconds
+ */
+double processCpuMs();
+double threadCpuMs();
+
+/**
+ * Cheap monotonic tick count for timing short spans: CPU timestamp counter
+ * cycles on x86, nanoseconds elsewhere
+ */
+inline uint64_t cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/**
+ * Peak resident set size of the process so far, in bytes (0 if unknown)
+ */
+size_t peakRssBytes();
+
+/**
+ * Bytes, samples and time for one file read or written
+ */
+struct IOStats {
+    uint64_t bytes = 0;   // Bytes read (just the decoded chunks for a region) or written
+    size_t samples = 0;
+    double wallMs = 0.0;
+    double cpuMs = 0.0;   // CPU time of the thread doing the I/O and (de)coding
+    
+    /**
+     * Megabytes (2^20) of `bytes` per wall-clock second (0 without a time)
+     */
+    double throughputMBps() const {
+        return wallMs > 0.0 ? (static_cast<double>(bytes) / (1024.0 * 1024.0)) / (wallMs / 1000.0)
+                            : 0.0;
+    }
+};
+
+/**
+ * Quote and escape text as a JSON string literal
+ */
+std::string jsonString(const std::string& text);
+
+/**
+ * JSON number with three decimals, or null for NaN/infinity (e.g. the
+ * depth range of an empty merge)
+ */
+std::string jsonNumber(double value);
+
 /**
  * Format a number with commas for readability
  */
 std::string formatNumber(size_t number);
 
+/**
+ * Format a duration in milliseconds as "12.3 ms" or "1.23 s"
+ */
+std::string formatDuration(double ms);
+
 /**
  * Format bytes as human-readable string
  */
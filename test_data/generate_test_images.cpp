@@ -10,6 +10,7 @@
  */
 
 #include "deep_image.h"
+#include "deep_tasks.h"
 #include "deep_writer.h"
 #include "utils.h"
 
@@ -78,7 +79,7 @@ bool raySphereIntersect(float rayX, float rayY,
 DeepImage generateSphere(const SphereParams& sphere) {
     DeepImage img(IMAGE_WIDTH, IMAGE_HEIGHT);
     
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             // Normalize coordinates to [0, 1]
             float normX = (static_cast<float>(x) + 0.5f) / IMAGE_WIDTH;
@@ -120,7 +121,7 @@ DeepImage generateSphere(const SphereParams& sphere) {
                 }
             }
         }
-    }
+    });
     
     return img;
 }
@@ -132,7 +133,7 @@ DeepImage generateSphere(const SphereParams& sphere) {
 DeepImage generateVolumetricSphere(const SphereParams& sphere) {
     DeepImage img(IMAGE_WIDTH, IMAGE_HEIGHT);
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             float normX = (static_cast<float>(x) + 0.5f) / IMAGE_WIDTH;
             float normY = (static_cast<float>(y) + 0.5f) / IMAGE_HEIGHT;
@@ -150,7 +151,7 @@ DeepImage generateVolumetricSphere(const SphereParams& sphere) {
                 img.pixel(x, y).addSample(sample);
             }
         }
-    }
+    });
 
     return img;
 }
@@ -164,7 +165,7 @@ DeepImage generateFogSlab(float centerX, float centerY, float radius,
                           float r, float g, float b, float alpha) {
     DeepImage img(IMAGE_WIDTH, IMAGE_HEIGHT);
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             float normX = (static_cast<float>(x) + 0.5f) / IMAGE_WIDTH;
             float normY = (static_cast<float>(y) + 0.5f) / IMAGE_HEIGHT;
@@ -182,7 +183,7 @@ DeepImage generateFogSlab(float centerX, float centerY, float radius,
                 img.pixel(x, y).addSample(sample);
             }
         }
-    }
+    });
 
     return img;
 }
@@ -193,7 +194,7 @@ DeepImage generateFogSlab(float centerX, float centerY, float radius,
 DeepImage generateGroundPlane(float depth, float r, float g, float b, float alpha) {
     DeepImage img(IMAGE_WIDTH, IMAGE_HEIGHT);
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             DeepPixel& pixel = img.pixel(x, y);
 
@@ -201,7 +202,7 @@ DeepImage generateGroundPlane(float depth, float r, float g, float b, float alph
             DeepSample sample(depth, r * alpha, g * alpha, b * alpha, alpha);
             pixel.addSample(sample);
         }
-    }
+    });
 
     return img;
 }
@@ -214,7 +215,7 @@ DeepImage generateWall(float centerX, float centerY, float radius,
                        float depth, float r, float g, float b) {
     DeepImage img(IMAGE_WIDTH, IMAGE_HEIGHT);
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             float normX = (static_cast<float>(x) + 0.5f) / IMAGE_WIDTH;
             float normY = (static_cast<float>(y) + 0.5f) / IMAGE_HEIGHT;
@@ -227,7 +228,7 @@ DeepImage generateWall(float centerX, float centerY, float radius,
                 img.pixel(x, y).addSample(sample);
             }
         }
-    }
+    });
 
     return img;
 }
@@ -245,7 +246,7 @@ DeepImage generateUniformLayeredFog(float depthFront, float depthBack,
         return img;
     }
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             DeepPixel& pixel = img.pixel(x, y);
             for (int i = 0; i < sliceCount; ++i) {
@@ -270,7 +271,7 @@ DeepImage generateUniformLayeredFog(float depthFront, float depthBack,
                 pixel.addSample(sample);
             }
         }
-    }
+    });
 
     return img;
 }
@@ -306,7 +307,7 @@ DeepImage generateSlantedRectangle(float startX, float startY,
         return std::clamp(v * m, 0.0f, 1.0f);
     };
 
-    for (int y = 0; y < IMAGE_HEIGHT; ++y) {
+    parallelForRows(PixelBox(0, 0, IMAGE_WIDTH - 1, IMAGE_HEIGHT - 1), [&](int y) {
         for (int x = 0; x < IMAGE_WIDTH; ++x) {
             float normX = (static_cast<float>(x) + 0.5f) / IMAGE_WIDTH;
             float normY = (static_cast<float>(y) + 0.5f) / IMAGE_HEIGHT;
@@ -353,7 +354,7 @@ DeepImage generateSlantedRectangle(float startX, float startY,
                 img.pixel(x, y).addSample(sample);
             }
         }
-    }
+    });
 
     return img;
 }